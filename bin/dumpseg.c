@@ -46,30 +46,119 @@
 #include <time.h>
 #endif	/* HAVE_TIME_H */
 
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>	/* madvise() */
+#endif	/* HAVE_SYS_MMAN_H */
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
 #include "nilfs.h"
 #include "segment.h"
+#include "format.h"
 
 #ifdef _GNU_SOURCE
 #include <getopt.h>
 static const struct option long_option[] = {
+	{"format", required_argument, NULL, 'f'},
+	{"jobs", required_argument, NULL, 'j'},
+	{"summary-only", no_argument, NULL, 's'},
 	{"help", no_argument, NULL, 'h'},
 	{"version", no_argument, NULL, 'V'},
 	{NULL, 0, NULL, 0}
 };
 
 #define DUMPSEG_USAGE	\
-	"Usage: %s [OPTION]... [DEVICE] SEGNUM...\n"	\
-	"  -h, --help\t\tdisplay this help and exit\n"	\
-	"  -V, --version\t\tdisplay version and exit\n"
+	"Usage: %s [OPTION]... [DEVICE] SEGMENT...\n"			\
+	"  -f, --format=FORMAT\ttext, json, or raw\n"			\
+	"  -j, --jobs=JOBS\tnumber of threads decoding segments\n"	\
+	"  -s, --summary-only\tprint partial segment headers only\n"	\
+	"  -h, --help\t\tdisplay this help and exit\n"			\
+	"  -V, --version\t\tdisplay version and exit\n"			\
+	"SEGMENT is a segment number, a range FIRST-LAST, \"all\", "	\
+	"or \"dirty\".\n"
 #else	/* !_GNU_SOURCE */
-#define DUMPSEG_USAGE	"Usage: %s [-h] [-V] [device] segnum...\n"
+#define DUMPSEG_USAGE	\
+	"Usage: %s [-hsV] [-f format] [-j jobs] [device] segment...\n"
 #endif	/* _GNU_SOURCE */
 
 
 #define DUMPSEG_BASE	10
 #define DUMPSEG_BUFSIZE	128
+#define DUMPSEG_NSUINFO	512
+#define DUMPSEG_MAX_JOBS	8	/* default limit of threads */
+#define DUMPSEG_WINDOW	4	/* decoded segments queued per thread */
+
+enum {
+	DUMPSEG_SPEC_RANGE,
+	DUMPSEG_SPEC_ALL,
+	DUMPSEG_SPEC_DIRTY,
+};
+
+/**
+ * struct dumpseg_raw_header - header of a record in raw format
+ * @rh_segnum: segment number
+ * @rh_blocknr: block number of the partial segment
+ * @rh_size: size of the segment summary that follows this header
+ * @rh_pad: padding
+ *
+ * All fields are little endian like the segment summary itself.
+ */
+struct dumpseg_raw_header {
+	__le64 rh_segnum;
+	__le64 rh_blocknr;
+	__le32 rh_size;
+	__le32 rh_pad;
+};
+
+/**
+ * struct dumpseg_slot - decoded segment waiting to be written out
+ * @buf: decoded output
+ * @len: length of @buf
+ * @error: error number if decoding failed
+ * @done: flag set once the segment has been decoded
+ */
+struct dumpseg_slot {
+	char *buf;
+	size_t len;
+	int error;
+	int done;
+};
 
-static void dumpseg_print_psegment_error(const struct nilfs_psegment *pseg,
+/**
+ * struct dumpseg_pool - decoder threads and the reorder window
+ * @nilfs: nilfs object
+ * @segnums: segments to be dumped, in output order
+ * @nsegs: number of segments in @segnums
+ * @next: index of the next segment to be decoded
+ * @emitted: number of segments written out
+ * @stop: flag telling the threads to stop
+ * @slots: ring of @nslots decoded segments, indexed by segment index
+ * @nslots: number of slots
+ * @lock: lock protecting the above state
+ * @filled: condition signaled when a slot has been filled
+ * @freed: condition signaled when a slot has been written out
+ */
+struct dumpseg_pool {
+	struct nilfs *nilfs;
+	const uint64_t *segnums;
+	size_t nsegs;
+	size_t next;
+	size_t emitted;
+	int stop;
+	struct dumpseg_slot *slots;
+	size_t nslots;
+	pthread_mutex_t lock;
+	pthread_cond_t filled;
+	pthread_cond_t freed;
+};
+
+static int format = NILFS_FORMAT_TEXT;
+static int summary_only;
+static unsigned int param_jobs;
+
+static void dumpseg_print_psegment_error(FILE *fp,
+					 const struct nilfs_psegment *pseg,
 					 const char *errstr)
 {
 	const struct nilfs_segment_summary *segsum = pseg->segsum;
@@ -79,37 +168,38 @@ static void dumpseg_print_psegment_error(const struct nilfs_psegment *pseg,
 	switch (pseg->error) {
 	case NILFS_PSEGMENT_ERROR_ALIGNMENT:
 		hdrsize = le16_to_cpu(segsum->ss_bytes);
-		printf("  error %d (%s) - header size = %u\n",
-		       pseg->error, errstr, hdrsize);
+		fprintf(fp, "  error %d (%s) - header size = %u\n",
+			pseg->error, errstr, hdrsize);
 		break;
 	case NILFS_PSEGMENT_ERROR_BIGPSEG:
 		nblocks = le32_to_cpu(segsum->ss_nblocks);
 		excess = ((uint32_t)(pseg->blocknr - pseg->segment->blocknr) +
 			  nblocks) - pseg->segment->nblocks;
-		printf("  error %d (%s) - pseg blkcnt = %lu, excess blkcnt = %lu\n",
-		       pseg->error, errstr,
-		       (unsigned long)nblocks, (unsigned long)excess);
+		fprintf(fp, "  error %d (%s) - pseg blkcnt = %lu, excess blkcnt = %lu\n",
+			pseg->error, errstr,
+			(unsigned long)nblocks, (unsigned long)excess);
 		break;
 	case NILFS_PSEGMENT_ERROR_BIGHDR:
 		hdrsize = le16_to_cpu(segsum->ss_bytes);
 		sumbytes = le32_to_cpu(segsum->ss_sumbytes);
-		printf("  error %d (%s) - header size = %u, summary size = %lu\n",
-		       pseg->error, errstr, hdrsize, (unsigned long)sumbytes);
+		fprintf(fp, "  error %d (%s) - header size = %u, summary size = %lu\n",
+			pseg->error, errstr, hdrsize,
+			(unsigned long)sumbytes);
 		break;
 	case NILFS_PSEGMENT_ERROR_BIGSUM:
 		sumbytes = le32_to_cpu(segsum->ss_sumbytes);
 		nblocks = le32_to_cpu(segsum->ss_nblocks);
-		printf("  error %d (%s) - summary size = %lu, pseg size = %llu\n",
-		       pseg->error, errstr, (unsigned long)sumbytes,
-		       (unsigned long long)nblocks << pseg->blkbits);
+		fprintf(fp, "  error %d (%s) - summary size = %lu, pseg size = %llu\n",
+			pseg->error, errstr, (unsigned long)sumbytes,
+			(unsigned long long)nblocks << pseg->blkbits);
 		break;
 	default:
-		printf("  error %d (%s)\n", pseg->error, errstr);
+		fprintf(fp, "  error %d (%s)\n", pseg->error, errstr);
 		break;
 	}
 }
 
-static void dumpseg_print_file_error(const struct nilfs_file *file,
+static void dumpseg_print_file_error(FILE *fp, const struct nilfs_file *file,
 				     const char *errstr)
 {
 	const struct nilfs_psegment *pseg = file->psegment;
@@ -120,89 +210,89 @@ static void dumpseg_print_file_error(const struct nilfs_file *file,
 	case NILFS_FILE_ERROR_MANYBLKS:
 		nblocks = le32_to_cpu(file->finfo->fi_nblocks);
 		pseg_nblocks = le32_to_cpu(pseg->segsum->ss_nblocks);
-		printf("%serror %d (%s) - file blkoff = %lu, file blkcnt = %lu, pseg blkcnt = %lu\n",
-		       indent, file->error, errstr,
-		       (unsigned long)(file->blocknr - pseg->blocknr),
-		       (unsigned long)nblocks, (unsigned long)pseg_nblocks);
+		fprintf(fp, "%serror %d (%s) - file blkoff = %lu, file blkcnt = %lu, pseg blkcnt = %lu\n",
+			indent, file->error, errstr,
+			(unsigned long)(file->blocknr - pseg->blocknr),
+			(unsigned long)nblocks, (unsigned long)pseg_nblocks);
 		break;
 	case NILFS_FILE_ERROR_BLKCNT:
 		nblocks = le32_to_cpu(file->finfo->fi_nblocks);
 		ndatablk = le32_to_cpu(file->finfo->fi_ndatablk);
-		printf("%serror %d (%s) - file blkcnt = %lu, data blkcnt = %lu\n",
-		       indent, file->error, errstr,
-		       (unsigned long)nblocks, (unsigned long)ndatablk);
+		fprintf(fp, "%serror %d (%s) - file blkcnt = %lu, data blkcnt = %lu\n",
+			indent, file->error, errstr,
+			(unsigned long)nblocks, (unsigned long)ndatablk);
 		break;
 	case NILFS_FILE_ERROR_OVERRUN:
 		sumbytes = le32_to_cpu(pseg->segsum->ss_sumbytes);
-		printf("%serror %d (%s) - finfo offset = %lu, finfo total size = %llu, summary size = %lu\n",
-		       indent, file->error, errstr,
-		       (unsigned long)file->offset,
-		       (unsigned long long)file->sumlen,
-		       (unsigned long)sumbytes);
+		fprintf(fp, "%serror %d (%s) - finfo offset = %lu, finfo total size = %llu, summary size = %lu\n",
+			indent, file->error, errstr,
+			(unsigned long)file->offset,
+			(unsigned long long)file->sumlen,
+			(unsigned long)sumbytes);
 		break;
 	default:
-		printf("%serror %d (%s)\n", indent, file->error, errstr);
+		fprintf(fp, "%serror %d (%s)\n", indent, file->error, errstr);
 		break;
 	}
 }
 
-static void dumpseg_print_virtual_block(struct nilfs_block *blk)
+static void dumpseg_print_virtual_block(FILE *fp, struct nilfs_block *blk)
 {
 	__le64 *binfo = blk->binfo;
 
 	if (nilfs_block_is_data(blk)) {
-		printf("        vblocknr = %llu, blkoff = %llu, blocknr = %llu\n",
-		       (unsigned long long)le64_to_cpu(binfo[0]),
-		       (unsigned long long)le64_to_cpu(binfo[1]),
-		       (unsigned long long)blk->blocknr);
+		fprintf(fp, "        vblocknr = %llu, blkoff = %llu, blocknr = %llu\n",
+			(unsigned long long)le64_to_cpu(binfo[0]),
+			(unsigned long long)le64_to_cpu(binfo[1]),
+			(unsigned long long)blk->blocknr);
 	} else {
-		printf("        vblocknr = %llu, blocknr = %llu\n",
-		       (unsigned long long)le64_to_cpu(binfo[0]),
-		       (unsigned long long)blk->blocknr);
+		fprintf(fp, "        vblocknr = %llu, blocknr = %llu\n",
+			(unsigned long long)le64_to_cpu(binfo[0]),
+			(unsigned long long)blk->blocknr);
 	}
 }
 
-static void dumpseg_print_real_block(struct nilfs_block *blk)
+static void dumpseg_print_real_block(FILE *fp, struct nilfs_block *blk)
 {
 	if (nilfs_block_is_data(blk)) {
 		__le64 *binfo = blk->binfo;
 
-		printf("        blkoff = %llu, blocknr = %llu\n",
-		       (unsigned long long)le64_to_cpu(binfo[0]),
-		       (unsigned long long)blk->blocknr);
+		fprintf(fp, "        blkoff = %llu, blocknr = %llu\n",
+			(unsigned long long)le64_to_cpu(binfo[0]),
+			(unsigned long long)blk->blocknr);
 	} else {
 		struct nilfs_binfo_dat *bid = blk->binfo;
 
-		printf("        blkoff = %llu, level = %d, blocknr = %llu\n",
-		       (unsigned long long)le64_to_cpu(bid->bi_blkoff),
-		       bid->bi_level,
-		       (unsigned long long)blk->blocknr);
+		fprintf(fp, "        blkoff = %llu, level = %d, blocknr = %llu\n",
+			(unsigned long long)le64_to_cpu(bid->bi_blkoff),
+			bid->bi_level,
+			(unsigned long long)blk->blocknr);
 	}
 }
 
-static void dumpseg_print_file(struct nilfs_file *file)
+static void dumpseg_print_file(FILE *fp, struct nilfs_file *file)
 {
 	struct nilfs_block blk;
 	struct nilfs_finfo *finfo = file->finfo;
 
-	printf("    finfo\n");
-	printf("      ino = %llu, cno = %llu, nblocks = %d, ndatblk = %d\n",
-	       (unsigned long long)le64_to_cpu(finfo->fi_ino),
-	       (unsigned long long)le64_to_cpu(finfo->fi_cno),
-	       le32_to_cpu(finfo->fi_nblocks),
-	       le32_to_cpu(finfo->fi_ndatablk));
+	fprintf(fp, "    finfo\n");
+	fprintf(fp, "      ino = %llu, cno = %llu, nblocks = %d, ndatblk = %d\n",
+		(unsigned long long)le64_to_cpu(finfo->fi_ino),
+		(unsigned long long)le64_to_cpu(finfo->fi_cno),
+		le32_to_cpu(finfo->fi_nblocks),
+		le32_to_cpu(finfo->fi_ndatablk));
 	if (!nilfs_file_use_real_blocknr(file)) {
 		nilfs_block_for_each(&blk, file) {
-			dumpseg_print_virtual_block(&blk);
+			dumpseg_print_virtual_block(fp, &blk);
 		}
 	} else {
 		nilfs_block_for_each(&blk, file) {
-			dumpseg_print_real_block(&blk);
+			dumpseg_print_real_block(fp, &blk);
 		}
 	}
 }
 
-static void dumpseg_print_psegment(struct nilfs_psegment *pseg)
+static void dumpseg_print_psegment(FILE *fp, struct nilfs_psegment *pseg)
 {
 	struct nilfs_file file;
 	struct tm tm;
@@ -210,71 +300,543 @@ static void dumpseg_print_psegment(struct nilfs_psegment *pseg)
 	char timebuf[DUMPSEG_BUFSIZE];
 	time_t t;
 
-	printf("  partial segment: blocknr = %llu, nblocks = %llu\n",
-	       (unsigned long long)pseg->blocknr,
-	       (unsigned long long)le32_to_cpu(pseg->segsum->ss_nblocks));
+	fprintf(fp, "  partial segment: blocknr = %llu, nblocks = %llu\n",
+		(unsigned long long)pseg->blocknr,
+		(unsigned long long)le32_to_cpu(pseg->segsum->ss_nblocks));
 
 	t = (time_t)le64_to_cpu(pseg->segsum->ss_create);
 	localtime_r(&t, &tm);
 	strftime(timebuf, DUMPSEG_BUFSIZE, "%F %T", &tm);
-	printf("    creation time = %s\n", timebuf);
-	printf("    nfinfo = %d\n", le32_to_cpu(pseg->segsum->ss_nfinfo));
+	fprintf(fp, "    creation time = %s\n", timebuf);
+	fprintf(fp, "    nfinfo = %d\n", le32_to_cpu(pseg->segsum->ss_nfinfo));
+	if (summary_only)
+		return;
+
 	nilfs_file_for_each(&file, pseg) {
-		dumpseg_print_file(&file);
+		dumpseg_print_file(fp, &file);
 	}
 	if (nilfs_file_is_error(&file, &errstr))
-		dumpseg_print_file_error(&file, errstr);
+		dumpseg_print_file_error(fp, &file, errstr);
 }
 
-static void dumpseg_print_segment(const struct nilfs_segment *segment)
+static void dumpseg_print_segment(FILE *fp,
+				  const struct nilfs_segment *segment)
 {
 	struct nilfs_psegment pseg;
 	const char *errstr;
 	uint64_t next;
 
-	printf("segment: segnum = %llu\n",
-	       (unsigned long long)segment->segnum);
+	fprintf(fp, "segment: segnum = %llu\n",
+		(unsigned long long)segment->segnum);
 	nilfs_psegment_init(&pseg, segment, segment->nblocks);
 
 	if (!nilfs_psegment_is_end(&pseg)) {
 		next = le64_to_cpu(pseg.segsum->ss_next) /
 			segment->blocks_per_segment;
-		printf("  sequence number = %llu, next segnum = %llu\n",
-		       (unsigned long long)le64_to_cpu(pseg.segsum->ss_seq),
-		       (unsigned long long)next);
+		fprintf(fp, "  sequence number = %llu, next segnum = %llu\n",
+			(unsigned long long)le64_to_cpu(pseg.segsum->ss_seq),
+			(unsigned long long)next);
 		do {
-			dumpseg_print_psegment(&pseg);
+			dumpseg_print_psegment(fp, &pseg);
 			nilfs_psegment_next(&pseg);
 		} while (!nilfs_psegment_is_end(&pseg));
 	}
 
 	if (nilfs_psegment_is_error(&pseg, &errstr))
-		dumpseg_print_psegment_error(&pseg, errstr);
+		dumpseg_print_psegment_error(fp, &pseg, errstr);
+}
+
+static void dumpseg_json_error(FILE *fp, uint64_t segnum, uint64_t blocknr,
+			       const char *record, int error,
+			       const char *errstr)
+{
+	fprintf(fp, "{\"type\": \"error\", \"segnum\": %llu, "
+		"\"blocknr\": %llu, \"record\": \"%s\", \"error\": %d, "
+		"\"message\": \"%s\"}\n",
+		(unsigned long long)segnum, (unsigned long long)blocknr,
+		record, error, errstr);
+}
+
+static void dumpseg_json_block(FILE *fp, uint64_t segnum, uint64_t ino,
+			       struct nilfs_block *blk)
+{
+	__le64 *binfo = blk->binfo;
+	int data = nilfs_block_is_data(blk);
+
+	fprintf(fp, "{\"type\": \"binfo\", \"segnum\": %llu, \"ino\": %llu, "
+		"\"blocknr\": %llu, \"data\": %s",
+		(unsigned long long)segnum, (unsigned long long)ino,
+		(unsigned long long)blk->blocknr, data ? "true" : "false");
+
+	if (!nilfs_file_use_real_blocknr(blk->file)) {
+		fprintf(fp, ", \"vblocknr\": %llu",
+			(unsigned long long)le64_to_cpu(binfo[0]));
+		if (data)
+			fprintf(fp, ", \"blkoff\": %llu",
+				(unsigned long long)le64_to_cpu(binfo[1]));
+	} else if (data) {
+		fprintf(fp, ", \"blkoff\": %llu",
+			(unsigned long long)le64_to_cpu(binfo[0]));
+	} else {
+		struct nilfs_binfo_dat *bid = blk->binfo;
+
+		fprintf(fp, ", \"blkoff\": %llu, \"level\": %d",
+			(unsigned long long)le64_to_cpu(bid->bi_blkoff),
+			bid->bi_level);
+	}
+	fputs("}\n", fp);
+}
+
+static void dumpseg_json_psegment(FILE *fp, struct nilfs_psegment *pseg)
+{
+	const struct nilfs_segment_summary *segsum = pseg->segsum;
+	uint64_t segnum = pseg->segment->segnum;
+	struct nilfs_finfo *finfo;
+	struct nilfs_file file;
+	struct nilfs_block blk;
+	const char *errstr;
+	uint64_t ino;
+
+	fprintf(fp, "{\"type\": \"psegment\", \"segnum\": %llu, "
+		"\"blocknr\": %llu, \"nblocks\": %lu, \"create\": %lld, "
+		"\"cno\": %llu, \"flags\": %u, \"nfinfo\": %lu, "
+		"\"sumbytes\": %lu}\n",
+		(unsigned long long)segnum, (unsigned long long)pseg->blocknr,
+		(unsigned long)le32_to_cpu(segsum->ss_nblocks),
+		(long long)le64_to_cpu(segsum->ss_create),
+		(unsigned long long)le64_to_cpu(segsum->ss_cno),
+		le16_to_cpu(segsum->ss_flags),
+		(unsigned long)le32_to_cpu(segsum->ss_nfinfo),
+		(unsigned long)le32_to_cpu(segsum->ss_sumbytes));
+	if (summary_only)
+		return;
+
+	nilfs_file_for_each(&file, pseg) {
+		finfo = file.finfo;
+		ino = le64_to_cpu(finfo->fi_ino);
+		fprintf(fp, "{\"type\": \"finfo\", \"segnum\": %llu, "
+			"\"blocknr\": %llu, \"ino\": %llu, \"cno\": %llu, "
+			"\"nblocks\": %lu, \"ndatablk\": %lu}\n",
+			(unsigned long long)segnum,
+			(unsigned long long)file.blocknr,
+			(unsigned long long)ino,
+			(unsigned long long)le64_to_cpu(finfo->fi_cno),
+			(unsigned long)le32_to_cpu(finfo->fi_nblocks),
+			(unsigned long)le32_to_cpu(finfo->fi_ndatablk));
+		nilfs_block_for_each(&blk, &file) {
+			dumpseg_json_block(fp, segnum, ino, &blk);
+		}
+	}
+	if (nilfs_file_is_error(&file, &errstr))
+		dumpseg_json_error(fp, segnum, file.blocknr, "finfo",
+				   file.error, errstr);
+}
+
+static void dumpseg_json_segment(FILE *fp,
+				 const struct nilfs_segment *segment)
+{
+	struct nilfs_psegment pseg;
+	const char *errstr;
+
+	fprintf(fp, "{\"type\": \"segment\", \"segnum\": %llu",
+		(unsigned long long)segment->segnum);
+	nilfs_psegment_init(&pseg, segment, segment->nblocks);
+
+	if (nilfs_psegment_is_end(&pseg)) {
+		fputs("}\n", fp);
+	} else {
+		fprintf(fp, ", \"seq\": %llu, \"next\": %llu}\n",
+			(unsigned long long)le64_to_cpu(pseg.segsum->ss_seq),
+			(unsigned long long)le64_to_cpu(pseg.segsum->ss_next) /
+			segment->blocks_per_segment);
+		do {
+			dumpseg_json_psegment(fp, &pseg);
+			nilfs_psegment_next(&pseg);
+		} while (!nilfs_psegment_is_end(&pseg));
+	}
+
+	if (nilfs_psegment_is_error(&pseg, &errstr))
+		dumpseg_json_error(fp, segment->segnum, pseg.blocknr,
+				   "psegment", pseg.error, errstr);
+}
+
+/**
+ * dumpseg_raw_segment - write segment summaries of valid logs
+ * @fp: output stream
+ * @segment: segment to be dumped
+ *
+ * Each record consists of a &struct dumpseg_raw_header and the segment
+ * summary as stored on disk, that is, the summary header followed by
+ * the finfo and binfo structures, or the summary header alone if
+ * summary_only is set.
+ */
+static void dumpseg_raw_segment(FILE *fp, const struct nilfs_segment *segment)
+{
+	struct dumpseg_raw_header hdr;
+	struct nilfs_psegment pseg;
+	uint32_t size;
+
+	nilfs_psegment_for_each(&pseg, segment, segment->nblocks) {
+		size = summary_only ? le16_to_cpu(pseg.segsum->ss_bytes) :
+			le32_to_cpu(pseg.segsum->ss_sumbytes);
+
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.rh_segnum = cpu_to_le64(segment->segnum);
+		hdr.rh_blocknr = cpu_to_le64(pseg.blocknr);
+		hdr.rh_size = cpu_to_le32(size);
+		fwrite(&hdr, sizeof(hdr), 1, fp);
+		fwrite(pseg.segsum, size, 1, fp);
+	}
+}
+
+/**
+ * dumpseg_advise_random - disable readahead on a mapped segment
+ * @segment: segment object
+ *
+ * Only the summary blocks are accessed with the summary_only option, so
+ * this keeps page faults on them from reading in payload blocks.
+ */
+static void dumpseg_advise_random(const struct nilfs_segment *segment)
+{
+#if defined(HAVE_MMAP) && defined(MADV_RANDOM)
+	unsigned long offset;
+	long pagesize;
+
+	if (!segment->mmapped)
+		return;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (unlikely(pagesize <= 0))
+		return;
+
+	offset = (unsigned long)segment->addr % pagesize;
+	madvise((char *)segment->addr - offset,
+		roundup(segment->segsize + offset, pagesize), MADV_RANDOM);
+#endif	/* HAVE_MMAP && MADV_RANDOM */
+}
+
+/**
+ * dumpseg_decode_segment - format a segment into a memory buffer
+ * @nilfs: nilfs object
+ * @segnum: segment number
+ * @slot: slot to store the output buffer
+ *
+ * Return: 0 on success, or -1 on failure with errno set.
+ */
+static int dumpseg_decode_segment(struct nilfs *nilfs, uint64_t segnum,
+				  struct dumpseg_slot *slot)
+{
+	struct nilfs_segment segment;
+	FILE *fp;
+	int ret = -1;
+
+	if (unlikely(nilfs_get_segment(nilfs, segnum, &segment) < 0))
+		return -1;
+
+	if (summary_only)
+		dumpseg_advise_random(&segment);
+
+	slot->buf = NULL;
+	fp = open_memstream(&slot->buf, &slot->len);
+	if (unlikely(!fp))
+		goto out_put;
+
+	switch (format) {
+	case NILFS_FORMAT_JSON:
+		dumpseg_json_segment(fp, &segment);
+		break;
+	case NILFS_FORMAT_RAW:
+		dumpseg_raw_segment(fp, &segment);
+		break;
+	default:
+		dumpseg_print_segment(fp, &segment);
+		break;
+	}
+
+	if (unlikely(fclose(fp) == EOF)) {
+		free(slot->buf);
+		slot->buf = NULL;
+		goto out_put;
+	}
+	ret = 0;
+
+out_put:
+	if (unlikely(nilfs_put_segment(&segment) < 0) && ret == 0) {
+		free(slot->buf);
+		slot->buf = NULL;
+		ret = -1;
+	}
+	return ret;
+}
+/**
+ * dumpseg_worker - decode segments in the reorder window
+ * @arg: decoder pool
+ */
+static void *dumpseg_worker(void *arg)
+{
+	struct dumpseg_pool *pool = arg;
+	struct dumpseg_slot *slot;
+	size_t index;
+	int ret, error;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->stop && pool->next < pool->nsegs &&
+		       pool->next - pool->emitted >= pool->nslots)
+			pthread_cond_wait(&pool->freed, &pool->lock);
+		if (pool->stop || pool->next >= pool->nsegs)
+			break;
+		index = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		slot = &pool->slots[index % pool->nslots];
+		ret = dumpseg_decode_segment(pool->nilfs, pool->segnums[index],
+					     slot);
+		error = ret < 0 ? (errno ? : EIO) : 0;
+
+		pthread_mutex_lock(&pool->lock);
+		slot->error = error;
+		slot->done = 1;
+		pthread_cond_broadcast(&pool->filled);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/**
+ * dumpseg_dump_segments - dump segments in parallel
+ * @nilfs: nilfs object
+ * @segnums: segments to be dumped
+ * @nsegs: number of segments in @segnums
+ *
+ * The segments are decoded by up to param_jobs threads, and written out
+ * in the order of @segnums.  A thread decodes at most DUMPSEG_WINDOW
+ * segments ahead of the output per thread, which bounds the memory
+ * used for the buffered output.
+ *
+ * Return: 0 on success, or -1 on failure.
+ */
+static int dumpseg_dump_segments(struct nilfs *nilfs, const uint64_t *segnums,
+				 size_t nsegs)
+{
+	struct dumpseg_pool pool;
+	struct dumpseg_slot *slot;
+	pthread_t *threads;
+	unsigned int i, nthreads, nstarted = 0;
+	size_t index;
+	int ret = -1;
+
+	if (nsegs == 0)
+		return 0;
+
+	nthreads = min_t(size_t, param_jobs, nsegs);
+	threads = malloc(sizeof(*threads) * nthreads);
+	pool.nslots = (size_t)nthreads * DUMPSEG_WINDOW;
+	pool.slots = calloc(pool.nslots, sizeof(*pool.slots));
+	if (unlikely(!threads || !pool.slots)) {
+		warn(NULL);
+		goto out_free;
+	}
+
+	pool.nilfs = nilfs;
+	pool.segnums = segnums;
+	pool.nsegs = nsegs;
+	pool.next = 0;
+	pool.emitted = 0;
+	pool.stop = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.filled, NULL);
+	pthread_cond_init(&pool.freed, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_create(&threads[i], NULL, dumpseg_worker, &pool);
+		if (ret != 0)
+			break;
+		nstarted++;
+	}
+	if (unlikely(nstarted == 0)) {
+		errno = ret;
+		warn("cannot create thread");
+		ret = -1;
+		goto out_destroy;
+	}
+
+	ret = 0;
+	for (index = 0; index < nsegs; index++) {
+		slot = &pool.slots[index % pool.nslots];
+
+		pthread_mutex_lock(&pool.lock);
+		while (!slot->done)
+			pthread_cond_wait(&pool.filled, &pool.lock);
+		pthread_mutex_unlock(&pool.lock);
+
+		if (unlikely(slot->error)) {
+			errno = slot->error;
+			warn("failed to read segment %llu",
+			     (unsigned long long)segnums[index]);
+			ret = -1;
+			break;
+		}
+		if (unlikely(fwrite(slot->buf, 1, slot->len, stdout) <
+			     slot->len)) {
+			warn("failed to write output");
+			ret = -1;
+			break;
+		}
+		free(slot->buf);
+		slot->buf = NULL;
+
+		pthread_mutex_lock(&pool.lock);
+		slot->done = 0;
+		pool.emitted++;
+		pthread_cond_broadcast(&pool.freed);
+		pthread_mutex_unlock(&pool.lock);
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.stop = 1;
+	pthread_cond_broadcast(&pool.freed);
+	pthread_mutex_unlock(&pool.lock);
+	for (i = 0; i < nstarted; i++)
+		pthread_join(threads[i], NULL);
+
+	for (index = 0; index < pool.nslots; index++)
+		free(pool.slots[index].buf);
+
+out_destroy:
+	pthread_cond_destroy(&pool.freed);
+	pthread_cond_destroy(&pool.filled);
+	pthread_mutex_destroy(&pool.lock);
+out_free:
+	free(pool.slots);
+	free(threads);
+	return ret;
+}
+
+/**
+ * dumpseg_parse_spec - parse a segment argument
+ * @arg: segment number, range of segment numbers, "all", or "dirty"
+ * @firstp: place to store the first segment number of a range
+ * @lastp: place to store the last segment number of a range
+ *
+ * Return: one of DUMPSEG_SPEC_* values, or -1 if @arg is invalid.
+ */
+static int dumpseg_parse_spec(const char *arg, uint64_t *firstp,
+			      uint64_t *lastp)
+{
+	char *endptr;
+
+	if (strcmp(arg, "all") == 0)
+		return DUMPSEG_SPEC_ALL;
+	if (strcmp(arg, "dirty") == 0)
+		return DUMPSEG_SPEC_DIRTY;
+
+	if (!isdigit((unsigned char)*arg))
+		return -1;
+
+	errno = 0;
+	*firstp = strtoull(arg, &endptr, DUMPSEG_BASE);
+	*lastp = *firstp;
+	if (*endptr == '-' && isdigit((unsigned char)endptr[1]))
+		*lastp = strtoull(endptr + 1, &endptr, DUMPSEG_BASE);
+
+	if (*endptr != '\0' || errno == ERANGE || *lastp < *firstp)
+		return -1;
+	return DUMPSEG_SPEC_RANGE;
+}
+
+static int dumpseg_add_segment(uint64_t **segnumsp, size_t *nsegsp,
+			       size_t *maxsegsp, uint64_t segnum)
+{
+	uint64_t *segnums;
+	size_t maxsegs;
+
+	if (*nsegsp == *maxsegsp) {
+		maxsegs = *maxsegsp ? *maxsegsp * 2 : DUMPSEG_NSUINFO;
+		segnums = realloc(*segnumsp, sizeof(*segnums) * maxsegs);
+		if (unlikely(!segnums)) {
+			warn(NULL);
+			return -1;
+		}
+		*segnumsp = segnums;
+		*maxsegsp = maxsegs;
+	}
+	(*segnumsp)[(*nsegsp)++] = segnum;
+	return 0;
+}
+
+static int dumpseg_add_dirty_segments(struct nilfs *nilfs,
+				      uint64_t **segnumsp, size_t *nsegsp,
+				      size_t *maxsegsp)
+{
+	struct nilfs_suinfo si[DUMPSEG_NSUINFO];
+	uint64_t segnum, nsegs;
+	ssize_t i, n;
+
+	nsegs = nilfs_get_nsegments(nilfs);
+	for (segnum = 0; segnum < nsegs; segnum += n) {
+		n = nilfs_get_suinfo(nilfs, segnum, si,
+				     min_t(uint64_t, nsegs - segnum,
+					   DUMPSEG_NSUINFO));
+		if (unlikely(n < 0)) {
+			warn("cannot get segment usage info");
+			return -1;
+		}
+		if (n == 0)
+			break;
+
+		for (i = 0; i < n; i++) {
+			if (!nilfs_suinfo_dirty(&si[i]))
+				continue;
+			if (unlikely(dumpseg_add_segment(segnumsp, nsegsp,
+							 maxsegsp,
+							 segnum + i) < 0))
+				return -1;
+		}
+	}
+	return 0;
 }
 
 int main(int argc, char *argv[])
 {
 	struct nilfs *nilfs;
-	uint64_t segnum;
-	char *dev, *endptr, *progname, *last;
-	struct nilfs_segment segment;
-	int c, i, status;
-	int ret;
+	uint64_t first, last, segnum, nsegments;
+	uint64_t *segnums = NULL;
+	size_t nsegs = 0, maxsegs = 0;
+	char *dev, *endptr, *progname, *last_slash;
+	int c, i, status, open_flags;
+	int kind;
 #ifdef _GNU_SOURCE
 	int option_index;
 #endif	/* _GNU_SOURCE */
 
-	last = strrchr(argv[0], '/');
-	progname = last ? last + 1 : argv[0];
+	last_slash = strrchr(argv[0], '/');
+	progname = last_slash ? last_slash + 1 : argv[0];
 
 #ifdef _GNU_SOURCE
-	while ((c = getopt_long(argc, argv, "hV",
+	while ((c = getopt_long(argc, argv, "f:j:shV",
 				long_option, &option_index)) >= 0) {
 #else	/* !_GNU_SOURCE */
-	while ((c = getopt(argc, argv, "hV")) >= 0) {
+	while ((c = getopt(argc, argv, "f:j:shV")) >= 0) {
 #endif	/* _GNU_SOURCE */
 
 		switch (c) {
+		case 'f':
+			format = nilfs_parse_format(optarg);
+			if (format < 0 || format == NILFS_FORMAT_CSV)
+				errx(EXIT_FAILURE, "invalid format: %s",
+				     optarg);
+			break;
+		case 'j':
+			param_jobs = strtoul(optarg, &endptr, DUMPSEG_BASE);
+			if (*endptr != '\0' || param_jobs == 0 ||
+			    param_jobs > 256)
+				errx(EXIT_FAILURE, "invalid number of jobs: %s",
+				     optarg);
+			break;
+		case 's':
+			summary_only = 1;
+			break;
 		case 'h':
 			fprintf(stderr, DUMPSEG_USAGE, progname);
 			exit(EXIT_SUCCESS);
@@ -290,46 +852,84 @@ int main(int argc, char *argv[])
 	if (optind > argc - 1) {
 		errx(EXIT_FAILURE, "too few arguments");
 	} else {
-		strtoull(argv[optind], &endptr, DUMPSEG_BASE);
-		if (*endptr == '\0')
+		if (dumpseg_parse_spec(argv[optind], &first, &last) >= 0)
 			dev = NULL;
 		else
 			dev = argv[optind++];
 	}
 
-	nilfs = nilfs_open(dev, NULL, NILFS_OPEN_RAW);
+	open_flags = NILFS_OPEN_RAW;
+	for (i = optind; i < argc; i++) {
+		if (dumpseg_parse_spec(argv[i], &first, &last) ==
+		    DUMPSEG_SPEC_DIRTY)
+			open_flags |= NILFS_OPEN_RDONLY;
+	}
+
+	if (nilfs_format_setup_output(format) < 0)
+		errx(EXIT_FAILURE, "refusing to write raw records to a terminal");
+
+	nilfs = nilfs_open(dev, NULL, open_flags);
 	if (nilfs == NULL)
 		err(EXIT_FAILURE, "cannot open NILFS on %s", dev ? : "device");
 
 	if (nilfs_opt_set_mmap(nilfs) < 0)
 		warnx("cannot use mmap");
 
+	if (param_jobs == 0) {
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		param_jobs = ncpus > 0 ?
+			min_t(long, ncpus, DUMPSEG_MAX_JOBS) : 1;
+	}
+
 	status = EXIT_SUCCESS;
+	nsegments = nilfs_get_nsegments(nilfs);
 	for (i = optind; i < argc; i++) {
-		segnum = strtoull(argv[i], &endptr, DUMPSEG_BASE);
-		if (*endptr != '\0') {
-			warnx("%s: invalid segment number", argv[i]);
+		kind = dumpseg_parse_spec(argv[i], &first, &last);
+		switch (kind) {
+		case DUMPSEG_SPEC_ALL:
+			first = 0;
+			last = nsegments - 1;
+			break;
+		case DUMPSEG_SPEC_DIRTY:
+			if (unlikely(dumpseg_add_dirty_segments(
+					     nilfs, &segnums, &nsegs,
+					     &maxsegs) < 0)) {
+				status = EXIT_FAILURE;
+				goto out;
+			}
+			continue;
+		case DUMPSEG_SPEC_RANGE:
+			if (last < nsegments)
+				break;
+			warnx("%s: segment number out of range", argv[i]);
 			status = EXIT_FAILURE;
 			continue;
-		}
-		ret = nilfs_get_segment(nilfs, segnum, &segment);
-		if (ret < 0) {
-			warn("failed to read segment");
+		default:
+			warnx("%s: invalid segment number", argv[i]);
 			status = EXIT_FAILURE;
-			goto out;
+			continue;
 		}
 
-		dumpseg_print_segment(&segment);
-
-		ret = nilfs_put_segment(&segment);
-		if (ret < 0) {
-			warn("failed to release segment");
-			status = EXIT_FAILURE;
-			goto out;
+		for (segnum = first; segnum <= last; segnum++) {
+			if (unlikely(dumpseg_add_segment(&segnums, &nsegs,
+							 &maxsegs,
+							 segnum) < 0)) {
+				status = EXIT_FAILURE;
+				goto out;
+			}
 		}
 	}
 
+	if (dumpseg_dump_segments(nilfs, segnums, nsegs) < 0)
+		status = EXIT_FAILURE;
+	if (unlikely(fflush(stdout) == EOF)) {
+		warn("failed to write output");
+		status = EXIT_FAILURE;
+	}
+
  out:
+	free(segnums);
 	nilfs_close(nilfs);
 	exit(status);
 }
@@ -46,8 +46,10 @@
 #include <time.h>
 #endif	/* HAVE_TIME_H */
 
+#include <errno.h>
 #include "nilfs.h"
 #include "util.h"
+#include "format.h"
 
 #undef CONFIG_PRINT_CPSTAT
 
@@ -56,11 +58,14 @@
 static const struct option long_option[] = {
 	{"all", no_argument, NULL, 'a'},
 	{"show-block-count", no_argument, NULL, 'b'},
+	{"format", required_argument, NULL, 'f'},
 	{"show-increment", no_argument, NULL, 'g'},
 	{"reverse", no_argument, NULL, 'r'},
 	{"snapshot", no_argument, NULL, 's'},
 	{"index", required_argument, NULL, 'i'},
 	{"lines", required_argument, NULL, 'n'},
+	{"since", required_argument, NULL, 'S'},
+	{"until", required_argument, NULL, 'U'},
 	{"help", no_argument, NULL, 'h'},
 	{"version", no_argument, NULL, 'V'},
 	{NULL, 0, NULL, 0}
@@ -68,18 +73,24 @@ static const struct option long_option[] = {
 #define LSCP_USAGE	"Usage: %s [OPTION]... [DEVICE]\n"		\
 			"  -a, --all\t\tshow all checkpoints\n"		\
 			"  -b, --show-block-count\t\tshow block count\n"\
+			"  -f, --format=FORMAT\ttext, json, csv, or raw\n"\
 			"  -g, --show-increment\t\tshow increment count\n"\
 			"  -r, --reverse\t\treverse order\n"		\
 			"  -s, --snapshot\tlist only snapshots\n"	\
 			"  -i, --index\t\tcp/ss index\n"		\
 			"  -n, --lines\t\tlines\n"			\
+			"  -S, --since=TIME\tlist checkpoints created at or "\
+			"after TIME\n"					\
+			"  -U, --until=TIME\tlist checkpoints created at or "\
+			"before TIME\n"					\
 			"  -h, --help\t\tdisplay this help and exit\n"	\
 			"  -V, --version\t\tdisplay version and exit\n"
 #else
-#define LSCP_USAGE	"Usage: %s [-bgrshV] [-i cno] [-n lines] [device]\n"
+#define LSCP_USAGE	"Usage: %s [-bgrshV] [-f format] [-i cno] [-n lines] " \
+			"[-S time] [-U time]\n"			\
+			"          [device]\n"
 #endif	/* _GNU_SOURCE */
 
-#define LSCP_BUFSIZE	128
 #define LSCP_NCPINFO	512
 #define LSCP_MINDELTA	64	/* Minimum delta for reverse direction */
 
@@ -95,25 +106,57 @@ static uint64_t param_lines;
 static struct nilfs_cpinfo cpinfos[LSCP_NCPINFO];
 static int show_block_count = 1;
 static int show_all;
+static nilfs_cno_t range_start = NILFS_CNO_MIN;	/* inclusive */
+static nilfs_cno_t range_end = NILFS_CNO_MAX;	/* exclusive */
+static int format = NILFS_FORMAT_TEXT;
+static struct nilfs_timefmt timefmt;
 
 static void lscp_print_header(void)
 {
-	printf("                 CNO        DATE     TIME  MODE  FLG     %s       ICNT\n",
-	       show_block_count ? " BLKCNT" : "NBLKINC");
+	switch (format) {
+	case NILFS_FORMAT_TEXT:
+		printf("                 CNO        DATE     TIME  MODE  FLG     %s       ICNT\n",
+		       show_block_count ? " BLKCNT" : "NBLKINC");
+		break;
+	case NILFS_FORMAT_CSV:
+		printf("cno,create,snapshot,minor,blocks_count,nblk_inc,inodes_count\n");
+		break;
+	}
 }
 
 static void lscp_print_cpinfo(struct nilfs_cpinfo *cpinfo)
 {
-	struct tm tm;
-	time_t t;
-	char timebuf[LSCP_BUFSIZE];
-
-	t = (time_t)cpinfo->ci_create;
-	localtime_r(&t, &tm);
-	strftime(timebuf, LSCP_BUFSIZE, "%F %T", &tm);
+	switch (format) {
+	case NILFS_FORMAT_JSON:
+		printf("{\"cno\": %llu, \"create\": %llu, \"snapshot\": %s, "
+		       "\"minor\": %s, \"blocks_count\": %llu, "
+		       "\"nblk_inc\": %llu, \"inodes_count\": %llu}\n",
+		       (unsigned long long)cpinfo->ci_cno,
+		       (unsigned long long)cpinfo->ci_create,
+		       nilfs_cpinfo_snapshot(cpinfo) ? "true" : "false",
+		       nilfs_cpinfo_minor(cpinfo) ? "true" : "false",
+		       (unsigned long long)cpinfo->ci_blocks_count,
+		       (unsigned long long)cpinfo->ci_nblk_inc,
+		       (unsigned long long)cpinfo->ci_inodes_count);
+		return;
+	case NILFS_FORMAT_CSV:
+		printf("%llu,%llu,%d,%d,%llu,%llu,%llu\n",
+		       (unsigned long long)cpinfo->ci_cno,
+		       (unsigned long long)cpinfo->ci_create,
+		       !!nilfs_cpinfo_snapshot(cpinfo),
+		       !!nilfs_cpinfo_minor(cpinfo),
+		       (unsigned long long)cpinfo->ci_blocks_count,
+		       (unsigned long long)cpinfo->ci_nblk_inc,
+		       (unsigned long long)cpinfo->ci_inodes_count);
+		return;
+	case NILFS_FORMAT_RAW:
+		fwrite(cpinfo, sizeof(*cpinfo), 1, stdout);
+		return;
+	}
 
 	printf("%20llu  %s   %s    %s %12llu %10llu\n",
-	       (unsigned long long)cpinfo->ci_cno, timebuf,
+	       (unsigned long long)cpinfo->ci_cno,
+	       nilfs_format_time(&timefmt, (time_t)cpinfo->ci_create),
 	       nilfs_cpinfo_snapshot(cpinfo) ? "ss" : "cp",
 	       nilfs_cpinfo_minor(cpinfo) ? "i" : "-",
 	       (unsigned long long)(show_block_count ?
@@ -147,15 +190,17 @@ static int lscp_forward_cpinfo(struct nilfs *nilfs,
 			       struct nilfs_cpstat *cpstat)
 {
 	struct nilfs_cpinfo *cpi;
-	nilfs_cno_t sidx;
+	nilfs_cno_t sidx, eidx;
 	uint64_t rest;
 	ssize_t n;
 
 	rest = param_lines && param_lines < cpstat->cs_ncps ? param_lines :
 		cpstat->cs_ncps;
-	sidx = param_index ? param_index : NILFS_CNO_MIN;
+	sidx = max_t(nilfs_cno_t, param_index, range_start);
 
-	while (rest > 0 && sidx < cpstat->cs_cno) {
+	eidx = min_t(nilfs_cno_t, cpstat->cs_cno, range_end);
+
+	while (rest > 0 && sidx < eidx) {
 		n = lscp_get_cpinfo(nilfs, sidx, NILFS_CHECKPOINT, rest);
 		if (unlikely(n < 0))
 			return n;
@@ -163,6 +208,8 @@ static int lscp_forward_cpinfo(struct nilfs *nilfs,
 			break;
 
 		for (cpi = cpinfos; cpi < cpinfos + n; cpi++) {
+			if (cpi->ci_cno >= range_end)
+				return 0;
 			if (show_all || nilfs_cpinfo_snapshot(cpi) ||
 			    !nilfs_cpinfo_minor(cpi)) {
 				lscp_print_cpinfo(cpi);
@@ -191,6 +238,7 @@ static int lscp_backward_cpinfo(struct nilfs *nilfs,
 		goto out;
 	eidx = param_index && param_index < cpstat->cs_cno ? param_index + 1 :
 		cpstat->cs_cno;
+	eidx = min_t(nilfs_cno_t, eidx, range_end);
 
 recalc_delta:
 	delta = min_t(uint64_t, LSCP_NCPINFO,
@@ -267,6 +315,8 @@ recalc_delta:
 		state = LSCP_NORMAL_ST;
 		cpi = &cpinfos[n - 1];
 		do {
+			if (cpi->ci_cno < range_start)
+				goto out;
 			if (cpi->ci_cno < eidx &&
 			    (show_all || nilfs_cpinfo_snapshot(cpi) ||
 			     !nilfs_cpinfo_minor(cpi))) {
@@ -320,7 +370,7 @@ static int lscp_forward_ssinfo(struct nilfs *nilfs,
 
 	rest = param_lines && param_lines < cpstat->cs_nsss ? param_lines :
 		cpstat->cs_nsss;
-	sidx = param_index;
+	sidx = max_t(nilfs_cno_t, param_index, range_start);
 
 	if (!rest || sidx >= cpstat->cs_cno)
 		return 0;
@@ -341,8 +391,11 @@ static int lscp_forward_ssinfo(struct nilfs *nilfs,
 		if (!n)
 			break;
 
-		for (i = 0; i < n; i++)
+		for (i = 0; i < n; i++) {
+			if (cpinfos[i].ci_cno >= range_end)
+				return 0;
 			lscp_print_cpinfo(&cpinfos[i]);
+		}
 
 		rest -= n;
 		sidx = cpinfos[n - 1].ci_next;
@@ -366,6 +419,7 @@ static int lscp_backward_ssinfo(struct nilfs *nilfs,
 	rest = param_lines && param_lines < rns ? param_lines : rns;
 	eidx = param_index && param_index < cpstat->cs_cno ? param_index + 1 :
 		cpstat->cs_cno;
+	eidx = min_t(nilfs_cno_t, eidx, range_end);
 
 	for ( ; rest > 0 && eidx > NILFS_CNO_MIN ; eidx = sidx) {
 		if (rns <= LSCP_NCPINFO || eidx <= NILFS_CNO_MIN + LSCP_NCPINFO)
@@ -384,6 +438,8 @@ static int lscp_backward_ssinfo(struct nilfs *nilfs,
 				continue;
 			if (!nilfs_cpinfo_snapshot(&cpinfos[n - i - 1]))
 				continue;
+			if (cpinfos[n - i - 1].ci_cno < range_start)
+				return 0;
 			lscp_print_cpinfo(&cpinfos[n - i - 1]);
 			eidx = cpinfos[n - i - 1].ci_cno;
 			rest--;
@@ -400,17 +456,113 @@ static int lscp_backward_ssinfo(struct nilfs *nilfs,
 	for (i = 0; i < n && rest > 0; i++) {
 		if (cpinfos[n - i - 1].ci_cno >= eidx)
 			continue;
+		if (cpinfos[n - i - 1].ci_cno < range_start)
+			break;
 		lscp_print_cpinfo(&cpinfos[n - i - 1]);
 		rest--;
 	}
 	return 0;
 }
 
+/**
+ * lscp_parse_time - parse time given to --since or --until
+ * @arg: "@SECONDS", or local time as "YYYY-MM-DD[ HH:MM[:SS]]"
+ * @timep: place to store the time in seconds since the Epoch
+ */
+static int lscp_parse_time(const char *arg, int64_t *timep)
+{
+	static const char * const formats[] = {
+		"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M",
+		"%Y-%m-%d",
+	};
+	struct tm tm;
+	const char *end;
+	char *endptr;
+	time_t t;
+	int i;
+
+	if (arg[0] == '@') {
+		errno = 0;
+		*timep = strtoll(arg + 1, &endptr, 10);
+		return (endptr == arg + 1 || *endptr != '\0' || errno) ? -1 : 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(formats); i++) {
+		memset(&tm, 0, sizeof(tm));
+		end = strptime(arg, formats[i], &tm);
+		if (!end || *end != '\0')
+			continue;
+		tm.tm_isdst = -1;
+		t = mktime(&tm);
+		if (t == (time_t)-1)
+			return -1;
+		*timep = t;
+		return 0;
+	}
+	return -1;
+}
+
+/**
+ * lscp_find_cno - find the first checkpoint created at or after a time
+ * @nilfs: nilfs object
+ * @cpstat: checkpoint status
+ * @t: time in seconds since the Epoch
+ * @cnop: place to store the checkpoint number, or cs_cno if all
+ * checkpoints were created before @t
+ *
+ * Bisects on the creation time, taking it as monotone in checkpoint
+ * number, so that a time range is located with O(log n) single-entry
+ * GET_CPINFO probes.  Each probe returns the first existing checkpoint
+ * at or after the probed number, which also skips deleted ranges.
+ */
+static int lscp_find_cno(struct nilfs *nilfs,
+			 const struct nilfs_cpstat *cpstat, int64_t t,
+			 nilfs_cno_t *cnop)
+{
+	struct nilfs_cpinfo cpinfo;
+	nilfs_cno_t low = NILFS_CNO_MIN, high = cpstat->cs_cno, mid;
+	ssize_t n;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		n = nilfs_get_cpinfo(nilfs, mid, NILFS_CHECKPOINT, &cpinfo, 1);
+		if (unlikely(n < 0))
+			return -1;
+		if (n == 0 || (int64_t)cpinfo.ci_create >= t)
+			high = mid;
+		else
+			low = cpinfo.ci_cno + 1;
+	}
+	*cnop = low;
+	return 0;
+}
+
+/**
+ * lscp_set_range - set the checkpoint range to be listed
+ * @nilfs: nilfs object
+ * @cpstat: checkpoint status
+ * @since: time of the oldest checkpoint to be listed, or %INT64_MIN
+ * @until: time of the newest checkpoint to be listed, or %INT64_MAX
+ */
+static int lscp_set_range(struct nilfs *nilfs,
+			  const struct nilfs_cpstat *cpstat,
+			  int64_t since, int64_t until)
+{
+	if (since > INT64_MIN &&
+	    unlikely(lscp_find_cno(nilfs, cpstat, since, &range_start) < 0))
+		return -1;
+	if (until < INT64_MAX &&
+	    unlikely(lscp_find_cno(nilfs, cpstat, until + 1, &range_end) < 0))
+		return -1;
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	struct nilfs *nilfs;
 	struct nilfs_cpstat cpstat;
 	char *dev, *progname;
+	int64_t since = INT64_MIN, until = INT64_MAX;
 	int c, mode, rvs, status, ret;
 #ifdef _GNU_SOURCE
 	int option_index;
@@ -426,10 +578,10 @@ int main(int argc, char *argv[])
 
 
 #ifdef _GNU_SOURCE
-	while ((c = getopt_long(argc, argv, "abgrsi:n:hV",
+	while ((c = getopt_long(argc, argv, "abf:grsi:n:S:U:hV",
 				long_option, &option_index)) >= 0) {
 #else
-	while ((c = getopt(argc, argv, "abgrsi:n:hV")) >= 0) {
+	while ((c = getopt(argc, argv, "abf:grsi:n:S:U:hV")) >= 0) {
 #endif	/* _GNU_SOURCE */
 
 		switch (c) {
@@ -439,6 +591,11 @@ int main(int argc, char *argv[])
 		case 'b':
 			show_block_count = 1;
 			break;
+		case 'f':
+			format = nilfs_parse_format(optarg);
+			if (format < 0)
+				errx(EXIT_FAILURE, "invalid format: %s", optarg);
+			break;
 		case 'g':
 			show_block_count = 0;
 			break;
@@ -454,6 +611,14 @@ int main(int argc, char *argv[])
 		case 'n':
 			param_lines = (uint64_t)atoll(optarg);
 			break;
+		case 'S':
+			if (lscp_parse_time(optarg, &since) < 0)
+				errx(EXIT_FAILURE, "invalid time: %s", optarg);
+			break;
+		case 'U':
+			if (lscp_parse_time(optarg, &until) < 0)
+				errx(EXIT_FAILURE, "invalid time: %s", optarg);
+			break;
 		case 'h':
 			fprintf(stderr, LSCP_USAGE, progname);
 			exit(EXIT_SUCCESS);
@@ -473,6 +638,9 @@ int main(int argc, char *argv[])
 	else
 		dev = NULL;
 
+	if (nilfs_format_setup_output(format) < 0)
+		errx(EXIT_FAILURE, "refusing to write raw records to a terminal");
+
 	nilfs = nilfs_open(dev, NULL, NILFS_OPEN_RDONLY);
 	if (nilfs == NULL)
 		err(EXIT_FAILURE, "cannot open NILFS on %s", dev ? : "device");
@@ -483,6 +651,10 @@ int main(int argc, char *argv[])
 	if (unlikely(ret < 0))
 		goto out;
 
+	ret = lscp_set_range(nilfs, &cpstat, since, until);
+	if (unlikely(ret < 0))
+		goto out;
+
 #ifdef CONFIG_PRINT_CPSTAT
 	lscp_print_cpstat(&cpstat, mode);
 #endif
@@ -505,6 +677,10 @@ int main(int argc, char *argv[])
 		warn(NULL);
 		status = EXIT_FAILURE;
 	}
+	if (unlikely(fflush(stdout) == EOF)) {
+		warn("failed to write output");
+		status = EXIT_FAILURE;
+	}
 	nilfs_close(nilfs);
 	exit(status);
 }
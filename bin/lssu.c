@@ -49,21 +49,32 @@
 #include <time.h>
 #endif	/* HAVE_TIME_H */
 
+#if HAVE_UNISTD_H
+#include <unistd.h>	/* sysconf() */
+#endif	/* HAVE_UNISTD_H */
+
 #include <errno.h>
 #include "nilfs.h"
 #include "util.h"
 #include "nilfs_gc.h"
 #include "cnormap.h"
 #include "parser.h"
+#include "format.h"
 
 #ifdef _GNU_SOURCE
 #include <getopt.h>
 static const struct option long_option[] = {
 	{"all",  no_argument, NULL, 'a'},
+	{"format", required_argument, NULL, 'f'},
 	{"index", required_argument, NULL, 'i'},
+	{"jobs", required_argument, NULL, 'j'},
+	{"json", no_argument, NULL, 'J'},
 	{"latest-usage", no_argument, NULL, 'l' },
 	{"lines", required_argument, NULL, 'n'},
 	{"protection-period", required_argument, NULL, 'p'},
+	{"summary", no_argument, NULL, 's'},
+	{"top", required_argument, NULL, 't'},
+	{"watch", required_argument, NULL, 'w'},
 	{"help", no_argument, NULL, 'h'},
 	{"version", no_argument, NULL, 'V'},
 	{NULL, 0, NULL, 0}
@@ -72,20 +83,31 @@ static const struct option long_option[] = {
 #define LSSU_USAGE							\
 	"Usage: %s [OPTION]... [DEVICE]\n"				\
 	"  -a, --all\t\t\tdo not hide clean segments\n"			\
+	"  -f, --format=FORMAT\t\ttext, json, csv, or raw\n"		\
 	"  -h, --help\t\t\tdisplay this help and exit\n"		\
 	"  -i, --index\t\t\tskip index segments at start of inputs\n"	\
+	"  -j, --jobs\t\t\tnumber of threads used with -l\n"		\
+	"  -J, --json\t\t\tprint summary in JSON (-s -f json)\n"	\
 	"  -l, --latest-usage\t\tprint usage status of the moment\n"	\
 	"  -n, --lines\t\t\tlist only lines input segments\n"		\
 	"  -p, --protection-period\tspecify protection period\n"	\
-	"  -V, --version\t\t\tdisplay version and exit\n"
+	"  -s, --summary\t\t\tprint histograms and totals only\n"	\
+	"  -t, --top\t\t\tprint most reclaimable segments (implies -s -l)\n" \
+	"  -V, --version\t\t\tdisplay version and exit\n"		\
+	"  -w, --watch=INTERVAL\t\tprint changed segments every INTERVAL\n"
 #else	/* !_GNU_SOURCE */
-#include <unistd.h>
 #define LSSU_USAGE \
-	"Usage: %s [-alhV] [-i index] [-n lines] [-p period] [device]\n"
+	"Usage: %s [-aJlshV] [-f format] [-i index] [-j jobs] [-n lines] " \
+	"[-p period]\n          [-t count] [-w interval] [device]\n"
 #endif	/* _GNU_SOURCE */
 
-#define LSSU_BUFSIZE	128
 #define LSSU_NSEGS	512
+#define LSSU_ASSESS_NSEGS	128	/* segments assessed per lock */
+#define LSSU_MAX_JOBS	8	/* default limit of threads */
+#define LSSU_WATCH_NSEGS	8192	/* segments fetched per ioctl */
+#define LSSU_NRATIOS	11	/* 0-9%, ..., 90-99%, 100% */
+#define LSSU_NAGES	7
+#define LSSU_BARWIDTH	40
 
 enum lssu_mode {
 	LSSU_MODE_NORMAL,
@@ -108,32 +130,373 @@ static const struct lssu_format lssu_format[] = {
 	}
 };
 
+/**
+ * struct lssu_victim - segment listed by the --top option
+ * @segnum: segment number
+ * @lastmod: modification time
+ * @nblocks: number of blocks written in the segment
+ * @nliveblks: number of live blocks
+ * @reclaimable: number of blocks that GC of the segment would reclaim
+ */
+struct lssu_victim {
+	uint64_t segnum;
+	int64_t lastmod;
+	uint32_t nblocks;
+	uint32_t nliveblks;
+	uint32_t reclaimable;
+};
+
+/**
+ * struct lssu_summary - statistics gathered by the --summary option
+ * @nsegs: number of examined segments
+ * @nclean: number of clean segments
+ * @nactive: number of active segments
+ * @nerror: number of erroneous segments
+ * @nprotected: number of protected segments (with -l)
+ * @nblocks: number of blocks written in dirty segments
+ * @nliveblks: number of live blocks (with -l)
+ * @nreclaimable: number of blocks reclaimable by GC (with -l)
+ * @ratio_hist: histogram of the live (or usage) ratio of dirty segments
+ * @age_hist: histogram of the age of dirty segments
+ * @top: bounded min-heap of the most reclaimable segments
+ * @ntop: number of entries in @top
+ */
+struct lssu_summary {
+	uint64_t nsegs;
+	uint64_t nclean;
+	uint64_t nactive;
+	uint64_t nerror;
+	uint64_t nprotected;
+	uint64_t nblocks;
+	uint64_t nliveblks;
+	uint64_t nreclaimable;
+	uint64_t ratio_hist[LSSU_NRATIOS];
+	uint64_t age_hist[LSSU_NAGES];
+	struct lssu_victim *top;
+	size_t ntop;
+};
+
+static const struct {
+	int64_t limit;
+	const char *label;
+} lssu_age_buckets[LSSU_NAGES] = {
+	{ 3600, "< 1 hour" },
+	{ 6 * 3600, "< 6 hours" },
+	{ 86400, "< 1 day" },
+	{ 7 * 86400, "< 1 week" },
+	{ 30 * 86400, "< 30 days" },
+	{ 365 * 86400, "< 1 year" },
+	{ INT64_MAX, ">= 1 year" },
+};
+
 static int all;
 static int latest;
+static int summary;
+static int format = NILFS_FORMAT_TEXT;
+static struct nilfs_timefmt timefmt;
+static struct lssu_summary sum;
 static int disp_mode;		/* display mode */
 static nilfs_cno_t protcno;
 static int64_t prottime, now;
 static uint64_t param_index;
 static uint64_t param_lines;
+static unsigned int param_jobs;
+static size_t param_top;
+static unsigned long param_watch;
 
 static size_t blocks_per_segment;
 static struct nilfs_suinfo suinfos[LSSU_NSEGS];
+static ssize_t liveblks[LSSU_NSEGS];
 
 static void lssu_print_header(void)
 {
-	puts(lssu_format[disp_mode].header);
+	if (summary)
+		return;
+
+	switch (format) {
+	case NILFS_FORMAT_TEXT:
+		puts(lssu_format[disp_mode].header);
+		break;
+	case NILFS_FORMAT_CSV:
+		printf("segnum,lastmod,active,dirty,error,nblocks%s\n",
+		       latest ? ",protected,live_blocks" : "");
+		break;
+	}
+}
+
+static int lssu_victim_less(const struct lssu_victim *v1,
+			    const struct lssu_victim *v2)
+{
+	if (v1->reclaimable != v2->reclaimable)
+		return v1->reclaimable < v2->reclaimable;
+	return v1->lastmod > v2->lastmod;	/* prefer older segments */
+}
+
+/**
+ * lssu_add_victim - keep a segment if it is among the most reclaimable
+ * @victim: segment to be considered
+ *
+ * sum.top is a min-heap of size param_top, so its root is the least
+ * reclaimable of the segments kept and the one to be replaced.
+ */
+static void lssu_add_victim(const struct lssu_victim *victim)
+{
+	struct lssu_victim *heap = sum.top, tmp;
+	size_t i, child;
+
+	if (sum.ntop < param_top) {
+		/* sift up */
+		i = sum.ntop++;
+		heap[i] = *victim;
+		while (i > 0 && lssu_victim_less(&heap[i], &heap[(i - 1) / 2])) {
+			tmp = heap[i];
+			heap[i] = heap[(i - 1) / 2];
+			heap[(i - 1) / 2] = tmp;
+			i = (i - 1) / 2;
+		}
+		return;
+	}
+	if (!lssu_victim_less(&heap[0], victim))
+		return;
+
+	/* replace the root and sift down */
+	heap[0] = *victim;
+	for (i = 0; (child = 2 * i + 1) < sum.ntop; i = child) {
+		if (child + 1 < sum.ntop &&
+		    lssu_victim_less(&heap[child + 1], &heap[child]))
+			child++;
+		if (!lssu_victim_less(&heap[child], &heap[i]))
+			break;
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+	}
+}
+
+static int lssu_comp_victim(const void *elem1, const void *elem2)
+{
+	const struct lssu_victim *v1 = elem1, *v2 = elem2;
+
+	return lssu_victim_less(v1, v2) ? 1 : lssu_victim_less(v2, v1) ? -1 : 0;
 }
 
-static ssize_t lssu_get_latest_usage(struct nilfs *nilfs,
-				     uint64_t segnum, uint64_t protseq,
-				     nilfs_cno_t protcno)
+/**
+ * lssu_account_suinfo - add a listed segment to the summary
+ * @segnum: segment number
+ * @si: usage information of the segment
+ * @nliveblks: number of live blocks (or written blocks without -l)
+ * @ratio: live (or usage) ratio in percent
+ * @protected: flag of protected segment (with -l)
+ */
+static void lssu_account_suinfo(uint64_t segnum,
+				const struct nilfs_suinfo *si,
+				size_t nliveblks, int ratio, int protected)
+{
+	struct lssu_victim victim;
+	int64_t age;
+	int i;
+
+	if (nilfs_suinfo_active(si))
+		sum.nactive++;
+	if (nilfs_suinfo_error(si))
+		sum.nerror++;
+	if (!nilfs_suinfo_dirty(si) || nilfs_suinfo_error(si))
+		return;
+
+	sum.nblocks += si->sui_nblocks;
+	age = now - (int64_t)si->sui_lastmod;
+	for (i = 0; age >= lssu_age_buckets[i].limit; i++)
+		;
+	sum.age_hist[i]++;
+
+	if (latest) {
+		sum.nliveblks += nliveblks;
+		if (protected) {
+			sum.nprotected++;
+			return;
+		}
+		sum.nreclaimable += blocks_per_segment - nliveblks;
+	}
+	sum.ratio_hist[min_t(int, ratio / 10, LSSU_NRATIOS - 1)]++;
+
+	if (param_top > 0) {
+		victim.segnum = segnum;
+		victim.lastmod = si->sui_lastmod;
+		victim.nblocks = si->sui_nblocks;
+		victim.nliveblks = nliveblks;
+		victim.reclaimable = blocks_per_segment - nliveblks;
+		lssu_add_victim(&victim);
+	}
+}
+
+static void lssu_print_bar(uint64_t count, uint64_t max)
+{
+	int i, len = max ? (count * LSSU_BARWIDTH + max - 1) / max : 0;
+
+	if (len > 0)
+		printf("  ");
+	for (i = 0; i < len; i++)
+		putchar('#');
+	putchar('\n');
+}
+
+static uint64_t lssu_hist_max(const uint64_t *hist, int n)
+{
+	uint64_t max = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		max = max_t(uint64_t, max, hist[i]);
+	return max;
+}
+
+static void lssu_print_summary_text(void)
+{
+	const char *ratio_name = latest ? "Live ratio" : "Usage ratio";
+	const struct lssu_victim *v;
+	uint64_t max, capacity = 0;
+	size_t i;
+
+	printf("Segments:\n");
+	printf("  %-16s %12llu\n", "total", (unsigned long long)sum.nsegs);
+	printf("  %-16s %12llu\n", "clean", (unsigned long long)sum.nclean);
+	printf("  %-16s %12llu\n", "active", (unsigned long long)sum.nactive);
+	printf("  %-16s %12llu\n", "erroneous",
+	       (unsigned long long)sum.nerror);
+	if (latest)
+		printf("  %-16s %12llu\n", "protected",
+		       (unsigned long long)sum.nprotected);
+
+	printf("Blocks:\n");
+	printf("  %-16s %12llu\n", "in use", (unsigned long long)sum.nblocks);
+	if (latest) {
+		for (i = 0; i < LSSU_NRATIOS; i++)
+			capacity += sum.ratio_hist[i] * blocks_per_segment;
+		printf("  %-16s %12llu\n", "live",
+		       (unsigned long long)sum.nliveblks);
+		printf("  %-16s %12llu (%llu%% of unprotected segments)\n",
+		       "reclaimable", (unsigned long long)sum.nreclaimable,
+		       capacity ? (unsigned long long)(sum.nreclaimable * 100 /
+						       capacity) : 0ULL);
+	}
+
+	printf("%s of %s segments:\n", ratio_name,
+	       latest ? "unprotected dirty" : "dirty");
+	max = lssu_hist_max(sum.ratio_hist, LSSU_NRATIOS);
+	for (i = 0; i < LSSU_NRATIOS; i++) {
+		if (i < LSSU_NRATIOS - 1)
+			printf("  %3zu-%3zu%%  %12llu", i * 10, i * 10 + 9,
+			       (unsigned long long)sum.ratio_hist[i]);
+		else
+			printf("     100%%  %12llu",
+			       (unsigned long long)sum.ratio_hist[i]);
+		lssu_print_bar(sum.ratio_hist[i], max);
+	}
+
+	printf("Age of dirty segments:\n");
+	max = lssu_hist_max(sum.age_hist, LSSU_NAGES);
+	for (i = 0; i < LSSU_NAGES; i++) {
+		printf("  %-9s %12llu", lssu_age_buckets[i].label,
+		       (unsigned long long)sum.age_hist[i]);
+		lssu_print_bar(sum.age_hist[i], max);
+	}
+
+	if (param_top == 0)
+		return;
+
+	printf("Most reclaimable segments:\n");
+	printf("           SEGNUM        DATE     TIME    NBLOCKS NLIVEBLOCKS RECLAIMABLE\n");
+	for (i = 0; i < sum.ntop; i++) {
+		v = &sum.top[i];
+		printf("%17llu  %s %10u  %10u  %10u\n",
+		       (unsigned long long)v->segnum,
+		       nilfs_format_time(&timefmt, (time_t)v->lastmod),
+		       v->nblocks, v->nliveblks, v->reclaimable);
+	}
+}
+
+static void lssu_print_summary_json(void)
+{
+	const struct lssu_victim *v;
+	size_t i;
+
+	printf("{\"segments\": {\"total\": %llu, \"clean\": %llu, "
+	       "\"active\": %llu, \"erroneous\": %llu",
+	       (unsigned long long)sum.nsegs, (unsigned long long)sum.nclean,
+	       (unsigned long long)sum.nactive,
+	       (unsigned long long)sum.nerror);
+	if (latest)
+		printf(", \"protected\": %llu",
+		       (unsigned long long)sum.nprotected);
+	printf("},\n \"blocks\": {\"per_segment\": %zu, \"in_use\": %llu",
+	       blocks_per_segment, (unsigned long long)sum.nblocks);
+	if (latest)
+		printf(", \"live\": %llu, \"reclaimable\": %llu",
+		       (unsigned long long)sum.nliveblks,
+		       (unsigned long long)sum.nreclaimable);
+	printf("},\n \"%s\": [", latest ? "live_ratio" : "usage_ratio");
+	for (i = 0; i < LSSU_NRATIOS; i++)
+		printf("%s{\"min\": %zu, \"max\": %zu, \"segments\": %llu}",
+		       i ? ", " : "", i * 10, min_t(size_t, i * 10 + 9, 100),
+		       (unsigned long long)sum.ratio_hist[i]);
+	printf("],\n \"age\": [");
+	for (i = 0; i < LSSU_NAGES; i++) {
+		printf("%s{\"max_seconds\": ", i ? ", " : "");
+		if (lssu_age_buckets[i].limit == INT64_MAX)
+			printf("null");
+		else
+			printf("%lld", (long long)lssu_age_buckets[i].limit);
+		printf(", \"segments\": %llu}",
+		       (unsigned long long)sum.age_hist[i]);
+	}
+	printf("]");
+	if (param_top > 0) {
+		printf(",\n \"top\": [");
+		for (i = 0; i < sum.ntop; i++) {
+			v = &sum.top[i];
+			printf("%s\n  {\"segnum\": %llu, \"lastmod\": %lld, "
+			       "\"nblocks\": %u, \"live_blocks\": %u, "
+			       "\"reclaimable_blocks\": %u}", i ? "," : "",
+			       (unsigned long long)v->segnum,
+			       (long long)v->lastmod, v->nblocks, v->nliveblks,
+			       v->reclaimable);
+		}
+		printf("]");
+	}
+	printf("}\n");
+}
+
+static void lssu_print_summary(void)
+{
+	qsort(sum.top, sum.ntop, sizeof(*sum.top), lssu_comp_victim);
+	if (format == NILFS_FORMAT_JSON)
+		lssu_print_summary_json();
+	else
+		lssu_print_summary_text();
+}
+
+/**
+ * lssu_get_latest_usage - count live blocks of dirty segments
+ * @nilfs: nilfs object
+ * @segnum: segment number of suinfos[0]
+ * @nsi: number of valid entries of suinfos
+ * @protseq: start of sequence number of protected segments
+ *
+ * Fills liveblks[] for the segments in suinfos[] that need a scan, with
+ * -1 for protected segments.  The segments are assessed in batches to
+ * take the cleaner lock and read the snapshot list once per batch
+ * rather than once per segment.
+ */
+static int lssu_get_latest_usage(struct nilfs *nilfs, uint64_t segnum,
+				 ssize_t nsi, uint64_t protseq)
 {
-	struct nilfs_reclaim_stat stat;
 	struct nilfs_reclaim_params params = {
 		.flags = NILFS_RECLAIM_PARAM_PROTSEQ,
 		.protseq = protseq
 	};
-	uint64_t segnums[1];
+	uint64_t segnums[LSSU_ASSESS_NSEGS];
+	ssize_t index[LSSU_ASSESS_NSEGS], results[LSSU_ASSESS_NSEGS];
+	ssize_t i, j, n = 0;
 	int ret;
 
 	if (protcno != NILFS_CNO_MAX) {
@@ -141,86 +504,156 @@ static ssize_t lssu_get_latest_usage(struct nilfs *nilfs,
 		params.protcno = protcno;
 	}
 
-	memset(&stat, 0, sizeof(stat));
-	segnums[0] = segnum;
+	for (i = 0; i < nsi; i++) {
+		if (nilfs_suinfo_dirty(&suinfos[i]) &&
+		    !nilfs_suinfo_error(&suinfos[i])) {
+			segnums[n] = segnum + i;
+			index[n++] = i;
+		}
+		/* assess when the batch is full or at the end of suinfos */
+		if (n < LSSU_ASSESS_NSEGS && (n == 0 || i < nsi - 1))
+			continue;
 
-	ret = nilfs_assess_segment(nilfs, segnums, 1, &params, &stat);
-	if (unlikely(ret < 0))
-		return -1;
+		ret = nilfs_assess_segments(nilfs, segnums, n, &params,
+					    param_jobs, results);
+		if (unlikely(ret < 0))
+			return -1;
+
+		for (j = 0; j < n; j++)
+			liveblks[index[j]] = results[j];
+		n = 0;
+	}
+	return 0;
+}
 
-	if (stat.protected_segs > 0)
-		return -2;
+static void lssu_print_row(uint64_t segnum, const struct nilfs_suinfo *si,
+			   size_t nliveblks, int ratio, int protected)
+{
+	time_t t = (time_t)si->sui_lastmod;
+	const char *timestr;
 
-	return stat.live_blks;
+	switch (format) {
+	case NILFS_FORMAT_JSON:
+		printf("{\"segnum\": %llu, \"lastmod\": %lld, \"active\": %s, "
+		       "\"dirty\": %s, \"error\": %s, \"nblocks\": %u",
+		       (unsigned long long)segnum, (long long)si->sui_lastmod,
+		       nilfs_suinfo_active(si) ? "true" : "false",
+		       nilfs_suinfo_dirty(si) ? "true" : "false",
+		       nilfs_suinfo_error(si) ? "true" : "false",
+		       si->sui_nblocks);
+		if (latest)
+			printf(", \"protected\": %s, \"live_blocks\": %zu",
+			       protected ? "true" : "false", nliveblks);
+		printf("}\n");
+		return;
+	case NILFS_FORMAT_CSV:
+		printf("%llu,%lld,%d,%d,%d,%u", (unsigned long long)segnum,
+		       (long long)si->sui_lastmod, !!nilfs_suinfo_active(si),
+		       !!nilfs_suinfo_dirty(si), !!nilfs_suinfo_error(si),
+		       si->sui_nblocks);
+		if (latest)
+			printf(",%d,%zu", protected, nliveblks);
+		putchar('\n');
+		return;
+	default:
+		break;
+	}
+
+	timestr = t != 0 ? nilfs_format_time(&timefmt, t) :
+		"---------- --:--:--";
+
+	switch (disp_mode) {
+	case LSSU_MODE_NORMAL:
+		printf(lssu_format[disp_mode].body,
+		       (unsigned long long)segnum,
+		       timestr,
+		       nilfs_suinfo_active(si) ? 'a' : '-',
+		       nilfs_suinfo_dirty(si) ? 'd' : '-',
+		       nilfs_suinfo_error(si) ? 'e' : '-',
+		       si->sui_nblocks);
+		break;
+	case LSSU_MODE_LATEST_USAGE:
+		printf(lssu_format[disp_mode].body,
+		       (unsigned long long)segnum,
+		       timestr,
+		       nilfs_suinfo_active(si) ? 'a' : '-',
+		       nilfs_suinfo_dirty(si) ? 'd' : '-',
+		       nilfs_suinfo_error(si) ? 'e' : '-',
+		       protected ? 'p' : '-',
+		       si->sui_nblocks, nliveblks, ratio);
+		break;
+	}
 }
 
 static ssize_t lssu_print_suinfo(struct nilfs *nilfs, uint64_t segnum,
 				 ssize_t nsi, uint64_t protseq)
 {
-	struct tm tm;
-	time_t t;
-	char timebuf[LSSU_BUFSIZE];
-	ssize_t i, n = 0, ret;
+	const struct nilfs_suinfo *si;
+	int64_t t;
+	ssize_t i, n = 0;
 	int ratio;
 	int protected;
 	size_t nliveblks;
 
+	if (format == NILFS_FORMAT_RAW) {
+		/* all segments, so that a record's position gives segnum */
+		if (fwrite(suinfos, sizeof(*suinfos), nsi, stdout) < (size_t)nsi) {
+			warn("failed to write records");
+			return -1;
+		}
+		return nsi;
+	}
+
+	if (disp_mode == LSSU_MODE_LATEST_USAGE &&
+	    unlikely(lssu_get_latest_usage(nilfs, segnum, nsi, protseq) < 0)) {
+		warn("failed to get usage");
+		return -1;
+	}
+
 	for (i = 0; i < nsi; i++, segnum++) {
-		if (!all && nilfs_suinfo_clean(&suinfos[i]))
+		si = &suinfos[i];
+		if (summary) {
+			sum.nsegs++;
+			if (nilfs_suinfo_clean(si))
+				sum.nclean++;
+		}
+		if (!all && nilfs_suinfo_clean(si))
 			continue;
 
-		t = (time_t)suinfos[i].sui_lastmod;
-		if (t != 0) {
-			localtime_r(&t, &tm);
-			strftime(timebuf, LSSU_BUFSIZE, "%F %T", &tm);
-		} else
-			snprintf(timebuf, LSSU_BUFSIZE,
-				 "---------- --:--:--");
-
+		nliveblks = 0;
+		ratio = 0;
+		protected = 0;
 		switch (disp_mode) {
 		case LSSU_MODE_NORMAL:
-			printf(lssu_format[disp_mode].body,
-			       (unsigned long long)segnum,
-			       timebuf,
-			       nilfs_suinfo_active(&suinfos[i]) ? 'a' : '-',
-			       nilfs_suinfo_dirty(&suinfos[i]) ? 'd' : '-',
-			       nilfs_suinfo_error(&suinfos[i]) ? 'e' : '-',
-			       suinfos[i].sui_nblocks);
+			nliveblks = si->sui_nblocks;
+			ratio = (si->sui_nblocks * 100 + 99) /
+				blocks_per_segment;
 			break;
 		case LSSU_MODE_LATEST_USAGE:
-			nliveblks = 0;
-			ratio = 0;
+			t = si->sui_lastmod;
 			protected = (t >= prottime && t <= now);
 
-			if (!nilfs_suinfo_dirty(&suinfos[i]) ||
-			    nilfs_suinfo_error(&suinfos[i]))
-				goto skip_scan;
-
-			ret = lssu_get_latest_usage(nilfs, segnum, protseq,
-						    protcno);
-			if (ret >= 0) {
-				nliveblks = ret;
-				ratio = (ret * 100 + 99) / blocks_per_segment;
-			} else if (likely(ret == -2)) {
-				nliveblks = suinfos[i].sui_nblocks;
+			if (!nilfs_suinfo_dirty(si) || nilfs_suinfo_error(si))
+				break;
+
+			if (liveblks[i] >= 0) {
+				nliveblks = liveblks[i];
+				ratio = (liveblks[i] * 100 + 99) /
+					blocks_per_segment;
+			} else {
+				nliveblks = si->sui_nblocks;
 				ratio = 100;
 				protected = 1;
-			} else {
-				warn("failed to get usage");
-				return -1;
 			}
-
-skip_scan:
-			printf(lssu_format[disp_mode].body,
-			       (unsigned long long)segnum,
-			       timebuf,
-			       nilfs_suinfo_active(&suinfos[i]) ? 'a' : '-',
-			       nilfs_suinfo_dirty(&suinfos[i]) ? 'd' : '-',
-			       nilfs_suinfo_error(&suinfos[i]) ? 'e' : '-',
-			       protected ? 'p' : '-',
-			       suinfos[i].sui_nblocks, nliveblks, ratio);
 			break;
 		}
+
+		if (summary)
+			lssu_account_suinfo(segnum, si, nliveblks, ratio,
+					    protected);
+		else
+			lssu_print_row(segnum, si, nliveblks, ratio,
+				       protected);
 		n++;
 	}
 	return n;
@@ -250,12 +683,162 @@ static int lssu_list_suinfo(struct nilfs *nilfs)
 		n = lssu_print_suinfo(nilfs, segnum, nsi, sustat.ss_prot_seq);
 		if (unlikely(n < 0))
 			return EXIT_FAILURE;
+		if (latest && !summary)
+			fflush(stdout);	/* stream the slow -l output */
 		segnum += nsi;
 	}
 
+	if (summary)
+		lssu_print_summary();
 	return EXIT_SUCCESS;
 }
 
+static int lssu_fetch_suinfo(struct nilfs *nilfs, uint64_t segnum,
+			     struct nilfs_suinfo *si, uint64_t nsegs)
+{
+	uint64_t done;
+	ssize_t n;
+
+	for (done = 0; done < nsegs; done += n) {
+		n = nilfs_get_suinfo(nilfs, segnum + done, si + done,
+				     min_t(uint64_t, nsegs - done,
+					   LSSU_WATCH_NSEGS));
+		if (unlikely(n < 0))
+			return -1;
+		if (n == 0)
+			break;
+	}
+	return 0;
+}
+
+static void lssu_print_watch_counters(time_t t, double elapsed,
+				      uint64_t nchanged, uint64_t nfreed,
+				      uint64_t nallocated, uint64_t nwritten,
+				      uint64_t nclean)
+{
+	switch (format) {
+	case NILFS_FORMAT_TEXT:
+		printf("--- %s: %llu changed, freed %.2f/s, allocated %.2f/s, "
+		       "written %.1f blocks/s, %llu clean\n",
+		       nilfs_format_time(&timefmt, t),
+		       (unsigned long long)nchanged, nfreed / elapsed,
+		       nallocated / elapsed, nwritten / elapsed,
+		       (unsigned long long)nclean);
+		break;
+	case NILFS_FORMAT_JSON:
+		printf("{\"time\": %lld, \"changed_segments\": %llu, "
+		       "\"freed_segments_per_sec\": %.2f, "
+		       "\"allocated_segments_per_sec\": %.2f, "
+		       "\"written_blocks_per_sec\": %.1f, "
+		       "\"clean_segments\": %llu}\n",
+		       (long long)t, (unsigned long long)nchanged,
+		       nfreed / elapsed, nallocated / elapsed,
+		       nwritten / elapsed, (unsigned long long)nclean);
+		break;
+	}
+}
+
+/**
+ * lssu_watch_suinfo - print changes of segment usage periodically
+ * @nilfs: nilfs object
+ *
+ * The usage information of the listed range is kept between rounds, so
+ * that only segments whose state, number of blocks or modification time
+ * changed are printed, followed by counters of the round.  Runs until
+ * interrupted or an error occurs.
+ */
+static int lssu_watch_suinfo(struct nilfs *nilfs)
+{
+	struct nilfs_sustat sustat;
+	struct nilfs_suinfo *prev, *cur, *tmp;
+	struct timespec ts, last;
+	uint64_t nsegs, i, nchanged, nfreed, nallocated, nwritten, nclean;
+	double elapsed;
+
+	if (unlikely(nilfs_get_sustat(nilfs, &sustat) < 0))
+		return EXIT_FAILURE;
+	if (param_index >= sustat.ss_nsegs)
+		return EXIT_SUCCESS;
+	nsegs = sustat.ss_nsegs - param_index;
+	if (param_lines && param_lines < nsegs)
+		nsegs = param_lines;
+
+	prev = calloc(nsegs, sizeof(*prev));
+	cur = calloc(nsegs, sizeof(*cur));
+	if (unlikely(!prev || !cur)) {
+		warn(NULL);
+		goto out;
+	}
+
+	if (unlikely(lssu_fetch_suinfo(nilfs, param_index, prev, nsegs) < 0 ||
+		     clock_gettime(CLOCK_MONOTONIC, &last) < 0))
+		goto out;
+
+	lssu_print_header();
+	for (i = 0; i < nsegs; i++) {
+		if (all || !nilfs_suinfo_clean(&prev[i]))
+			lssu_print_row(param_index + i, &prev[i], 0, 0, 0);
+	}
+	fflush(stdout);
+
+	for (;;) {
+		sleep(param_watch);
+
+		if (unlikely(lssu_fetch_suinfo(nilfs, param_index, cur,
+					       nsegs) < 0 ||
+			     clock_gettime(CLOCK_MONOTONIC, &ts) < 0))
+			goto out;
+
+		nchanged = nfreed = nallocated = nwritten = nclean = 0;
+		for (i = 0; i < nsegs; i++) {
+			if (nilfs_suinfo_clean(&cur[i]))
+				nclean++;
+			if (cur[i].sui_flags == prev[i].sui_flags &&
+			    cur[i].sui_nblocks == prev[i].sui_nblocks &&
+			    cur[i].sui_lastmod == prev[i].sui_lastmod)
+				continue;
+
+			nchanged++;
+			if (nilfs_suinfo_dirty(&prev[i]) &&
+			    !nilfs_suinfo_dirty(&cur[i]))
+				nfreed++;
+			if (!nilfs_suinfo_dirty(&prev[i]) &&
+			    nilfs_suinfo_dirty(&cur[i]))
+				nallocated++;
+			if (nilfs_suinfo_dirty(&cur[i])) {
+				/* fewer blocks than before means new contents */
+				if (nilfs_suinfo_dirty(&prev[i]) &&
+				    cur[i].sui_nblocks >= prev[i].sui_nblocks)
+					nwritten += cur[i].sui_nblocks -
+						prev[i].sui_nblocks;
+				else
+					nwritten += cur[i].sui_nblocks;
+			}
+			lssu_print_row(param_index + i, &cur[i], 0, 0, 0);
+		}
+
+		elapsed = (ts.tv_sec - last.tv_sec) +
+			(ts.tv_nsec - last.tv_nsec) / 1e9;
+		if (elapsed <= 0)
+			elapsed = 1;
+		lssu_print_watch_counters(time(NULL), elapsed, nchanged,
+					  nfreed, nallocated, nwritten, nclean);
+		if (unlikely(fflush(stdout) == EOF)) {
+			warn("failed to write output");
+			goto out;
+		}
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+		last = ts;
+	}
+out:
+	free(prev);
+	free(cur);
+	return EXIT_FAILURE;
+}
+
 static int lssu_get_protcno(struct nilfs *nilfs,
 			    unsigned long protection_period,
 			    int64_t *prottimep, nilfs_cno_t *protcnop)
@@ -289,7 +872,7 @@ static int lssu_get_protcno(struct nilfs *nilfs,
 int main(int argc, char *argv[])
 {
 	struct nilfs *nilfs;
-	char *dev, *progname;
+	char *dev, *progname, *endptr;
 	int c, status;
 	int open_flags;
 	unsigned long protection_period = ULONG_MAX;
@@ -305,19 +888,35 @@ int main(int argc, char *argv[])
 		progname++;
 
 #ifdef _GNU_SOURCE
-	while ((c = getopt_long(argc, argv, "ai:ln:hp:V",
+	while ((c = getopt_long(argc, argv, "af:i:j:Jln:hp:st:Vw:",
 				long_option, &option_index)) >= 0) {
 #else	/* !_GNU_SOURCE */
-	while ((c = getopt(argc, argv, "ai:ln:hp:V")) >= 0) {
+	while ((c = getopt(argc, argv, "af:i:j:Jln:hp:st:Vw:")) >= 0) {
 #endif	/* _GNU_SOURCE */
 
 		switch (c) {
 		case 'a':
 			all = 1;
 			break;
+		case 'f':
+			format = nilfs_parse_format(optarg);
+			if (format < 0)
+				errx(EXIT_FAILURE, "invalid format: %s", optarg);
+			break;
 		case 'i':
 			param_index = (uint64_t)atoll(optarg);
 			break;
+		case 'j':
+			param_jobs = strtoul(optarg, &endptr, 10);
+			if (*endptr != '\0' || param_jobs == 0 ||
+			    param_jobs > 256)
+				errx(EXIT_FAILURE, "invalid number of jobs: %s",
+				     optarg);
+			break;
+		case 'J':
+			format = NILFS_FORMAT_JSON;
+			summary = 1;
+			break;
 		case 'l':
 			latest = 1;
 			break;
@@ -339,10 +938,29 @@ int main(int argc, char *argv[])
 
 			errx(EXIT_FAILURE, "invalid protection period: %s",
 			     optarg);
+		case 's':
+			summary = 1;
+			break;
+		case 't':
+			param_top = strtoul(optarg, &endptr, 10);
+			if (*endptr != '\0' || param_top == 0 ||
+			    param_top > 1000000)
+				errx(EXIT_FAILURE, "invalid count: %s", optarg);
+			summary = 1;
+			latest = 1;
+			break;
 		case 'V':
 			printf("%s (%s %s)\n", progname, PACKAGE,
 			       PACKAGE_VERSION);
 			exit(EXIT_SUCCESS);
+		case 'w':
+			ret = nilfs_parse_protection_period(optarg,
+							    &param_watch);
+			if (ret < 0 || param_watch == 0 ||
+			    param_watch > UINT_MAX)
+				errx(EXIT_FAILURE, "invalid interval: %s",
+				     optarg);
+			break;
 		default:
 			exit(EXIT_FAILURE);
 		}
@@ -355,6 +973,17 @@ int main(int argc, char *argv[])
 	else
 		errx(EXIT_FAILURE, "too many arguments");
 
+	if (summary && format != NILFS_FORMAT_TEXT &&
+	    format != NILFS_FORMAT_JSON)
+		errx(EXIT_FAILURE, "summary can only be printed in text or json");
+	if (format == NILFS_FORMAT_RAW && latest)
+		errx(EXIT_FAILURE, "raw format cannot be used with -l");
+	if (param_watch && (latest || summary || format == NILFS_FORMAT_RAW))
+		errx(EXIT_FAILURE,
+		     "watch mode cannot be used with -l, -s, or raw format");
+	if (nilfs_format_setup_output(format) < 0)
+		errx(EXIT_FAILURE, "refusing to write raw records to a terminal");
+
 	open_flags = NILFS_OPEN_RDONLY;
 	if (latest)
 		open_flags |= NILFS_OPEN_RAW | NILFS_OPEN_GCLK;
@@ -363,7 +992,18 @@ int main(int argc, char *argv[])
 	if (nilfs == NULL)
 		err(EXIT_FAILURE, "cannot open NILFS on %s", dev ? : "device");
 
-	if (latest) {
+	blocks_per_segment = nilfs_get_blocks_per_segment(nilfs);
+
+	if (param_top > 0) {
+		sum.top = malloc(sizeof(*sum.top) * param_top);
+		if (unlikely(!sum.top)) {
+			warn(NULL);
+			status = EXIT_FAILURE;
+			goto out_close_nilfs;
+		}
+	}
+
+	if (latest || summary) {
 		struct timeval tv;
 
 		ret = gettimeofday(&tv, NULL);
@@ -373,10 +1013,18 @@ int main(int argc, char *argv[])
 			goto out_close_nilfs;
 		}
 		now = tv.tv_sec;
+	}
 
-		blocks_per_segment = nilfs_get_blocks_per_segment(nilfs);
+	if (latest) {
 		disp_mode = LSSU_MODE_LATEST_USAGE;
 
+		if (param_jobs == 0) {
+			long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+			param_jobs = ncpus > 0 ?
+				min_t(long, ncpus, LSSU_MAX_JOBS) : 1;
+		}
+
 		ret = lssu_get_protcno(nilfs, protection_period, &prottime,
 				       &protcno);
 		if (unlikely(ret < 0)) {
@@ -385,9 +1033,17 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	status = lssu_list_suinfo(nilfs);
+	if (param_watch)
+		status = lssu_watch_suinfo(nilfs);
+	else
+		status = lssu_list_suinfo(nilfs);
+	if (unlikely(fflush(stdout) == EOF)) {
+		warn("failed to write output");
+		status = EXIT_FAILURE;
+	}
 
 out_close_nilfs:
+	free(sum.top);
 	nilfs_close(nilfs);
 	exit(status);
 }
@@ -54,6 +54,8 @@
 
 #include <errno.h>
 #include "nilfs.h"
+#include "nilfs_gc.h"
+#include "cnormap.h"
 #include "parser.h"
 #include "util.h"
 
@@ -61,20 +63,27 @@
 #ifdef _GNU_SOURCE
 #include <getopt.h>
 static const struct option long_options[] = {
+	{"estimate", no_argument, NULL, 'e'},
 	{"force", no_argument, NULL, 'f'},
 	{"interactive", no_argument, NULL, 'i'},
+	{"protection-period", required_argument, NULL, 'p'},
+	{"verbose", no_argument, NULL, 'v'},
 	{"help", no_argument, NULL, 'h'},
 	{"version", no_argument, NULL, 'V'},
 	{NULL, 0, NULL, 0}
 };
 #define RMCP_USAGE							\
 	"Usage: %s [OPTION]... [DEVICE] CNO...\n"			\
+	"  -e, --estimate\testimate reclaimable space without removal\n" \
 	"  -f, --force\t\tignore snapshots or nonexistent checkpoints\n" \
 	"  -i, --interactive\tprompt before any removal\n"		\
+	"  -p, --protection-period=SECONDS\n"				\
+	"               \t\tprotection period assumed by --estimate\n"	\
+	"  -v, --verbose\t\tshow progress and a summary of each range\n" \
 	"  -h, --help\t\tdisplay this help and exit\n"			\
 	"  -V, --version\t\tdisplay version and exit\n"
 #else	/* !_GNU_SOURCE */
-#define RMCP_USAGE	"Usage: %s [-fihV] [device] cno...\n"
+#define RMCP_USAGE	"Usage: %s [-efivhV] [-p period] [device] cno...\n"
 #endif	/* _GNU_SOURCE */
 
 #define CHCP_PROMPT							\
@@ -82,11 +91,21 @@ static const struct option long_options[] = {
 	"chcp command before removal.\n"
 
 #define RMCP_BASE 10
+#define RMCP_NCPINFO	512	/* checkpoints enumerated per request */
+#define RMCP_NSEGS	512	/* segments assessed per request */
+#define RMCP_MAX_JOBS	8	/* maximum number of assessment threads */
+#define RMCP_CHEAP_PERCENT	25	/* live ratio of cheap segments */
 
 static char *progname;
 
 static int force;
 static int interactive;
+static int verbose;
+static int estimate;
+static unsigned long protection_period = ULONG_MAX;
+
+static unsigned int progress;	/* last percentage shown */
+static uint64_t nioctls;	/* number of ioctl requests issued */
 
 static int rmcp_confirm(const char *arg)
 {
@@ -98,42 +117,398 @@ static int rmcp_confirm(const char *arg)
 	return 0;
 }
 
+/**
+ * rmcp_delete_checkpoint - delete a checkpoint counting the request
+ * @nilfs: nilfs object
+ * @cno: checkpoint number
+ */
+static int rmcp_delete_checkpoint(struct nilfs *nilfs, nilfs_cno_t cno)
+{
+	nioctls++;
+	return nilfs_delete_checkpoint(nilfs, cno);
+}
+
+/**
+ * rmcp_show_progress - show progress of a range removal
+ * @cno: checkpoint number reached
+ * @start: start checkpoint number of the range
+ * @end: end checkpoint number of the range
+ * @nd: number of checkpoints removed so far
+ */
+static void rmcp_show_progress(nilfs_cno_t cno, nilfs_cno_t start,
+			       nilfs_cno_t end, size_t nd)
+{
+	unsigned int percent;
+
+	percent = (unsigned int)((double)(cno - start) * 100 /
+				 (end - start + 1));
+	if (percent == progress)
+		return;
+	progress = percent;
+	fprintf(stderr, "\r%s: %3u%% (%zu removed)", progname, percent, nd);
+	fflush(stderr);
+}
+
+static int rmcp_handle_error(nilfs_cno_t cno, int *nss, uint64_t *nocp)
+{
+	if (errno == EBUSY) {
+		(*nss)++;
+		if (!force)
+			warnx("%llu: cannot remove snapshot",
+			      (unsigned long long)cno);
+	} else if (errno == ENOENT) {
+		(*nocp)++;
+	} else {
+		warn("%llu: cannot remove checkpoint",
+		     (unsigned long long)cno);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * rmcp_remove_range - remove checkpoints in a range
+ * @nilfs: nilfs object
+ * @start: start checkpoint number
+ * @end: end checkpoint number (inclusive)
+ * @ndeleted: place to store the number of removed checkpoints
+ * @nsnapshots: place to store the number of snapshots in the range
+ *
+ * The checkpoints that exist in the range are enumerated in batches with
+ * nilfs_get_cpinfo(), which passes over deleted checkpoints in the
+ * kernel, so that only existing checkpoints are requested for deletion
+ * and snapshots are passed over without a deletion request.  The number
+ * of requests is thus proportional to the number of checkpoints found
+ * rather than to the width of the range.
+ */
 static int rmcp_remove_range(struct nilfs *nilfs,
 			     nilfs_cno_t start, nilfs_cno_t end,
 			     size_t *ndeleted, size_t *nsnapshots)
 {
+	struct nilfs_cpinfo cpinfo[RMCP_NCPINFO];
 	nilfs_cno_t cno;
-	int nocp = 0, nd = 0, nss = 0;
+	uint64_t nfound = 0;
+	uint64_t nocp = 0;
+	int nd = 0, nss = 0;
+	int show = verbose && isatty(fileno(stderr));
+	ssize_t n, i;
 	int ret = 0;
 
-	for (cno = start; cno <= end; cno++) {
-		if (likely(nilfs_delete_checkpoint(nilfs, cno) == 0)) {
+	if (start == end) {
+		if (likely(rmcp_delete_checkpoint(nilfs, start) == 0))
 			nd++;
-			continue;
-		}
-		if (errno == EBUSY) {
-			nss++;
-			if (!force)
-				warnx("%llu: cannot remove snapshot",
-				      (unsigned long long)cno);
-
-		} else if (errno == ENOENT) {
-			nocp++;
-		} else {
-			warn("%llu: cannot remove checkpoint",
-			     (unsigned long long)cno);
+		else
+			ret = rmcp_handle_error(start, &nss, &nocp);
+		goto check;
+	}
+
+	progress = UINT_MAX;
+	cno = start;
+	while (cno <= end) {
+		nioctls++;
+		n = nilfs_get_cpinfo(nilfs, cno, NILFS_CHECKPOINT, cpinfo,
+				     min_t(uint64_t, end - cno + 1,
+					   RMCP_NCPINFO));
+		if (unlikely(n < 0)) {
+			warn("cannot get checkpoint information");
 			ret = -1;
 			goto out;
 		}
+		if (!n)
+			break;
+
+		for (i = 0; i < n; i++) {
+			cno = cpinfo[i].ci_cno;
+			if (cno > end)
+				goto done;
+			nfound++;
+			if (nilfs_cpinfo_snapshot(&cpinfo[i])) {
+				nss++;
+				if (!force)
+					warnx("%llu: cannot remove snapshot",
+					      (unsigned long long)cno);
+				continue;
+			}
+			if (likely(rmcp_delete_checkpoint(nilfs, cno) == 0)) {
+				nd++;
+				continue;
+			}
+			ret = rmcp_handle_error(cno, &nss, &nocp);
+			if (unlikely(ret < 0))
+				goto out;
+		}
+		cno = cpinfo[n - 1].ci_cno + 1;
+		if (show)
+			rmcp_show_progress(cno, start, end, nd);
 	}
+ done:
+	nocp += end - start + 1 - nfound;
+ check:
 	if (!force && (nss > 0 || (nocp > 0 && nd == 0)))
 		ret = 1;
  out:
+	if (show && progress != UINT_MAX)
+		fputc('\n', stderr);
 	*ndeleted = nd;
 	*nsnapshots = nss;
 	return ret;
 }
 
+/**
+ * struct rmcp_range - checkpoint range to be removed
+ * @start: start checkpoint number
+ * @end: end checkpoint number (inclusive)
+ */
+struct rmcp_range {
+	nilfs_cno_t start;
+	nilfs_cno_t end;
+};
+
+static int rmcp_in_ranges(const struct rmcp_range *ranges, int nranges,
+			  nilfs_cno_t cno)
+{
+	int i;
+
+	for (i = 0; i < nranges; i++) {
+		if (cno >= ranges[i].start && cno <= ranges[i].end)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * rmcp_get_protcno - get start of the protection period assumed
+ * @nilfs: nilfs object
+ * @protcnop: place to store the checkpoint number
+ *
+ * Without a protection period, every checkpoint is taken as protected,
+ * so the period starts at the oldest checkpoint.
+ */
+static int rmcp_get_protcno(struct nilfs *nilfs, nilfs_cno_t *protcnop)
+{
+	struct nilfs_cnormap *cnormap;
+	int ret;
+
+	if (protection_period == ULONG_MAX) {
+		*protcnop = nilfs_get_oldest_cno(nilfs);
+		return 0;
+	}
+
+	cnormap = nilfs_cnormap_create(nilfs);
+	if (unlikely(!cnormap)) {
+		warn("failed to create checkpoint number reverse mapper");
+		return -1;
+	}
+
+	ret = nilfs_cnormap_track_back(cnormap, protection_period, protcnop);
+	if (unlikely(ret < 0))
+		warn("failed to get checkpoint number from protection period (%lu)",
+		     protection_period);
+
+	nilfs_cnormap_destroy(cnormap);
+	return ret;
+}
+
+/**
+ * rmcp_get_new_protcno - get start of the protection period after removal
+ * @nilfs: nilfs object
+ * @protcno: current start checkpoint number of the protection period
+ * @ranges: ranges to be removed
+ * @nranges: number of @ranges
+ * @newprotcnop: place to store the checkpoint number
+ *
+ * The cleaner finds the start of the protection period by tracking back
+ * to the oldest checkpoint created within the period.  If that one is
+ * removed, the period starts at the next remaining checkpoint instead.
+ * Snapshots are kept since rmcp refuses to remove them.
+ */
+static int rmcp_get_new_protcno(struct nilfs *nilfs, nilfs_cno_t protcno,
+				const struct rmcp_range *ranges, int nranges,
+				nilfs_cno_t *newprotcnop)
+{
+	struct nilfs_cpinfo cpinfo[RMCP_NCPINFO];
+	nilfs_cno_t cno = protcno;
+	ssize_t n, i;
+
+	for (;;) {
+		n = nilfs_get_cpinfo(nilfs, cno, NILFS_CHECKPOINT, cpinfo,
+				     RMCP_NCPINFO);
+		if (unlikely(n < 0)) {
+			warn("cannot get checkpoint information");
+			return -1;
+		}
+		if (!n)
+			break;
+
+		for (i = 0; i < n; i++) {
+			if (nilfs_cpinfo_snapshot(&cpinfo[i]) ||
+			    !rmcp_in_ranges(ranges, nranges,
+					    cpinfo[i].ci_cno)) {
+				*newprotcnop = cpinfo[i].ci_cno;
+				return 0;
+			}
+		}
+		cno = cpinfo[n - 1].ci_cno + 1;
+	}
+	/* not reached as the latest checkpoint is never removed */
+	*newprotcnop = protcno;
+	return 0;
+}
+
+/**
+ * rmcp_estimate - estimate space reclaimed by removing checkpoints
+ * @nilfs: nilfs object
+ * @cpstat: checkpoint status
+ * @nargs: number of checkpoint range arguments
+ * @args: checkpoint range arguments
+ *
+ * All the given ranges are taken as removed together.  The cleaner
+ * keeps blocks in use by checkpoints within the protection period or by
+ * snapshots, so the removal only frees blocks if it moves the start of
+ * the protection period.  The shift is reported, and every reclaimable
+ * segment is assessed with both boundaries; the segments in which live
+ * blocks would become dead are listed, followed by totals.
+ */
+static int rmcp_estimate(struct nilfs *nilfs,
+			 const struct nilfs_cpstat *cpstat,
+			 int nargs, char *args[])
+{
+	struct nilfs_reclaim_params params = {
+		.flags = NILFS_RECLAIM_PARAM_PROTSEQ |
+			 NILFS_RECLAIM_PARAM_PROTCNO,
+	};
+	struct nilfs_suinfo si[RMCP_NSEGS];
+	struct nilfs_sustat sustat;
+	struct rmcp_range *ranges;
+	uint64_t segnums[RMCP_NSEGS], segnum;
+	ssize_t live[RMCP_NSEGS], freed[RMCP_NSEGS];
+	uint64_t total_live = 0, total_freed = 0;
+	size_t nemptied = 0, ncheap = 0, nsegs;
+	nilfs_cno_t oldest, newprotcno;
+	ssize_t n, i;
+	unsigned int nthreads;
+	uint32_t nblocks;
+	long ncpus;
+	int nranges = 0, status = EXIT_FAILURE;
+
+	ranges = malloc(sizeof(*ranges) * nargs);
+	if (unlikely(!ranges)) {
+		warn(NULL);
+		return EXIT_FAILURE;
+	}
+
+	oldest = nilfs_get_oldest_cno(nilfs);
+	for (i = 0; i < nargs; i++) {
+		struct rmcp_range *r = &ranges[nranges];
+
+		if (nilfs_parse_cno_range(args[i], &r->start, &r->end,
+					  RMCP_BASE) < 0 ||
+		    r->start > r->end || r->start < NILFS_CNO_MIN) {
+			warnx("invalid checkpoint range: %s", args[i]);
+			goto out;
+		}
+		if (r->start != r->end) {
+			if (r->start < oldest)
+				r->start = oldest;
+			if (r->end >= cpstat->cs_cno)
+				r->end = cpstat->cs_cno - 2;
+			if (r->start > r->end)
+				continue;
+		}
+		nranges++;
+	}
+
+	if (unlikely(rmcp_get_protcno(nilfs, &params.protcno) < 0))
+		goto out;
+
+	if (params.protcno == NILFS_CNO_MAX) {
+		printf("no checkpoint is protected, nothing would be freed\n");
+		status = EXIT_SUCCESS;
+		goto out;
+	}
+
+	if (unlikely(rmcp_get_new_protcno(nilfs, params.protcno, ranges,
+					  nranges, &newprotcno) < 0))
+		goto out;
+
+	if (newprotcno == params.protcno) {
+		printf("protection period would still start at checkpoint %llu, nothing would be freed\n",
+		       (unsigned long long)params.protcno);
+		status = EXIT_SUCCESS;
+		goto out;
+	}
+	printf("protection period would start at checkpoint %llu instead of %llu\n",
+	       (unsigned long long)newprotcno,
+	       (unsigned long long)params.protcno);
+
+	if (unlikely(nilfs_get_sustat(nilfs, &sustat) < 0)) {
+		warn("cannot get segment usage status");
+		goto out;
+	}
+	params.protseq = sustat.ss_prot_seq;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = ncpus > 0 ? min_t(long, ncpus, RMCP_MAX_JOBS) : 1;
+
+	printf("%10s %8s %8s %8s\n", "SEGNUM", "BLKCNT", "LIVE", "FREED");
+	for (segnum = 0; segnum < sustat.ss_nsegs; segnum += n) {
+		n = nilfs_get_suinfo(nilfs, segnum, si, RMCP_NSEGS);
+		if (unlikely(n < 0)) {
+			warn("cannot get segment usage information");
+			goto out;
+		}
+		if (!n)
+			break;
+
+		for (i = 0, nsegs = 0; i < n; i++) {
+			if (nilfs_suinfo_reclaimable(&si[i]) &&
+			    !nilfs_suinfo_empty(&si[i]))
+				segnums[nsegs++] = segnum + i;
+		}
+		if (unlikely(nilfs_assess_deletion(nilfs, segnums, nsegs,
+						   &params, newprotcno,
+						   nthreads, live,
+						   freed) < 0)) {
+			warn("cannot assess segments");
+			goto out;
+		}
+
+		for (i = 0; i < nsegs; i++) {
+			if (live[i] <= 0)
+				continue;
+			total_live += live[i];
+			if (!freed[i])
+				continue;
+			total_freed += freed[i];
+
+			nblocks = si[segnums[i] - segnum].sui_nblocks;
+			if (freed[i] == live[i])
+				nemptied++;
+			else if ((uint64_t)(live[i] - freed[i]) * 100 <=
+				 (uint64_t)nblocks * RMCP_CHEAP_PERCENT &&
+				 (uint64_t)live[i] * 100 >
+				 (uint64_t)nblocks * RMCP_CHEAP_PERCENT)
+				ncheap++;
+
+			printf("%10llu %8u %8zd %8zd\n",
+			       (unsigned long long)segnums[i], nblocks,
+			       live[i], freed[i]);
+		}
+	}
+
+	printf("%llu of %llu live blocks (%llu bytes) would be freed\n",
+	       (unsigned long long)total_freed,
+	       (unsigned long long)total_live,
+	       (unsigned long long)total_freed *
+	       nilfs_get_block_size(nilfs));
+	printf("%zu segment(s) would have no live blocks, %zu more would drop to %d%% live or less\n",
+	       nemptied, ncheap, RMCP_CHEAP_PERCENT);
+	status = EXIT_SUCCESS;
+ out:
+	free(ranges);
+	return status;
+}
+
 int main(int argc, char *argv[])
 {
 	char *dev;
@@ -141,6 +516,7 @@ int main(int argc, char *argv[])
 	struct nilfs *nilfs;
 	struct nilfs_cpstat cpstat;
 	nilfs_cno_t start, end, oldest;
+	uint64_t nreq;
 	size_t nsnapshots, nss, ndel;
 	int c, status, ret;
 #ifdef _GNU_SOURCE
@@ -151,13 +527,16 @@ int main(int argc, char *argv[])
 	progname = last ? last + 1 : argv[0];
 
 #ifdef _GNU_SOURCE
-	while ((c = getopt_long(argc, argv, "fihV",
+	while ((c = getopt_long(argc, argv, "efip:vhV",
 				long_options, &option_index)) >= 0) {
 #else	/* !_GNU_SOURCE */
-	while ((c = getopt(argc, argv, "fihV")) >= 0) {
+	while ((c = getopt(argc, argv, "efip:vhV")) >= 0) {
 #endif	/* _GNU_SOURCE */
 
 		switch (c) {
+		case 'e':
+			estimate = 1;
+			break;
 		case 'f':
 			force = 1;
 			interactive = 0;
@@ -166,6 +545,21 @@ int main(int argc, char *argv[])
 			force = 0;
 			interactive = 1;
 			break;
+		case 'p':
+			ret = nilfs_parse_protection_period(
+				optarg, &protection_period);
+			if (!ret)
+				break;
+
+			if (errno == ERANGE)
+				errx(EXIT_FAILURE, "too large period: %s",
+				     optarg);
+
+			errx(EXIT_FAILURE, "invalid protection period: %s",
+			     optarg);
+		case 'v':
+			verbose = 1;
+			break;
 		case 'h':
 			fprintf(stderr, RMCP_USAGE, progname);
 			exit(EXIT_SUCCESS);
@@ -190,7 +584,9 @@ int main(int argc, char *argv[])
 			dev = NULL;
 	}
 
-	nilfs = nilfs_open(dev, NULL, NILFS_OPEN_RDWR);
+	nilfs = nilfs_open(dev, NULL, estimate ?
+			   NILFS_OPEN_RDONLY | NILFS_OPEN_RAW | NILFS_OPEN_GCLK :
+			   NILFS_OPEN_RDWR);
 	if (nilfs == NULL)
 		err(EXIT_FAILURE, "cannot open NILFS on %s", dev ? : "device");
 
@@ -201,6 +597,12 @@ int main(int argc, char *argv[])
 		goto out_close_nilfs;
 	}
 
+	if (estimate) {
+		status = rmcp_estimate(nilfs, &cpstat, argc - optind,
+				       argv + optind);
+		goto out_close_nilfs;
+	}
+
 	status = EXIT_SUCCESS;
 	nsnapshots = 0;
 	for ( ; optind < argc; optind++) {
@@ -229,8 +631,13 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		nreq = nioctls;
 		ret = rmcp_remove_range(nilfs, start, end, &ndel, &nss);
 		nsnapshots += nss;
+		if (verbose)
+			printf("%s: %zu removed, %zu snapshot(s) kept, %llu ioctl(s)\n",
+			       argv[optind], ndel, nss,
+			       (unsigned long long)(nioctls - nreq));
 		if (!ret)
 			continue;
 
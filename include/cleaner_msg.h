@@ -20,6 +20,13 @@
 
 #define NILFS_CLEANER_MSG_MAX_PATH	4064 /* max pathname length */
 #define NILFS_CLEANER_MSG_MAX_REQSZ	4096 /* max request size */
+#define NILFS_CLEANER_MSG_MAX_RSPSZ	512  /* max response size */
+
+/*
+ * Name of the control socket in the abstract namespace, followed by the
+ * same device id suffix as the name of the receive queue of cleanerd.
+ */
+#define NILFS_CLEANER_SOCK_PREFIX	"nilfs-cleaner-"
 
 enum {
 	NILFS_CLEANER_CMD_GET_STATUS,	/* get status */
@@ -31,6 +38,10 @@ enum {
 	NILFS_CLEANER_CMD_WAIT,		/* wait for completion of a job */
 	NILFS_CLEANER_CMD_STOP,		/* stop running gc */
 	NILFS_CLEANER_CMD_SHUTDOWN,	/* shutdown daemon */
+	NILFS_CLEANER_CMD_GET_WASTAT,	/* get write amplification stats */
+	NILFS_CLEANER_CMD_GET_PROGRESS,	/* get progress of gc */
+	NILFS_CLEANER_CMD_SUBSCRIBE,	/* subscribe to progress events */
+	NILFS_CLEANER_CMD_GET_STATS,	/* get counters and pacing state */
 };
 
 
@@ -61,6 +72,7 @@ struct nilfs_cleaner_request_with_jobid {
 enum {
 	NILFS_CLEANER_RSP_ACK,
 	NILFS_CLEANER_RSP_NACK,
+	NILFS_CLEANER_RSP_EVENT,	/* unsolicited progress event */
 };
 
 struct nilfs_cleaner_response {
@@ -71,4 +83,19 @@ struct nilfs_cleaner_response {
 	uint32_t pad;
 };
 
+struct nilfs_cleaner_response_with_wastat {
+	struct nilfs_cleaner_response hdr;
+	struct nilfs_cleaner_wastat wastat;
+};
+
+struct nilfs_cleaner_response_with_progress {
+	struct nilfs_cleaner_response hdr;
+	struct nilfs_cleaner_progress progress;
+};
+
+struct nilfs_cleaner_response_with_stats {
+	struct nilfs_cleaner_response hdr;
+	struct nilfs_cleaner_stats stats;
+};
+
 #endif /* NILFS_CLEANER_MSG_H */
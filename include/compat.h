@@ -50,6 +50,16 @@
 #define FITHAW		_IOWR('X', 120, int)
 #endif
 
+/* I/O priority of processes (see ioprio_set(2)) */
+#ifndef IOPRIO_WHO_PROCESS
+#define IOPRIO_WHO_PROCESS	1
+#endif
+
+/* Scheduling policy for very low priority background jobs */
+#ifndef SCHED_IDLE
+#define SCHED_IDLE		5  /* Supported on Linux 2.6.23 or later */
+#endif
+
 /* Linux specific system clocks */
 #ifndef CLOCK_REALTIME_COARSE
 #define CLOCK_REALTIME_COARSE	5  /* Supported on Linux 2.6.32 or later */
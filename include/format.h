@@ -0,0 +1,40 @@
+/*
+ * format.h - Output formats of NILFS listing commands
+ *
+ * Licensed under LGPLv2: the complete text of the GNU Lesser General
+ * Public License can be found in COPYING file of the nilfs-utils
+ * package.
+ */
+
+#ifndef NILFS_FORMAT_H
+#define NILFS_FORMAT_H
+
+#include <time.h>	/* time_t */
+
+enum nilfs_format {
+	NILFS_FORMAT_TEXT,
+	NILFS_FORMAT_JSON,	/* one JSON object per line */
+	NILFS_FORMAT_CSV,
+	NILFS_FORMAT_RAW,	/* packed binary records */
+};
+
+#define NILFS_FORMAT_BUFSIZE		65536
+#define NILFS_FORMAT_TIMEBUFSIZE	32
+
+/**
+ * struct nilfs_timefmt - cache of the last formatted time
+ * @t: time in seconds
+ * @valid: flag set once @buf holds the formatted @t
+ * @buf: formatted time
+ */
+struct nilfs_timefmt {
+	time_t t;
+	int valid;
+	char buf[NILFS_FORMAT_TIMEBUFSIZE];
+};
+
+int nilfs_parse_format(const char *arg);
+int nilfs_format_setup_output(int format);
+const char *nilfs_format_time(struct nilfs_timefmt *tf, time_t t);
+
+#endif /* NILFS_FORMAT_H */
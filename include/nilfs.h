@@ -170,6 +170,7 @@ size_t nilfs_get_block_size(const struct nilfs *nilfs);
 uint64_t nilfs_get_nsegments(const struct nilfs *nilfs);
 uint32_t nilfs_get_blocks_per_segment(const struct nilfs *nilfs);
 uint32_t nilfs_get_reserved_segments_ratio(const struct nilfs *nilfs);
+const uint8_t *nilfs_get_uuid(const struct nilfs *nilfs);
 
 int nilfs_change_cpmode(struct nilfs *nilfs, nilfs_cno_t cno, int mode);
 ssize_t nilfs_get_cpinfo(struct nilfs *nilfs, nilfs_cno_t cno, int mode,
@@ -196,5 +197,7 @@ int nilfs_resize(struct nilfs *nilfs, off_t size);
 int nilfs_set_alloc_range(struct nilfs *nilfs, off_t start, off_t end);
 int nilfs_freeze(struct nilfs *nilfs);
 int nilfs_thaw(struct nilfs *nilfs);
+int nilfs_trim(struct nilfs *nilfs, uint64_t start, uint64_t len,
+	       uint64_t *trimmedp);
 
 #endif	/* NILFS_H */
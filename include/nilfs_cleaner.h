@@ -19,6 +19,7 @@ struct nilfs_cleaner;
 
 #define NILFS_CLEANER_OPEN_GCPID	(1 << 0)
 #define NILFS_CLEANER_OPEN_QUEUE	(1 << 1)
+#define NILFS_CLEANER_OPEN_SOCKET	(1 << 2)
 
 struct nilfs_cleaner *nilfs_cleaner_launch(const char *device,
 					   const char *mntdir,
@@ -74,11 +75,11 @@ enum nilfs_cleaner_args_unit {
 #define NILFS_CLEANER_ARG_PROTECTION_PERIOD		(1 << 0)
 #define NILFS_CLEANER_ARG_NSEGMENTS_PER_CLEAN		(1 << 1)
 #define NILFS_CLEANER_ARG_CLEANING_INTERVAL		(1 << 2)
-#define NILFS_CLEANER_ARG_USAGE_RATE_THRESHOLD		(1 << 3) /* reserved */
-#define NILFS_CLEANER_ARG_START_SEGNUM			(1 << 4) /* reserved */
-#define NILFS_CLEANER_ARG_NSEGS				(1 << 5) /* reserved */
+#define NILFS_CLEANER_ARG_USAGE_RATE_THRESHOLD		(1 << 3)
+#define NILFS_CLEANER_ARG_START_SEGNUM			(1 << 4)
+#define NILFS_CLEANER_ARG_NSEGS				(1 << 5)
 #define NILFS_CLEANER_ARG_NPASSES			(1 << 6) /* reserved */
-#define NILFS_CLEANER_ARG_RUNTIME			(1 << 7) /* reserved */
+#define NILFS_CLEANER_ARG_RUNTIME			(1 << 7)
 #define NILFS_CLEANER_ARG_MIN_RECLAIMABLE_BLOCKS	(1 << 8)
 
 enum {
@@ -87,7 +88,161 @@ enum {
 	NILFS_CLEANER_STATUS_SUSPENDED,
 };
 
+/**
+ * struct nilfs_cleaner_wastat_window - write statistics over a time window
+ * @span: length of the window in seconds
+ * @pad: padding
+ * @user_blocks: number of blocks written other than by GC
+ * @gc_blocks: number of live blocks rewritten by GC
+ */
+struct nilfs_cleaner_wastat_window {
+	uint32_t span;
+	uint32_t pad;
+	uint64_t user_blocks;
+	uint64_t gc_blocks;
+};
+
+#define NILFS_CLEANER_WASTAT_NWINDOWS	3	/* 5 minutes, 1 hour, 1 day */
+
+/**
+ * struct nilfs_cleaner_wastat - write amplification statistics
+ * @block_size: block size in bytes
+ * @nwindows: number of valid entries in @windows
+ * @since: start time of the accounting (seconds since the epoch)
+ * @user_blocks: cumulative number of blocks written other than by GC
+ * @gc_blocks: cumulative number of live blocks rewritten by GC
+ * @windows: statistics over sliding windows
+ *
+ * The write amplification factor is (user_blocks + gc_blocks) / user_blocks.
+ */
+struct nilfs_cleaner_wastat {
+	uint32_t block_size;
+	uint32_t nwindows;
+	uint64_t since;
+	uint64_t user_blocks;
+	uint64_t gc_blocks;
+	struct nilfs_cleaner_wastat_window windows[NILFS_CLEANER_WASTAT_NWINDOWS];
+};
+
+#define NILFS_CLEANER_PROGRESS_DONE	(1 << 0) /* job @jobid has ended */
+#define NILFS_CLEANER_PROGRESS_ACTIVE	(1 << 1) /* job @jobid running */
+
+#define NILFS_CLEANER_ETA_UNKNOWN	UINT64_MAX
+
+/**
+ * struct nilfs_cleaner_progress - progress of garbage collection
+ * @jobid: id of the current manual job, or of the last one if no job is
+ * running (0 if none has been run)
+ * @status: cleaner status (NILFS_CLEANER_STATUS_*)
+ * @flags: progress flags (NILFS_CLEANER_PROGRESS_*)
+ * @pad: padding
+ * @cleaned_segs: number of segments cleaned since cleanerd started
+ * @freed_bytes: number of bytes freed since cleanerd started
+ * @remaining_segs: number of segments left to be processed by the
+ * current job
+ * @eta: estimated number of seconds until the current job ends, or
+ * NILFS_CLEANER_ETA_UNKNOWN
+ * @free_segs: number of clean segments
+ * @nsegs: number of segments
+ *
+ * The counters are cumulative, so the progress of a job is the
+ * difference from the values seen when it was started.
+ */
+struct nilfs_cleaner_progress {
+	uint32_t jobid;
+	int32_t status;
+	uint32_t flags;
+	uint32_t pad;
+	uint64_t cleaned_segs;
+	uint64_t freed_bytes;
+	uint64_t remaining_segs;
+	uint64_t eta;
+	uint64_t free_segs;
+	uint64_t nsegs;
+};
+
+enum {
+	NILFS_CLEANER_MODE_IDLE,	/* waiting for file system updates */
+	NILFS_CLEANER_MODE_BACKGROUND,	/* normal background cleaning */
+	NILFS_CLEANER_MODE_URGENT,	/* below min_clean_segments */
+	NILFS_CLEANER_MODE_MANUAL,	/* running a job of nilfs-clean */
+	NILFS_CLEANER_MODE_SUSPENDED,	/* suspended by nilfs-clean */
+};
+
+#define NILFS_CLEANER_STATS_VERSION	1
+
+/**
+ * struct nilfs_cleaner_stats - counters and pacing state of cleanerd
+ * @version: version of the structure (NILFS_CLEANER_STATS_VERSION)
+ * @size: number of bytes of the structure filled in by cleanerd
+ * @status: cleaner status (NILFS_CLEANER_STATUS_*)
+ * @mode: cleaning mode (NILFS_CLEANER_MODE_*)
+ * @nsegments_per_clean: number of segments reclaimed per cleaning cycle
+ * @emergency_level: number of emergency watermarks the free segments are
+ * below
+ * @cleaning_interval: cleaning interval in nanoseconds
+ * @protection_period: protection period in seconds
+ * @nsegs: number of segments
+ * @free_segs: number of clean segments
+ * @reserved_segs: number of segments reserved for GC
+ * @reclaimable_segs: number of reclaimable segments found by the last
+ * selection
+ * @candidate_segs: number of those outside the protection period
+ * @ncycles: number of cleaning cycles that tried to reclaim segments
+ * @cleaned_segs: number of cleaned segments
+ * @deferred_segs: number of segments deferred due to too few
+ * reclaimable blocks
+ * @protected_segs: number of selected segments skipped because they
+ * were protected
+ * @live_blks: number of live blocks moved by GC
+ * @defunct_blks: number of defunct blocks reclaimed by GC
+ * @last_cycle: duration of the last cleaning cycle in nanoseconds
+ * @block_size: block size in bytes
+ * @pad: padding
+ * @progress: progress of the current or last manual job
+ *
+ * Counters are cumulative since cleanerd started.  Fields are only
+ * appended in later versions; those beyond @size are zero-filled by
+ * nilfs_cleaner_get_stats().
+ */
+struct nilfs_cleaner_stats {
+	uint16_t version;
+	uint16_t size;
+	int16_t status;
+	int16_t mode;
+	uint32_t nsegments_per_clean;
+	uint32_t emergency_level;
+	uint64_t cleaning_interval;
+	uint64_t protection_period;
+	uint64_t nsegs;
+	uint64_t free_segs;
+	uint64_t reserved_segs;
+	uint64_t reclaimable_segs;
+	uint64_t candidate_segs;
+	uint64_t ncycles;
+	uint64_t cleaned_segs;
+	uint64_t deferred_segs;
+	uint64_t protected_segs;
+	uint64_t live_blks;
+	uint64_t defunct_blks;
+	uint64_t last_cycle;
+	uint32_t block_size;
+	uint32_t pad;
+	struct nilfs_cleaner_progress progress;
+};
+
 int nilfs_cleaner_get_status(struct nilfs_cleaner *cleaner, int *status);
+int nilfs_cleaner_get_stats(struct nilfs_cleaner *cleaner,
+			    struct nilfs_cleaner_stats *stats);
+int nilfs_cleaner_get_progress(struct nilfs_cleaner *cleaner,
+			       struct nilfs_cleaner_progress *progress);
+int nilfs_cleaner_subscribe(struct nilfs_cleaner *cleaner);
+int nilfs_cleaner_recv_progress(struct nilfs_cleaner *cleaner,
+				struct nilfs_cleaner_progress *progress,
+				const struct timespec *timeout);
+int nilfs_cleaner_get_fd(const struct nilfs_cleaner *cleaner);
+int nilfs_cleaner_get_wastat(struct nilfs_cleaner *cleaner,
+			     struct nilfs_cleaner_wastat *wastat);
 int nilfs_cleaner_run(struct nilfs_cleaner *cleaner,
 		      const struct nilfs_cleaner_args *args, uint32_t *jobid);
 int nilfs_cleaner_suspend(struct nilfs_cleaner *cleaner);
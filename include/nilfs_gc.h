@@ -13,6 +13,7 @@
 
 #include <stddef.h>	/* size_t */
 #include <stdint.h>	/* uint64_t, etc */
+#include <time.h>	/* struct timespec */
 #include <linux/nilfs2_api.h>  /* nilfs_suinfo, etc */
 #include "nilfs.h"	/* nilfs_cno_t, struct nilfs */
 
@@ -22,6 +23,10 @@
 #define NILFS_RECLAIM_PARAM_MIN_RECLAIMABLE_BLKS	(1UL << 2)
 #define __NR_NILFS_RECLAIM_PARAMS	3
 
+/* flags for nilfs_reclaim_stat struct (exflags) */
+#define NILFS_RECLAIM_STAT_LOCK_WAIT			(1UL << 0)
+#define __NR_NILFS_RECLAIM_STAT_EXFLAGS	1
+
 /**
  * struct nilfs_reclaim_params - structure to specify GC parameters
  * @flags: flags of valid fields
@@ -38,7 +43,7 @@ struct nilfs_reclaim_params {
 
 /**
  * struct nilfs_reclaim_stat - structure to store GC statistics
- * @exflags: flags for extended fields (reserved)
+ * @exflags: flags for extended fields
  * @cleaned_segs: number of cleaned segments
  * @protected_segs: number of protected (deselected) segments
  * @deferred_segs: number of deferred segments
@@ -49,6 +54,12 @@ struct nilfs_reclaim_params {
  * @defunct_vblks: number of defunct (reclaimable) virtual blocks
  * @defunct_pblks: number of defunct (reclaimable) DAT file blocks
  * @freed_vblks: number of freed virtual blocks
+ * @lock_wait: time spent waiting for the cleaner lock
+ *             (valid if NILFS_RECLAIM_STAT_LOCK_WAIT is set in @exflags)
+ *
+ * The extended fields that follow @freed_vblks are filled only when the
+ * caller sets the corresponding flag in @exflags; the flags of fields
+ * that could not be filled are cleared on return.
  */
 struct nilfs_reclaim_stat {
 	unsigned long exflags;
@@ -62,6 +73,9 @@ struct nilfs_reclaim_stat {
 	size_t defunct_vblks;
 	size_t defunct_pblks;
 	size_t freed_vblks;
+
+	/* extended fields */
+	struct timespec lock_wait;
 };
 
 ssize_t nilfs_reclaim_segment(struct nilfs *nilfs,
@@ -73,6 +87,17 @@ int nilfs_xreclaim_segment(struct nilfs *nilfs,
 			   const struct nilfs_reclaim_params *params,
 			   struct nilfs_reclaim_stat *stat);
 
+int nilfs_assess_segments(struct nilfs *nilfs,
+			  const uint64_t *segnums, size_t nsegs,
+			  const struct nilfs_reclaim_params *params,
+			  unsigned int nthreads, ssize_t *live_blks);
+
+int nilfs_assess_deletion(struct nilfs *nilfs,
+			  const uint64_t *segnums, size_t nsegs,
+			  const struct nilfs_reclaim_params *params,
+			  nilfs_cno_t newprotcno, unsigned int nthreads,
+			  ssize_t *live_blks, ssize_t *freed_blks);
+
 int nilfs_segment_is_protected(struct nilfs *nilfs, uint64_t segnum,
 			       uint64_t protseq);
 
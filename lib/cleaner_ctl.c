@@ -70,6 +70,14 @@
 #include <poll.h>
 #endif	/* HAVE_POLL_H */
 
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif	/* HAVE_SYS_SOCKET_H */
+
+#if HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif	/* HAVE_SYS_UN_H */
+
 #include <signal.h>
 #include <stdarg.h>
 #include <errno.h>
@@ -94,6 +102,8 @@ struct nilfs_cleaner {
 	mqd_t recvq;
 	char *recvq_name;
 	uuid_t client_uuid;
+	int sockfd; /* control socket, or -1 if the queues are used */
+	int subscribed; /* receiving progress events on the socket */
 };
 
 #ifndef LINE_MAX
@@ -285,7 +295,7 @@ static int nilfs_cleaner_open_queue(struct nilfs_cleaner *cleaner)
 	char uuidbuf[36 + 1];
 	struct mq_attr attr = {
 		.mq_maxmsg = 3,
-		.mq_msgsize = sizeof(struct nilfs_cleaner_response)
+		.mq_msgsize = NILFS_CLEANER_MSG_MAX_RSPSZ
 	};
 	int ret;
 
@@ -373,6 +383,87 @@ static void nilfs_cleaner_close_queue(struct nilfs_cleaner *cleaner)
 	}
 }
 
+/**
+ * nilfs_cleaner_open_socket - connect to the control socket of cleanerd
+ * @cleaner: cleaner object
+ * @quiet: do not report a missing socket (the caller falls back to the
+ * message queues)
+ */
+static int nilfs_cleaner_open_socket(struct nilfs_cleaner *cleaner,
+				     int quiet)
+{
+	struct sockaddr_un addr;
+	struct ucred cred;
+	socklen_t addrlen, credlen = sizeof(cred);
+	int ret;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (cleaner->dev_ino == 0) {
+		ret = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+			       NILFS_CLEANER_SOCK_PREFIX "%llu",
+			       (unsigned long long)cleaner->dev_id);
+	} else {
+		ret = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+			       NILFS_CLEANER_SOCK_PREFIX "%llu-%llu",
+			       (unsigned long long)cleaner->dev_id,
+			       (unsigned long long)cleaner->dev_ino);
+	}
+	assert(ret > 0 && ret < sizeof(addr.sun_path) - 1);
+	addrlen = offsetof(struct sockaddr_un, sun_path) + 1 + ret;
+
+	cleaner->sockfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (unlikely(cleaner->sockfd < 0))
+		goto failed;
+
+	ret = connect(cleaner->sockfd, (struct sockaddr *)&addr, addrlen);
+	if (unlikely(ret < 0))
+		goto failed_close;
+
+	/*
+	 * Any local user can bind a name in the abstract namespace, so
+	 * make sure that the socket is served by root or by ourselves.
+	 */
+	ret = getsockopt(cleaner->sockfd, SOL_SOCKET, SO_PEERCRED, &cred,
+			 &credlen);
+	if (unlikely(ret < 0))
+		goto failed_close;
+	if (unlikely(cred.uid != 0 && cred.uid != geteuid())) {
+		nilfs_cleaner_logger(LOG_WARNING,
+				     _("Warning: control socket of %s is owned by uid %lu, ignored."),
+				     cleaner->device, (unsigned long)cred.uid);
+		errno = EPERM;
+		goto failed_close;
+	}
+	return 0;
+
+failed_close:
+	ret = errno;
+	close(cleaner->sockfd);
+	cleaner->sockfd = -1;
+	errno = ret;
+failed:
+	if (quiet)
+		return -1;
+	if (errno == ECONNREFUSED) {
+		nilfs_cleaner_logger(LOG_NOTICE, _("No cleaner found on %s."),
+				     cleaner->device);
+	} else {
+		nilfs_cleaner_logger(LOG_ERR,
+				     _("Error: cannot open cleaner on %s: %s."),
+				     cleaner->device, strerror(errno));
+	}
+	return -1;
+}
+
+static void nilfs_cleaner_close_socket(struct nilfs_cleaner *cleaner)
+{
+	if (cleaner->sockfd >= 0) {
+		close(cleaner->sockfd);
+		cleaner->sockfd = -1;
+	}
+}
+
 struct nilfs_cleaner *nilfs_cleaner_launch(const char *device,
 					   const char *mntdir,
 					   unsigned long protperiod)
@@ -386,6 +477,7 @@ struct nilfs_cleaner *nilfs_cleaner_launch(const char *device,
 	memset(cleaner, 0, sizeof(*cleaner));
 	cleaner->sendq = -1;
 	cleaner->recvq = -1;
+	cleaner->sockfd = -1;
 
 	cleaner->device = strdup(device);
 	cleaner->mountdir = strdup(mntdir);
@@ -426,6 +518,7 @@ struct nilfs_cleaner *nilfs_cleaner_open(const char *device,
 	memset(cleaner, 0, sizeof(*cleaner));
 	cleaner->sendq = -1;
 	cleaner->recvq = -1;
+	cleaner->sockfd = -1;
 
 	ret = nilfs_cleaner_find_fs(cleaner, device, mntdir);
 	if (unlikely(ret < 0))
@@ -441,7 +534,17 @@ struct nilfs_cleaner *nilfs_cleaner_open(const char *device,
 		goto abort;
 	}
 
-	if ((oflag & NILFS_CLEANER_OPEN_QUEUE) &&
+	/*
+	 * The control socket is preferred; the message queues are used
+	 * with cleaner daemons that do not provide it.
+	 */
+	if ((oflag & NILFS_CLEANER_OPEN_SOCKET) &&
+	    nilfs_cleaner_open_socket(cleaner,
+				      oflag & NILFS_CLEANER_OPEN_QUEUE) < 0 &&
+	    !(oflag & NILFS_CLEANER_OPEN_QUEUE))
+		goto abort;
+
+	if ((oflag & NILFS_CLEANER_OPEN_QUEUE) && cleaner->sockfd < 0 &&
 	    nilfs_cleaner_open_queue(cleaner) < 0)
 		goto abort;
 
@@ -473,8 +576,14 @@ const char *nilfs_cleaner_device(const struct nilfs_cleaner *cleaner)
 	return cleaner->device;
 }
 
+int nilfs_cleaner_get_fd(const struct nilfs_cleaner *cleaner)
+{
+	return cleaner->sockfd >= 0 ? cleaner->sockfd : cleaner->recvq;
+}
+
 void nilfs_cleaner_close(struct nilfs_cleaner *cleaner)
 {
+	nilfs_cleaner_close_socket(cleaner);
 	nilfs_cleaner_close_queue(cleaner);
 	free(cleaner->device);
 	free(cleaner->mountdir);
@@ -483,7 +592,7 @@ void nilfs_cleaner_close(struct nilfs_cleaner *cleaner)
 
 static int nilfs_cleaner_clear_queueu(struct nilfs_cleaner *cleaner)
 {
-	struct nilfs_cleaner_response res;
+	char buf[NILFS_CLEANER_MSG_MAX_RSPSZ];
 	struct mq_attr attr;
 	unsigned count;
 	int ret;
@@ -499,8 +608,8 @@ static int nilfs_cleaner_clear_queueu(struct nilfs_cleaner *cleaner)
 		do {
 			ssize_t bytes;
 
-			bytes = mq_receive(cleaner->recvq, (char *)&res,
-					   sizeof(res), NULL);
+			bytes = mq_receive(cleaner->recvq, buf, sizeof(buf),
+					   NULL);
 			if (unlikely(bytes < 0))
 				goto failed;
 		} while (--count > 0);
@@ -518,37 +627,145 @@ failed:
 	return -1;
 }
 
-static int nilfs_cleaner_command(struct nilfs_cleaner *cleaner, int cmd)
+/**
+ * nilfs_cleaner_send_request - send a request to cleaner daemon
+ * @cleaner: cleaner object
+ * @req: request
+ * @size: size of @req including its arguments
+ *
+ * Stale responses left in the receive queue are discarded before
+ * sending.  The control socket carries no stale responses, since the
+ * connection is renewed whenever a deferred response is abandoned (see
+ * nilfs_cleaner_wait_common()).
+ */
+static int nilfs_cleaner_send_request(struct nilfs_cleaner *cleaner,
+				      struct nilfs_cleaner_request *req,
+				      size_t size)
 {
-	struct nilfs_cleaner_request req;
-	struct nilfs_cleaner_response res;
-	int bytes, ret;
+	ssize_t bytes;
+	int ret;
+
+	if (cleaner->sockfd >= 0) {
+		bytes = send(cleaner->sockfd, req, size, MSG_NOSIGNAL);
+		return bytes < 0 ? -1 : 0;
+	}
 
 	if (unlikely(cleaner->sendq < 0 || cleaner->recvq < 0)) {
 		errno = EBADF;
-		ret = -1;
-		goto out;
+		return -1;
 	}
 	ret = nilfs_cleaner_clear_queueu(cleaner);
 	if (unlikely(ret < 0))
-		goto out;
+		return -1;
+
+	uuid_copy(req->client_uuid, cleaner->client_uuid);
+	return mq_send(cleaner->sendq, (char *)req, size,
+		       NILFS_CLEANER_PRIO_NORMAL);
+}
+
+/**
+ * nilfs_cleaner_recv_message - receive a message from cleaner daemon
+ * @cleaner: cleaner object
+ * @buf: buffer to store the message
+ * @size: size of @buf
+ * @abs_timeout: absolute timeout, or NULL to wait without limit
+ */
+static ssize_t nilfs_cleaner_recv_message(struct nilfs_cleaner *cleaner,
+					  void *buf, size_t size,
+					  const struct timespec *abs_timeout)
+{
+	struct timespec now, timeout;
+	struct pollfd pfd;
+	ssize_t bytes;
+	int ret;
+
+	if (cleaner->sockfd < 0)
+		return mq_timedreceive(cleaner->recvq, buf, size, NULL,
+				       abs_timeout);
+
+	if (abs_timeout) {
+		/* same clock as mq_timedreceive() */
+		ret = clock_gettime(CLOCK_REALTIME, &now);
+		if (unlikely(ret < 0))
+			return -1;
+		if (timespeccmp(abs_timeout, &now, >))
+			timespecsub(abs_timeout, &now, &timeout);
+		else
+			timespecclear(&timeout);
+
+		pfd.fd = cleaner->sockfd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		ret = ppoll(&pfd, 1, &timeout, NULL);
+		if (unlikely(ret < 0))
+			return -1;
+		if (ret == 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+	}
+	bytes = recv(cleaner->sockfd, buf, size, 0);
+	if (unlikely(bytes == 0)) {
+		errno = ECONNRESET; /* cleanerd has gone away */
+		return -1;
+	}
+	return bytes;
+}
+
+/**
+ * nilfs_cleaner_recv_response - receive a response from cleaner daemon
+ * @cleaner: cleaner object
+ * @res: buffer to store the response
+ * @size: size of @res
+ * @abs_timeout: absolute timeout, or NULL to wait without limit
+ *
+ * Responses may be longer than struct nilfs_cleaner_response, so they
+ * are received with a buffer of the maximum response size.  Fields that
+ * are missing from a shorter response are cleared.  Progress events
+ * received in the meantime are skipped.
+ */
+static int nilfs_cleaner_recv_response(struct nilfs_cleaner *cleaner,
+				       void *res, size_t size,
+				       const struct timespec *abs_timeout)
+{
+	char buf[NILFS_CLEANER_MSG_MAX_RSPSZ];
+	ssize_t bytes;
+
+	do {
+		bytes = nilfs_cleaner_recv_message(cleaner, buf, sizeof(buf),
+						   abs_timeout);
+		if (unlikely(bytes <
+			     (ssize_t)sizeof(struct nilfs_cleaner_response))) {
+			if (bytes >= 0)
+				errno = EIO;
+			return -1;
+		}
+	} while (((struct nilfs_cleaner_response *)buf)->result ==
+		 NILFS_CLEANER_RSP_EVENT);
+
+	if (bytes > size)
+		bytes = size;
+	memcpy(res, buf, bytes);
+	memset((char *)res + bytes, 0, size - bytes);
+	return 0;
+}
+
+static int nilfs_cleaner_command(struct nilfs_cleaner *cleaner, int cmd)
+{
+	struct nilfs_cleaner_request req;
+	struct nilfs_cleaner_response res;
+	int ret;
 
 	req.cmd = cmd;
 	req.argsize = 0;
-	uuid_copy(req.client_uuid, cleaner->client_uuid);
 
-	ret = mq_send(cleaner->sendq, (char *)&req, sizeof(req),
-		      NILFS_CLEANER_PRIO_NORMAL);
+	ret = nilfs_cleaner_send_request(cleaner, &req, sizeof(req));
 	if (unlikely(ret < 0))
 		goto out;
 
-	bytes = mq_receive(cleaner->recvq, (char *)&res, sizeof(res), NULL);
-	if (unlikely(bytes < sizeof(res))) {
-		if (bytes >= 0)
-			errno = EIO;
-		ret = -1;
+	ret = nilfs_cleaner_recv_response(cleaner, &res, sizeof(res), NULL);
+	if (unlikely(ret < 0))
 		goto out;
-	}
 	if (res.result == NILFS_CLEANER_RSP_NACK) {
 		ret = -1;
 		errno = res.err;
@@ -561,77 +778,220 @@ int nilfs_cleaner_get_status(struct nilfs_cleaner *cleaner, int *status)
 {
 	struct nilfs_cleaner_request req;
 	struct nilfs_cleaner_response res;
-	int bytes, ret;
+	int ret;
 
-	if (unlikely(cleaner->sendq < 0 || cleaner->recvq < 0)) {
-		errno = EBADF;
-		ret = -1;
+	req.cmd = NILFS_CLEANER_CMD_GET_STATUS;
+	req.argsize = 0;
+
+	ret = nilfs_cleaner_send_request(cleaner, &req, sizeof(req));
+	if (unlikely(ret < 0))
 		goto out;
+
+	ret = nilfs_cleaner_recv_response(cleaner, &res, sizeof(res), NULL);
+	if (unlikely(ret < 0))
+		goto out;
+	if (res.result == NILFS_CLEANER_RSP_ACK) {
+		*status = res.status;
+	} else if (res.result == NILFS_CLEANER_RSP_NACK) {
+		ret = -1;
+		errno = res.err;
 	}
-	ret = nilfs_cleaner_clear_queueu(cleaner);
+out:
+	return ret;
+}
+
+int nilfs_cleaner_get_wastat(struct nilfs_cleaner *cleaner,
+			     struct nilfs_cleaner_wastat *wastat)
+{
+	struct nilfs_cleaner_request req;
+	struct nilfs_cleaner_response_with_wastat res;
+	int ret;
+
+	req.cmd = NILFS_CLEANER_CMD_GET_WASTAT;
+	req.argsize = 0;
+
+	ret = nilfs_cleaner_send_request(cleaner, &req, sizeof(req));
 	if (unlikely(ret < 0))
 		goto out;
 
-	req.cmd = NILFS_CLEANER_CMD_GET_STATUS;
+	ret = nilfs_cleaner_recv_response(cleaner, &res, sizeof(res), NULL);
+	if (unlikely(ret < 0))
+		goto out;
+
+	if (res.hdr.result == NILFS_CLEANER_RSP_ACK) {
+		memcpy(wastat, &res.wastat, sizeof(*wastat));
+	} else if (res.hdr.result == NILFS_CLEANER_RSP_NACK) {
+		ret = -1;
+		errno = res.hdr.err;
+	}
+out:
+	return ret;
+}
+
+/**
+ * nilfs_cleaner_get_stats - get counters and pacing state of cleanerd
+ * @cleaner: cleaner object
+ * @stats: place to store the statistics
+ *
+ * Cleaner daemons that do not know the command nack it with EINVAL.
+ */
+int nilfs_cleaner_get_stats(struct nilfs_cleaner *cleaner,
+			    struct nilfs_cleaner_stats *stats)
+{
+	struct nilfs_cleaner_request req;
+	struct nilfs_cleaner_response_with_stats res;
+	int ret;
+
+	req.cmd = NILFS_CLEANER_CMD_GET_STATS;
 	req.argsize = 0;
-	uuid_copy(req.client_uuid, cleaner->client_uuid);
 
-	ret = mq_send(cleaner->sendq, (char *)&req, sizeof(req),
-		      NILFS_CLEANER_PRIO_NORMAL);
+	ret = nilfs_cleaner_send_request(cleaner, &req, sizeof(req));
 	if (unlikely(ret < 0))
 		goto out;
 
-	bytes = mq_receive(cleaner->recvq, (char *)&res, sizeof(res), NULL);
-	if (unlikely(bytes < sizeof(res))) {
-		if (bytes >= 0)
+	ret = nilfs_cleaner_recv_response(cleaner, &res, sizeof(res), NULL);
+	if (unlikely(ret < 0))
+		goto out;
+
+	if (res.hdr.result == NILFS_CLEANER_RSP_ACK) {
+		if (unlikely(res.stats.version == 0)) {
+			ret = -1;
 			errno = EIO;
+			goto out;
+		}
+		memcpy(stats, &res.stats, sizeof(*stats));
+	} else if (res.hdr.result == NILFS_CLEANER_RSP_NACK) {
 		ret = -1;
-		goto out;
+		errno = res.hdr.err;
 	}
-	if (res.result == NILFS_CLEANER_RSP_ACK) {
-		*status = res.status;
-	} else if (res.result == NILFS_CLEANER_RSP_NACK) {
+out:
+	return ret;
+}
+
+/**
+ * nilfs_cleaner_get_progress - get progress of garbage collection
+ * @cleaner: cleaner object
+ * @progress: place to store the progress
+ */
+int nilfs_cleaner_get_progress(struct nilfs_cleaner *cleaner,
+			       struct nilfs_cleaner_progress *progress)
+{
+	struct nilfs_cleaner_request req;
+	struct nilfs_cleaner_response_with_progress res;
+	int ret;
+
+	req.cmd = NILFS_CLEANER_CMD_GET_PROGRESS;
+	req.argsize = 0;
+
+	ret = nilfs_cleaner_send_request(cleaner, &req, sizeof(req));
+	if (unlikely(ret < 0))
+		goto out;
+
+	ret = nilfs_cleaner_recv_response(cleaner, &res, sizeof(res), NULL);
+	if (unlikely(ret < 0))
+		goto out;
+
+	if (res.hdr.result == NILFS_CLEANER_RSP_ACK) {
+		memcpy(progress, &res.progress, sizeof(*progress));
+	} else if (res.hdr.result == NILFS_CLEANER_RSP_NACK) {
 		ret = -1;
-		errno = res.err;
+		errno = res.hdr.err;
 	}
 out:
 	return ret;
 }
 
+/**
+ * nilfs_cleaner_subscribe - start receiving progress events
+ * @cleaner: cleaner object
+ *
+ * Once subscribed, cleanerd sends a progress event after every cleaning
+ * cycle and when a job ends.  Events are read with
+ * nilfs_cleaner_recv_progress().  This requires the control socket.
+ */
+int nilfs_cleaner_subscribe(struct nilfs_cleaner *cleaner)
+{
+	if (cleaner->sockfd < 0) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if (unlikely(nilfs_cleaner_command(cleaner,
+					   NILFS_CLEANER_CMD_SUBSCRIBE) < 0))
+		return -1;
+	cleaner->subscribed = 1;
+	return 0;
+}
+
+/**
+ * nilfs_cleaner_recv_progress - receive a progress event
+ * @cleaner: cleaner object
+ * @progress: place to store the progress
+ * @timeout: time to wait for an event, or NULL to wait without limit
+ *
+ * The descriptor returned by nilfs_cleaner_get_fd() becomes readable
+ * when an event is pending.  Responses to requests are skipped.
+ * Return: 0 on success, or -1 with errno set (ETIMEDOUT on timeout).
+ */
+int nilfs_cleaner_recv_progress(struct nilfs_cleaner *cleaner,
+				struct nilfs_cleaner_progress *progress,
+				const struct timespec *timeout)
+{
+	struct nilfs_cleaner_response_with_progress *res;
+	char buf[NILFS_CLEANER_MSG_MAX_RSPSZ];
+	struct timespec abs_timeout;
+	ssize_t bytes;
+	int ret;
+
+	if (cleaner->sockfd < 0) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if (timeout) {
+		ret = clock_gettime(CLOCK_REALTIME, &abs_timeout);
+		if (unlikely(ret < 0))
+			return -1;
+		timespecadd(&abs_timeout, timeout, &abs_timeout);
+	}
+
+	res = (struct nilfs_cleaner_response_with_progress *)buf;
+	do {
+		bytes = nilfs_cleaner_recv_message(cleaner, buf, sizeof(buf),
+						   timeout ? &abs_timeout :
+						   NULL);
+		if (unlikely(bytes < (ssize_t)sizeof(res->hdr))) {
+			if (bytes >= 0)
+				errno = EIO;
+			return -1;
+		}
+	} while (res->hdr.result != NILFS_CLEANER_RSP_EVENT);
+
+	if (unlikely(bytes < (ssize_t)sizeof(*res))) {
+		errno = EIO;
+		return -1;
+	}
+	memcpy(progress, &res->progress, sizeof(*progress));
+	return 0;
+}
+
 int nilfs_cleaner_run(struct nilfs_cleaner *cleaner,
 		      const struct nilfs_cleaner_args *args,
 		      uint32_t *jobid)
 {
 	struct nilfs_cleaner_request_with_args req;
 	struct nilfs_cleaner_response res;
-	int bytes, ret;
-
-	if (unlikely(cleaner->sendq < 0 || cleaner->recvq < 0)) {
-		errno = EBADF;
-		ret = -1;
-		goto out;
-	}
-	ret = nilfs_cleaner_clear_queueu(cleaner);
-	if (unlikely(ret < 0))
-		goto out;
+	int ret;
 
 	req.hdr.cmd = NILFS_CLEANER_CMD_RUN;
 	req.hdr.argsize = sizeof(req.args);
-	uuid_copy(req.hdr.client_uuid, cleaner->client_uuid);
 	memcpy(&req.args, args, sizeof(req.args));
 
-	ret = mq_send(cleaner->sendq, (char *)&req, sizeof(req),
-		      NILFS_CLEANER_PRIO_NORMAL);
+	ret = nilfs_cleaner_send_request(cleaner, &req.hdr, sizeof(req));
 	if (unlikely(ret < 0))
 		goto out;
 
-	bytes = mq_receive(cleaner->recvq, (char *)&res, sizeof(res), NULL);
-	if (unlikely(bytes < sizeof(res))) {
-		if (bytes >= 0)
-			errno = EIO;
-		ret = -1;
+	ret = nilfs_cleaner_recv_response(cleaner, &res, sizeof(res), NULL);
+	if (unlikely(ret < 0))
 		goto out;
-	}
 	if (res.result == NILFS_CLEANER_RSP_ACK) {
 		if (jobid)
 			*jobid = res.jobid;
@@ -658,34 +1018,19 @@ int nilfs_cleaner_tune(struct nilfs_cleaner *cleaner,
 {
 	struct nilfs_cleaner_request_with_args req;
 	struct nilfs_cleaner_response res;
-	int bytes, ret;
-
-	if (unlikely(cleaner->sendq < 0 || cleaner->recvq < 0)) {
-		errno = EBADF;
-		ret = -1;
-		goto out;
-	}
-	ret = nilfs_cleaner_clear_queueu(cleaner);
-	if (unlikely(ret < 0))
-		goto out;
+	int ret;
 
 	req.hdr.cmd = NILFS_CLEANER_CMD_TUNE;
 	req.hdr.argsize = sizeof(req.args);
-	uuid_copy(req.hdr.client_uuid, cleaner->client_uuid);
 	memcpy(&req.args, args, sizeof(req.args));
 
-	ret = mq_send(cleaner->sendq, (char *)&req, sizeof(req),
-		      NILFS_CLEANER_PRIO_NORMAL);
+	ret = nilfs_cleaner_send_request(cleaner, &req.hdr, sizeof(req));
 	if (unlikely(ret < 0))
 		goto out;
 
-	bytes = mq_receive(cleaner->recvq, (char *)&res, sizeof(res), NULL);
-	if (unlikely(bytes < sizeof(res))) {
-		if (bytes >= 0)
-			errno = EIO;
-		ret = -1;
+	ret = nilfs_cleaner_recv_response(cleaner, &res, sizeof(res), NULL);
+	if (unlikely(ret < 0))
 		goto out;
-	}
 	if (res.result == NILFS_CLEANER_RSP_NACK) {
 		ret = -1;
 		errno = res.err;
@@ -699,16 +1044,7 @@ int nilfs_cleaner_reload(struct nilfs_cleaner *cleaner, const char *conffile)
 	struct nilfs_cleaner_request_with_path req;
 	struct nilfs_cleaner_response res;
 	size_t pathlen, reqsz;
-	int bytes, ret;
-
-	if (unlikely(cleaner->sendq < 0 || cleaner->recvq < 0)) {
-		errno = EBADF;
-		ret = -1;
-		goto out;
-	}
-	ret = nilfs_cleaner_clear_queueu(cleaner);
-	if (unlikely(ret < 0))
-		goto out;
+	int ret = -1;
 
 	if (conffile) {
 		if (unlikely(myrealpath(conffile, req.pathname,
@@ -723,20 +1059,14 @@ int nilfs_cleaner_reload(struct nilfs_cleaner *cleaner, const char *conffile)
 		reqsz = sizeof(req.hdr);
 	}
 	req.hdr.cmd = NILFS_CLEANER_CMD_RELOAD;
-	uuid_copy(req.hdr.client_uuid, cleaner->client_uuid);
 
-	ret = mq_send(cleaner->sendq, (char *)&req, reqsz,
-		      NILFS_CLEANER_PRIO_NORMAL);
+	ret = nilfs_cleaner_send_request(cleaner, &req.hdr, reqsz);
 	if (unlikely(ret < 0))
 		goto out;
 
-	bytes = mq_receive(cleaner->recvq, (char *)&res, sizeof(res), NULL);
-	if (unlikely(bytes < sizeof(res))) {
-		if (bytes >= 0)
-			errno = EIO;
-		ret = -1;
+	ret = nilfs_cleaner_recv_response(cleaner, &res, sizeof(res), NULL);
+	if (unlikely(ret < 0))
 		goto out;
-	}
 	if (res.result == NILFS_CLEANER_RSP_NACK) {
 		ret = -1;
 		errno = res.err;
@@ -745,49 +1075,58 @@ out:
 	return ret;
 }
 
+/**
+ * nilfs_cleaner_reconnect - renew the connection to the control socket
+ * @cleaner: cleaner object
+ *
+ * Responses on the socket carry no request identifier, so a response
+ * that is still to come, such as the deferred response of a wait that
+ * timed out, would be taken as the response of the next request.  Such
+ * a response is dropped along with the old connection.  The
+ * subscription to progress events is restored on the new one.
+ */
+static int nilfs_cleaner_reconnect(struct nilfs_cleaner *cleaner)
+{
+	nilfs_cleaner_close_socket(cleaner);
+	if (unlikely(nilfs_cleaner_open_socket(cleaner, 0) < 0))
+		return -1;
+	if (cleaner->subscribed &&
+	    unlikely(nilfs_cleaner_command(cleaner,
+					   NILFS_CLEANER_CMD_SUBSCRIBE) < 0))
+		return -1;
+	return 0;
+}
+
+/*
+ * Waiting for a job is only supported on the control socket; cleaner
+ * daemons nack it on the message queues.
+ */
 static int nilfs_cleaner_wait_common(struct nilfs_cleaner *cleaner,
-				     uint32_t jobid)
+				     uint32_t jobid,
+				     const struct timespec *abs_timeout)
 {
 	struct nilfs_cleaner_request_with_jobid req;
+	struct nilfs_cleaner_response res;
 	int ret;
 
-	if (unlikely(cleaner->sendq < 0 || cleaner->recvq < 0)) {
-		ret = -1;
-		errno = EBADF;
-		goto out;
-	}
-
-	ret = nilfs_cleaner_clear_queueu(cleaner);
-	if (unlikely(ret < 0))
-		goto out;
-
 	req.hdr.cmd = NILFS_CLEANER_CMD_WAIT;
-	req.hdr.argsize = 0;
-	uuid_copy(req.hdr.client_uuid, cleaner->client_uuid);
+	req.hdr.argsize = sizeof(req.jobid);
 	req.jobid = jobid;
 
-	ret = mq_send(cleaner->sendq, (char *)&req, sizeof(req),
-		      NILFS_CLEANER_PRIO_NORMAL);
-out:
-	return ret;
-}
-
-int nilfs_cleaner_wait(struct nilfs_cleaner *cleaner, uint32_t jobid,
-		       const struct timespec *abs_timeout)
-{
-	struct nilfs_cleaner_response res;
-	int bytes, ret;
-
-	ret = nilfs_cleaner_wait_common(cleaner, jobid);
+	ret = nilfs_cleaner_send_request(cleaner, &req.hdr, sizeof(req));
 	if (unlikely(ret < 0))
 		goto out;
 
-	bytes = mq_timedreceive(cleaner->recvq, (char *)&res, sizeof(res),
-				NULL, abs_timeout);
-	if (unlikely(bytes < sizeof(res))) {
-		if (bytes >= 0)
-			errno = EIO;
-		ret = -1;
+	ret = nilfs_cleaner_recv_response(cleaner, &res, sizeof(res),
+					  abs_timeout);
+	if (unlikely(ret < 0)) {
+		/* the response may still come if the wait was cut short */
+		if (cleaner->sockfd >= 0 && errno != ECONNRESET) {
+			int errsv = errno;
+
+			nilfs_cleaner_reconnect(cleaner);
+			errno = errsv;
+		}
 		goto out;
 	}
 	if (res.result == NILFS_CLEANER_RSP_NACK) {
@@ -798,44 +1137,26 @@ out:
 	return ret;
 }
 
+int nilfs_cleaner_wait(struct nilfs_cleaner *cleaner, uint32_t jobid,
+		       const struct timespec *abs_timeout)
+{
+	return nilfs_cleaner_wait_common(cleaner, jobid, abs_timeout);
+}
+
 int nilfs_cleaner_wait_r(struct nilfs_cleaner *cleaner, uint32_t jobid,
 			 const struct timespec *timeout)
 {
-	struct nilfs_cleaner_response res;
-	struct pollfd pfd;
-	int bytes, ret;
-
-	ret = nilfs_cleaner_wait_common(cleaner, jobid);
-	if (unlikely(ret < 0))
-		goto out;
+	struct timespec abs_timeout;
+	int ret;
 
-	memset(&pfd, 0, sizeof(0));
-	pfd.fd = cleaner->recvq;
-	pfd.events = POLLIN;
+	if (!timeout)
+		return nilfs_cleaner_wait_common(cleaner, jobid, NULL);
 
-	ret = ppoll(&pfd, 1, timeout, NULL);
+	ret = clock_gettime(CLOCK_REALTIME, &abs_timeout);
 	if (unlikely(ret < 0))
-		goto out;
-
-	if (!(pfd.revents & POLLIN)) {
-		ret = -1;
-		errno = ETIMEDOUT;
-		goto out;
-	}
-
-	bytes = mq_receive(cleaner->recvq, (char *)&res, sizeof(res), NULL);
-	if (unlikely(bytes < sizeof(res))) {
-		if (bytes >= 0)
-			errno = EIO;
-		ret = -1;
-		goto out;
-	}
-	if (res.result == NILFS_CLEANER_RSP_NACK) {
-		ret = -1;
-		errno = res.err;
-	}
-out:
-	return ret;
+		return -1;
+	timespecadd(&abs_timeout, timeout, &abs_timeout);
+	return nilfs_cleaner_wait_common(cleaner, jobid, &abs_timeout);
 }
 
 int nilfs_cleaner_stop(struct nilfs_cleaner *cleaner)
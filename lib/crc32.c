@@ -86,11 +86,54 @@ static const uint32_t crc32tab[] = { /* CRC polynomial 0xedb88320 */
 	0x2d02ef8d
 };
 
+/*
+ * Tables for the slice-by-8 algorithm: crc32tab8[k][i] is the CRC of
+ * byte i followed by k + 1 zero bytes, crc32tab being the one for k = -1.
+ */
+static uint32_t crc32tab8[7][256];
+
+static void __attribute__((constructor)) crc32_init_tables(void)
+{
+	uint32_t crc;
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		crc = crc32tab[i];
+		for (k = 0; k < 7; k++) {
+			crc = (crc >> 8) ^ crc32tab[(uint8_t)crc];
+			crc32tab8[k][i] = crc;
+		}
+	}
+}
+
+static inline uint32_t crc32_load_le32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
 uint32_t crc32_le(uint32_t Crc_I, const unsigned char *Buffer_PC,
 		  size_t Length_I)
 {
+	uint32_t lo, hi;
 	size_t c;
 
+	/* Process eight bytes at a time with table lookups in parallel */
+	while (Length_I >= 8) {
+		lo = Crc_I ^ crc32_load_le32(Buffer_PC);
+		hi = crc32_load_le32(Buffer_PC + 4);
+		Crc_I = crc32tab8[6][(uint8_t)lo] ^
+			crc32tab8[5][(uint8_t)(lo >> 8)] ^
+			crc32tab8[4][(uint8_t)(lo >> 16)] ^
+			crc32tab8[3][lo >> 24] ^
+			crc32tab8[2][(uint8_t)hi] ^
+			crc32tab8[1][(uint8_t)(hi >> 8)] ^
+			crc32tab8[0][(uint8_t)(hi >> 16)] ^
+			crc32tab[hi >> 24];
+		Buffer_PC += 8;
+		Length_I -= 8;
+	}
+
 	for (c = 0; c < Length_I; c++)
 		Crc_I = (Crc_I >> 8) ^ crc32tab[(uint8_t)Crc_I ^ Buffer_PC[c]];
 
@@ -0,0 +1,97 @@
+/*
+ * format.c - Output formats of NILFS listing commands
+ *
+ * Licensed under LGPLv2: the complete text of the GNU Lesser General
+ * Public License can be found in COPYING file of the nilfs-utils
+ * package.
+ *
+ * Listing commands can print millions of rows.  The helpers here let
+ * them write through a large stdio buffer and format timestamps once
+ * per distinct second, since consecutive rows mostly share the same
+ * modification or creation time.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>	/* isatty() */
+#endif	/* HAVE_UNISTD_H */
+
+#include <errno.h>
+#include "util.h"
+#include "format.h"
+
+static const char * const nilfs_format_names[] = {
+	[NILFS_FORMAT_TEXT] = "text",
+	[NILFS_FORMAT_JSON] = "json",
+	[NILFS_FORMAT_CSV] = "csv",
+	[NILFS_FORMAT_RAW] = "raw",
+};
+
+/**
+ * nilfs_parse_format - parse name of an output format
+ * @arg: format name
+ *
+ * Return: one of NILFS_FORMAT_* values, or -1 with errno set to EINVAL
+ * if @arg is not a known format.
+ */
+int nilfs_parse_format(const char *arg)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(nilfs_format_names); i++) {
+		if (strcmp(arg, nilfs_format_names[i]) == 0)
+			return i;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * nilfs_format_setup_output - prepare standard output for a format
+ * @format: output format
+ *
+ * Makes stdout fully buffered with a large buffer.  This must be called
+ * before anything is written to stdout.
+ *
+ * Return: 0 on success, or -1 with errno set to ENOTTY if binary records
+ * would be written to a terminal.
+ */
+int nilfs_format_setup_output(int format)
+{
+	if (format == NILFS_FORMAT_RAW && isatty(STDOUT_FILENO)) {
+		errno = ENOTTY;
+		return -1;
+	}
+	setvbuf(stdout, NULL, _IOFBF, NILFS_FORMAT_BUFSIZE);
+	return 0;
+}
+
+/**
+ * nilfs_format_time - format time in local time
+ * @tf: cache of the last formatted time
+ * @t: time in seconds
+ *
+ * Return: time in "%F %T" format, which stays valid until the next call
+ * with @tf.
+ */
+const char *nilfs_format_time(struct nilfs_timefmt *tf, time_t t)
+{
+	struct tm tm;
+
+	if (!tf->valid || tf->t != t) {
+		localtime_r(&t, &tm);
+		strftime(tf->buf, sizeof(tf->buf), "%F %T", &tm);
+		tf->t = t;
+		tf->valid = 1;
+	}
+	return tf->buf;
+}
@@ -33,11 +33,20 @@
 #include <sys/time.h>
 #endif	/* HAVE_SYS_TIME */
 
+#if HAVE_TIME_H
+#include <time.h>	/* clock_gettime() */
+#endif	/* HAVE_TIME_H */
+
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif	/* HAVE_PTHREAD_H */
+
 #include <errno.h>
 #include <assert.h>
 #include <stdarg.h>
 #include <signal.h>
 #include "util.h"
+#include "compat.h"	/* timespecsub(), timespecclear() */
 #include "segment.h"
 #include "vector.h"
 #include "nilfs_gc.h"
@@ -668,6 +677,7 @@ int nilfs_xreclaim_segment(struct nilfs *nilfs,
 	uint32_t reclaimable_blocks;
 	struct nilfs_suinfo_update *sup;
 	struct timeval tv;
+	struct timespec lock_start, lock_end;
 
 	if (unlikely(!(params->flags & NILFS_RECLAIM_PARAM_PROTSEQ) ||
 	    (params->flags & (~0UL << __NR_NILFS_RECLAIM_PARAMS)))) {
@@ -679,6 +689,13 @@ int nilfs_xreclaim_segment(struct nilfs *nilfs,
 		return -1;
 	}
 
+	if (stat) {
+		/* Drop requests for extended fields unknown to this library */
+		stat->exflags &= ~(~0UL << __NR_NILFS_RECLAIM_STAT_EXFLAGS);
+		if (stat->exflags & NILFS_RECLAIM_STAT_LOCK_WAIT)
+			timespecclear(&stat->lock_wait);
+	}
+
 	if (nsegs == 0)
 		return 0;
 
@@ -700,10 +717,21 @@ int nilfs_xreclaim_segment(struct nilfs *nilfs,
 		goto out_vec;
 	}
 
+	if (stat && (stat->exflags & NILFS_RECLAIM_STAT_LOCK_WAIT) &&
+	    unlikely(clock_gettime(CLOCK_MONOTONIC, &lock_start) < 0))
+		stat->exflags &= ~NILFS_RECLAIM_STAT_LOCK_WAIT;
+
 	ret = nilfs_lock_cleaner(nilfs);
 	if (unlikely(ret < 0))
 		goto out_sig;
 
+	if (stat && (stat->exflags & NILFS_RECLAIM_STAT_LOCK_WAIT)) {
+		if (likely(clock_gettime(CLOCK_MONOTONIC, &lock_end) == 0))
+			timespecsub(&lock_end, &lock_start, &stat->lock_wait);
+		else
+			stat->exflags &= ~NILFS_RECLAIM_STAT_LOCK_WAIT;
+	}
+
 	/* count blocks */
 	n = nilfs_acc_blocks(nilfs, segnums, nsegs, params->protseq, vdescv,
 			     bdescv);
@@ -859,11 +887,367 @@ out_vec:
 	nilfs_vector_destroy(vblocknrv);
 	nilfs_vector_destroy(supv);
 	/*
-	 * Flags of valid fields in stat->exflags must be unset.
+	 * Flags of invalid fields in stat->exflags must be unset.
 	 */
 	return ret;
 }
 
+/**
+ * struct nilfs_assess_ctx - shared state of a segment assessment
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers to be assessed
+ * @nsegs: size of the @segnums array
+ * @protseq: start of sequence number of protected segments
+ * @protcno: start number of checkpoint to be protected
+ * @ss: checkpoint numbers of snapshots
+ * @nss: size of @ss array
+ * @live_blks: array to store the results
+ * @newprotcno: start checkpoint number of the protection period after a
+ * deletion, for a deletion estimate
+ * @freed_blks: array to store the estimated numbers of freed blocks, or
+ * %NULL if no deletion is estimated
+ * @lock: mutex protecting @next and @error
+ * @next: index of the next segment to be assessed
+ * @error: error number of the first failure, or zero
+ */
+struct nilfs_assess_ctx {
+	struct nilfs *nilfs;
+	const uint64_t *segnums;
+	size_t nsegs;
+	uint64_t protseq;
+	nilfs_cno_t protcno;
+	const nilfs_cno_t *ss;
+	size_t nss;
+	ssize_t *live_blks;
+	nilfs_cno_t newprotcno;
+	ssize_t *freed_blks;
+	pthread_mutex_t lock;
+	size_t next;
+	int error;
+};
+
+/**
+ * nilfs_count_live_blocks - count live blocks in a segment
+ * @ctx: assessment context
+ * @segnum: segment number
+ * @vdescv: vector object used to store virtual block descriptors
+ * @bdescv: vector object used to store disk block descriptors
+ * @live_blksp: place to store the number of live blocks, or -1 if the
+ * segment is protected or not reclaimable
+ * @freed_blksp: place to store the number of live blocks that would be
+ * dead with @ctx->newprotcno as the protection boundary, or %NULL
+ */
+static int nilfs_count_live_blocks(const struct nilfs_assess_ctx *ctx,
+				   uint64_t segnum,
+				   struct nilfs_vector *vdescv,
+				   struct nilfs_vector *bdescv,
+				   ssize_t *live_blksp, ssize_t *freed_blksp)
+{
+	struct nilfs_suinfo si;
+	struct nilfs_segment segment;
+	struct nilfs_vdesc *vdesc;
+	struct nilfs_bdesc *bdesc;
+	nilfs_cno_t last_hit = 0, last_kept = 0;
+	size_t i, nlive = 0, nfreed = 0;
+	ssize_t n;
+	int ret;
+
+	if (freed_blksp)
+		*freed_blksp = 0;
+
+	n = nilfs_get_suinfo(ctx->nilfs, segnum, &si, 1);
+	if (unlikely(n < 0))
+		return -1;
+
+	/* segment number beyond the end of the device */
+	if (n == 0 || !nilfs_suinfo_reclaimable(&si)) {
+		*live_blksp = -1;
+		return 0;
+	}
+	if (nilfs_suinfo_empty(&si)) {
+		*live_blksp = 0;
+		return 0;
+	}
+
+	ret = nilfs_get_segment(ctx->nilfs, segnum, &segment);
+	if (unlikely(ret < 0))
+		return -1;
+
+	if (cnt64_ge(segment.seqnum, ctx->protseq)) {
+		*live_blksp = -1;
+		return nilfs_put_segment(&segment);
+	}
+
+	nilfs_vector_clear(vdescv);
+	nilfs_vector_clear(bdescv);
+	ret = nilfs_acc_blocks_segment(&segment, si.sui_nblocks, vdescv,
+				       bdescv);
+	if (unlikely(nilfs_put_segment(&segment) < 0 || ret < 0))
+		return -1;
+
+	ret = nilfs_get_vdesc(ctx->nilfs, vdescv);
+	if (unlikely(ret < 0))
+		return -1;
+
+	for (i = 0; i < nilfs_vector_get_size(vdescv); i++) {
+		vdesc = nilfs_vector_get_element(vdescv, i);
+		if (!nilfs_vdesc_is_live(vdesc, ctx->protcno, ctx->ss,
+					 ctx->nss, &last_hit))
+			continue;
+		nlive++;
+		if (freed_blksp &&
+		    !nilfs_vdesc_is_live(vdesc, ctx->newprotcno, ctx->ss,
+					 ctx->nss, &last_kept))
+			nfreed++;
+	}
+
+	ret = nilfs_get_bdesc(ctx->nilfs, bdescv);
+	if (unlikely(ret < 0))
+		return -1;
+
+	for (i = 0; i < nilfs_vector_get_size(bdescv); i++) {
+		bdesc = nilfs_vector_get_element(bdescv, i);
+		if (nilfs_bdesc_is_live(bdesc))
+			nlive++;
+	}
+
+	*live_blksp = nlive;
+	if (freed_blksp)
+		*freed_blksp = nfreed;
+	return 0;
+}
+
+/**
+ * nilfs_assess_worker - assess segments until none is left
+ * @arg: assessment context
+ */
+static void *nilfs_assess_worker(void *arg)
+{
+	struct nilfs_assess_ctx *ctx = arg;
+	struct nilfs_vector *vdescv, *bdescv;
+	size_t index;
+	int ret = 0;
+
+	vdescv = nilfs_vector_create(sizeof(struct nilfs_vdesc));
+	bdescv = nilfs_vector_create(sizeof(struct nilfs_bdesc));
+	if (unlikely(!vdescv || !bdescv))
+		ret = -1;
+
+	while (ret == 0) {
+		pthread_mutex_lock(&ctx->lock);
+		if (ctx->error || ctx->next >= ctx->nsegs) {
+			pthread_mutex_unlock(&ctx->lock);
+			break;
+		}
+		index = ctx->next++;
+		pthread_mutex_unlock(&ctx->lock);
+
+		ret = nilfs_count_live_blocks(ctx, ctx->segnums[index],
+					      vdescv, bdescv,
+					      &ctx->live_blks[index],
+					      ctx->freed_blks ?
+					      &ctx->freed_blks[index] : NULL);
+	}
+
+	if (unlikely(ret < 0)) {
+		pthread_mutex_lock(&ctx->lock);
+		if (!ctx->error)
+			ctx->error = errno ? : EIO;
+		pthread_mutex_unlock(&ctx->lock);
+	}
+	if (vdescv)
+		nilfs_vector_destroy(vdescv);
+	if (bdescv)
+		nilfs_vector_destroy(bdescv);
+	return NULL;
+}
+
+/**
+ * nilfs_assess_run - run an assessment with worker threads
+ * @ctx: assessment context with the segments and the result arrays set
+ * @params: reclaim parameters
+ * @nthreads: maximum number of threads to be used
+ *
+ * Return: 0 on success, or -1 on failure with errno set.
+ */
+static int nilfs_assess_run(struct nilfs_assess_ctx *ctx,
+			    const struct nilfs_reclaim_params *params,
+			    unsigned int nthreads)
+{
+	struct nilfs *nilfs = ctx->nilfs;
+	pthread_t *threads = NULL;
+	sigset_t sigset, oldset;
+	nilfs_cno_t *ss = NULL;
+	unsigned int i, nstarted = 0;
+	ssize_t nss;
+	int ret = -1;
+
+	if (unlikely(!(params->flags & NILFS_RECLAIM_PARAM_PROTSEQ) ||
+	    (params->flags & (~0UL << __NR_NILFS_RECLAIM_PARAMS)))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (ctx->nsegs == 0)
+		return 0;
+
+	nthreads = min_t(size_t, max_t(unsigned int, nthreads, 1),
+			 ctx->nsegs);
+	if (nthreads > 1) {
+		threads = malloc(sizeof(*threads) * (nthreads - 1));
+		if (unlikely(!threads))
+			return -1;
+	}
+
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGTERM);
+	ret = pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+	if (unlikely(ret != 0)) {
+		nilfs_gc_logger(LOG_ERR, "cannot block signals: %s",
+				strerror(ret));
+		errno = ret;
+		ret = -1;
+		goto out_free;
+	}
+
+	ret = nilfs_lock_cleaner(nilfs);
+	if (unlikely(ret < 0))
+		goto out_sig;
+
+	nss = nilfs_get_snapshot(nilfs, &ss);
+	if (unlikely(nss < 0)) {
+		ret = -1;
+		goto out_lock;
+	}
+
+	ctx->protseq = params->protseq;
+	ctx->protcno = (params->flags & NILFS_RECLAIM_PARAM_PROTCNO) ?
+		params->protcno : NILFS_CNO_MAX;
+	ctx->ss = ss;
+	ctx->nss = nss;
+	ctx->next = 0;
+	ctx->error = 0;
+	pthread_mutex_init(&ctx->lock, NULL);
+
+	/*
+	 * The threads inherit the signal mask, so SIGINT and SIGTERM stay
+	 * pending until the cleaner lock is released below.  Failing to
+	 * start a thread only reduces parallelism.
+	 */
+	for (i = 0; i < nthreads - 1; i++) {
+		if (pthread_create(&threads[i], NULL, nilfs_assess_worker,
+				   ctx) != 0)
+			break;
+		nstarted++;
+	}
+	nilfs_assess_worker(ctx);
+	for (i = 0; i < nstarted; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&ctx->lock);
+	free(ss);
+
+	ret = 0;
+	if (unlikely(ctx->error)) {
+		errno = ctx->error;
+		ret = -1;
+	}
+
+out_lock:
+	if (unlikely(nilfs_unlock_cleaner(nilfs) < 0)) {
+		nilfs_gc_logger(LOG_CRIT, "failed to unlock cleaner: %s",
+				strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+out_sig:
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+out_free:
+	free(threads);
+	return ret;
+}
+
+/**
+ * nilfs_assess_segments - count live blocks of segments one by one
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers to be assessed
+ * @nsegs: size of the @segnums array
+ * @params: reclaim parameters
+ * @nthreads: maximum number of threads to be used
+ * @live_blks: array to store the number of live blocks of each segment
+ *
+ * Unlike nilfs_assess_segment(), which sums up the statistics of the
+ * given segments, this function reports the live blocks of each segment
+ * in @live_blks[i], or -1 if the segment is protected or not reclaimable.
+ * The cleaner lock is taken and the snapshot list is read only once for
+ * the whole array, and the segments are parsed and resolved by up to
+ * @nthreads threads in parallel.  The NILFS_RECLAIM_PARAM_MIN_RECLAIMABLE_BLKS
+ * parameter is ignored.
+ *
+ * Return: 0 on success, or -1 on failure with errno set.
+ */
+int nilfs_assess_segments(struct nilfs *nilfs,
+			  const uint64_t *segnums, size_t nsegs,
+			  const struct nilfs_reclaim_params *params,
+			  unsigned int nthreads, ssize_t *live_blks)
+{
+	struct nilfs_assess_ctx ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.nilfs = nilfs;
+	ctx.segnums = segnums;
+	ctx.nsegs = nsegs;
+	ctx.live_blks = live_blks;
+
+	return nilfs_assess_run(&ctx, params, nthreads);
+}
+
+/**
+ * nilfs_assess_deletion - estimate blocks freed by deleting checkpoints
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers to be assessed
+ * @nsegs: size of the @segnums array
+ * @params: reclaim parameters
+ * @newprotcno: start checkpoint number of the protection period after
+ * the deletion
+ * @nthreads: maximum number of threads to be used
+ * @live_blks: array to store the number of live blocks of each segment
+ * @freed_blks: array to store the number of blocks freed in each segment
+ *
+ * Garbage collection keeps a block only if it is in use by a checkpoint
+ * not older than the protection period or by a snapshot.  Deleting
+ * checkpoints therefore frees blocks only by moving the start of the
+ * protection period, when the checkpoint it fell on is deleted and the
+ * period starts at the next remaining checkpoint @newprotcno instead.
+ *
+ * Works like nilfs_assess_segments(), and additionally stores in
+ * @freed_blks[i] how many of the live blocks of the segment would be
+ * dead with @newprotcno in place of the protection period start given
+ * by @params.
+ *
+ * Return: 0 on success, or -1 on failure with errno set.
+ */
+int nilfs_assess_deletion(struct nilfs *nilfs,
+			  const uint64_t *segnums, size_t nsegs,
+			  const struct nilfs_reclaim_params *params,
+			  nilfs_cno_t newprotcno, unsigned int nthreads,
+			  ssize_t *live_blks, ssize_t *freed_blks)
+{
+	struct nilfs_assess_ctx ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.nilfs = nilfs;
+	ctx.segnums = segnums;
+	ctx.nsegs = nsegs;
+	ctx.live_blks = live_blks;
+	ctx.newprotcno = newprotcno;
+	ctx.freed_blks = freed_blks;
+
+	return nilfs_assess_run(&ctx, params, nthreads);
+}
+
 /**
  * nilfs_reclaim_segment - reclaim segments
  * @nilfs: nilfs object
@@ -71,6 +71,7 @@
 #endif	/* HAVE_LINUX_TYPES_H */
 
 #include <linux/nilfs2_ondisk.h>
+#include <linux/fs.h>	/* FITRIM, struct fstrim_range */
 #include <errno.h>
 #include <assert.h>
 #include <mntent.h>	/* setmntent, getmntent_r, endmntent, etc */
@@ -285,6 +286,18 @@ uint32_t nilfs_get_reserved_segments_ratio(const struct nilfs *nilfs)
 	return le32_to_cpu(nilfs->n_sb->s_r_segments_percentage);
 }
 
+/**
+ * nilfs_get_uuid - get uuid of the file system
+ * @nilfs: nilfs object
+ *
+ * Return: pointer to the 128-bit uuid stored in the super block.
+ */
+const uint8_t *nilfs_get_uuid(const struct nilfs *nilfs)
+{
+	assert(nilfs->n_sb != NULL);
+	return nilfs->n_sb->s_uuid;
+}
+
 static int __nilfs_opt_set_mmap(struct nilfs *nilfs)
 {
 	long pagesize;
@@ -962,6 +975,36 @@ int nilfs_thaw(struct nilfs *nilfs)
 	return ioctl(nilfs->n_iocfd, FITHAW, &arg);
 }
 
+/**
+ * nilfs_trim - discard unused blocks in a range of the device
+ * @nilfs: nilfs object
+ * @start: start byte offset of the range
+ * @len: length of the range in bytes
+ * @trimmedp: place to store the number of bytes discarded (optional)
+ *
+ * Blocks in use are left untouched by the file system, so @start and
+ * @len do not have to be aligned with segments.
+ */
+int nilfs_trim(struct nilfs *nilfs, uint64_t start, uint64_t len,
+	       uint64_t *trimmedp)
+{
+	struct fstrim_range range;
+	int ret;
+
+	if (unlikely(nilfs->n_iocfd < 0)) {
+		errno = EBADF;
+		return -1;
+	}
+
+	range.start = start;
+	range.len = len;
+	range.minlen = 0;
+	ret = ioctl(nilfs->n_iocfd, FITRIM, &range);
+	if (!ret && trimmedp)
+		*trimmedp = range.len;
+	return ret;
+}
+
 /**
  * nilfs_get_segment - read or mmap segment to a memory region
  * @nilfs: nilfs object
@@ -130,6 +130,23 @@ static int nilfs_cldconfig_get_ulong_argument(char **tokens, size_t ntoks,
 	return 0;
 }
 
+static int nilfs_cldconfig_get_path_argument(char **tokens, size_t ntoks,
+					     char *buf, size_t size)
+{
+	if (tokens[1][0] != '/') {
+		syslog(LOG_WARNING, "%s: %s: not an absolute path",
+		       tokens[0], tokens[1]);
+		return -1;
+	}
+	if (strlen(tokens[1]) >= size) {
+		syslog(LOG_WARNING, "%s: %s: path too long",
+		       tokens[0], tokens[1]);
+		return -1;
+	}
+	strcpy(buf, tokens[1]);
+	return 0;
+}
+
 static int nilfs_cldconfig_get_time_argument(char **tokens, size_t ntoks,
 					     struct timespec *ts)
 {
@@ -362,6 +379,44 @@ nilfs_cldconfig_handle_max_clean_segments(struct nilfs_cldconfig *config,
 	return 0;
 }
 
+static int
+nilfs_cldconfig_handle_emergency_clean_segments(struct nilfs_cldconfig *config,
+						char **tokens, size_t ntoks,
+						struct nilfs *nilfs)
+{
+	uint64_t nsegs[NILFS_CLDCONFIG_EMERGENCY_LEVELS_MAX];
+	struct nilfs_param param;
+	char *args[2];
+	size_t i;
+
+	args[0] = tokens[0];
+	for (i = 1; i < ntoks; i++) {
+		args[1] = tokens[i];
+		if (nilfs_cldconfig_get_size_argument(args, 2, &param) < 0)
+			return 0;
+		nsegs[i - 1] = nilfs_convert_size_to_nsegments(nilfs, &param);
+		if (i > 1 && nsegs[i - 1] >= nsegs[i - 2]) {
+			syslog(LOG_WARNING, "%s: %s: not in descending order",
+			       tokens[0], tokens[i]);
+			return 0;
+		}
+	}
+
+	memcpy(config->cf_emergency_clean_segments, nsegs,
+	       (ntoks - 1) * sizeof(nsegs[0]));
+	config->cf_emergency_nlevels = ntoks - 1;
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_min_protection_period(struct nilfs_cldconfig *config,
+					     char **tokens, size_t ntoks,
+					     struct nilfs *nilfs)
+{
+	return nilfs_cldconfig_get_time_argument(
+		tokens, ntoks, &config->cf_min_protection_period);
+}
+
 static int
 nilfs_cldconfig_handle_clean_check_interval(struct nilfs_cldconfig *config,
 					    char **tokens, size_t ntoks,
@@ -371,11 +426,28 @@ nilfs_cldconfig_handle_clean_check_interval(struct nilfs_cldconfig *config,
 		tokens, ntoks, &config->cf_clean_check_interval);
 }
 
+static int
+nilfs_cldconfig_handle_min_clean_check_interval(struct nilfs_cldconfig *config,
+						char **tokens, size_t ntoks,
+						struct nilfs *nilfs)
+{
+	return nilfs_cldconfig_get_time_argument(
+		tokens, ntoks, &config->cf_min_clean_check_interval);
+}
+
 static int
 nilfs_cldconfig_handle_selection_policy_timestamp(struct nilfs_cldconfig *cf,
 						  char **tokens, size_t ntoks)
 {
 	cf->cf_selection_policy = NILFS_SELECTION_POLICY_TIMESTAMP;
+	cf->cf_select_grouped = 0;
+	if (ntoks > 2) {
+		if (strcmp(tokens[2], "grouped") == 0)
+			cf->cf_select_grouped = 1;
+		else
+			syslog(LOG_WARNING, "%s: %s: unknown option: %s",
+			       tokens[0], tokens[1], tokens[2]);
+	}
 	return 0;
 }
 
@@ -520,6 +592,110 @@ nilfs_cldconfig_handle_retry_interval(struct nilfs_cldconfig *config,
 		tokens, ntoks, &config->cf_retry_interval);
 }
 
+static int nilfs_cldconfig_get_io_priority(char **tokens, size_t ntoks,
+					   int *ioprio)
+{
+	unsigned long level = 4;
+	char *endptr;
+
+	if (strcmp(tokens[1], "none") == 0 && ntoks == 2) {
+		*ioprio = NILFS_CLDCONFIG_IOPRIO_NONE;
+	} else if (strcmp(tokens[1], "idle") == 0 && ntoks == 2) {
+		*ioprio = NILFS_CLDCONFIG_IOPRIO_VALUE(
+			NILFS_CLDCONFIG_IOPRIO_CLASS_IDLE, 0);
+	} else if (strcmp(tokens[1], "best-effort") == 0) {
+		if (ntoks > 2) {
+			level = strtoul(tokens[2], &endptr, 10);
+			if (endptr == tokens[2] || *endptr != '\0' ||
+			    level > 7) {
+				syslog(LOG_WARNING,
+				       "%s: %s: invalid priority level",
+				       tokens[0], tokens[2]);
+				return -1;
+			}
+		}
+		*ioprio = NILFS_CLDCONFIG_IOPRIO_VALUE(
+			NILFS_CLDCONFIG_IOPRIO_CLASS_BE, level);
+	} else {
+		syslog(LOG_WARNING, "%s: %s: invalid I/O priority",
+		       tokens[0], tokens[1]);
+		return -1;
+	}
+	return 0;
+}
+
+static int nilfs_cldconfig_get_cpu_priority(char **tokens, size_t ntoks,
+					    int *cpuprio)
+{
+	long nice;
+	char *endptr;
+
+	if (strcmp(tokens[1], "none") == 0) {
+		*cpuprio = NILFS_CLDCONFIG_CPUPRIO_NONE;
+	} else if (strcmp(tokens[1], "idle") == 0) {
+		*cpuprio = NILFS_CLDCONFIG_CPUPRIO_IDLE;
+	} else {
+		nice = strtol(tokens[1], &endptr, 10);
+		if (endptr == tokens[1] || *endptr != '\0' ||
+		    nice < -20 || nice > 19) {
+			syslog(LOG_WARNING, "%s: %s: invalid CPU priority",
+			       tokens[0], tokens[1]);
+			return -1;
+		}
+		*cpuprio = nice;
+	}
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_io_priority(struct nilfs_cldconfig *config,
+				   char **tokens, size_t ntoks,
+				   struct nilfs *nilfs)
+{
+	nilfs_cldconfig_get_io_priority(tokens, ntoks,
+					&config->cf_io_priority);
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_mc_io_priority(struct nilfs_cldconfig *config,
+				      char **tokens, size_t ntoks,
+				      struct nilfs *nilfs)
+{
+	nilfs_cldconfig_get_io_priority(tokens, ntoks,
+					&config->cf_mc_io_priority);
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_cpu_priority(struct nilfs_cldconfig *config,
+				    char **tokens, size_t ntoks,
+				    struct nilfs *nilfs)
+{
+	nilfs_cldconfig_get_cpu_priority(tokens, ntoks,
+					 &config->cf_cpu_priority);
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_mc_cpu_priority(struct nilfs_cldconfig *config,
+				       char **tokens, size_t ntoks,
+				       struct nilfs *nilfs)
+{
+	nilfs_cldconfig_get_cpu_priority(tokens, ntoks,
+					 &config->cf_mc_cpu_priority);
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_freeze_interval(struct nilfs_cldconfig *config,
+				       char **tokens, size_t ntoks,
+				       struct nilfs *nilfs)
+{
+	return nilfs_cldconfig_get_time_argument(
+		tokens, ntoks, &config->cf_freeze_interval);
+}
+
 static int nilfs_cldconfig_handle_use_mmap(struct nilfs_cldconfig *config,
 					   char **tokens, size_t ntoks,
 					   struct nilfs *nilfs)
@@ -536,6 +712,308 @@ static int nilfs_cldconfig_handle_use_set_suinfo(struct nilfs_cldconfig *config,
 	return 0;
 }
 
+static int
+nilfs_cldconfig_handle_metrics_socket(struct nilfs_cldconfig *config,
+				      char **tokens, size_t ntoks,
+				      struct nilfs *nilfs)
+{
+	nilfs_cldconfig_get_path_argument(tokens, ntoks,
+					  config->cf_metrics_socket,
+					  sizeof(config->cf_metrics_socket));
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_metrics_file(struct nilfs_cldconfig *config,
+				    char **tokens, size_t ntoks,
+				    struct nilfs *nilfs)
+{
+	nilfs_cldconfig_get_path_argument(tokens, ntoks,
+					  config->cf_metrics_file,
+					  sizeof(config->cf_metrics_file));
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_state_directory(struct nilfs_cldconfig *config,
+				       char **tokens, size_t ntoks,
+				       struct nilfs *nilfs)
+{
+	nilfs_cldconfig_get_path_argument(tokens, ntoks,
+					  config->cf_state_directory,
+					  sizeof(config->cf_state_directory));
+	return 0;
+}
+
+static int nilfs_cldconfig_handle_use_discard(struct nilfs_cldconfig *config,
+					      char **tokens, size_t ntoks,
+					      struct nilfs *nilfs)
+{
+	config->cf_use_discard = 1;
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_discard_batch_size(struct nilfs_cldconfig *config,
+					  char **tokens, size_t ntoks,
+					  struct nilfs *nilfs)
+{
+	unsigned long n;
+
+	if (nilfs_cldconfig_get_ulong_argument(tokens, ntoks, &n) < 0)
+		return 0;
+
+	if (n == 0) {
+		syslog(LOG_WARNING, "%s: %s: invalid number",
+		       tokens[0], tokens[1]);
+		return 0;
+	}
+
+	config->cf_discard_batch_size = n;
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_discard_interval(struct nilfs_cldconfig *config,
+					char **tokens, size_t ntoks,
+					struct nilfs *nilfs)
+{
+	return nilfs_cldconfig_get_time_argument(
+		tokens, ntoks, &config->cf_discard_interval);
+}
+
+static int nilfs_cldconfig_handle_retention(struct nilfs_cldconfig *config,
+					    char **tokens, size_t ntoks,
+					    struct nilfs *nilfs)
+{
+	unsigned long nums[3];
+	char *endptr;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		errno = 0;
+		nums[i] = strtoul(tokens[i + 1], &endptr, 10);
+		if (endptr == tokens[i + 1] || *endptr != '\0' ||
+		    errno == ERANGE || nums[i] > NILFS_CLDCONFIG_RETENTION_MAX) {
+			syslog(LOG_WARNING, "%s: %s: invalid number",
+			       tokens[0], tokens[i + 1]);
+			return 0;
+		}
+	}
+	config->cf_use_retention = 1;
+	config->cf_retention_hours = nums[0];
+	config->cf_retention_days = nums[1];
+	config->cf_retention_weeks = nums[2];
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_retention_promote(struct nilfs_cldconfig *config,
+					 char **tokens, size_t ntoks,
+					 struct nilfs *nilfs)
+{
+	config->cf_retention_promote = 1;
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_retention_interval(struct nilfs_cldconfig *config,
+					  char **tokens, size_t ntoks,
+					  struct nilfs *nilfs)
+{
+	return nilfs_cldconfig_get_time_argument(
+		tokens, ntoks, &config->cf_retention_interval);
+}
+
+static int nilfs_cldconfig_get_profile_param(struct nilfs_cldprofile *prof,
+					     char *token, struct nilfs *nilfs)
+{
+	struct nilfs_param param;
+	unsigned long n;
+	char *args[2], *eq;
+
+	eq = strchr(token, '=');
+	if (eq == NULL || eq == token || eq[1] == '\0') {
+		syslog(LOG_WARNING, "profile: %s: invalid parameter", token);
+		return -1;
+	}
+	*eq = '\0';
+	args[0] = token;
+	args[1] = eq + 1;
+
+	if (strcmp(args[0], "nsegments_per_clean") == 0) {
+		if (nilfs_cldconfig_get_ulong_argument(args, 2, &n) < 0)
+			return -1;
+		if (n > NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX) {
+			syslog(LOG_WARNING,
+			       "%s: %s: too large, use the maximum value",
+			       args[0], args[1]);
+			n = NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX;
+		}
+		prof->pf_nsegments_per_clean = n;
+		prof->pf_flags |= NILFS_CLDPROFILE_NSEGMENTS_PER_CLEAN;
+	} else if (strcmp(args[0], "cleaning_interval") == 0) {
+		if (nilfs_cldconfig_get_time_argument(
+			    args, 2, &prof->pf_cleaning_interval) < 0)
+			return -1;
+		prof->pf_flags |= NILFS_CLDPROFILE_CLEANING_INTERVAL;
+	} else if (strcmp(args[0], "min_reclaimable_blocks") == 0) {
+		if (nilfs_cldconfig_get_size_argument(args, 2, &param) < 0)
+			return -1;
+		prof->pf_min_reclaimable_blocks =
+			nilfs_convert_size_to_blocks_per_segment(nilfs, &param);
+		prof->pf_flags |= NILFS_CLDPROFILE_MIN_RECLAIMABLE_BLOCKS;
+	} else if (strcmp(args[0], "protection_period") == 0) {
+		if (nilfs_cldconfig_get_time_argument(
+			    args, 2, &prof->pf_protection_period) < 0)
+			return -1;
+		prof->pf_flags |= NILFS_CLDPROFILE_PROTECTION_PERIOD;
+	} else {
+		syslog(LOG_WARNING, "profile: %s: unknown parameter", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+static int nilfs_cldconfig_lookup_profile(const struct nilfs_cldconfig *config,
+					  const char *name)
+{
+	int i;
+
+	for (i = 0; i < config->cf_nprofiles; i++)
+		if (strcmp(config->cf_profiles[i].pf_name, name) == 0)
+			return i;
+	return -1;
+}
+
+static int nilfs_cldconfig_handle_profile(struct nilfs_cldconfig *config,
+					  char **tokens, size_t ntoks,
+					  struct nilfs *nilfs)
+{
+	struct nilfs_cldprofile *prof;
+	size_t i;
+
+	if (strlen(tokens[1]) >= NILFS_CLDCONFIG_PROFILE_NAME_MAX) {
+		syslog(LOG_WARNING, "%s: %s: too long name", tokens[0],
+		       tokens[1]);
+		return 0;
+	}
+	if (nilfs_cldconfig_lookup_profile(config, tokens[1]) >= 0) {
+		syslog(LOG_WARNING, "%s: %s: already defined", tokens[0],
+		       tokens[1]);
+		return 0;
+	}
+	if (config->cf_nprofiles >= NILFS_CLDCONFIG_NPROFILES_MAX) {
+		syslog(LOG_WARNING, "%s: %s: too many profiles", tokens[0],
+		       tokens[1]);
+		return 0;
+	}
+
+	prof = &config->cf_profiles[config->cf_nprofiles];
+	memset(prof, 0, sizeof(*prof));
+	strcpy(prof->pf_name, tokens[1]);
+	for (i = 2; i < ntoks; i++)
+		if (nilfs_cldconfig_get_profile_param(prof, tokens[i],
+						      nilfs) < 0)
+			return 0;
+	config->cf_nprofiles++;
+	return 0;
+}
+
+static const char *nilfs_cldconfig_day_names[] = {
+	"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+
+static int nilfs_cldconfig_get_day(const char *str, size_t len)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(nilfs_cldconfig_day_names); i++)
+		if (len == 3 &&
+		    strncasecmp(str, nilfs_cldconfig_day_names[i], 3) == 0)
+			return i;
+	return -1;
+}
+
+/* parse days of week, such as "*", "Mon-Fri", or "Sat,Sun" */
+static int nilfs_cldconfig_get_days(const char *arg, unsigned int *daysp)
+{
+	unsigned int days = 0;
+	const char *p = arg, *q, *dash;
+	int first, last;
+
+	if (strcmp(arg, "*") == 0) {
+		*daysp = 0x7f;
+		return 0;
+	}
+
+	for (;;) {
+		q = strchrnul(p, ',');
+		dash = memchr(p, '-', q - p);
+		first = nilfs_cldconfig_get_day(p, (dash ? dash : q) - p);
+		last = dash ? nilfs_cldconfig_get_day(dash + 1, q - dash - 1) :
+			first;
+		if (first < 0 || last < 0)
+			return -1;
+		for (;;) {
+			days |= 1U << first;
+			if (first == last)
+				break;
+			first = (first + 1) % 7;
+		}
+		if (*q == '\0')
+			break;
+		p = q + 1;
+	}
+	*daysp = days;
+	return 0;
+}
+
+/* parse time window such as "22:00-06:30" */
+static int nilfs_cldconfig_get_window(const char *arg, int *startp, int *endp)
+{
+	int sh, sm, eh, em, n = -1;
+
+	if (sscanf(arg, "%2d:%2d-%2d:%2d%n", &sh, &sm, &eh, &em, &n) != 4 ||
+	    arg[n] != '\0' || sh < 0 || sh > 23 || eh < 0 || eh > 24 ||
+	    sm < 0 || sm > 59 || em < 0 || em > 59 || (eh == 24 && em > 0))
+		return -1;
+	*startp = sh * 60 + sm;
+	*endp = eh * 60 + em;
+	return 0;
+}
+
+static int nilfs_cldconfig_handle_schedule(struct nilfs_cldconfig *config,
+					   char **tokens, size_t ntoks,
+					   struct nilfs *nilfs)
+{
+	struct nilfs_cldschedule sc;
+
+	sc.sc_profile = nilfs_cldconfig_lookup_profile(config, tokens[1]);
+	if (sc.sc_profile < 0) {
+		syslog(LOG_WARNING, "%s: %s: unknown profile", tokens[0],
+		       tokens[1]);
+		return 0;
+	}
+	if (nilfs_cldconfig_get_days(tokens[2], &sc.sc_days) < 0) {
+		syslog(LOG_WARNING, "%s: %s: invalid days of week", tokens[0],
+		       tokens[2]);
+		return 0;
+	}
+	if (nilfs_cldconfig_get_window(tokens[3], &sc.sc_start,
+				       &sc.sc_end) < 0) {
+		syslog(LOG_WARNING, "%s: %s: invalid time window", tokens[0],
+		       tokens[3]);
+		return 0;
+	}
+	if (config->cf_nschedules >= NILFS_CLDCONFIG_NSCHEDULES_MAX) {
+		syslog(LOG_WARNING, "%s: too many schedules", tokens[0]);
+		return 0;
+	}
+	config->cf_schedules[config->cf_nschedules++] = sc;
+	return 0;
+}
+
 static const struct nilfs_cldconfig_log_priority
 nilfs_cldconfig_log_priority_table[] = {
 	{"emerg",	LOG_EMERG},
@@ -583,10 +1061,23 @@ nilfs_cldconfig_keyword_table[] = {
 		"max_clean_segments", 2, 2,
 		nilfs_cldconfig_handle_max_clean_segments
 	},
+	{
+		"emergency_clean_segments", 2,
+		NILFS_CLDCONFIG_EMERGENCY_LEVELS_MAX + 1,
+		nilfs_cldconfig_handle_emergency_clean_segments
+	},
+	{
+		"min_protection_period", 2, 2,
+		nilfs_cldconfig_handle_min_protection_period
+	},
 	{
 		"clean_check_interval", 2, 2,
 		nilfs_cldconfig_handle_clean_check_interval
 	},
+	{
+		"min_clean_check_interval", 2, 2,
+		nilfs_cldconfig_handle_min_clean_check_interval
+	},
 	{
 		"selection_policy", 2, 3,
 		nilfs_cldconfig_handle_selection_policy
@@ -611,6 +1102,34 @@ nilfs_cldconfig_keyword_table[] = {
 		"retry_interval", 2, 2,
 		nilfs_cldconfig_handle_retry_interval
 	},
+	{
+		"freeze_interval", 2, 2,
+		nilfs_cldconfig_handle_freeze_interval
+	},
+	{
+		"io_priority", 2, 3,
+		nilfs_cldconfig_handle_io_priority
+	},
+	{
+		"mc_io_priority", 2, 3,
+		nilfs_cldconfig_handle_mc_io_priority
+	},
+	{
+		"cpu_priority", 2, 2,
+		nilfs_cldconfig_handle_cpu_priority
+	},
+	{
+		"mc_cpu_priority", 2, 2,
+		nilfs_cldconfig_handle_mc_cpu_priority
+	},
+	{
+		"profile", 3, 6,
+		nilfs_cldconfig_handle_profile
+	},
+	{
+		"schedule", 4, 4,
+		nilfs_cldconfig_handle_schedule
+	},
 	{
 		"use_mmap", 1, 1,
 		nilfs_cldconfig_handle_use_mmap
@@ -631,6 +1150,42 @@ nilfs_cldconfig_keyword_table[] = {
 		"use_set_suinfo", 1, 1,
 		nilfs_cldconfig_handle_use_set_suinfo
 	},
+	{
+		"metrics_socket", 2, 2,
+		nilfs_cldconfig_handle_metrics_socket
+	},
+	{
+		"metrics_file", 2, 2,
+		nilfs_cldconfig_handle_metrics_file
+	},
+	{
+		"state_directory", 2, 2,
+		nilfs_cldconfig_handle_state_directory
+	},
+	{
+		"use_discard", 1, 1,
+		nilfs_cldconfig_handle_use_discard
+	},
+	{
+		"discard_batch_size", 2, 2,
+		nilfs_cldconfig_handle_discard_batch_size
+	},
+	{
+		"discard_interval", 2, 2,
+		nilfs_cldconfig_handle_discard_interval
+	},
+	{
+		"retention", 4, 4,
+		nilfs_cldconfig_handle_retention
+	},
+	{
+		"retention_promote", 1, 1,
+		nilfs_cldconfig_handle_retention_promote
+	},
+	{
+		"retention_interval", 2, 2,
+		nilfs_cldconfig_handle_retention_interval
+	},
 };
 
 static int nilfs_cldconfig_handle_keyword(struct nilfs_cldconfig *config,
@@ -663,6 +1218,7 @@ static void nilfs_cldconfig_set_default(struct nilfs_cldconfig *config,
 	struct nilfs_param param;
 
 	config->cf_selection_policy = NILFS_SELECTION_POLICY_TIMESTAMP;
+	config->cf_select_grouped = 0;
 
 	config->cf_protection_period.tv_sec = NILFS_CLDCONFIG_PROTECTION_PERIOD;
 	config->cf_protection_period.tv_nsec = 0;
@@ -677,9 +1233,17 @@ static void nilfs_cldconfig_set_default(struct nilfs_cldconfig *config,
 	config->cf_max_clean_segments =
 		nilfs_convert_size_to_nsegments(nilfs, &param);
 
+	config->cf_emergency_nlevels = 0;
+	config->cf_min_protection_period.tv_sec =
+		NILFS_CLDCONFIG_MIN_PROTECTION_PERIOD;
+	config->cf_min_protection_period.tv_nsec = 0;
+
 	config->cf_clean_check_interval.tv_sec =
 		NILFS_CLDCONFIG_CLEAN_CHECK_INTERVAL;
 	config->cf_clean_check_interval.tv_nsec = 0;
+	config->cf_min_clean_check_interval.tv_sec = 0;
+	config->cf_min_clean_check_interval.tv_nsec =
+		NILFS_CLDCONFIG_MIN_CLEAN_CHECK_INTERVAL_MS * 1000000L;
 	config->cf_nsegments_per_clean = NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN;
 	config->cf_mc_nsegments_per_clean =
 		NILFS_CLDCONFIG_MC_NSEGMENTS_PER_CLEAN;
@@ -690,6 +1254,14 @@ static void nilfs_cldconfig_set_default(struct nilfs_cldconfig *config,
 	config->cf_mc_cleaning_interval.tv_nsec = 0;
 	config->cf_retry_interval.tv_sec = NILFS_CLDCONFIG_RETRY_INTERVAL;
 	config->cf_retry_interval.tv_nsec = 0;
+	config->cf_freeze_interval.tv_sec = NILFS_CLDCONFIG_FREEZE_INTERVAL;
+	config->cf_freeze_interval.tv_nsec = 0;
+	config->cf_io_priority = NILFS_CLDCONFIG_IO_PRIORITY;
+	config->cf_mc_io_priority = NILFS_CLDCONFIG_MC_IO_PRIORITY;
+	config->cf_cpu_priority = NILFS_CLDCONFIG_CPU_PRIORITY;
+	config->cf_mc_cpu_priority = NILFS_CLDCONFIG_MC_CPU_PRIORITY;
+	config->cf_nprofiles = 0;
+	config->cf_nschedules = 0;
 	config->cf_use_mmap = NILFS_CLDCONFIG_USE_MMAP;
 	config->cf_use_set_suinfo = NILFS_CLDCONFIG_USE_SET_SUINFO;
 	config->cf_log_priority = NILFS_CLDCONFIG_LOG_PRIORITY;
@@ -703,6 +1275,24 @@ static void nilfs_cldconfig_set_default(struct nilfs_cldconfig *config,
 	param.unit = NILFS_CLDCONFIG_MC_MIN_RECLAIMABLE_BLOCKS_UNIT;
 	config->cf_mc_min_reclaimable_blocks =
 		nilfs_convert_size_to_blocks_per_segment(nilfs, &param);
+
+	config->cf_metrics_socket[0] = '\0';
+	config->cf_metrics_file[0] = '\0';
+	strcpy(config->cf_state_directory, NILFS_CLDCONFIG_STATE_DIRECTORY);
+
+	config->cf_use_discard = NILFS_CLDCONFIG_USE_DISCARD;
+	config->cf_discard_batch_size = NILFS_CLDCONFIG_DISCARD_BATCH_SIZE;
+	config->cf_discard_interval.tv_sec = NILFS_CLDCONFIG_DISCARD_INTERVAL;
+	config->cf_discard_interval.tv_nsec = 0;
+
+	config->cf_use_retention = 0;
+	config->cf_retention_hours = 0;
+	config->cf_retention_days = 0;
+	config->cf_retention_weeks = 0;
+	config->cf_retention_promote = NILFS_CLDCONFIG_RETENTION_PROMOTE;
+	config->cf_retention_interval.tv_sec =
+		NILFS_CLDCONFIG_RETENTION_INTERVAL;
+	config->cf_retention_interval.tv_nsec = 0;
 }
 
 static inline int iseol(int c)
@@ -790,3 +1380,35 @@ int nilfs_cldconfig_read(struct nilfs_cldconfig *config, const char *path,
 		syslog(LOG_WARNING, "%s: cannot read", path);
 	return 0;
 }
+
+/**
+ * nilfs_cldconfig_find_profile - find profile scheduled at a given time
+ * @config: config
+ * @tm: local time
+ *
+ * Return the index of the profile of the first schedule whose window
+ * contains @tm, or -1 if no schedule matches.
+ */
+int nilfs_cldconfig_find_profile(const struct nilfs_cldconfig *config,
+				 const struct tm *tm)
+{
+	const struct nilfs_cldschedule *sc = config->cf_schedules;
+	int min = tm->tm_hour * 60 + tm->tm_min;
+	unsigned int today = 1U << tm->tm_wday;
+	unsigned int yesterday = 1U << ((tm->tm_wday + 6) % 7);
+	int i;
+
+	for (i = 0; i < config->cf_nschedules; i++, sc++) {
+		if (sc->sc_start < sc->sc_end) {
+			if ((sc->sc_days & today) && min >= sc->sc_start &&
+			    min < sc->sc_end)
+				return sc->sc_profile;
+		} else {
+			/* the window extends into the next day */
+			if (((sc->sc_days & today) && min >= sc->sc_start) ||
+			    ((sc->sc_days & yesterday) && min < sc->sc_end))
+				return sc->sc_profile;
+		}
+	}
+	return -1;
+}
@@ -51,13 +51,71 @@ enum nilfs_size_unit {
 	NILFS_MAX_BINARY_SUFFIX = NILFS_SIZE_UNIT_EIB,
 };
 
+#ifndef LOCALSTATEDIR
+#define LOCALSTATEDIR	"/var"
+#endif	/* LOCALSTATEDIR */
+
+#define NILFS_CLDCONFIG_PATH_MAX	256
+#define NILFS_CLDCONFIG_EMERGENCY_LEVELS_MAX	4
+#define NILFS_CLDCONFIG_NPROFILES_MAX		8
+#define NILFS_CLDCONFIG_NSCHEDULES_MAX		16
+#define NILFS_CLDCONFIG_PROFILE_NAME_MAX	32
+
+/* parameters overridden by a profile */
+#define NILFS_CLDPROFILE_NSEGMENTS_PER_CLEAN	(1UL << 0)
+#define NILFS_CLDPROFILE_CLEANING_INTERVAL	(1UL << 1)
+#define NILFS_CLDPROFILE_MIN_RECLAIMABLE_BLOCKS	(1UL << 2)
+#define NILFS_CLDPROFILE_PROTECTION_PERIOD	(1UL << 3)
+
+/**
+ * struct nilfs_cldprofile - named set of cleaning parameters
+ * @pf_name: profile name
+ * @pf_flags: parameters overridden by the profile
+ * @pf_nsegments_per_clean: number of segments reclaimed per clean cycle
+ * @pf_cleaning_interval: cleaning interval
+ * @pf_min_reclaimable_blocks: minimum reclaimable blocks for cleaning
+ * @pf_protection_period: protection period
+ */
+struct nilfs_cldprofile {
+	char pf_name[NILFS_CLDCONFIG_PROFILE_NAME_MAX];
+	unsigned long pf_flags;
+	int pf_nsegments_per_clean;
+	struct timespec pf_cleaning_interval;
+	unsigned long pf_min_reclaimable_blocks;
+	struct timespec pf_protection_period;
+};
+
+/**
+ * struct nilfs_cldschedule - time window in which a profile is used
+ * @sc_profile: index of the profile
+ * @sc_days: days of week on which the window starts (bit 0 is Sunday)
+ * @sc_start: start of the window in minutes since midnight
+ * @sc_end: end of the window in minutes since midnight; the window
+ * extends into the next day if it is not greater than @sc_start
+ */
+struct nilfs_cldschedule {
+	int sc_profile;
+	unsigned int sc_days;
+	int sc_start;
+	int sc_end;
+};
+
 /**
  * struct nilfs_cldconfig - cleanerd configuration
  * @cf_selection_policy: selection policy
+ * @cf_select_grouped: flag that indicates grouping victims of the same
+ * generation into cleaning steps
  * @cf_protection_period: protection period
  * @cf_min_clean_segments: low threshold on the number of free segments
  * @cf_max_clean_segments: high threshold on the number of free segments
+ * @cf_emergency_clean_segments: descending thresholds on the number of free
+ * segments below which the protection period is shortened step by step
+ * @cf_emergency_nlevels: number of valid thresholds in
+ * @cf_emergency_clean_segments
+ * @cf_min_protection_period: protection period at the last emergency level
  * @cf_clean_check_interval: cleaner check interval
+ * @cf_min_clean_check_interval: shortest interval of free segment checks
+ * while paused
  * @cf_nsegments_per_clean: number of segments reclaimed per clean cycle
  * @cf_mc_nsegments_per_clean: number of segments reclaimed per clean cycle
  * if clean segments < min_clean_segments
@@ -65,31 +123,94 @@ enum nilfs_size_unit {
  * @cf_mc_cleaning_interval: cleaning interval
  * if clean segments < min_clean_segments
  * @cf_retry_interval: retry interval
+ * @cf_freeze_interval: minimum interval between freezes to advance the log
+ * cursor
+ * @cf_io_priority: I/O priority while cleaning in the background
+ * @cf_mc_io_priority: I/O priority if clean segments < min_clean_segments
+ * @cf_cpu_priority: CPU priority while cleaning in the background
+ * @cf_mc_cpu_priority: CPU priority if clean segments < min_clean_segments
+ * @cf_profiles: named parameter profiles
+ * @cf_nprofiles: number of profiles
+ * @cf_schedules: time windows of profiles, the first match wins
+ * @cf_nschedules: number of time windows
  * @cf_use_mmap: flag that indicate using mmap
  * @cf_use_set_suinfo: flag that indicates the use of the set_suinfo ioctl
  * @cf_log_priority: log priority level
  * @cf_min_reclaimable_blocks: minimum reclaimable blocks for cleaning
  * @cf_mc_min_reclaimable_blocks: minimum reclaimable blocks for cleaning
  * if clean segments < min_clean_segments
+ * @cf_metrics_socket: pathname of unix socket on which metrics are served
+ * @cf_metrics_file: pathname of file to which metrics are written
+ * @cf_state_directory: directory to store persistent state
+ * @cf_use_discard: flag that indicates discarding segments freed by GC
+ * @cf_discard_batch_size: maximum number of segments discarded at a time
+ * @cf_discard_interval: minimum interval between discard rounds
+ * @cf_use_retention: flag that indicates thinning out checkpoints
+ * @cf_retention_hours: hours for which all checkpoints are kept
+ * @cf_retention_days: days for which one checkpoint per hour is kept
+ * @cf_retention_weeks: weeks for which one checkpoint per day is kept
+ * @cf_retention_promote: flag that indicates turning checkpoints kept by
+ * retention into snapshots
+ * @cf_retention_interval: interval between retention runs
  */
 struct nilfs_cldconfig {
 	int cf_selection_policy;
+	int cf_select_grouped;
 	struct timespec cf_protection_period;
 	uint64_t cf_min_clean_segments;
 	uint64_t cf_max_clean_segments;
+	uint64_t cf_emergency_clean_segments[NILFS_CLDCONFIG_EMERGENCY_LEVELS_MAX];
+	int cf_emergency_nlevels;
+	struct timespec cf_min_protection_period;
 	struct timespec cf_clean_check_interval;
+	struct timespec cf_min_clean_check_interval;
 	int cf_nsegments_per_clean;
 	int cf_mc_nsegments_per_clean;
 	struct timespec cf_cleaning_interval;
 	struct timespec cf_mc_cleaning_interval;
 	struct timespec cf_retry_interval;
+	struct timespec cf_freeze_interval;
+	int cf_io_priority;
+	int cf_mc_io_priority;
+	int cf_cpu_priority;
+	int cf_mc_cpu_priority;
+	struct nilfs_cldprofile cf_profiles[NILFS_CLDCONFIG_NPROFILES_MAX];
+	int cf_nprofiles;
+	struct nilfs_cldschedule cf_schedules[NILFS_CLDCONFIG_NSCHEDULES_MAX];
+	int cf_nschedules;
 	int cf_use_mmap;
 	int cf_use_set_suinfo;
 	int cf_log_priority;
 	unsigned long cf_min_reclaimable_blocks;
 	unsigned long cf_mc_min_reclaimable_blocks;
+	char cf_metrics_socket[NILFS_CLDCONFIG_PATH_MAX];
+	char cf_metrics_file[NILFS_CLDCONFIG_PATH_MAX];
+	char cf_state_directory[NILFS_CLDCONFIG_PATH_MAX];
+	int cf_use_discard;
+	unsigned long cf_discard_batch_size;
+	struct timespec cf_discard_interval;
+	int cf_use_retention;
+	unsigned long cf_retention_hours;
+	unsigned long cf_retention_days;
+	unsigned long cf_retention_weeks;
+	int cf_retention_promote;
+	struct timespec cf_retention_interval;
 };
 
+/*
+ * I/O priorities are encoded as the values passed to ioprio_set(2).
+ * CPU priorities are nice values, or one of the special values below,
+ * which lie outside the range of nice values.
+ */
+#define NILFS_CLDCONFIG_IOPRIO_CLASS_SHIFT	13
+#define NILFS_CLDCONFIG_IOPRIO_CLASS_BE		2
+#define NILFS_CLDCONFIG_IOPRIO_CLASS_IDLE	3
+#define NILFS_CLDCONFIG_IOPRIO_VALUE(class, level)			\
+	(((class) << NILFS_CLDCONFIG_IOPRIO_CLASS_SHIFT) | (level))
+#define NILFS_CLDCONFIG_IOPRIO_NONE		(-1)	/* keep original */
+#define NILFS_CLDCONFIG_CPUPRIO_NONE		100	/* keep original */
+#define NILFS_CLDCONFIG_CPUPRIO_IDLE		101	/* SCHED_IDLE */
+
 enum nilfs_selection_policy {
 	NILFS_SELECTION_POLICY_TIMESTAMP = 0,
 	__NR_NILFS_SELECTION_POLICY
@@ -100,12 +221,19 @@ enum nilfs_selection_policy {
 #define NILFS_CLDCONFIG_MIN_CLEAN_SEGMENTS_UNIT		NILFS_SIZE_UNIT_PERCENT
 #define NILFS_CLDCONFIG_MAX_CLEAN_SEGMENTS		20
 #define NILFS_CLDCONFIG_MAX_CLEAN_SEGMENTS_UNIT		NILFS_SIZE_UNIT_PERCENT
+#define NILFS_CLDCONFIG_MIN_PROTECTION_PERIOD		60
 #define NILFS_CLDCONFIG_CLEAN_CHECK_INTERVAL		10
+#define NILFS_CLDCONFIG_MIN_CLEAN_CHECK_INTERVAL_MS	100
 #define NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN		2
 #define NILFS_CLDCONFIG_MC_NSEGMENTS_PER_CLEAN		4
 #define NILFS_CLDCONFIG_CLEANING_INTERVAL		5
 #define NILFS_CLDCONFIG_MC_CLEANING_INTERVAL		1
 #define NILFS_CLDCONFIG_RETRY_INTERVAL			60
+#define NILFS_CLDCONFIG_FREEZE_INTERVAL			60
+#define NILFS_CLDCONFIG_IO_PRIORITY			NILFS_CLDCONFIG_IOPRIO_NONE
+#define NILFS_CLDCONFIG_MC_IO_PRIORITY			NILFS_CLDCONFIG_IOPRIO_NONE
+#define NILFS_CLDCONFIG_CPU_PRIORITY			NILFS_CLDCONFIG_CPUPRIO_NONE
+#define NILFS_CLDCONFIG_MC_CPU_PRIORITY			NILFS_CLDCONFIG_CPUPRIO_NONE
 #define NILFS_CLDCONFIG_USE_MMAP			1
 #define NILFS_CLDCONFIG_USE_SET_SUINFO			0
 #define NILFS_CLDCONFIG_LOG_PRIORITY			LOG_INFO
@@ -113,6 +241,13 @@ enum nilfs_selection_policy {
 #define NILFS_CLDCONFIG_MIN_RECLAIMABLE_BLOCKS_UNIT	NILFS_SIZE_UNIT_PERCENT
 #define NILFS_CLDCONFIG_MC_MIN_RECLAIMABLE_BLOCKS	1
 #define NILFS_CLDCONFIG_MC_MIN_RECLAIMABLE_BLOCKS_UNIT	NILFS_SIZE_UNIT_PERCENT
+#define NILFS_CLDCONFIG_STATE_DIRECTORY			LOCALSTATEDIR "/lib/nilfs"
+#define NILFS_CLDCONFIG_USE_DISCARD			0
+#define NILFS_CLDCONFIG_DISCARD_BATCH_SIZE		32
+#define NILFS_CLDCONFIG_DISCARD_INTERVAL		60
+#define NILFS_CLDCONFIG_RETENTION_PROMOTE		0
+#define NILFS_CLDCONFIG_RETENTION_INTERVAL		600
+#define NILFS_CLDCONFIG_RETENTION_MAX			100000
 
 #define NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX	32
 
@@ -120,5 +255,7 @@ struct nilfs;
 
 int nilfs_cldconfig_read(struct nilfs_cldconfig *config, const char *path,
 			 struct nilfs *nilfs);
+int nilfs_cldconfig_find_profile(const struct nilfs_cldconfig *config,
+				 const struct tm *tm);
 
 #endif	/* CLDCONFIG_H */
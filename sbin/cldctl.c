@@ -0,0 +1,415 @@
+/*
+ * cldctl.c - Control socket of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ *
+ * The control socket accepts the same requests as the POSIX message
+ * queue of the daemon, but on a unix domain SOCK_SEQPACKET socket in
+ * the abstract namespace.  Each client has its own connection, so
+ * several clients can talk to the daemon at the same time, and the
+ * daemon can send further messages to a client after its request has
+ * been answered: progress events to subscribed clients, and deferred
+ * responses to clients waiting for a job to end.  Only processes of the
+ * same user as the daemon, or of root, may connect.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif	/* HAVE_UNISTD_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif	/* HAVE_SYS_SOCKET_H */
+
+#if HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif	/* HAVE_SYS_UN_H */
+
+#if HAVE_SYSLOG_H
+#include <syslog.h>
+#endif	/* HAVE_SYSLOG_H */
+
+#include <stddef.h>	/* offsetof */
+#include <errno.h>
+#include "util.h"
+#include "cldctl.h"
+
+/* client flags */
+#define NILFS_CLDCTL_SUBSCRIBED	(1 << 0)	/* receives events */
+#define NILFS_CLDCTL_WAITING	(1 << 1)	/* waits for a job to end */
+
+/**
+ * struct nilfs_cldctl_client - connection of a control client
+ * @cc_fd: connected socket, or -1 if the slot is free
+ * @cc_flags: client flags
+ * @cc_jobid: id of the job waited for
+ */
+struct nilfs_cldctl_client {
+	int cc_fd;
+	int cc_flags;
+	uint32_t cc_jobid;
+};
+
+/**
+ * struct nilfs_cldctl - control socket
+ * @ct_fd: listening socket
+ * @ct_next: index of the client to be read first by the next receive
+ * @ct_clients: client slots
+ */
+struct nilfs_cldctl {
+	int ct_fd;
+	unsigned int ct_next;
+	struct nilfs_cldctl_client ct_clients[NILFS_CLDCTL_MAX_CLIENTS];
+};
+
+/**
+ * nilfs_cldctl_create - create control socket
+ * @name: name of the socket in the abstract namespace
+ *
+ * Return: the control socket, or NULL with errno set (EADDRINUSE if
+ * another process holds @name).
+ */
+struct nilfs_cldctl *nilfs_cldctl_create(const char *name)
+{
+	struct nilfs_cldctl *ctl;
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+	size_t len = strlen(name);
+	int errsv, i;
+
+	if (len >= sizeof(addr.sun_path) - 1) {
+		errno = ENAMETOOLONG;
+		goto failed;
+	}
+
+	ctl = malloc(sizeof(*ctl));
+	if (unlikely(!ctl))
+		goto failed;
+
+	ctl->ct_next = 0;
+	for (i = 0; i < NILFS_CLDCTL_MAX_CLIENTS; i++)
+		ctl->ct_clients[i].cc_fd = -1;
+
+	/* leading null byte selects the abstract namespace */
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path + 1, name, len);
+	addrlen = offsetof(struct sockaddr_un, sun_path) + 1 + len;
+
+	ctl->ct_fd = socket(AF_UNIX,
+			    SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (unlikely(ctl->ct_fd < 0))
+		goto failed_free;
+
+	if (unlikely(bind(ctl->ct_fd, (struct sockaddr *)&addr, addrlen) < 0 ||
+		     listen(ctl->ct_fd, 8) < 0))
+		goto failed_close;
+
+	return ctl;
+
+failed_close:
+	errsv = errno;
+	close(ctl->ct_fd);
+	errno = errsv;
+failed_free:
+	free(ctl);
+failed:
+	return NULL;
+}
+
+static void nilfs_cldctl_close_client(struct nilfs_cldctl_client *client)
+{
+	close(client->cc_fd);
+	client->cc_fd = -1;
+	client->cc_flags = 0;
+}
+
+/**
+ * nilfs_cldctl_destroy - close control socket and all connections
+ * @ctl: control socket
+ */
+void nilfs_cldctl_destroy(struct nilfs_cldctl *ctl)
+{
+	int i;
+
+	for (i = 0; i < NILFS_CLDCTL_MAX_CLIENTS; i++) {
+		if (ctl->ct_clients[i].cc_fd >= 0)
+			nilfs_cldctl_close_client(&ctl->ct_clients[i]);
+	}
+	close(ctl->ct_fd);
+	free(ctl);
+}
+
+/**
+ * nilfs_cldctl_fill_pollfd - set up poll entries for the control socket
+ * @ctl: control socket
+ * @pfd: array of poll entries to be filled
+ * @nfds: number of entries in @pfd
+ *
+ * At most NILFS_CLDCTL_MAX_CLIENTS + 1 entries are used.  Return: number
+ * of entries filled.
+ */
+nfds_t nilfs_cldctl_fill_pollfd(const struct nilfs_cldctl *ctl,
+				struct pollfd *pfd, nfds_t nfds)
+{
+	nfds_t n = 0;
+	int i;
+
+	if (n < nfds) {
+		pfd[n].fd = ctl->ct_fd;
+		pfd[n].events = POLLIN;
+		pfd[n++].revents = 0;
+	}
+	for (i = 0; i < NILFS_CLDCTL_MAX_CLIENTS && n < nfds; i++) {
+		if (ctl->ct_clients[i].cc_fd < 0)
+			continue;
+		pfd[n].fd = ctl->ct_clients[i].cc_fd;
+		pfd[n].events = POLLIN;
+		pfd[n++].revents = 0;
+	}
+	return n;
+}
+
+static int nilfs_cldctl_permitted(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (unlikely(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred,
+				&len) < 0))
+		return 0;
+	return cred.uid == 0 || cred.uid == geteuid();
+}
+
+static void nilfs_cldctl_accept(struct nilfs_cldctl *ctl)
+{
+	struct nilfs_cldctl_client *client;
+	int fd, i;
+
+	while ((fd = accept4(ctl->ct_fd, NULL, NULL,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		if (!nilfs_cldctl_permitted(fd)) {
+			syslog(LOG_NOTICE, "control client rejected");
+			close(fd);
+			continue;
+		}
+		client = NULL;
+		for (i = 0; i < NILFS_CLDCTL_MAX_CLIENTS; i++) {
+			if (ctl->ct_clients[i].cc_fd < 0) {
+				client = &ctl->ct_clients[i];
+				break;
+			}
+		}
+		if (!client) {
+			syslog(LOG_NOTICE, "too many control clients");
+			close(fd);
+			continue;
+		}
+		client->cc_fd = fd;
+		client->cc_flags = 0;
+		client->cc_jobid = 0;
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+	    errno != ECONNABORTED)
+		syslog(LOG_ERR, "cannot accept control client: %m");
+}
+
+/**
+ * nilfs_cldctl_recv - receive a request from control clients
+ * @ctl: control socket
+ * @buf: buffer to store the request
+ * @size: size of @buf
+ * @clientp: place to store the client which sent the request
+ *
+ * Accepts pending connections and reads one request without blocking.
+ * Clients are read in turn so that a busy client cannot starve the
+ * others.  Closed connections are released.  The client returned in
+ * @clientp stays valid until the next call of this function.
+ *
+ * Return: size of the request, or 0 if no request is pending.
+ */
+ssize_t nilfs_cldctl_recv(struct nilfs_cldctl *ctl, void *buf, size_t size,
+			  struct nilfs_cldctl_client **clientp)
+{
+	struct nilfs_cldctl_client *client;
+	unsigned int i, index;
+	ssize_t bytes;
+
+	nilfs_cldctl_accept(ctl);
+
+	for (i = 0; i < NILFS_CLDCTL_MAX_CLIENTS; i++) {
+		index = (ctl->ct_next + i) % NILFS_CLDCTL_MAX_CLIENTS;
+		client = &ctl->ct_clients[index];
+		if (client->cc_fd < 0)
+			continue;
+
+		bytes = recv(client->cc_fd, buf, size, MSG_DONTWAIT);
+		if (bytes > 0) {
+			ctl->ct_next = index + 1;
+			*clientp = client;
+			return bytes;
+		}
+		if (bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+				   errno != EINTR))
+			nilfs_cldctl_close_client(client);
+	}
+	return 0;
+}
+
+static int nilfs_cldctl_xmit(struct nilfs_cldctl_client *client,
+			     const void *buf, size_t size, int droppable)
+{
+	ssize_t bytes;
+
+	if (unlikely(client->cc_fd < 0)) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	do {
+		bytes = send(client->cc_fd, buf, size,
+			     MSG_DONTWAIT | MSG_NOSIGNAL);
+	} while (bytes < 0 && errno == EINTR);
+
+	if (unlikely(bytes < 0)) {
+		if (droppable && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return -1;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			syslog(LOG_NOTICE,
+			       "control client not reading, disconnected");
+		nilfs_cldctl_close_client(client);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * nilfs_cldctl_send - send a message to a control client
+ * @client: control client
+ * @buf: message
+ * @size: size of the message
+ *
+ * The daemon never blocks on a client.  If the socket buffer of the
+ * client is full, the message cannot be dropped without leaving the
+ * client waiting for it forever, so the connection is closed instead and
+ * the client sees the end of the stream.  The connection is also
+ * released if the client has gone away.
+ */
+int nilfs_cldctl_send(struct nilfs_cldctl_client *client, const void *buf,
+		      size_t size)
+{
+	return nilfs_cldctl_xmit(client, buf, size, 0);
+}
+
+/**
+ * nilfs_cldctl_send_event - send a progress event to a control client
+ * @client: control client
+ * @buf: event message
+ * @size: size of the event message
+ *
+ * Unlike nilfs_cldctl_send(), the event is dropped if the socket buffer
+ * of the client is full.
+ */
+int nilfs_cldctl_send_event(struct nilfs_cldctl_client *client,
+			    const void *buf, size_t size)
+{
+	return nilfs_cldctl_xmit(client, buf, size, 1);
+}
+
+/**
+ * nilfs_cldctl_subscribe - let a client receive progress events
+ * @client: control client
+ */
+void nilfs_cldctl_subscribe(struct nilfs_cldctl_client *client)
+{
+	client->cc_flags |= NILFS_CLDCTL_SUBSCRIBED;
+}
+
+/**
+ * nilfs_cldctl_has_subscribers - check if any client receives events
+ * @ctl: control socket
+ */
+int nilfs_cldctl_has_subscribers(const struct nilfs_cldctl *ctl)
+{
+	int i;
+
+	for (i = 0; i < NILFS_CLDCTL_MAX_CLIENTS; i++) {
+		if (ctl->ct_clients[i].cc_fd >= 0 &&
+		    (ctl->ct_clients[i].cc_flags & NILFS_CLDCTL_SUBSCRIBED))
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * nilfs_cldctl_broadcast - send a progress event to subscribed clients
+ * @ctl: control socket
+ * @buf: event message
+ * @size: size of the event message
+ * @last: the event ends a job and must not be dropped
+ *
+ * Progress events are best effort; a client that does not keep up with
+ * them misses some events instead of stalling the daemon.  The last
+ * event of a job is sent with nilfs_cldctl_send().
+ */
+void nilfs_cldctl_broadcast(struct nilfs_cldctl *ctl, const void *buf,
+			    size_t size, int last)
+{
+	struct nilfs_cldctl_client *client;
+	int i;
+
+	for (i = 0; i < NILFS_CLDCTL_MAX_CLIENTS; i++) {
+		client = &ctl->ct_clients[i];
+		if (client->cc_fd >= 0 &&
+		    (client->cc_flags & NILFS_CLDCTL_SUBSCRIBED))
+			nilfs_cldctl_xmit(client, buf, size, !last);
+	}
+}
+
+/**
+ * nilfs_cldctl_wait - defer the response to a client until a job ends
+ * @client: control client
+ * @jobid: id of the job
+ */
+void nilfs_cldctl_wait(struct nilfs_cldctl_client *client, uint32_t jobid)
+{
+	client->cc_flags |= NILFS_CLDCTL_WAITING;
+	client->cc_jobid = jobid;
+}
+
+/**
+ * nilfs_cldctl_wake - send the deferred response to clients of a job
+ * @ctl: control socket
+ * @jobid: id of the job that ended
+ * @buf: response message
+ * @size: size of the response message
+ */
+void nilfs_cldctl_wake(struct nilfs_cldctl *ctl, uint32_t jobid,
+		       const void *buf, size_t size)
+{
+	struct nilfs_cldctl_client *client;
+	int i;
+
+	for (i = 0; i < NILFS_CLDCTL_MAX_CLIENTS; i++) {
+		client = &ctl->ct_clients[i];
+		if (client->cc_fd < 0 ||
+		    !(client->cc_flags & NILFS_CLDCTL_WAITING) ||
+		    client->cc_jobid != jobid)
+			continue;
+		client->cc_flags &= ~NILFS_CLDCTL_WAITING;
+		if (unlikely(nilfs_cldctl_send(client, buf, size) < 0))
+			syslog(LOG_ERR, "cannot respond to waiting client: %m");
+	}
+}
@@ -0,0 +1,41 @@
+/*
+ * cldctl.h - Control socket of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifndef CLDCTL_H
+#define CLDCTL_H
+
+#include <sys/types.h>	/* size_t, ssize_t */
+#include <stdint.h>	/* uint32_t */
+#include <poll.h>	/* struct pollfd */
+
+#define NILFS_CLDCTL_MAX_CLIENTS	16
+
+struct nilfs_cldctl;
+struct nilfs_cldctl_client;
+
+struct nilfs_cldctl *nilfs_cldctl_create(const char *name);
+void nilfs_cldctl_destroy(struct nilfs_cldctl *ctl);
+
+nfds_t nilfs_cldctl_fill_pollfd(const struct nilfs_cldctl *ctl,
+				struct pollfd *pfd, nfds_t nfds);
+ssize_t nilfs_cldctl_recv(struct nilfs_cldctl *ctl, void *buf, size_t size,
+			  struct nilfs_cldctl_client **clientp);
+int nilfs_cldctl_send(struct nilfs_cldctl_client *client, const void *buf,
+		      size_t size);
+int nilfs_cldctl_send_event(struct nilfs_cldctl_client *client,
+			    const void *buf, size_t size);
+
+void nilfs_cldctl_subscribe(struct nilfs_cldctl_client *client);
+int nilfs_cldctl_has_subscribers(const struct nilfs_cldctl *ctl);
+void nilfs_cldctl_broadcast(struct nilfs_cldctl *ctl, const void *buf,
+			    size_t size, int last);
+
+void nilfs_cldctl_wait(struct nilfs_cldctl_client *client, uint32_t jobid);
+void nilfs_cldctl_wake(struct nilfs_cldctl *ctl, uint32_t jobid,
+		       const void *buf, size_t size);
+
+#endif	/* CLDCTL_H */
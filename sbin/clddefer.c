@@ -0,0 +1,259 @@
+/*
+ * clddefer.c - Deferral cache of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ *
+ * When a segment has too few reclaimable blocks, GC only updates its
+ * modification time, and the segment comes back to selection after the
+ * protection period to be parsed and resolved against the DAT again.
+ * Unless checkpoints have moved out of the protection period or been
+ * deleted in the meantime, the result cannot differ.  This cache
+ * remembers the assessed segments together with the checkpoint
+ * generation at the time, so that selection can pass over them until
+ * the checkpoint history has moved far enough to change their liveness.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#include <errno.h>
+#include "util.h"
+#include "vector.h"
+#include "clddefer.h"
+
+/**
+ * struct nilfs_clddefer_entry - assessed low-yield segment
+ * @de_segnum: segment number
+ * @de_lastmod: modification time of the segment after the deferral
+ * @de_nblocks: number of blocks in the segment
+ * @de_live_blks: number of live blocks found by the assessment
+ * @de_gen: checkpoint generation at the assessment
+ *
+ * @de_lastmod and @de_nblocks identify the contents of the segment; they
+ * change when the segment is cleaned and written again.
+ */
+struct nilfs_clddefer_entry {
+	uint64_t de_segnum;
+	int64_t de_lastmod;
+	uint32_t de_nblocks;
+	uint32_t de_live_blks;
+	struct nilfs_clddefer_gen de_gen;
+};
+
+/**
+ * struct nilfs_clddefer - deferral cache
+ * @df_entries: entries sorted by segment number
+ */
+struct nilfs_clddefer {
+	struct nilfs_vector *df_entries;
+};
+
+/**
+ * nilfs_clddefer_create - create deferral cache
+ */
+struct nilfs_clddefer *nilfs_clddefer_create(void)
+{
+	struct nilfs_clddefer *defer;
+
+	defer = malloc(sizeof(*defer));
+	if (unlikely(!defer))
+		return NULL;
+
+	defer->df_entries =
+		nilfs_vector_create(sizeof(struct nilfs_clddefer_entry));
+	if (unlikely(!defer->df_entries)) {
+		free(defer);
+		return NULL;
+	}
+	return defer;
+}
+
+/**
+ * nilfs_clddefer_destroy - destroy deferral cache
+ * @defer: deferral cache
+ */
+void nilfs_clddefer_destroy(struct nilfs_clddefer *defer)
+{
+	nilfs_vector_destroy(defer->df_entries);
+	free(defer);
+}
+
+/**
+ * nilfs_clddefer_lookup - find the entry of a segment
+ * @defer: deferral cache
+ * @segnum: segment number
+ * @indexp: place to store the index of the entry, or the index at which
+ * it should be inserted
+ */
+static struct nilfs_clddefer_entry *
+nilfs_clddefer_lookup(struct nilfs_clddefer *defer, uint64_t segnum,
+		      size_t *indexp)
+{
+	struct nilfs_clddefer_entry *entries =
+		nilfs_vector_get_data(defer->df_entries);
+	size_t low = 0, high = nilfs_vector_get_size(defer->df_entries);
+	size_t index;
+
+	while (low < high) {
+		index = low + (high - low) / 2;
+		if (entries[index].de_segnum < segnum) {
+			low = index + 1;
+		} else if (entries[index].de_segnum > segnum) {
+			high = index;
+		} else {
+			*indexp = index;
+			return &entries[index];
+		}
+	}
+	*indexp = low;
+	return NULL;
+}
+
+/**
+ * nilfs_clddefer_evict - drop the entry assessed longest ago
+ * @defer: deferral cache
+ */
+static void nilfs_clddefer_evict(struct nilfs_clddefer *defer)
+{
+	struct nilfs_clddefer_entry *entries =
+		nilfs_vector_get_data(defer->df_entries);
+	size_t n = nilfs_vector_get_size(defer->df_entries);
+	size_t i, oldest = 0;
+
+	for (i = 1; i < n; i++) {
+		if (entries[i].de_gen.dg_cno < entries[oldest].de_gen.dg_cno)
+			oldest = i;
+	}
+	nilfs_vector_delete_element(defer->df_entries, oldest);
+}
+
+/**
+ * nilfs_clddefer_add - remember a deferred segment
+ * @defer: deferral cache
+ * @segnum: segment number
+ * @si: usage information of the segment after the deferral
+ * @live_blks: number of live blocks found in the segment itself
+ * @gen: checkpoint generation the segment was assessed at
+ */
+int nilfs_clddefer_add(struct nilfs_clddefer *defer, uint64_t segnum,
+		       const struct nilfs_suinfo *si, uint32_t live_blks,
+		       const struct nilfs_clddefer_gen *gen)
+{
+	struct nilfs_clddefer_entry *entry;
+	size_t index;
+
+	entry = nilfs_clddefer_lookup(defer, segnum, &index);
+	if (!entry) {
+		if (nilfs_vector_get_size(defer->df_entries) >=
+		    NILFS_CLDDEFER_MAX_ENTRIES) {
+			nilfs_clddefer_evict(defer);
+			nilfs_clddefer_lookup(defer, segnum, &index);
+		}
+		entry = nilfs_vector_insert_element(defer->df_entries, index);
+		if (unlikely(!entry))
+			return -1;
+	}
+	entry->de_segnum = segnum;
+	entry->de_lastmod = si->sui_lastmod;
+	entry->de_nblocks = si->sui_nblocks;
+	entry->de_live_blks = live_blks;
+	entry->de_gen = *gen;
+	return 0;
+}
+
+/**
+ * nilfs_clddefer_stale - check if an assessment may no longer hold
+ * @entry: entry of the segment
+ * @si: current usage information of the segment
+ * @min_reclaimable_blks: current threshold
+ * @gen: current checkpoint generation
+ *
+ * A live block only becomes reclaimable when the checkpoints that refer
+ * to it leave the protection period or are deleted, or when a snapshot
+ * covering it is removed.  The assessment is taken to hold until as many
+ * checkpoints have been retired this way as were protected at the time
+ * it was made; by then the blocks overwritten while they were protected
+ * can all have become reclaimable.  The assessment no longer holds
+ * either once the threshold has been lowered to the number of blocks
+ * the segment was found to have reclaimable.
+ */
+static int nilfs_clddefer_stale(const struct nilfs_clddefer_entry *entry,
+				const struct nilfs_suinfo *si,
+				unsigned long min_reclaimable_blks,
+				const struct nilfs_clddefer_gen *gen)
+{
+	const struct nilfs_clddefer_gen *old = &entry->de_gen;
+	uint64_t window, retired = 0;
+
+	if ((int64_t)si->sui_lastmod != entry->de_lastmod ||
+	    si->sui_nblocks != entry->de_nblocks)
+		return 1; /* segment has been rewritten */
+
+	if (entry->de_nblocks - entry->de_live_blks >= min_reclaimable_blks ||
+	    gen->dg_nsss < old->dg_nsss)
+		return 1;
+
+	window = old->dg_cno > old->dg_protcno ?
+		old->dg_cno - old->dg_protcno : 0;
+	if (gen->dg_protcno > old->dg_protcno)
+		retired += gen->dg_protcno - old->dg_protcno;
+	if (gen->dg_ndeleted > old->dg_ndeleted)
+		retired += gen->dg_ndeleted - old->dg_ndeleted;
+
+	return retired >= max_t(uint64_t, window, 1);
+}
+
+/**
+ * nilfs_clddefer_skip - check if a segment is known to be low-yield
+ * @defer: deferral cache
+ * @segnum: segment number
+ * @si: current usage information of the segment
+ * @min_reclaimable_blks: current threshold
+ * @gen: current checkpoint generation
+ *
+ * Entries that no longer hold are dropped.
+ *
+ * Return: 1 if the segment can be passed over, 0 otherwise.
+ */
+int nilfs_clddefer_skip(struct nilfs_clddefer *defer, uint64_t segnum,
+			const struct nilfs_suinfo *si,
+			unsigned long min_reclaimable_blks,
+			const struct nilfs_clddefer_gen *gen)
+{
+	struct nilfs_clddefer_entry *entry;
+	size_t index;
+
+	entry = nilfs_clddefer_lookup(defer, segnum, &index);
+	if (!entry)
+		return 0;
+
+	if (nilfs_clddefer_stale(entry, si, min_reclaimable_blks, gen)) {
+		nilfs_vector_delete_element(defer->df_entries, index);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * nilfs_clddefer_clear - forget all deferred segments
+ * @defer: deferral cache
+ */
+void nilfs_clddefer_clear(struct nilfs_clddefer *defer)
+{
+	nilfs_vector_clear(defer->df_entries);
+}
+
+/**
+ * nilfs_clddefer_count - get the number of remembered segments
+ * @defer: deferral cache
+ */
+size_t nilfs_clddefer_count(const struct nilfs_clddefer *defer)
+{
+	return nilfs_vector_get_size(defer->df_entries);
+}
@@ -0,0 +1,46 @@
+/*
+ * clddefer.h - Deferral cache of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifndef CLDDEFER_H
+#define CLDDEFER_H
+
+#include <sys/types.h>	/* size_t */
+#include <stdint.h>	/* uint64_t */
+#include <linux/nilfs2_api.h>	/* struct nilfs_suinfo */
+
+#define NILFS_CLDDEFER_MAX_ENTRIES	16384
+
+/**
+ * struct nilfs_clddefer_gen - checkpoint generation of the file system
+ * @dg_protcno: start checkpoint number of the protection period
+ * @dg_cno: next checkpoint number
+ * @dg_ndeleted: number of checkpoints deleted so far
+ * @dg_nsss: number of snapshots
+ */
+struct nilfs_clddefer_gen {
+	uint64_t dg_protcno;
+	uint64_t dg_cno;
+	uint64_t dg_ndeleted;
+	uint64_t dg_nsss;
+};
+
+struct nilfs_clddefer;
+
+struct nilfs_clddefer *nilfs_clddefer_create(void);
+void nilfs_clddefer_destroy(struct nilfs_clddefer *defer);
+
+int nilfs_clddefer_add(struct nilfs_clddefer *defer, uint64_t segnum,
+		       const struct nilfs_suinfo *si, uint32_t live_blks,
+		       const struct nilfs_clddefer_gen *gen);
+int nilfs_clddefer_skip(struct nilfs_clddefer *defer, uint64_t segnum,
+			const struct nilfs_suinfo *si,
+			unsigned long min_reclaimable_blks,
+			const struct nilfs_clddefer_gen *gen);
+void nilfs_clddefer_clear(struct nilfs_clddefer *defer);
+size_t nilfs_clddefer_count(const struct nilfs_clddefer *defer);
+
+#endif	/* CLDDEFER_H */
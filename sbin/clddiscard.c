@@ -0,0 +1,176 @@
+/*
+ * clddiscard.c - Discard scheduling of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ *
+ * Segments freed by GC are queued here and discarded later in batches,
+ * so that the device sees a few large discard requests issued while the
+ * file system is idle instead of many small ones mixed into foreground
+ * I/O.  Adjacent segments are coalesced into a single FITRIM range.  The
+ * file system skips blocks that have been reused since the segment was
+ * queued, so a stale queue entry never discards live data.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#include <errno.h>
+#include "util.h"
+#include "vector.h"
+#include "clddiscard.h"
+
+/**
+ * struct nilfs_clddiscard - discard queue
+ * @d_nilfs: nilfs object
+ * @d_segnums: numbers of segments waiting to be discarded
+ * @d_segsize: size of a segment in bytes
+ */
+struct nilfs_clddiscard {
+	struct nilfs *d_nilfs;
+	struct nilfs_vector *d_segnums;
+	uint64_t d_segsize;
+};
+
+static int nilfs_clddiscard_comp_segnum(const void *elem1, const void *elem2)
+{
+	const uint64_t *segnum1 = elem1, *segnum2 = elem2;
+
+	return (*segnum1 < *segnum2) ? -1 : (*segnum1 > *segnum2) ? 1 : 0;
+}
+
+/**
+ * nilfs_clddiscard_create - create discard queue
+ * @nilfs: nilfs object
+ */
+struct nilfs_clddiscard *nilfs_clddiscard_create(struct nilfs *nilfs)
+{
+	struct nilfs_clddiscard *discard;
+
+	discard = malloc(sizeof(*discard));
+	if (unlikely(!discard))
+		return NULL;
+
+	discard->d_segnums = nilfs_vector_create(sizeof(uint64_t));
+	if (unlikely(!discard->d_segnums)) {
+		free(discard);
+		return NULL;
+	}
+	discard->d_nilfs = nilfs;
+	discard->d_segsize = (uint64_t)nilfs_get_blocks_per_segment(nilfs) *
+		nilfs_get_block_size(nilfs);
+	return discard;
+}
+
+/**
+ * nilfs_clddiscard_destroy - destroy discard queue
+ * @discard: discard queue
+ */
+void nilfs_clddiscard_destroy(struct nilfs_clddiscard *discard)
+{
+	nilfs_vector_destroy(discard->d_segnums);
+	free(discard);
+}
+
+/**
+ * nilfs_clddiscard_add - queue segments to be discarded
+ * @discard: discard queue
+ * @segnums: array of segment numbers
+ * @nsegs: number of segments
+ */
+int nilfs_clddiscard_add(struct nilfs_clddiscard *discard,
+			 const uint64_t *segnums, size_t nsegs)
+{
+	uint64_t *segnum;
+	size_t i;
+
+	for (i = 0; i < nsegs; i++) {
+		segnum = nilfs_vector_get_new_element(discard->d_segnums);
+		if (unlikely(!segnum))
+			return -1;
+		*segnum = segnums[i];
+	}
+	return 0;
+}
+
+/**
+ * nilfs_clddiscard_clear - drop all queued segments
+ * @discard: discard queue
+ */
+void nilfs_clddiscard_clear(struct nilfs_clddiscard *discard)
+{
+	nilfs_vector_clear(discard->d_segnums);
+}
+
+/**
+ * nilfs_clddiscard_pending - return the number of queued segments
+ * @discard: discard queue
+ *
+ * The count may include duplicates that are merged on the next round.
+ */
+size_t nilfs_clddiscard_pending(const struct nilfs_clddiscard *discard)
+{
+	return nilfs_vector_get_size(discard->d_segnums);
+}
+
+/**
+ * nilfs_clddiscard_issue - discard queued segments
+ * @discard: discard queue
+ * @maxsegs: maximum number of segments discarded in this round
+ * @bytesp: place to store the number of bytes discarded
+ * @nrangesp: place to store the number of FITRIM requests issued
+ *
+ * The lowest numbered segments are discarded first.  Return the number
+ * of segments removed from the queue, or -1 with errno set if FITRIM
+ * failed.  Segments whose range failed stay in the queue.
+ */
+ssize_t nilfs_clddiscard_issue(struct nilfs_clddiscard *discard,
+			       size_t maxsegs, uint64_t *bytesp,
+			       size_t *nrangesp)
+{
+	struct nilfs_vector *vec = discard->d_segnums;
+	uint64_t *segnums, trimmed;
+	size_t i, j, n, nsegs, done = 0;
+	int ret;
+
+	*bytesp = 0;
+	*nrangesp = 0;
+
+	nsegs = nilfs_vector_get_size(vec);
+	if (nsegs == 0)
+		return 0;
+
+	/* sort and remove duplicates */
+	nilfs_vector_sort(vec, nilfs_clddiscard_comp_segnum);
+	segnums = nilfs_vector_get_data(vec);
+	for (i = 1, n = 1; i < nsegs; i++) {
+		if (segnums[i] != segnums[n - 1])
+			segnums[n++] = segnums[i];
+	}
+	if (n < nsegs)
+		nilfs_vector_delete_elements(vec, n, nsegs - n);
+	nsegs = min_t(size_t, n, maxsegs);
+
+	for (i = 0; i < nsegs; i = j) {
+		for (j = i + 1; j < nsegs && segnums[j] == segnums[j - 1] + 1;
+		     j++)
+			;
+		ret = nilfs_trim(discard->d_nilfs,
+				 segnums[i] * discard->d_segsize,
+				 (j - i) * discard->d_segsize, &trimmed);
+		if (unlikely(ret < 0))
+			break;
+		*bytesp += trimmed;
+		(*nrangesp)++;
+		done = j;
+	}
+
+	if (done > 0)
+		nilfs_vector_delete_elements(vec, 0, done);
+	return i < nsegs ? -1 : (ssize_t)done;
+}
@@ -0,0 +1,28 @@
+/*
+ * clddiscard.h - Discard scheduling of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifndef CLDDISCARD_H
+#define CLDDISCARD_H
+
+#include <sys/types.h>	/* size_t */
+#include <stdint.h>	/* uint64_t */
+#include "nilfs.h"
+
+struct nilfs_clddiscard;
+
+struct nilfs_clddiscard *nilfs_clddiscard_create(struct nilfs *nilfs);
+void nilfs_clddiscard_destroy(struct nilfs_clddiscard *discard);
+
+int nilfs_clddiscard_add(struct nilfs_clddiscard *discard,
+			 const uint64_t *segnums, size_t nsegs);
+void nilfs_clddiscard_clear(struct nilfs_clddiscard *discard);
+size_t nilfs_clddiscard_pending(const struct nilfs_clddiscard *discard);
+ssize_t nilfs_clddiscard_issue(struct nilfs_clddiscard *discard,
+			       size_t maxsegs, uint64_t *bytesp,
+			       size_t *nrangesp);
+
+#endif	/* CLDDISCARD_H */
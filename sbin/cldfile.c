@@ -0,0 +1,102 @@
+/*
+ * cldfile.c - State file writer of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif	/* HAVE_UNISTD_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif	/* HAVE_FCNTL_H */
+
+#if HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif	/* HAVE_SYS_STAT_H */
+
+#include <errno.h>
+#include "util.h"
+#include "cldfile.h"
+
+/**
+ * nilfs_cld_save_file - replace a file atomically
+ * @path: pathname of the file
+ * @iov: buffers holding the new contents
+ * @n: number of @iov entries
+ * @flags: NILFS_CLDFILE_* flags
+ *
+ * The contents are written to a temporary file in the same directory,
+ * which is then renamed over @path, so that readers see either the old
+ * or the new contents.  With NILFS_CLDFILE_SYNC, the temporary file is
+ * synced first, so that the new contents also survive a crash.  The
+ * file is only readable by the owner unless NILFS_CLDFILE_PUBLIC is
+ * given.
+ *
+ * Return: 0 on success, or -1 with errno set on failure.
+ */
+int nilfs_cld_save_file(const char *path, const struct iovec *iov, int n,
+			int flags)
+{
+	char *tmppath;
+	size_t size = 0;
+	ssize_t nw;
+	int fd, i, errsv, ret = -1;
+
+	tmppath = malloc(strlen(path) + sizeof(".XXXXXX"));
+	if (unlikely(!tmppath))
+		return -1;
+	sprintf(tmppath, "%s.XXXXXX", path);
+
+	fd = mkostemp(tmppath, O_CLOEXEC);
+	if (unlikely(fd < 0))
+		goto out_free;
+
+	if ((flags & NILFS_CLDFILE_PUBLIC) && unlikely(fchmod(fd, 0644) < 0))
+		goto out_close;
+
+	for (i = 0; i < n; i++)
+		size += iov[i].iov_len;
+	nw = writev(fd, iov, n);
+	if (unlikely(nw < 0 || nw != size)) {
+		if (nw >= 0)
+			errno = EIO;
+		goto out_close;
+	}
+	if ((flags & NILFS_CLDFILE_SYNC) && unlikely(fsync(fd) < 0))
+		goto out_close;
+
+	if (unlikely(close(fd) < 0 || rename(tmppath, path) < 0))
+		goto out_unlink;
+
+	ret = 0;
+	goto out_free;
+
+out_close:
+	errsv = errno;
+	close(fd);
+	errno = errsv;
+out_unlink:
+	errsv = errno;
+	unlink(tmppath);
+	errno = errsv;
+out_free:
+	free(tmppath);
+	return ret;
+}
@@ -0,0 +1,20 @@
+/*
+ * cldfile.h - State file writer of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifndef CLDFILE_H
+#define CLDFILE_H
+
+#include <sys/uio.h>	/* struct iovec */
+
+/* flags of nilfs_cld_save_file() */
+#define NILFS_CLDFILE_SYNC	(1 << 0)	/* sync before replacing */
+#define NILFS_CLDFILE_PUBLIC	(1 << 1)	/* readable by all users */
+
+int nilfs_cld_save_file(const char *path, const struct iovec *iov, int n,
+			int flags);
+
+#endif	/* CLDFILE_H */
@@ -0,0 +1,537 @@
+/*
+ * cldmetrics.c - Metrics exporter of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ *
+ * The metrics are exposed in the Prometheus text exposition format,
+ * either on a unix domain stream socket (each connecting client is sent
+ * one snapshot and the connection is closed), or in a regular file that
+ * is atomically replaced after every cleaning cycle.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif	/* HAVE_UNISTD_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif	/* HAVE_FCNTL_H */
+
+#if HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif	/* HAVE_SYS_STAT_H */
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif	/* HAVE_SYS_SOCKET_H */
+
+#if HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif	/* HAVE_SYS_UN_H */
+
+#if HAVE_SYSLOG_H
+#include <syslog.h>
+#endif	/* HAVE_SYSLOG_H */
+
+#include <errno.h>
+#include "util.h"
+#include "cldfile.h"
+#include "cldmetrics.h"
+
+#define NILFS_CLDMETRICS_PREFIX		"nilfs_cleanerd_"
+#define NILFS_CLDMETRICS_SOCK_MODE	0666	/* metrics are not secret */
+
+/**
+ * struct nilfs_cldmetrics - metrics exporter
+ * @cm_fd: listening socket (-1 if not serving on a socket)
+ * @cm_label: label set attached to every sample
+ * @cm_sockpath: pathname of the listening socket
+ * @cm_filepath: pathname of the metrics file
+ */
+struct nilfs_cldmetrics {
+	int cm_fd;
+	char *cm_label;
+	char *cm_sockpath;
+	char *cm_filepath;
+};
+
+/* upper bounds of the duration histogram buckets in seconds */
+static const double nilfs_cldhist_bounds[NILFS_CLDHIST_NBUCKETS - 1] = {
+	0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+/**
+ * nilfs_cldhist_add - record an observation in a histogram
+ * @hist: histogram
+ * @ts: observed duration
+ */
+void nilfs_cldhist_add(struct nilfs_cldhist *hist, const struct timespec *ts)
+{
+	double val = ts->tv_sec + ts->tv_nsec / 1000000000.0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(nilfs_cldhist_bounds); i++)
+		if (val <= nilfs_cldhist_bounds[i])
+			break;
+	hist->ch_count[i]++;
+	hist->ch_total++;
+	hist->ch_sum += val;
+}
+
+static double nilfs_cldmetrics_seconds(const struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec / 1000000000.0;
+}
+
+static void nilfs_cldmetrics_header(FILE *fp, const char *name,
+				    const char *type, const char *help)
+{
+	fprintf(fp, "# HELP " NILFS_CLDMETRICS_PREFIX "%s %s\n", name, help);
+	fprintf(fp, "# TYPE " NILFS_CLDMETRICS_PREFIX "%s %s\n", name, type);
+}
+
+static void nilfs_cldmetrics_put_u64(FILE *fp, const char *label,
+				     const char *name, const char *type,
+				     const char *help, uint64_t val)
+{
+	nilfs_cldmetrics_header(fp, name, type, help);
+	fprintf(fp, NILFS_CLDMETRICS_PREFIX "%s{%s} %llu\n", name, label,
+		(unsigned long long)val);
+}
+
+static void nilfs_cldmetrics_put_double(FILE *fp, const char *label,
+					const char *name, const char *type,
+					const char *help, double val)
+{
+	nilfs_cldmetrics_header(fp, name, type, help);
+	fprintf(fp, NILFS_CLDMETRICS_PREFIX "%s{%s} %.9g\n", name, label, val);
+}
+
+static void nilfs_cldmetrics_put_hist(FILE *fp, const char *label,
+				      const char *name, const char *help,
+				      const struct nilfs_cldhist *hist)
+{
+	uint64_t cumulative = 0;
+	int i;
+
+	nilfs_cldmetrics_header(fp, name, "histogram", help);
+	for (i = 0; i < ARRAY_SIZE(nilfs_cldhist_bounds); i++) {
+		cumulative += hist->ch_count[i];
+		fprintf(fp, NILFS_CLDMETRICS_PREFIX "%s_bucket{%s,le=\"%g\"} %llu\n",
+			name, label, nilfs_cldhist_bounds[i],
+			(unsigned long long)cumulative);
+	}
+	fprintf(fp, NILFS_CLDMETRICS_PREFIX "%s_bucket{%s,le=\"+Inf\"} %llu\n",
+		name, label, (unsigned long long)hist->ch_total);
+	fprintf(fp, NILFS_CLDMETRICS_PREFIX "%s_sum{%s} %.9g\n",
+		name, label, hist->ch_sum);
+	fprintf(fp, NILFS_CLDMETRICS_PREFIX "%s_count{%s} %llu\n",
+		name, label, (unsigned long long)hist->ch_total);
+}
+
+static void nilfs_cldmetrics_print(FILE *fp, const char *label,
+				   const struct nilfs_cldstats *stats)
+{
+	/* segment usage */
+	nilfs_cldmetrics_put_u64(fp, label, "segments", "gauge",
+				 "Total number of segments.", stats->cs_nsegs);
+	nilfs_cldmetrics_put_u64(fp, label, "free_segments", "gauge",
+				 "Number of clean segments.",
+				 stats->cs_free_segs);
+	nilfs_cldmetrics_put_u64(fp, label, "reserved_segments", "gauge",
+				 "Number of segments reserved for GC.",
+				 stats->cs_reserved_segs);
+	nilfs_cldmetrics_put_u64(fp, label, "reclaimable_segments", "gauge",
+				 "Number of reclaimable segments found by the last selection.",
+				 stats->cs_reclaimable_segs);
+	nilfs_cldmetrics_put_u64(fp, label, "candidate_segments", "gauge",
+				 "Number of reclaimable segments outside the protection period found by the last selection.",
+				 stats->cs_candidate_segs);
+
+	/* activity */
+	nilfs_cldmetrics_put_u64(fp, label, "cycles_total", "counter",
+				 "Number of cleaning cycles that tried to reclaim segments.",
+				 stats->cs_ncycles);
+	nilfs_cldmetrics_put_u64(fp, label, "cleaned_segments_total",
+				 "counter", "Number of cleaned segments.",
+				 stats->cs_cleaned_segs);
+	nilfs_cldmetrics_put_u64(fp, label, "deferred_segments_total",
+				 "counter",
+				 "Number of segments deferred due to too few reclaimable blocks.",
+				 stats->cs_deferred_segs);
+	nilfs_cldmetrics_put_u64(fp, label, "protected_segments_total",
+				 "counter",
+				 "Number of selected segments skipped because they were protected.",
+				 stats->cs_protected_segs);
+	nilfs_cldmetrics_put_u64(fp, label, "live_blocks_total", "counter",
+				 "Number of live blocks moved by GC.",
+				 stats->cs_live_blks);
+	nilfs_cldmetrics_put_u64(fp, label, "defunct_blocks_total", "counter",
+				 "Number of defunct blocks reclaimed by GC.",
+				 stats->cs_defunct_blks);
+	nilfs_cldmetrics_put_u64(fp, label, "copied_bytes_total", "counter",
+				 "Number of bytes copied by GC.",
+				 stats->cs_copied_bytes);
+	nilfs_cldmetrics_put_u64(fp, label, "freed_bytes_total", "counter",
+				 "Number of bytes in segments cleaned by GC.",
+				 stats->cs_freed_bytes);
+	nilfs_cldmetrics_put_u64(fp, label, "discarded_bytes_total", "counter",
+				 "Number of bytes discarded after GC.",
+				 stats->cs_discarded_bytes);
+	nilfs_cldmetrics_put_u64(fp, label, "deferral_skipped_segments_total",
+				 "counter",
+				 "Number of times selection passed over a segment known to be low-yield.",
+				 stats->cs_defer_skipped_segs);
+	nilfs_cldmetrics_put_double(fp, label, "lock_wait_seconds_total",
+				    "counter",
+				    "Time spent waiting for the cleaner lock.",
+				    nilfs_cldmetrics_seconds(&stats->cs_lock_wait));
+	nilfs_cldmetrics_put_hist(fp, label, "cycle_duration_seconds",
+				  "Duration of cleaning cycles.",
+				  &stats->cs_cycle_time);
+	nilfs_cldmetrics_put_hist(fp, label, "freeze_stall_seconds",
+				  "Duration writers were blocked by freezes to advance the log cursor.",
+				  &stats->cs_freeze_stall);
+
+	/* pacing */
+	nilfs_cldmetrics_put_double(fp, label, "state", "gauge",
+				    "Running state (-1: suspended, 0: idle, 1: running, 2: manual run).",
+				    stats->cs_state);
+	nilfs_cldmetrics_put_u64(fp, label, "emergency_level", "gauge",
+				 "Number of emergency watermarks the free segments are below.",
+				 stats->cs_emergency_level);
+	nilfs_cldmetrics_put_u64(fp, label, "nsegments_per_clean", "gauge",
+				 "Number of segments reclaimed per cleaning cycle.",
+				 stats->cs_nsegments_per_clean);
+	nilfs_cldmetrics_put_double(fp, label, "cleaning_interval_seconds",
+				    "gauge", "Cleaning interval.",
+				    nilfs_cldmetrics_seconds(&stats->cs_cleaning_interval));
+	nilfs_cldmetrics_put_double(fp, label, "protection_period_seconds",
+				    "gauge", "Protection period.",
+				    nilfs_cldmetrics_seconds(&stats->cs_protection_period));
+	nilfs_cldmetrics_put_u64(fp, label, "min_reclaimable_blocks", "gauge",
+				 "Minimum number of reclaimable blocks in a segment to clean it.",
+				 stats->cs_min_reclaimable_blocks);
+	nilfs_cldmetrics_put_double(fp, label, "last_cycle_duration_seconds",
+				    "gauge", "Duration of the last cleaning cycle.",
+				    nilfs_cldmetrics_seconds(&stats->cs_last_cycle_time));
+	nilfs_cldmetrics_put_u64(fp, label, "deferral_cache_segments", "gauge",
+				 "Number of segments remembered as low-yield.",
+				 stats->cs_defer_segs);
+}
+
+/**
+ * nilfs_cldmetrics_format - format metrics into a newly allocated buffer
+ * @metrics: metrics exporter
+ * @stats: statistics to be exported
+ * @sizep: place to store the length of the text
+ */
+static char *nilfs_cldmetrics_format(struct nilfs_cldmetrics *metrics,
+				     const struct nilfs_cldstats *stats,
+				     size_t *sizep)
+{
+	char *buf = NULL;
+	FILE *fp;
+
+	fp = open_memstream(&buf, sizep);
+	if (unlikely(!fp))
+		return NULL;
+
+	nilfs_cldmetrics_print(fp, metrics->cm_label, stats);
+	if (unlikely(fclose(fp) == EOF)) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+static int nilfs_cldmetrics_write_all(int fd, const char *buf, size_t size,
+				      int flags)
+{
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = send(fd, buf, size, flags);
+		if (unlikely(ret < 0)) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		size -= ret;
+	}
+	return 0;
+}
+
+static char *nilfs_cldmetrics_make_label(const char *device)
+{
+	static const char prefix[] = "device=\"";
+	char *label, *p;
+	const char *s;
+
+	/* every character may need escaping */
+	label = malloc(sizeof(prefix) + strlen(device) * 2 + 1);
+	if (unlikely(!label))
+		return NULL;
+
+	p = stpcpy(label, prefix);
+	for (s = device; *s != '\0'; s++) {
+		if (*s == '\\' || *s == '"') {
+			*p++ = '\\';
+			*p++ = *s;
+		} else if (*s == '\n') {
+			*p++ = '\\';
+			*p++ = 'n';
+		} else {
+			*p++ = *s;
+		}
+	}
+	*p++ = '"';
+	*p = '\0';
+	return label;
+}
+
+/**
+ * nilfs_cldmetrics_create - create metrics exporter
+ * @device: device name used to label the samples
+ */
+struct nilfs_cldmetrics *nilfs_cldmetrics_create(const char *device)
+{
+	struct nilfs_cldmetrics *metrics;
+
+	metrics = malloc(sizeof(*metrics));
+	if (unlikely(!metrics))
+		return NULL;
+
+	metrics->cm_fd = -1;
+	metrics->cm_sockpath = NULL;
+	metrics->cm_filepath = NULL;
+	metrics->cm_label = nilfs_cldmetrics_make_label(device ? : "");
+	if (unlikely(!metrics->cm_label)) {
+		free(metrics);
+		return NULL;
+	}
+	return metrics;
+}
+
+static void nilfs_cldmetrics_close_socket(struct nilfs_cldmetrics *metrics)
+{
+	if (metrics->cm_fd >= 0) {
+		close(metrics->cm_fd);
+		unlink(metrics->cm_sockpath);
+		metrics->cm_fd = -1;
+	}
+	free(metrics->cm_sockpath);
+	metrics->cm_sockpath = NULL;
+}
+
+static int nilfs_cldmetrics_open_socket(struct nilfs_cldmetrics *metrics,
+					const char *sockpath)
+{
+	struct sockaddr_un addr;
+	struct stat stbuf;
+	int fd;
+
+	if (strlen(sockpath) >= sizeof(addr.sun_path)) {
+		syslog(LOG_ERR, "%s: socket path too long", sockpath);
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, sockpath);
+
+	/* remove a stale socket left by a previous instance */
+	if (lstat(sockpath, &stbuf) == 0 && S_ISSOCK(stbuf.st_mode))
+		unlink(sockpath);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (unlikely(fd < 0))
+		goto failed;
+
+	if (unlikely(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0))
+		goto failed_close;
+
+	/* do not depend on the umask of the daemon */
+	if (unlikely(chmod(sockpath, NILFS_CLDMETRICS_SOCK_MODE) < 0 ||
+		     listen(fd, 8) < 0)) {
+		unlink(sockpath);
+		goto failed_close;
+	}
+
+	metrics->cm_sockpath = strdup(sockpath);
+	if (unlikely(!metrics->cm_sockpath)) {
+		unlink(sockpath);
+		goto failed_close;
+	}
+	metrics->cm_fd = fd;
+	return 0;
+
+failed_close:
+	close(fd);
+failed:
+	syslog(LOG_ERR, "cannot open metrics socket %s: %m", sockpath);
+	return -1;
+}
+
+static int nilfs_cldmetrics_path_changed(const char *curr, const char *path)
+{
+	if (!curr)
+		return path[0] != '\0';
+	return strcmp(curr, path) != 0;
+}
+
+/**
+ * nilfs_cldmetrics_setup - (re)configure metrics exporter
+ * @metrics: metrics exporter
+ * @sockpath: pathname of socket to serve on, or an empty string
+ * @filepath: pathname of file to write to, or an empty string
+ *
+ * The socket is recreated only if @sockpath differs from the current one.
+ */
+int nilfs_cldmetrics_setup(struct nilfs_cldmetrics *metrics,
+			   const char *sockpath, const char *filepath)
+{
+	int ret = 0;
+
+	if (nilfs_cldmetrics_path_changed(metrics->cm_sockpath, sockpath)) {
+		nilfs_cldmetrics_close_socket(metrics);
+		if (sockpath[0] != '\0')
+			ret = nilfs_cldmetrics_open_socket(metrics, sockpath);
+	}
+
+	if (nilfs_cldmetrics_path_changed(metrics->cm_filepath, filepath)) {
+		free(metrics->cm_filepath);
+		metrics->cm_filepath = NULL;
+		if (filepath[0] != '\0') {
+			metrics->cm_filepath = strdup(filepath);
+			if (unlikely(!metrics->cm_filepath))
+				ret = -1;
+		}
+	}
+	return ret;
+}
+
+/**
+ * nilfs_cldmetrics_destroy - destroy metrics exporter
+ * @metrics: metrics exporter
+ */
+void nilfs_cldmetrics_destroy(struct nilfs_cldmetrics *metrics)
+{
+	nilfs_cldmetrics_close_socket(metrics);
+	free(metrics->cm_filepath);
+	free(metrics->cm_label);
+	free(metrics);
+}
+
+/**
+ * nilfs_cldmetrics_get_fd - get file descriptor to be polled
+ * @metrics: metrics exporter
+ *
+ * Return: listening socket descriptor, or -1 if not serving on a socket.
+ */
+int nilfs_cldmetrics_get_fd(const struct nilfs_cldmetrics *metrics)
+{
+	return metrics->cm_fd;
+}
+
+/**
+ * nilfs_cldmetrics_serve - send metrics to pending clients
+ * @metrics: metrics exporter
+ * @stats: statistics to be exported
+ *
+ * Accepts all pending connections on the listening socket, sends a
+ * snapshot of @stats to each of them, and closes the connections.
+ */
+int nilfs_cldmetrics_serve(struct nilfs_cldmetrics *metrics,
+			   const struct nilfs_cldstats *stats)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	int fd, ret = 0;
+
+	if (metrics->cm_fd < 0)
+		return 0;
+
+	while ((fd = accept4(metrics->cm_fd, NULL, NULL,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		if (!buf) {
+			buf = nilfs_cldmetrics_format(metrics, stats, &size);
+			if (unlikely(!buf)) {
+				syslog(LOG_ERR, "cannot format metrics: %m");
+				close(fd);
+				ret = -1;
+				break;
+			}
+		}
+		/*
+		 * The snapshot normally fits in the socket buffer; a client
+		 * that does not take it at once is dropped rather than
+		 * letting it block the daemon.
+		 */
+		if (unlikely(nilfs_cldmetrics_write_all(fd, buf, size,
+							MSG_NOSIGNAL) < 0))
+			syslog(LOG_DEBUG, "cannot send metrics: %m");
+		close(fd);
+	}
+	if (fd < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+	    errno != EINTR && errno != ECONNABORTED) {
+		syslog(LOG_ERR, "cannot accept metrics client: %m");
+		ret = -1;
+	}
+	free(buf);
+	return ret;
+}
+
+/**
+ * nilfs_cldmetrics_update_file - write metrics to the metrics file
+ * @metrics: metrics exporter
+ * @stats: statistics to be exported
+ *
+ * The file is replaced atomically so that readers never see partial
+ * contents.
+ */
+int nilfs_cldmetrics_update_file(struct nilfs_cldmetrics *metrics,
+				 const struct nilfs_cldstats *stats)
+{
+	struct iovec iov;
+	char *buf;
+	size_t size;
+	int ret;
+
+	if (!metrics->cm_filepath)
+		return 0;
+
+	buf = nilfs_cldmetrics_format(metrics, stats, &size);
+	if (unlikely(!buf)) {
+		ret = -1;
+		goto out;
+	}
+
+	iov.iov_base = buf;
+	iov.iov_len = size;
+	ret = nilfs_cld_save_file(metrics->cm_filepath, &iov, 1,
+				  NILFS_CLDFILE_PUBLIC);
+	free(buf);
+out:
+	if (unlikely(ret < 0))
+		syslog(LOG_ERR, "cannot update metrics file %s: %m",
+		       metrics->cm_filepath);
+	return ret;
+}
@@ -0,0 +1,108 @@
+/*
+ * cldmetrics.h - Metrics exporter of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifndef CLDMETRICS_H
+#define CLDMETRICS_H
+
+#if HAVE_TIME_H
+#include <time.h>	/* timespec */
+#endif	/* HAVE_TIME_H */
+
+#include <stdint.h>	/* uint64_t */
+
+#define NILFS_CLDHIST_NBUCKETS	12	/* including +Inf bucket */
+
+/**
+ * struct nilfs_cldhist - histogram of durations
+ * @ch_count: number of observations per bucket (not cumulative)
+ * @ch_total: total number of observations
+ * @ch_sum: sum of observed values in seconds
+ */
+struct nilfs_cldhist {
+	uint64_t ch_count[NILFS_CLDHIST_NBUCKETS];
+	uint64_t ch_total;
+	double ch_sum;
+};
+
+/**
+ * struct nilfs_cldstats - statistics of cleaner daemon
+ * @cs_ncycles: number of cleaning cycles that tried to reclaim segments
+ * @cs_cleaned_segs: number of cleaned segments
+ * @cs_deferred_segs: number of deferred segments
+ * @cs_protected_segs: number of protected (deselected) segments
+ * @cs_live_blks: number of live blocks moved by GC
+ * @cs_defunct_blks: number of defunct blocks reclaimed by GC
+ * @cs_copied_bytes: number of bytes copied by GC
+ * @cs_freed_bytes: number of bytes in segments cleaned by GC
+ * @cs_discarded_bytes: number of bytes discarded after GC
+ * @cs_defer_skipped_segs: number of times selection passed over a
+ * segment remembered as low-yield
+ * @cs_lock_wait: total time spent waiting for the cleaner lock
+ * @cs_cycle_time: histogram of cleaning cycle durations
+ * @cs_freeze_stall: histogram of durations writers were blocked by freezes
+ * @cs_nsegs: number of segments
+ * @cs_free_segs: number of clean segments
+ * @cs_reserved_segs: number of reserved segments
+ * @cs_reclaimable_segs: number of reclaimable segments (last selection)
+ * @cs_candidate_segs: number of unprotected reclaimable segments
+ * (last selection)
+ * @cs_state: running state of the daemon
+ * @cs_emergency_level: current emergency level of free space
+ * @cs_nsegments_per_clean: current number of segments reclaimed per cycle
+ * @cs_cleaning_interval: current cleaning interval
+ * @cs_protection_period: current protection period
+ * @cs_min_reclaimable_blocks: current min. number of reclaimable blocks
+ * @cs_last_cycle_time: duration of the last cleaning cycle
+ * @cs_defer_segs: number of segments remembered as low-yield
+ */
+struct nilfs_cldstats {
+	/* counters */
+	uint64_t cs_ncycles;
+	uint64_t cs_cleaned_segs;
+	uint64_t cs_deferred_segs;
+	uint64_t cs_protected_segs;
+	uint64_t cs_live_blks;
+	uint64_t cs_defunct_blks;
+	uint64_t cs_copied_bytes;
+	uint64_t cs_freed_bytes;
+	uint64_t cs_discarded_bytes;
+	uint64_t cs_defer_skipped_segs;
+	struct timespec cs_lock_wait;
+	struct nilfs_cldhist cs_cycle_time;
+	struct nilfs_cldhist cs_freeze_stall;
+
+	/* gauges */
+	uint64_t cs_nsegs;
+	uint64_t cs_free_segs;
+	uint64_t cs_reserved_segs;
+	uint64_t cs_reclaimable_segs;
+	uint64_t cs_candidate_segs;
+	int cs_state;
+	int cs_emergency_level;
+	long cs_nsegments_per_clean;
+	struct timespec cs_cleaning_interval;
+	struct timespec cs_protection_period;
+	unsigned long cs_min_reclaimable_blocks;
+	struct timespec cs_last_cycle_time;
+	uint64_t cs_defer_segs;
+};
+
+struct nilfs_cldmetrics;
+
+void nilfs_cldhist_add(struct nilfs_cldhist *hist, const struct timespec *ts);
+
+struct nilfs_cldmetrics *nilfs_cldmetrics_create(const char *device);
+void nilfs_cldmetrics_destroy(struct nilfs_cldmetrics *metrics);
+int nilfs_cldmetrics_setup(struct nilfs_cldmetrics *metrics,
+			   const char *sockpath, const char *filepath);
+int nilfs_cldmetrics_get_fd(const struct nilfs_cldmetrics *metrics);
+int nilfs_cldmetrics_serve(struct nilfs_cldmetrics *metrics,
+			   const struct nilfs_cldstats *stats);
+int nilfs_cldmetrics_update_file(struct nilfs_cldmetrics *metrics,
+				 const struct nilfs_cldstats *stats);
+
+#endif	/* CLDMETRICS_H */
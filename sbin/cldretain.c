@@ -0,0 +1,447 @@
+/*
+ * cldretain.c - Checkpoint retention of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ *
+ * Checkpoints are thinned out by age: all of the recent ones are kept,
+ * then the first checkpoint of each hour, then the first checkpoint of
+ * each day, and older ones are deleted.  Since plain checkpoints older
+ * than the protection period are reclaimed by GC anyway, the kept ones
+ * can be turned into snapshots.  Those snapshots are remembered in a
+ * state file so that they, and only they, are turned back into plain
+ * checkpoints once they fall out of the policy; snapshots taken by
+ * users are never touched.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif	/* HAVE_UNISTD_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif	/* HAVE_FCNTL_H */
+
+#if HAVE_SYSLOG_H
+#include <syslog.h>
+#endif	/* HAVE_SYSLOG_H */
+
+#include <errno.h>
+#include "util.h"
+#include "vector.h"
+#include "cldfile.h"
+#include "cldretain.h"
+
+#define NILFS_CLDRETAIN_NCPINFO		512
+#define NILFS_CLDRETAIN_MAGIC		0x4e524554	/* "NRET" */
+#define NILFS_CLDRETAIN_VERSION		1
+
+enum nilfs_cldretain_tier {
+	NILFS_CLDRETAIN_HOURLY,
+	NILFS_CLDRETAIN_DAILY,
+	NILFS_CLDRETAIN_EXPIRED,
+};
+
+/**
+ * struct nilfs_cldretain_header - header of the state file
+ * @rh_magic: magic number
+ * @rh_version: format version
+ * @rh_pad: padding
+ * @rh_nsss: number of snapshot numbers following the header
+ */
+struct nilfs_cldretain_header {
+	uint32_t rh_magic;
+	uint16_t rh_version;
+	uint16_t rh_pad;
+	uint64_t rh_nsss;
+};
+
+/**
+ * struct nilfs_cldretain - checkpoint retention state
+ * @rt_nilfs: nilfs object
+ * @rt_path: pathname of the state file (NULL if not persistent)
+ * @rt_owned: ascending numbers of the snapshots made by retention
+ */
+struct nilfs_cldretain {
+	struct nilfs *rt_nilfs;
+	char *rt_path;
+	struct nilfs_vector *rt_owned;
+};
+
+static int nilfs_cldretain_load(struct nilfs_cldretain *retain)
+{
+	struct nilfs_cldretain_header hdr;
+	uint64_t *sss;
+	ssize_t nr;
+	int fd;
+
+	fd = open(retain->rt_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -1;
+
+	nr = read(fd, &hdr, sizeof(hdr));
+	if (nr != sizeof(hdr) || hdr.rh_magic != NILFS_CLDRETAIN_MAGIC ||
+	    hdr.rh_version != NILFS_CLDRETAIN_VERSION ||
+	    hdr.rh_nsss > SIZE_MAX / sizeof(*sss))
+		goto invalid;
+
+	if (hdr.rh_nsss > 0) {
+		sss = nilfs_vector_insert_elements(retain->rt_owned, 0,
+						   hdr.rh_nsss);
+		if (unlikely(!sss)) {
+			close(fd);
+			return -1;
+		}
+		nr = read(fd, sss, hdr.rh_nsss * sizeof(*sss));
+		if (nr != hdr.rh_nsss * sizeof(*sss)) {
+			nilfs_vector_clear(retain->rt_owned);
+			goto invalid;
+		}
+	}
+	close(fd);
+	return 0;
+
+invalid:
+	close(fd);
+	syslog(LOG_WARNING, "%s: ignored invalid retention state",
+	       retain->rt_path);
+	return 0;
+}
+
+static int nilfs_cldretain_save(struct nilfs_cldretain *retain)
+{
+	struct nilfs_cldretain_header hdr;
+	struct iovec iov[2];
+
+	if (!retain->rt_path)
+		return 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.rh_magic = NILFS_CLDRETAIN_MAGIC;
+	hdr.rh_version = NILFS_CLDRETAIN_VERSION;
+	hdr.rh_nsss = nilfs_vector_get_size(retain->rt_owned);
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = nilfs_vector_get_data(retain->rt_owned);
+	iov[1].iov_len = hdr.rh_nsss * sizeof(uint64_t);
+
+	if (unlikely(nilfs_cld_save_file(retain->rt_path, iov, 2,
+					 NILFS_CLDFILE_SYNC) < 0)) {
+		syslog(LOG_WARNING, "cannot save retention state to %s: %m",
+		       retain->rt_path);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * nilfs_cldretain_create - create checkpoint retention state
+ * @nilfs: nilfs object
+ * @path: pathname of the state file, or NULL
+ *
+ * If @path is given, the snapshots made by a previous instance are
+ * restored from the file.
+ */
+struct nilfs_cldretain *nilfs_cldretain_create(struct nilfs *nilfs,
+					       const char *path)
+{
+	struct nilfs_cldretain *retain;
+
+	retain = malloc(sizeof(*retain));
+	if (unlikely(!retain))
+		return NULL;
+
+	memset(retain, 0, sizeof(*retain));
+	retain->rt_nilfs = nilfs;
+	retain->rt_owned = nilfs_vector_create(sizeof(uint64_t));
+	if (unlikely(!retain->rt_owned))
+		goto failed;
+
+	if (path) {
+		retain->rt_path = strdup(path);
+		if (unlikely(!retain->rt_path))
+			goto failed_vector;
+
+		if (unlikely(nilfs_cldretain_load(retain) < 0))
+			syslog(LOG_WARNING,
+			       "cannot load retention state from %s: %m",
+			       path);
+	}
+	return retain;
+
+failed_vector:
+	nilfs_vector_destroy(retain->rt_owned);
+failed:
+	free(retain);
+	return NULL;
+}
+
+/**
+ * nilfs_cldretain_destroy - destroy checkpoint retention state
+ * @retain: checkpoint retention state
+ */
+void nilfs_cldretain_destroy(struct nilfs_cldretain *retain)
+{
+	nilfs_vector_destroy(retain->rt_owned);
+	free(retain->rt_path);
+	free(retain);
+}
+
+/**
+ * nilfs_cldretain_classify - find the tier and the bucket of a checkpoint
+ * @policy: retention policy
+ * @now: current time
+ * @create: creation time of the checkpoint
+ * @keyp: place to store the bucket within the tier
+ *
+ * Checkpoints young enough to be kept unconditionally are classified
+ * by the tier they will enter next, so that the one to be kept there
+ * can be turned into a snapshot before GC gets to it.
+ */
+static int
+nilfs_cldretain_classify(const struct nilfs_cldretain_policy *policy,
+			 time_t now, int64_t create, int64_t *keyp)
+{
+	int64_t age = max_t(int64_t, now - create, policy->rp_all);
+	time_t t = create;
+	struct tm tm;
+
+	if (age < policy->rp_hourly) {
+		*keyp = create / 3600;
+		return NILFS_CLDRETAIN_HOURLY;
+	}
+	if (age < policy->rp_daily) {
+		if (unlikely(!localtime_r(&t, &tm)))
+			*keyp = create / 86400;
+		else
+			*keyp = (int64_t)tm.tm_year * 366 + tm.tm_yday;
+		return NILFS_CLDRETAIN_DAILY;
+	}
+	*keyp = 0;
+	return NILFS_CLDRETAIN_EXPIRED;
+}
+
+static int nilfs_cldretain_set_mode(struct nilfs_cldretain *retain,
+				    nilfs_cno_t cno, int mode)
+{
+	if (nilfs_change_cpmode(retain->rt_nilfs, cno, mode) < 0) {
+		syslog(LOG_WARNING, "cannot change mode of checkpoint %llu: %m",
+		       (unsigned long long)cno);
+		return -1;
+	}
+	return 0;
+}
+
+static int nilfs_cldretain_own(struct nilfs_vector *owned, nilfs_cno_t cno)
+{
+	uint64_t *p;
+
+	p = nilfs_vector_get_new_element(owned);
+	if (unlikely(!p))
+		return -1;
+	*p = cno;
+	return 0;
+}
+
+/**
+ * nilfs_cldretain_apply - thin out checkpoints according to a policy
+ * @retain: checkpoint retention state
+ * @policy: retention policy
+ * @now: current time
+ * @stat: place to store the result
+ *
+ * The checkpoints are enumerated in batches from the oldest one.  The
+ * first checkpoint of each bucket is kept; the others are deleted
+ * unless they are younger than @policy->rp_all or are snapshots not
+ * made by retention.  The latest checkpoint is never deleted.
+ *
+ * Return: 0 on success, or -1 on failure with errno set.
+ */
+int nilfs_cldretain_apply(struct nilfs_cldretain *retain,
+			  const struct nilfs_cldretain_policy *policy,
+			  time_t now, struct nilfs_cldretain_stat *stat)
+{
+	struct nilfs_cpinfo cpinfo[NILFS_CLDRETAIN_NCPINFO];
+	struct nilfs_cpstat cpstat;
+	struct nilfs_vector *owned;
+	const uint64_t *old;
+	const struct nilfs_cpinfo *ci;
+	size_t nold, iold = 0;
+	nilfs_cno_t cno = NILFS_CNO_MIN, visited = 0;
+	int64_t key, prev_key = 0;
+	int tier, prev_tier = -1;
+	int keep, mine, changed = 0;
+	ssize_t n, i;
+	int ret = -1;
+
+	memset(stat, 0, sizeof(*stat));
+	if (unlikely(nilfs_get_cpstat(retain->rt_nilfs, &cpstat) < 0))
+		return -1;
+
+	owned = nilfs_vector_create(sizeof(uint64_t));
+	if (unlikely(!owned))
+		return -1;
+	old = nilfs_vector_get_data(retain->rt_owned);
+	nold = nilfs_vector_get_size(retain->rt_owned);
+
+	for (;;) {
+		n = nilfs_get_cpinfo(retain->rt_nilfs, cno, NILFS_CHECKPOINT,
+				     cpinfo, NILFS_CLDRETAIN_NCPINFO);
+		if (unlikely(n < 0))
+			goto failed;
+		if (n == 0)
+			break;
+
+		for (i = 0, ci = cpinfo; i < n; i++, ci++) {
+			cno = ci->ci_cno;
+			if (cno >= cpstat.cs_cno - 1)
+				goto done;
+			visited = cno;
+			stat->rs_ncps++;
+
+			while (iold < nold && old[iold] < cno)
+				iold++;
+			mine = nilfs_cpinfo_snapshot(ci) && iold < nold &&
+				old[iold] == cno;
+
+			tier = nilfs_cldretain_classify(policy, now,
+							ci->ci_create, &key);
+			keep = tier != NILFS_CLDRETAIN_EXPIRED &&
+				(tier != prev_tier || key != prev_key);
+			prev_tier = tier;
+			prev_key = key;
+
+			if (keep && policy->rp_promote) {
+				if (!nilfs_cpinfo_snapshot(ci)) {
+					if (nilfs_cldretain_set_mode(
+						    retain, cno,
+						    NILFS_SNAPSHOT) < 0)
+						continue;
+					stat->rs_promoted++;
+					mine = 1;
+				}
+				if (mine && unlikely(nilfs_cldretain_own(
+						owned, cno) < 0))
+					goto failed;
+				continue;
+			}
+
+			if (mine) {
+				/* release the snapshot made by retention */
+				if (nilfs_cldretain_set_mode(
+					    retain, cno, NILFS_CHECKPOINT) < 0) {
+					if (unlikely(nilfs_cldretain_own(
+							owned, cno) < 0))
+						goto failed;
+					continue;
+				}
+				stat->rs_demoted++;
+			} else if (nilfs_cpinfo_snapshot(ci)) {
+				continue;
+			}
+
+			if (keep || now - ci->ci_create < policy->rp_all)
+				continue;
+
+			if (nilfs_delete_checkpoint(retain->rt_nilfs,
+						    cno) < 0) {
+				if (errno != ENOENT)
+					syslog(LOG_WARNING,
+					       "cannot delete checkpoint %llu: %m",
+					       (unsigned long long)cno);
+				continue;
+			}
+			stat->rs_deleted++;
+		}
+		cno = cpinfo[n - 1].ci_cno + 1;
+	}
+done:
+	if (nilfs_vector_get_size(owned) != nold ||
+	    (nold > 0 && memcmp(nilfs_vector_get_data(owned), old,
+				nold * sizeof(*old)) != 0))
+		changed = 1;
+	ret = 0;
+	goto out;
+
+failed:
+	/* keep track of the snapshots not visited yet */
+	for ( ; iold < nold; iold++) {
+		if (old[iold] > visited &&
+		    unlikely(nilfs_cldretain_own(owned, old[iold]) < 0)) {
+			nilfs_vector_destroy(owned);
+			return -1;
+		}
+	}
+	changed = 1;
+out:
+	if (changed) {
+		nilfs_vector_destroy(retain->rt_owned);
+		retain->rt_owned = owned;
+		nilfs_cldretain_save(retain);
+	} else {
+		nilfs_vector_destroy(owned);
+	}
+	return ret;
+}
+
+/**
+ * nilfs_cldretain_release - turn all snapshots made by retention back
+ * @retain: checkpoint retention state
+ * @stat: place to store the result
+ *
+ * This is used once retention has been disabled, so that the snapshots
+ * it made do not stay around forever.  Snapshots that cannot be changed
+ * are kept track of and retried by the next call.
+ *
+ * Return: number of snapshots still owned by retention.
+ */
+size_t nilfs_cldretain_release(struct nilfs_cldretain *retain,
+			       struct nilfs_cldretain_stat *stat)
+{
+	uint64_t *owned = nilfs_vector_get_data(retain->rt_owned);
+	size_t nold = nilfs_vector_get_size(retain->rt_owned);
+	size_t i, n = 0;
+
+	memset(stat, 0, sizeof(*stat));
+	for (i = 0; i < nold; i++) {
+		if (nilfs_change_cpmode(retain->rt_nilfs, owned[i],
+					NILFS_CHECKPOINT) < 0 &&
+		    errno != ENOENT) {
+			syslog(LOG_WARNING,
+			       "cannot change mode of checkpoint %llu: %m",
+			       (unsigned long long)owned[i]);
+			owned[n++] = owned[i];
+			continue;
+		}
+		stat->rs_demoted++;
+	}
+	if (n < nold) {
+		nilfs_vector_delete_elements(retain->rt_owned, n, nold - n);
+		nilfs_cldretain_save(retain);
+	}
+	return n;
+}
+
+/**
+ * nilfs_cldretain_nowned - get the number of snapshots made by retention
+ * @retain: checkpoint retention state
+ */
+size_t nilfs_cldretain_nowned(const struct nilfs_cldretain *retain)
+{
+	return nilfs_vector_get_size(retain->rt_owned);
+}
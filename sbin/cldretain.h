@@ -0,0 +1,61 @@
+/*
+ * cldretain.h - Checkpoint retention of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifndef CLDRETAIN_H
+#define CLDRETAIN_H
+
+#include <sys/types.h>	/* size_t */
+#include <stdint.h>	/* int64_t */
+#include <time.h>	/* time_t */
+#include "nilfs.h"
+
+/**
+ * struct nilfs_cldretain_policy - checkpoint retention policy
+ * @rp_all: age in seconds below which all checkpoints are kept
+ * @rp_hourly: age in seconds below which one checkpoint per hour is kept
+ * @rp_daily: age in seconds below which one checkpoint per day is kept
+ * @rp_promote: flag that indicates turning kept checkpoints into
+ * snapshots
+ *
+ * The ages are not decreasing in this order; a tier is empty if its age
+ * equals that of the previous one.
+ */
+struct nilfs_cldretain_policy {
+	int64_t rp_all;
+	int64_t rp_hourly;
+	int64_t rp_daily;
+	int rp_promote;
+};
+
+/**
+ * struct nilfs_cldretain_stat - result of applying a retention policy
+ * @rs_ncps: number of checkpoints examined
+ * @rs_deleted: number of checkpoints deleted
+ * @rs_promoted: number of checkpoints turned into snapshots
+ * @rs_demoted: number of snapshots turned back into checkpoints
+ */
+struct nilfs_cldretain_stat {
+	size_t rs_ncps;
+	size_t rs_deleted;
+	size_t rs_promoted;
+	size_t rs_demoted;
+};
+
+struct nilfs_cldretain;
+
+struct nilfs_cldretain *nilfs_cldretain_create(struct nilfs *nilfs,
+					       const char *path);
+void nilfs_cldretain_destroy(struct nilfs_cldretain *retain);
+
+int nilfs_cldretain_apply(struct nilfs_cldretain *retain,
+			  const struct nilfs_cldretain_policy *policy,
+			  time_t now, struct nilfs_cldretain_stat *stat);
+size_t nilfs_cldretain_release(struct nilfs_cldretain *retain,
+			       struct nilfs_cldretain_stat *stat);
+size_t nilfs_cldretain_nowned(const struct nilfs_cldretain *retain);
+
+#endif	/* CLDRETAIN_H */
@@ -0,0 +1,229 @@
+/*
+ * cldselect.c - Victim grouping of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ *
+ * Live blocks of the segments reclaimed by one cleaning step are written
+ * out together.  If a step mixes segments holding data that has already
+ * survived GC with segments of freshly written data, cold data that is
+ * likely to stay live ends up next to data that will soon be overwritten,
+ * and has to be copied again when the new segments are reclaimed.
+ *
+ * The segment usage file only tells when a segment was last written, so
+ * the update frequency of the data in a segment is estimated by how many
+ * times it has survived GC.  Segments written by users are generation 0.
+ * The time windows in which GC steps ran are remembered with the
+ * generation of the step, and a segment last modified inside a window
+ * gets the next generation: it holds survivors of that step, or is a
+ * victim whose reclaim was deferred because it was mostly live.  Steps
+ * are then made of victims of the same generation, taken in the order of
+ * the selection policy, so survivors of similar age and temperature are
+ * packed into the same new segments.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#include <errno.h>
+#include "util.h"
+#include "cldselect.h"
+
+/**
+ * struct nilfs_cldselect_seg - estimated generation of a segment
+ * @sg_lastmod: modification time the generation was estimated for
+ * @sg_gen: generation
+ */
+struct nilfs_cldselect_seg {
+	int64_t sg_lastmod;
+	int sg_gen;
+};
+
+/**
+ * struct nilfs_cldselect_window - time window of a GC step
+ * @sw_start: start time in seconds
+ * @sw_end: end time in seconds
+ * @sw_gen: generation of data written in the window
+ */
+struct nilfs_cldselect_window {
+	int64_t sw_start;
+	int64_t sw_end;
+	int sw_gen;
+};
+
+/**
+ * struct nilfs_cldselect - victim grouping state
+ * @sl_segs: per segment generations indexed by segment number
+ * @sl_nsegs: number of entries of @sl_segs
+ * @sl_windows: ring buffer of recent GC step windows
+ * @sl_nwindows: number of valid entries in @sl_windows
+ * @sl_next: index of @sl_windows to be overwritten next
+ *
+ * A window is only needed until the segments written in it have been
+ * classified, which happens at the next selection, so a short ring of
+ * windows suffices.
+ */
+struct nilfs_cldselect {
+	struct nilfs_cldselect_seg *sl_segs;
+	uint64_t sl_nsegs;
+	struct nilfs_cldselect_window sl_windows[NILFS_CLDSELECT_NWINDOWS];
+	unsigned int sl_nwindows;
+	unsigned int sl_next;
+};
+
+/**
+ * nilfs_cldselect_create - create victim grouping state
+ */
+struct nilfs_cldselect *nilfs_cldselect_create(void)
+{
+	struct nilfs_cldselect *sel;
+
+	sel = malloc(sizeof(*sel));
+	if (unlikely(!sel))
+		return NULL;
+
+	memset(sel, 0, sizeof(*sel));
+	return sel;
+}
+
+/**
+ * nilfs_cldselect_destroy - destroy victim grouping state
+ * @sel: victim grouping state
+ */
+void nilfs_cldselect_destroy(struct nilfs_cldselect *sel)
+{
+	free(sel->sl_segs);
+	free(sel);
+}
+
+static int nilfs_cldselect_window_gen(const struct nilfs_cldselect *sel,
+				      int64_t t)
+{
+	const struct nilfs_cldselect_window *w;
+	int gen = 0;
+	unsigned int i;
+
+	for (i = 0; i < sel->sl_nwindows; i++) {
+		w = &sel->sl_windows[i];
+		if (t >= w->sw_start && t <= w->sw_end && w->sw_gen > gen)
+			gen = w->sw_gen;
+	}
+	return gen;
+}
+
+/**
+ * nilfs_cldselect_classify - estimate generation of a segment
+ * @sel: victim grouping state
+ * @segnum: segment number
+ * @lastmod: modification time of the segment
+ *
+ * Must be called for candidate segments before nilfs_cldselect_group().
+ * The estimate is redone only when the segment has been written since.
+ *
+ * Return: generation of the segment, or -1 if out of memory.
+ */
+int nilfs_cldselect_classify(struct nilfs_cldselect *sel, uint64_t segnum,
+			     int64_t lastmod)
+{
+	struct nilfs_cldselect_seg *segs, *sg;
+	uint64_t nsegs;
+
+	if (segnum >= sel->sl_nsegs) {
+		nsegs = max_t(uint64_t, segnum + 1, sel->sl_nsegs * 2);
+		segs = realloc(sel->sl_segs, nsegs * sizeof(*segs));
+		if (unlikely(!segs))
+			return -1;
+		memset(segs + sel->sl_nsegs, 0,
+		       (nsegs - sel->sl_nsegs) * sizeof(*segs));
+		sel->sl_segs = segs;
+		sel->sl_nsegs = nsegs;
+	}
+
+	sg = &sel->sl_segs[segnum];
+	if (sg->sg_lastmod != lastmod) {
+		sg->sg_lastmod = lastmod;
+		sg->sg_gen = nilfs_cldselect_window_gen(sel, lastmod);
+	}
+	return sg->sg_gen;
+}
+
+static int nilfs_cldselect_gen(const struct nilfs_cldselect *sel,
+			       uint64_t segnum)
+{
+	return segnum < sel->sl_nsegs ? sel->sl_segs[segnum].sg_gen : 0;
+}
+
+/**
+ * nilfs_cldselect_group - choose victims of the same generation
+ * @sel: victim grouping state
+ * @segnums: candidate segment numbers in the order of preference
+ * @nblocks: numbers of blocks of the candidates
+ * @n: number of candidates
+ * @nsegs: maximum number of victims
+ * @genp: place to store the generation of the chosen victims
+ *
+ * The first candidate is always chosen; it is followed by the next
+ * candidates of the same generation.  The chosen victims are moved to
+ * the head of @segnums and @nblocks, keeping their order.
+ *
+ * Return: number of chosen victims.
+ */
+size_t nilfs_cldselect_group(const struct nilfs_cldselect *sel,
+			     uint64_t *segnums, uint32_t *nblocks, size_t n,
+			     size_t nsegs, int *genp)
+{
+	size_t i, nchosen = 0;
+	uint64_t segnum;
+	uint32_t blocks;
+	int gen;
+
+	if (n == 0 || nsegs == 0)
+		return 0;
+
+	gen = nilfs_cldselect_gen(sel, segnums[0]);
+	for (i = 0; i < n && nchosen < nsegs; i++) {
+		if (nilfs_cldselect_gen(sel, segnums[i]) != gen)
+			continue;
+		segnum = segnums[i];
+		blocks = nblocks[i];
+		memmove(&segnums[nchosen + 1], &segnums[nchosen],
+			(i - nchosen) * sizeof(*segnums));
+		memmove(&nblocks[nchosen + 1], &nblocks[nchosen],
+			(i - nchosen) * sizeof(*nblocks));
+		segnums[nchosen] = segnum;
+		nblocks[nchosen] = blocks;
+		nchosen++;
+	}
+	*genp = gen;
+	return nchosen;
+}
+
+/**
+ * nilfs_cldselect_add_window - remember time window of a GC step
+ * @sel: victim grouping state
+ * @start: start time of the step in seconds
+ * @end: end time of the step in seconds
+ * @gen: generation of the victims of the step
+ */
+void nilfs_cldselect_add_window(struct nilfs_cldselect *sel, int64_t start,
+				int64_t end, int gen)
+{
+	struct nilfs_cldselect_window *w = &sel->sl_windows[sel->sl_next];
+
+	w->sw_start = start;
+	w->sw_end = end;
+	w->sw_gen = min_t(int, gen + 1, NILFS_CLDSELECT_MAX_GEN);
+
+	sel->sl_next = (sel->sl_next + 1) % NILFS_CLDSELECT_NWINDOWS;
+	if (sel->sl_nwindows < NILFS_CLDSELECT_NWINDOWS)
+		sel->sl_nwindows++;
+}
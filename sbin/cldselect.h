@@ -0,0 +1,31 @@
+/*
+ * cldselect.h - Victim grouping of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifndef CLDSELECT_H
+#define CLDSELECT_H
+
+#include <sys/types.h>	/* size_t */
+#include <stdint.h>	/* uint64_t */
+
+#define NILFS_CLDSELECT_MAX_GEN		3	/* coldest generation */
+#define NILFS_CLDSELECT_NWINDOWS	64
+#define NILFS_CLDSELECT_LOOKAHEAD	64	/* candidates examined */
+
+struct nilfs_cldselect;
+
+struct nilfs_cldselect *nilfs_cldselect_create(void);
+void nilfs_cldselect_destroy(struct nilfs_cldselect *sel);
+
+int nilfs_cldselect_classify(struct nilfs_cldselect *sel, uint64_t segnum,
+			     int64_t lastmod);
+size_t nilfs_cldselect_group(const struct nilfs_cldselect *sel,
+			     uint64_t *segnums, uint32_t *nblocks, size_t n,
+			     size_t nsegs, int *genp);
+void nilfs_cldselect_add_window(struct nilfs_cldselect *sel, int64_t start,
+				int64_t end, int gen);
+
+#endif	/* CLDSELECT_H */
@@ -0,0 +1,476 @@
+/*
+ * cldsim.c - Write amplification simulator for cleanerd victim selection
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ *
+ * This program replays a synthetic overwrite workload on a model of a
+ * log-structured file system and reports the write amplification of GC
+ * with victims batched in timestamp order, and with victims of the same
+ * generation grouped by the code nilfs_cleanerd uses (cldselect.c).
+ *
+ * The model follows nilfs_cleanerd: user and GC writes share the log
+ * head, segments carry the time of their last write, victims are the
+ * oldest segments outside the protection period, the live blocks of a
+ * cleaning step are written out together, and a step whose segments
+ * have less than min_reclaimable_blocks reclaimable blocks on average
+ * only has their modification time updated.  Time advances by one unit
+ * per segment filled by users.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_ERR_H
+#include <err.h>
+#endif	/* HAVE_ERR_H */
+
+#include <errno.h>
+#include "util.h"
+#include "cldselect.h"
+
+#ifdef _GNU_SOURCE
+#include <getopt.h>
+
+static const struct option long_option[] = {
+	{"blocks", required_argument, NULL, 'b'},
+	{"help", no_argument, NULL, 'h'},
+	{"min-reclaimable", required_argument, NULL, 'm'},
+	{"nsegments-per-clean", required_argument, NULL, 'n'},
+	{"protection", required_argument, NULL, 'p'},
+	{"segments", required_argument, NULL, 's'},
+	{"utilization", required_argument, NULL, 'u'},
+	{"writes", required_argument, NULL, 'w'},
+	{NULL, 0, NULL, 0}
+};
+
+#define CLDSIM_USAGE							\
+	"Usage: %s [OPTION]...\n"					\
+	"  -b, --blocks=N\t\tblocks per segment (default 256)\n"	\
+	"  -h, --help\t\t\tdisplay this help and exit\n"		\
+	"  -m, --min-reclaimable=PERCENT\n"				\
+	"\t\t\t\tmin_reclaimable_blocks (default 10)\n"		\
+	"  -n, --nsegments-per-clean=N\tsegments per cleaning step "	\
+	"(default 4)\n"							\
+	"  -p, --protection=N\t\tprotection period in segment writes "	\
+	"(default 16)\n"						\
+	"  -s, --segments=N\t\tnumber of segments (default 1024)\n"	\
+	"  -u, --utilization=PERCENT\tdisk utilization (default 75)\n"	\
+	"  -w, --writes=N\t\tuser writes in multiples of the data size "\
+	"(default 20)\n"
+#else	/* !_GNU_SOURCE */
+#define CLDSIM_USAGE							\
+	"Usage: %s [-h] [-b blocks] [-m percent] [-n nsegs] "		\
+	"[-p segs] [-s segments]\n"					\
+	"          [-u percent] [-w writes]\n"
+#endif	/* _GNU_SOURCE */
+
+#define CLDSIM_NOBLOCK		UINT32_MAX
+#define CLDSIM_MIN_CLEAN	8	/* min_clean_segments */
+#define CLDSIM_MAX_CLEAN	16	/* max_clean_segments */
+
+/* parameters */
+static uint32_t sim_nsegs = 1024;
+static uint32_t sim_blocks = 256;
+static unsigned int sim_utilization = 75;
+static unsigned int sim_min_reclaimable = 10;
+static unsigned int sim_nsegments_per_clean = 4;
+static int64_t sim_protection = 16;
+static unsigned int sim_writes = 20;
+
+/**
+ * struct cldsim_workload - overwrite pattern
+ * @name: name of the workload
+ * @hot_data: percentage of data that is hot
+ * @hot_writes: percentage of writes that go to hot data
+ */
+struct cldsim_workload {
+	const char *name;
+	unsigned int hot_data;
+	unsigned int hot_writes;
+};
+
+static const struct cldsim_workload cldsim_workloads[] = {
+	{ "uniform", 100, 100 },
+	{ "hot/cold 80/20", 20, 80 },
+	{ "hot/cold 90/10", 10, 90 },
+	{ "hot/cold 95/5", 5, 95 },
+};
+
+/**
+ * struct cldsim_seg - simulated segment
+ * @sg_lastmod: time of the last write
+ * @sg_nlive: number of live blocks
+ * @sg_used: number of blocks written
+ */
+struct cldsim_seg {
+	int64_t sg_lastmod;
+	uint32_t sg_nlive;
+	uint32_t sg_used;
+};
+
+/**
+ * struct cldsim - simulated file system
+ * @segs: segments
+ * @owner: logical block stored in each physical block
+ * @where: physical block of each logical block
+ * @nlogical: number of logical blocks
+ * @free: stack of free segment numbers
+ * @nfree: number of free segments
+ * @head: segment at the log head
+ * @now: current time
+ * @rand: state of the random number generator
+ * @sel: victim grouping state, or NULL for timestamp order
+ * @user_blocks: number of blocks written by users after warm-up
+ * @gc_blocks: number of blocks written by GC after warm-up
+ * @nsteps: number of cleaning steps after warm-up
+ * @ndeferred: number of deferred steps after warm-up
+ * @warm: flag set once the warm-up is over
+ */
+struct cldsim {
+	struct cldsim_seg *segs;
+	uint32_t *owner;
+	uint64_t *where;
+	uint64_t nlogical;
+	uint32_t *free;
+	uint32_t nfree;
+	uint32_t head;
+	int64_t now;
+	uint64_t rand;
+	struct nilfs_cldselect *sel;
+	uint64_t user_blocks;
+	uint64_t gc_blocks;
+	uint64_t nsteps;
+	uint64_t ndeferred;
+	int warm;
+};
+
+static uint64_t cldsim_rand(struct cldsim *sim)
+{
+	/* xorshift64* */
+	sim->rand ^= sim->rand >> 12;
+	sim->rand ^= sim->rand << 25;
+	sim->rand ^= sim->rand >> 27;
+	return sim->rand * 0x2545F4914F6CDD1DULL;
+}
+
+static int cldsim_open_head(struct cldsim *sim)
+{
+	if (sim->nfree == 0)
+		return -1;
+	sim->head = sim->free[--sim->nfree];
+	sim->segs[sim->head].sg_used = 0;
+	sim->segs[sim->head].sg_nlive = 0;
+	return 0;
+}
+
+static int cldsim_append(struct cldsim *sim, uint64_t lblk)
+{
+	struct cldsim_seg *sg = &sim->segs[sim->head];
+	uint64_t pblk;
+
+	if (sg->sg_used == sim_blocks) {
+		if (cldsim_open_head(sim) < 0)
+			return -1;
+		sg = &sim->segs[sim->head];
+	}
+	if (sim->where[lblk] != UINT64_MAX) {
+		pblk = sim->where[lblk];
+		sim->owner[pblk] = CLDSIM_NOBLOCK;
+		sim->segs[pblk / sim_blocks].sg_nlive--;
+	}
+	pblk = (uint64_t)sim->head * sim_blocks + sg->sg_used++;
+	sim->owner[pblk] = lblk;
+	sim->where[lblk] = pblk;
+	sg->sg_nlive++;
+	sg->sg_lastmod = sim->now;
+	return 0;
+}
+
+static int cldsim_comp_lastmod(const void *elem1, const void *elem2,
+			       void *arg)
+{
+	const struct cldsim_seg *segs = arg;
+	uint32_t seg1 = *(const uint32_t *)elem1;
+	uint32_t seg2 = *(const uint32_t *)elem2;
+
+	if (segs[seg1].sg_lastmod != segs[seg2].sg_lastmod)
+		return segs[seg1].sg_lastmod < segs[seg2].sg_lastmod ? -1 : 1;
+	return seg1 < seg2 ? -1 : seg1 > seg2;
+}
+
+/**
+ * cldsim_clean_step - run a cleaning step
+ * @sim: simulated file system
+ * @force: ignore min_reclaimable_blocks
+ *
+ * Return: number of segments freed, or -1 if no victims are available.
+ */
+static int cldsim_clean_step(struct cldsim *sim, int force)
+{
+	uint64_t segnums[NILFS_CLDSELECT_LOOKAHEAD];
+	uint32_t nblocks[NILFS_CLDSELECT_LOOKAHEAD];
+	uint32_t *cands, ncands = 0, seg, i, b;
+	uint64_t live = 0, pblk;
+	size_t nvictims;
+	int gen = 0, ret = 0;
+
+	cands = malloc(sizeof(*cands) * sim_nsegs);
+	if (!cands)
+		err(EXIT_FAILURE, NULL);
+
+	for (seg = 0; seg < sim_nsegs; seg++) {
+		if (seg == sim->head || sim->segs[seg].sg_used == 0 ||
+		    sim->segs[seg].sg_lastmod >= sim->now - sim_protection)
+			continue;
+		cands[ncands++] = seg;
+		if (sim->sel)
+			nilfs_cldselect_classify(sim->sel, seg,
+						 sim->segs[seg].sg_lastmod);
+	}
+	if (ncands == 0) {
+		free(cands);
+		return -1;
+	}
+	qsort_r(cands, ncands, sizeof(*cands), cldsim_comp_lastmod,
+		sim->segs);
+
+	nvictims = min_t(size_t, ncands, NILFS_CLDSELECT_LOOKAHEAD);
+	for (i = 0; i < nvictims; i++) {
+		segnums[i] = cands[i];
+		nblocks[i] = sim->segs[cands[i]].sg_used;
+	}
+	if (sim->sel)
+		nvictims = nilfs_cldselect_group(sim->sel, segnums, nblocks,
+						 nvictims,
+						 sim_nsegments_per_clean,
+						 &gen);
+	else
+		nvictims = min_t(size_t, nvictims, sim_nsegments_per_clean);
+	free(cands);
+
+	for (i = 0; i < nvictims; i++)
+		live += sim->segs[segnums[i]].sg_nlive;
+
+	if (sim->warm)
+		sim->nsteps++;
+
+	if (!force && (uint64_t)sim_blocks * nvictims - live <
+	    (uint64_t)sim_blocks * sim_min_reclaimable / 100 * nvictims) {
+		/* deferred: only the modification time is updated */
+		for (i = 0; i < nvictims; i++)
+			sim->segs[segnums[i]].sg_lastmod = sim->now;
+		if (sim->warm)
+			sim->ndeferred++;
+		goto out;
+	}
+
+	for (i = 0; i < nvictims; i++) {
+		seg = segnums[i];
+		for (b = 0; b < sim_blocks; b++) {
+			pblk = (uint64_t)seg * sim_blocks + b;
+			if (sim->owner[pblk] == CLDSIM_NOBLOCK)
+				continue;
+			if (cldsim_append(sim, sim->owner[pblk]) < 0)
+				errx(EXIT_FAILURE, "out of space during GC");
+			if (sim->warm)
+				sim->gc_blocks++;
+		}
+		sim->segs[seg].sg_used = 0;
+		sim->free[sim->nfree++] = seg;
+		ret++;
+	}
+out:
+	if (sim->sel)
+		nilfs_cldselect_add_window(sim->sel, sim->now, sim->now, gen);
+	return ret;
+}
+
+/**
+ * cldsim_clean - reclaim segments while free segments are short
+ * @sim: simulated file system
+ *
+ * When every candidate is deferred, the threshold is ignored as
+ * nilfs_cleanerd does with mc_min_reclaimable_blocks.
+ */
+static void cldsim_clean(struct cldsim *sim)
+{
+	unsigned int nidle = 0;
+	uint32_t best;
+
+	if (sim->nfree >= CLDSIM_MIN_CLEAN)
+		return;
+
+	best = sim->nfree;
+	while (sim->nfree < CLDSIM_MAX_CLEAN && nidle < 2 * sim_nsegs) {
+		if (cldsim_clean_step(sim, nidle >= sim_nsegs) < 0)
+			break;
+		if (sim->nfree > best) {
+			best = sim->nfree;
+			nidle = 0;
+		} else {
+			nidle++;
+		}
+	}
+	/* GC runs at a time of its own */
+	sim->now++;
+}
+
+static void cldsim_run(const struct cldsim_workload *wl, int grouped)
+{
+	struct cldsim sim;
+	uint64_t nphys = (uint64_t)sim_nsegs * sim_blocks;
+	uint64_t nwrites, nhot, lblk, i;
+	uint32_t seg;
+
+	memset(&sim, 0, sizeof(sim));
+	sim.segs = calloc(sim_nsegs, sizeof(*sim.segs));
+	sim.owner = malloc(nphys * sizeof(*sim.owner));
+	sim.free = malloc(sim_nsegs * sizeof(*sim.free));
+	sim.nlogical = nphys * sim_utilization / 100;
+	sim.where = malloc(sim.nlogical * sizeof(*sim.where));
+	if (!sim.segs || !sim.owner || !sim.free || !sim.where)
+		err(EXIT_FAILURE, NULL);
+	if (grouped) {
+		sim.sel = nilfs_cldselect_create();
+		if (!sim.sel)
+			err(EXIT_FAILURE, NULL);
+	}
+
+	for (i = 0; i < nphys; i++)
+		sim.owner[i] = CLDSIM_NOBLOCK;
+	for (i = 0; i < sim.nlogical; i++)
+		sim.where[i] = UINT64_MAX;
+	for (seg = sim_nsegs; seg > 0; seg--)
+		sim.free[sim.nfree++] = seg - 1;
+	sim.rand = 0x9e3779b97f4a7c15ULL;
+	cldsim_open_head(&sim);
+
+	/* fill the file system sequentially */
+	for (lblk = 0; lblk < sim.nlogical; lblk++) {
+		if (sim.segs[sim.head].sg_used == sim_blocks)
+			sim.now++;
+		cldsim_append(&sim, lblk);
+	}
+	sim.warm = 1;
+
+	nhot = max_t(uint64_t, sim.nlogical * wl->hot_data / 100, 1);
+	nwrites = sim.nlogical * sim_writes;
+	for (i = 0; i < nwrites; i++) {
+		if (nhot == sim.nlogical ||
+		    cldsim_rand(&sim) % 100 < wl->hot_writes)
+			lblk = cldsim_rand(&sim) % nhot;
+		else
+			lblk = nhot + cldsim_rand(&sim) % (sim.nlogical - nhot);
+
+		if (sim.segs[sim.head].sg_used == sim_blocks) {
+			cldsim_clean(&sim);
+			sim.now++;
+		}
+		if (cldsim_append(&sim, lblk) < 0)
+			errx(EXIT_FAILURE, "out of space");
+		sim.user_blocks++;
+	}
+
+	printf("%-16s %-10s %6.3f %12llu %10llu %10llu\n", wl->name,
+	       grouped ? "grouped" : "timestamp",
+	       (double)(sim.user_blocks + sim.gc_blocks) / sim.user_blocks,
+	       (unsigned long long)sim.gc_blocks,
+	       (unsigned long long)sim.nsteps,
+	       (unsigned long long)sim.ndeferred);
+
+	if (sim.sel)
+		nilfs_cldselect_destroy(sim.sel);
+	free(sim.segs);
+	free(sim.owner);
+	free(sim.free);
+	free(sim.where);
+}
+
+static unsigned long cldsim_parse(const char *arg, unsigned long min,
+				  unsigned long max)
+{
+	unsigned long val;
+	char *endptr;
+
+	errno = 0;
+	val = strtoul(arg, &endptr, 10);
+	if (endptr == arg || *endptr != '\0' || errno || val < min ||
+	    val > max)
+		errx(EXIT_FAILURE, "invalid argument: %s", arg);
+	return val;
+}
+
+int main(int argc, char *argv[])
+{
+	char *progname, *last;
+	int c, i;
+#ifdef _GNU_SOURCE
+	int option_index;
+#endif	/* _GNU_SOURCE */
+
+	last = strrchr(argv[0], '/');
+	progname = last ? last + 1 : argv[0];
+
+#ifdef _GNU_SOURCE
+	while ((c = getopt_long(argc, argv, "b:hm:n:p:s:u:w:",
+				long_option, &option_index)) >= 0) {
+#else	/* !_GNU_SOURCE */
+	while ((c = getopt(argc, argv, "b:hm:n:p:s:u:w:")) >= 0) {
+#endif	/* _GNU_SOURCE */
+		switch (c) {
+		case 'b':
+			sim_blocks = cldsim_parse(optarg, 16, 65536);
+			break;
+		case 'h':
+			fprintf(stderr, CLDSIM_USAGE, progname);
+			exit(EXIT_SUCCESS);
+		case 'm':
+			sim_min_reclaimable = cldsim_parse(optarg, 0, 100);
+			break;
+		case 'n':
+			sim_nsegments_per_clean =
+				cldsim_parse(optarg, 1, CLDSIM_MIN_CLEAN);
+			break;
+		case 'p':
+			sim_protection = cldsim_parse(optarg, 0, 1 << 20);
+			break;
+		case 's':
+			sim_nsegs = cldsim_parse(optarg, 64, 1 << 20);
+			break;
+		case 'u':
+			sim_utilization = cldsim_parse(optarg, 10, 90);
+			break;
+		case 'w':
+			sim_writes = cldsim_parse(optarg, 1, 1000);
+			break;
+		default:
+			fprintf(stderr, CLDSIM_USAGE, progname);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	printf("# %u segments of %u blocks, utilization %u%%, "
+	       "nsegments_per_clean %u,\n"
+	       "# min_reclaimable_blocks %u%%, protection %lld segment writes\n",
+	       sim_nsegs, sim_blocks, sim_utilization, sim_nsegments_per_clean,
+	       sim_min_reclaimable, (long long)sim_protection);
+	printf("%-16s %-10s %6s %12s %10s %10s\n", "workload", "policy", "WA",
+	       "gc_blocks", "steps", "deferred");
+	for (i = 0; i < ARRAY_SIZE(cldsim_workloads); i++) {
+		cldsim_run(&cldsim_workloads[i], 0);
+		cldsim_run(&cldsim_workloads[i], 1);
+	}
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,161 @@
+/*
+ * cldtrace.c - Flight recorder of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ *
+ * The flight recorder keeps the most recent structured events of the
+ * cleaner daemon in a fixed-size ring buffer so that GC stalls can be
+ * diagnosed after the fact without enabling debug logging.  Events are
+ * only recorded from the main loop of the daemon, so the ring needs no
+ * locking; recording an event costs a clock read and a few stores.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif	/* HAVE_UNISTD_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif	/* HAVE_FCNTL_H */
+
+#if HAVE_TIME_H
+#include <time.h>
+#endif	/* HAVE_TIME_H */
+
+#include <errno.h>
+#include "util.h"
+#include "cldfile.h"
+#include "cldtrace.h"
+
+/**
+ * struct nilfs_cldtrace - flight recorder
+ * @ct_seq: total number of recorded events
+ * @ct_events: ring buffer of events
+ */
+struct nilfs_cldtrace {
+	uint64_t ct_seq;
+	struct nilfs_cldtrace_event ct_events[NILFS_CLDTRACE_NEVENTS];
+};
+
+static uint64_t nilfs_cldtrace_now(clockid_t clk)
+{
+	struct timespec ts;
+
+	if (unlikely(clock_gettime(clk, &ts) < 0))
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * nilfs_cldtrace_create - create flight recorder
+ */
+struct nilfs_cldtrace *nilfs_cldtrace_create(void)
+{
+	struct nilfs_cldtrace *trace;
+
+	trace = calloc(1, sizeof(*trace));
+	return trace;
+}
+
+/**
+ * nilfs_cldtrace_destroy - destroy flight recorder
+ * @trace: flight recorder
+ */
+void nilfs_cldtrace_destroy(struct nilfs_cldtrace *trace)
+{
+	free(trace);
+}
+
+/**
+ * nilfs_cldtrace_record - record an event
+ * @trace: flight recorder
+ * @type: event type
+ * @err: error number, or zero
+ * @arg0: first argument
+ * @arg1: second argument
+ * @arg2: third argument
+ * @arg3: fourth argument
+ *
+ * The oldest event is overwritten if the ring buffer is full.
+ */
+void nilfs_cldtrace_record(struct nilfs_cldtrace *trace, int type, int err,
+			   uint64_t arg0, uint64_t arg1, uint64_t arg2,
+			   uint64_t arg3)
+{
+	struct nilfs_cldtrace_event *ev;
+
+	ev = &trace->ct_events[trace->ct_seq & (NILFS_CLDTRACE_NEVENTS - 1)];
+	ev->te_time = nilfs_cldtrace_now(CLOCK_MONOTONIC);
+	ev->te_type = type;
+	ev->te_pad = 0;
+	ev->te_err = err;
+	ev->te_args[0] = arg0;
+	ev->te_args[1] = arg1;
+	ev->te_args[2] = arg2;
+	ev->te_args[3] = arg3;
+	trace->ct_seq++;
+}
+
+/**
+ * nilfs_cldtrace_dump - write recorded events to a file
+ * @trace: flight recorder
+ * @path: pathname of the dump file
+ *
+ * The file is replaced atomically.  Return 0 on success, or -1 with
+ * errno set on failure.
+ */
+int nilfs_cldtrace_dump(const struct nilfs_cldtrace *trace, const char *path)
+{
+	struct nilfs_cldtrace_header hdr;
+	const struct nilfs_cldtrace_event *ev;
+	size_t head, nevents, n1, n2;
+	struct iovec iov[3];
+
+	nevents = min_t(uint64_t, trace->ct_seq, NILFS_CLDTRACE_NEVENTS);
+	head = trace->ct_seq & (NILFS_CLDTRACE_NEVENTS - 1);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.th_magic = NILFS_CLDTRACE_MAGIC;
+	hdr.th_version = NILFS_CLDTRACE_VERSION;
+	hdr.th_evsize = sizeof(*ev);
+	hdr.th_nevents = nevents;
+	hdr.th_pid = getpid();
+	hdr.th_seq = trace->ct_seq;
+	hdr.th_monotonic = nilfs_cldtrace_now(CLOCK_MONOTONIC);
+	hdr.th_realtime = nilfs_cldtrace_now(CLOCK_REALTIME);
+
+	/* oldest events start at the head once the ring has wrapped */
+	if (nevents < NILFS_CLDTRACE_NEVENTS) {
+		ev = trace->ct_events;
+		n1 = nevents;
+		n2 = 0;
+	} else {
+		ev = &trace->ct_events[head];
+		n1 = NILFS_CLDTRACE_NEVENTS - head;
+		n2 = head;
+	}
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *)ev;
+	iov[1].iov_len = n1 * sizeof(*ev);
+	iov[2].iov_base = (void *)trace->ct_events;
+	iov[2].iov_len = n2 * sizeof(*ev);
+
+	return nilfs_cld_save_file(path, iov, 3, 0);
+}
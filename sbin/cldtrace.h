@@ -0,0 +1,115 @@
+/*
+ * cldtrace.h - Flight recorder of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifndef CLDTRACE_H
+#define CLDTRACE_H
+
+#include <stdint.h>	/* uint64_t */
+
+#define NILFS_CLDTRACE_MAGIC	0x4e435452	/* "NCTR" */
+#define NILFS_CLDTRACE_VERSION	1
+#define NILFS_CLDTRACE_NARGS	4
+#define NILFS_CLDTRACE_NEVENTS	4096	/* must be a power of two */
+
+/*
+ * Event types.  Arguments of each event are as follows:
+ *
+ * CYCLE_START:  free segments, total segments, state, nongc ctime
+ * SELECT:       selected, reclaimable, candidates, elapsed ns
+ * RECLAIM:      cleaned, deferred, protected, live blocks
+ * RECLAIM_TIME: elapsed ns, lock wait ns, defunct blocks
+ * CYCLE_END:    selected, done, elapsed ns
+ * PACING:       timeout ns, segments per clean, interval ns, flags
+ * COMMAND:      command, result
+ * ERROR:        operation
+ * DISCARD:      segments, ranges, bytes, elapsed ns
+ * FREEZE:       stall ns, protseq
+ */
+enum {
+	NILFS_CLDTRACE_NONE,
+	NILFS_CLDTRACE_CYCLE_START,
+	NILFS_CLDTRACE_SELECT,
+	NILFS_CLDTRACE_RECLAIM,
+	NILFS_CLDTRACE_RECLAIM_TIME,
+	NILFS_CLDTRACE_CYCLE_END,
+	NILFS_CLDTRACE_PACING,
+	NILFS_CLDTRACE_COMMAND,
+	NILFS_CLDTRACE_ERROR,
+	NILFS_CLDTRACE_DISCARD,
+	NILFS_CLDTRACE_FREEZE,
+	NILFS_CLDTRACE_NTYPES
+};
+
+/*
+ * Operations reported by NILFS_CLDTRACE_ERROR events.
+ */
+enum {
+	NILFS_CLDTRACE_OP_NONE,
+	NILFS_CLDTRACE_OP_GET_SUSTAT,
+	NILFS_CLDTRACE_OP_SELECT,
+	NILFS_CLDTRACE_OP_CNOMAP,
+	NILFS_CLDTRACE_OP_RECLAIM,
+	NILFS_CLDTRACE_OP_INTERVAL,
+	NILFS_CLDTRACE_OP_WAIT,
+	NILFS_CLDTRACE_OP_NTYPES
+};
+
+/* Flags of NILFS_CLDTRACE_PACING events */
+#define NILFS_CLDTRACE_PACING_NO_TIMEOUT	(1UL << 0)
+#define NILFS_CLDTRACE_PACING_FALLBACK		(1UL << 1)
+#define NILFS_CLDTRACE_PACING_RETRY		(1UL << 2)
+
+/**
+ * struct nilfs_cldtrace_event - trace event record
+ * @te_time: monotonic time of the event in nanoseconds
+ * @te_type: event type
+ * @te_pad: padding
+ * @te_err: error number, or zero
+ * @te_args: event type specific arguments
+ */
+struct nilfs_cldtrace_event {
+	uint64_t te_time;
+	uint16_t te_type;
+	uint16_t te_pad;
+	int32_t te_err;
+	uint64_t te_args[NILFS_CLDTRACE_NARGS];
+};
+
+/**
+ * struct nilfs_cldtrace_header - header of trace dump files
+ * @th_magic: magic number
+ * @th_version: format version
+ * @th_evsize: size of an event record
+ * @th_nevents: number of event records following the header
+ * @th_pid: process id of the cleaner daemon
+ * @th_seq: total number of events recorded (including overwritten ones)
+ * @th_monotonic: monotonic time of the dump in nanoseconds
+ * @th_realtime: wall-clock time of the dump in nanoseconds
+ *
+ * Event records are stored in chronological order.
+ */
+struct nilfs_cldtrace_header {
+	uint32_t th_magic;
+	uint16_t th_version;
+	uint16_t th_evsize;
+	uint32_t th_nevents;
+	uint32_t th_pid;
+	uint64_t th_seq;
+	uint64_t th_monotonic;
+	uint64_t th_realtime;
+};
+
+struct nilfs_cldtrace;
+
+struct nilfs_cldtrace *nilfs_cldtrace_create(void);
+void nilfs_cldtrace_destroy(struct nilfs_cldtrace *trace);
+void nilfs_cldtrace_record(struct nilfs_cldtrace *trace, int type, int err,
+			   uint64_t arg0, uint64_t arg1, uint64_t arg2,
+			   uint64_t arg3);
+int nilfs_cldtrace_dump(const struct nilfs_cldtrace *trace, const char *path);
+
+#endif	/* CLDTRACE_H */
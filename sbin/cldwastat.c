@@ -0,0 +1,343 @@
+/*
+ * cldwastat.c - Write amplification accounting of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ *
+ * The number of blocks written by GC is known exactly from the reclaim
+ * statistics.  The number of blocks written by others is inferred from
+ * the total number of blocks in dirty segments:
+ *
+ *   user = (used_now - used_prev) - gc_written + freed
+ *
+ * where gc_written and freed are the numbers of blocks written by GC and
+ * the number of blocks in segments freed by GC since the previous sample.
+ * The counts are kept in one-minute slots covering a day so that the
+ * write amplification can be reported over sliding windows.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif	/* HAVE_UNISTD_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif	/* HAVE_FCNTL_H */
+
+#if HAVE_SYSLOG_H
+#include <syslog.h>
+#endif	/* HAVE_SYSLOG_H */
+
+#include <errno.h>
+#include "util.h"
+#include "cldfile.h"
+#include "cldwastat.h"
+
+#define NILFS_CLDWASTAT_NSLOTS		1440	/* one-minute slots */
+#define NILFS_CLDWASTAT_SAVE_INTERVAL	60	/* seconds */
+#define NILFS_CLDWASTAT_MAGIC		0x4e574153	/* "NWAS" */
+#define NILFS_CLDWASTAT_VERSION		1
+
+static const uint32_t nilfs_cldwastat_spans[NILFS_CLEANER_WASTAT_NWINDOWS] = {
+	5 * 60, 60 * 60, 24 * 60 * 60
+};
+
+/**
+ * struct nilfs_cldwastat_slot - write counts in a one-minute slot
+ * @ws_minute: minutes since the epoch this slot accounts for
+ * @ws_user_blocks: number of blocks written other than by GC
+ * @ws_gc_blocks: number of blocks rewritten by GC
+ */
+struct nilfs_cldwastat_slot {
+	int64_t ws_minute;
+	uint64_t ws_user_blocks;
+	uint64_t ws_gc_blocks;
+};
+
+/**
+ * struct nilfs_cldwastat_header - header of the state file
+ * @wh_magic: magic number
+ * @wh_version: format version
+ * @wh_nslots: number of slots following the header
+ * @wh_since: start time of the accounting
+ * @wh_user_blocks: cumulative number of blocks written other than by GC
+ * @wh_gc_blocks: cumulative number of blocks rewritten by GC
+ */
+struct nilfs_cldwastat_header {
+	uint32_t wh_magic;
+	uint16_t wh_version;
+	uint16_t wh_nslots;
+	uint64_t wh_since;
+	uint64_t wh_user_blocks;
+	uint64_t wh_gc_blocks;
+};
+
+/**
+ * struct nilfs_cldwastat - write amplification accounting
+ * @cw_path: pathname of the state file (NULL if not persistent)
+ * @cw_since: start time of the accounting
+ * @cw_user_blocks: cumulative number of blocks written other than by GC
+ * @cw_gc_blocks: cumulative number of blocks rewritten by GC
+ * @cw_used_blocks: number of blocks in dirty segments at the last sample
+ * @cw_sampled: flag indicating that @cw_used_blocks is valid
+ * @cw_pending_gc: blocks written by GC since the last sample
+ * @cw_pending_freed: blocks in segments freed by GC since the last sample
+ * @cw_dirty: flag indicating that the state file is out of date
+ * @cw_last_save: time of the last save
+ * @cw_slots: ring of one-minute slots
+ */
+struct nilfs_cldwastat {
+	char *cw_path;
+	uint64_t cw_since;
+	uint64_t cw_user_blocks;
+	uint64_t cw_gc_blocks;
+	uint64_t cw_used_blocks;
+	int cw_sampled;
+	uint64_t cw_pending_gc;
+	uint64_t cw_pending_freed;
+	int cw_dirty;
+	time_t cw_last_save;
+	struct nilfs_cldwastat_slot cw_slots[NILFS_CLDWASTAT_NSLOTS];
+};
+
+static struct nilfs_cldwastat_slot *
+nilfs_cldwastat_get_slot(struct nilfs_cldwastat *wastat, time_t now)
+{
+	int64_t minute = now / 60;
+	struct nilfs_cldwastat_slot *slot;
+
+	slot = &wastat->cw_slots[minute % NILFS_CLDWASTAT_NSLOTS];
+	if (slot->ws_minute != minute) {
+		slot->ws_minute = minute;
+		slot->ws_user_blocks = 0;
+		slot->ws_gc_blocks = 0;
+	}
+	return slot;
+}
+
+static int nilfs_cldwastat_load(struct nilfs_cldwastat *wastat)
+{
+	struct nilfs_cldwastat_header hdr;
+	ssize_t nr;
+	int fd;
+
+	fd = open(wastat->cw_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -1;
+
+	nr = read(fd, &hdr, sizeof(hdr));
+	if (nr != sizeof(hdr) || hdr.wh_magic != NILFS_CLDWASTAT_MAGIC ||
+	    hdr.wh_version != NILFS_CLDWASTAT_VERSION ||
+	    hdr.wh_nslots != NILFS_CLDWASTAT_NSLOTS)
+		goto invalid;
+
+	nr = read(fd, wastat->cw_slots, sizeof(wastat->cw_slots));
+	if (nr != sizeof(wastat->cw_slots)) {
+		memset(wastat->cw_slots, 0, sizeof(wastat->cw_slots));
+		goto invalid;
+	}
+	close(fd);
+
+	wastat->cw_since = hdr.wh_since;
+	wastat->cw_user_blocks = hdr.wh_user_blocks;
+	wastat->cw_gc_blocks = hdr.wh_gc_blocks;
+	return 0;
+
+invalid:
+	close(fd);
+	syslog(LOG_WARNING, "%s: ignored invalid write statistics",
+	       wastat->cw_path);
+	return 0;
+}
+
+/**
+ * nilfs_cldwastat_create - create write amplification accounting
+ * @path: pathname of the state file, or NULL
+ *
+ * If @path is given, the statistics saved by a previous instance are
+ * restored from the file.
+ */
+struct nilfs_cldwastat *nilfs_cldwastat_create(const char *path)
+{
+	struct nilfs_cldwastat *wastat;
+
+	wastat = malloc(sizeof(*wastat));
+	if (unlikely(!wastat))
+		return NULL;
+
+	memset(wastat, 0, sizeof(*wastat));
+	wastat->cw_since = time(NULL);
+
+	if (path) {
+		wastat->cw_path = strdup(path);
+		if (unlikely(!wastat->cw_path))
+			goto failed;
+
+		if (unlikely(nilfs_cldwastat_load(wastat) < 0))
+			syslog(LOG_WARNING,
+			       "cannot load write statistics from %s: %m",
+			       path);
+	}
+	return wastat;
+
+failed:
+	free(wastat);
+	return NULL;
+}
+
+static int nilfs_cldwastat_do_save(struct nilfs_cldwastat *wastat)
+{
+	struct nilfs_cldwastat_header hdr;
+	struct iovec iov[2];
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.wh_magic = NILFS_CLDWASTAT_MAGIC;
+	hdr.wh_version = NILFS_CLDWASTAT_VERSION;
+	hdr.wh_nslots = NILFS_CLDWASTAT_NSLOTS;
+	hdr.wh_since = wastat->cw_since;
+	hdr.wh_user_blocks = wastat->cw_user_blocks;
+	hdr.wh_gc_blocks = wastat->cw_gc_blocks;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = wastat->cw_slots;
+	iov[1].iov_len = sizeof(wastat->cw_slots);
+
+	if (unlikely(nilfs_cld_save_file(wastat->cw_path, iov, 2, 0) < 0)) {
+		syslog(LOG_WARNING, "cannot save write statistics to %s: %m",
+		       wastat->cw_path);
+		return -1;
+	}
+	wastat->cw_dirty = 0;
+	return 0;
+}
+
+/**
+ * nilfs_cldwastat_save - save statistics to the state file
+ * @wastat: write amplification accounting
+ * @now: current time
+ *
+ * The state file is rewritten at most once per minute.
+ */
+int nilfs_cldwastat_save(struct nilfs_cldwastat *wastat, time_t now)
+{
+	if (!wastat->cw_path || !wastat->cw_dirty ||
+	    now - wastat->cw_last_save < NILFS_CLDWASTAT_SAVE_INTERVAL)
+		return 0;
+
+	wastat->cw_last_save = now;
+	return nilfs_cldwastat_do_save(wastat);
+}
+
+/**
+ * nilfs_cldwastat_destroy - destroy write amplification accounting
+ * @wastat: write amplification accounting
+ */
+void nilfs_cldwastat_destroy(struct nilfs_cldwastat *wastat)
+{
+	if (wastat->cw_path && wastat->cw_dirty)
+		nilfs_cldwastat_do_save(wastat);
+	free(wastat->cw_path);
+	free(wastat);
+}
+
+/**
+ * nilfs_cldwastat_add_gc - account blocks processed by GC
+ * @wastat: write amplification accounting
+ * @now: current time
+ * @gc_blocks: number of live blocks rewritten by GC
+ * @freed_blocks: number of blocks in the segments freed by GC
+ */
+void nilfs_cldwastat_add_gc(struct nilfs_cldwastat *wastat, time_t now,
+			    uint64_t gc_blocks, uint64_t freed_blocks)
+{
+	struct nilfs_cldwastat_slot *slot;
+
+	slot = nilfs_cldwastat_get_slot(wastat, now);
+	slot->ws_gc_blocks += gc_blocks;
+	wastat->cw_gc_blocks += gc_blocks;
+	wastat->cw_pending_gc += gc_blocks;
+	wastat->cw_pending_freed += freed_blocks;
+	wastat->cw_dirty = 1;
+}
+
+/**
+ * nilfs_cldwastat_sample - infer user writes from segment usage
+ * @wastat: write amplification accounting
+ * @now: current time
+ * @used_blocks: current number of blocks in dirty segments
+ *
+ * The first sample only establishes a baseline.
+ */
+void nilfs_cldwastat_sample(struct nilfs_cldwastat *wastat, time_t now,
+			    uint64_t used_blocks)
+{
+	struct nilfs_cldwastat_slot *slot;
+	int64_t user;
+
+	if (wastat->cw_sampled) {
+		user = (int64_t)(used_blocks - wastat->cw_used_blocks) -
+			(int64_t)wastat->cw_pending_gc +
+			(int64_t)wastat->cw_pending_freed;
+		if (user > 0) {
+			slot = nilfs_cldwastat_get_slot(wastat, now);
+			slot->ws_user_blocks += user;
+			wastat->cw_user_blocks += user;
+			wastat->cw_dirty = 1;
+		}
+	}
+	wastat->cw_used_blocks = used_blocks;
+	wastat->cw_sampled = 1;
+	wastat->cw_pending_gc = 0;
+	wastat->cw_pending_freed = 0;
+}
+
+/**
+ * nilfs_cldwastat_get - get write amplification statistics
+ * @wastat: write amplification accounting
+ * @now: current time
+ * @res: buffer to store the statistics (block_size is not set)
+ */
+void nilfs_cldwastat_get(const struct nilfs_cldwastat *wastat, time_t now,
+			 struct nilfs_cleaner_wastat *res)
+{
+	const struct nilfs_cldwastat_slot *slot;
+	int64_t minute = now / 60, age;
+	int i, j;
+
+	memset(res, 0, sizeof(*res));
+	res->nwindows = NILFS_CLEANER_WASTAT_NWINDOWS;
+	res->since = wastat->cw_since;
+	res->user_blocks = wastat->cw_user_blocks;
+	res->gc_blocks = wastat->cw_gc_blocks;
+
+	for (j = 0; j < NILFS_CLEANER_WASTAT_NWINDOWS; j++)
+		res->windows[j].span = nilfs_cldwastat_spans[j];
+
+	for (i = 0; i < NILFS_CLDWASTAT_NSLOTS; i++) {
+		slot = &wastat->cw_slots[i];
+		age = minute - slot->ws_minute;
+		if (age < 0 || !(slot->ws_user_blocks | slot->ws_gc_blocks))
+			continue;
+		for (j = 0; j < NILFS_CLEANER_WASTAT_NWINDOWS; j++) {
+			if (age >= nilfs_cldwastat_spans[j] / 60)
+				continue;
+			res->windows[j].user_blocks += slot->ws_user_blocks;
+			res->windows[j].gc_blocks += slot->ws_gc_blocks;
+		}
+	}
+}
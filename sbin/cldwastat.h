@@ -0,0 +1,31 @@
+/*
+ * cldwastat.h - Write amplification accounting of NILFS cleaner daemon.
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifndef CLDWASTAT_H
+#define CLDWASTAT_H
+
+#if HAVE_TIME_H
+#include <time.h>	/* time_t */
+#endif	/* HAVE_TIME_H */
+
+#include <stdint.h>	/* uint64_t */
+#include "nilfs_cleaner.h"	/* struct nilfs_cleaner_wastat */
+
+struct nilfs_cldwastat;
+
+struct nilfs_cldwastat *nilfs_cldwastat_create(const char *path);
+void nilfs_cldwastat_destroy(struct nilfs_cldwastat *wastat);
+
+void nilfs_cldwastat_add_gc(struct nilfs_cldwastat *wastat, time_t now,
+			    uint64_t gc_blocks, uint64_t freed_blocks);
+void nilfs_cldwastat_sample(struct nilfs_cldwastat *wastat, time_t now,
+			    uint64_t used_blocks);
+void nilfs_cldwastat_get(const struct nilfs_cldwastat *wastat, time_t now,
+			 struct nilfs_cleaner_wastat *res);
+int nilfs_cldwastat_save(struct nilfs_cldwastat *wastat, time_t now);
+
+#endif	/* CLDWASTAT_H */
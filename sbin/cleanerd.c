@@ -69,6 +69,18 @@
 #include <poll.h>
 #endif	/* HAVE_POLL_H */
 
+#if HAVE_SCHED_H
+#include <sched.h>
+#endif	/* HAVE_SCHED_H */
+
+#if HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif	/* HAVE_SYS_RESOURCE_H */
+
+#if HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif	/* HAVE_SYS_SYSCALL_H */
+
 #include <errno.h>
 #include <signal.h>
 #include <setjmp.h>
@@ -83,6 +95,14 @@
 #include "nilfs_cleaner.h"
 #include "cleaner_msg.h"
 #include "cldconfig.h"
+#include "cldmetrics.h"
+#include "cldwastat.h"
+#include "cldtrace.h"
+#include "clddiscard.h"
+#include "clddefer.h"
+#include "cldselect.h"
+#include "cldretain.h"
+#include "cldctl.h"
 #include "cnormap.h"
 #include "realpath.h"
 
@@ -136,9 +156,13 @@ static const struct option long_option[] = {
  * @recvq: receive queue
  * @recvq_name: receive queue name
  * @sendq: send queue
+ * @ctl: control socket, or NULL if not available
+ * @ctl_client: control client whose request is being handled, or NULL if
+ * the request came from the message queue
  * @client_uuid: uuid of the previous message received from a client
  * @pending_cmd: pending client command
  * @jobid: current job id
+ * @job_active: flag that indicates the manual job @jobid has not ended
  * @mm_prev_state: previous status during suspending
  * @mm_nrestpasses: remaining number of passes
  * @mm_nrestsegs: remaining number of segment (1-pass)
@@ -146,6 +170,52 @@ static const struct option long_option[] = {
  * @mm_protection_period: protection period (manual mode)
  * @mm_cleaning_interval: cleaning interval (manual mode)
  * @mm_min_reclaimable_blocks: min. number of reclaimable blocks (manual mode)
+ * @mm_start_segnum: first segment of the range to be cleaned (manual mode)
+ * @mm_end_segnum: segment following the range to be cleaned (manual mode)
+ * @mm_usage_rate_threshold: max. live ratio in percent of segments to be
+ * cleaned, or 0 if not limited (manual mode)
+ * @mm_deadline: monotonic time at which to end the run (manual mode)
+ * @mm_skipped: sorted segment numbers skipped due to usage (manual mode)
+ * @mm_pass_nsegs: number of segments to be processed by the current pass
+ * (manual mode)
+ * @mm_pass_start: monotonic time at which the current pass started
+ * (manual mode)
+ * @metrics: metrics exporter
+ * @stats: statistics exported as metrics
+ * @wastat: write amplification accounting
+ * @wa_nongc_ctime: nongc ctime when segment usage was last sampled
+ * @trace: flight recorder
+ * @discard: queue of freed segments to be discarded
+ * @discard_last: monotonic time of the last discard round
+ * @defer: segments assessed as low-yield and deferred
+ * @select: generation estimates for grouping victims
+ * @select_gen: generation of the victims selected last, or -1 if the
+ *	       last selection was not grouped
+ * @retain: checkpoint retention state
+ * @retain_last: monotonic time of the last retention run
+ * @watch: flag that indicates watching free segments while paused
+ * @watch_interval: current interval of free segment checks
+ * @watch_prev_time: monotonic time of the previous free segment check
+ * @watch_prev_ncleansegs: number of free segments at the previous check
+ * @watch_prev_ctime: nongc ctime at the previous check
+ * @watch_nsps: shortest observed time in nanoseconds to fill a segment,
+ * or 0 if unknown
+ * @emergency_level: number of emergency watermarks the free segments are
+ * below, or 0 if not in emergency
+ * @emergency_protection_period: protection period shortened for
+ * @emergency_level
+ * @shrink_synced: flag that indicates a sync was done to shrink the
+ * protected region and the log cursor has not moved since
+ * @shrink_prot_seq: protseq when the protected region was last shrunk
+ * @shrink_since: monotonic time since when the log cursor has not moved
+ * @freeze_last: monotonic time of the last freeze
+ * @urgent: flag that indicates cleaning under min_clean_segments
+ * @prio_state: priorities in effect (0: not set, 1: normal, 2: urgent)
+ * @orig_ioprio: I/O priority at startup, or -1 if unknown
+ * @orig_policy: scheduling policy at startup
+ * @orig_param: scheduling parameters at startup
+ * @orig_nice: nice value at startup
+ * @profile: index of the scheduled parameter profile, or -1 if none
  */
 struct nilfs_cleanerd {
 	struct nilfs *nilfs;
@@ -166,8 +236,11 @@ struct nilfs_cleanerd {
 	mqd_t recvq;
 	char *recvq_name;
 	mqd_t sendq;
+	struct nilfs_cldctl *ctl;
+	struct nilfs_cldctl_client *ctl_client;
 	uuid_t client_uuid;
 	unsigned long jobid;
+	int job_active;
 	int mm_prev_state;
 	int mm_nrestpasses;
 	long mm_nrestsegs;
@@ -175,16 +248,56 @@ struct nilfs_cleanerd {
 	struct timespec mm_protection_period;
 	struct timespec mm_cleaning_interval;
 	unsigned long mm_min_reclaimable_blocks;
+	uint64_t mm_start_segnum;
+	uint64_t mm_end_segnum;
+	int mm_usage_rate_threshold;
+	struct timespec mm_deadline;
+	struct nilfs_vector *mm_skipped;
+	long mm_pass_nsegs;
+	struct timespec mm_pass_start;
+	struct nilfs_cldmetrics *metrics;
+	struct nilfs_cldstats stats;
+	struct nilfs_cldwastat *wastat;
+	uint64_t wa_nongc_ctime;
+	struct nilfs_cldtrace *trace;
+	struct nilfs_clddiscard *discard;
+	struct timespec discard_last;
+	struct nilfs_clddefer *defer;
+	struct nilfs_cldselect *select;
+	int select_gen;
+	struct nilfs_cldretain *retain;
+	struct timespec retain_last;
+	int watch;
+	struct timespec watch_interval;
+	struct timespec watch_prev_time;
+	uint64_t watch_prev_ncleansegs;
+	uint64_t watch_prev_ctime;
+	uint64_t watch_nsps;
+	int emergency_level;
+	struct timespec emergency_protection_period;
+	int shrink_synced;
+	uint64_t shrink_prot_seq;
+	struct timespec shrink_since;
+	struct timespec freeze_last;
+	int urgent;
+	int prio_state;
+	int orig_ioprio;
+	int orig_policy;
+	struct sched_param orig_param;
+	int orig_nice;
+	int profile;
 };
 
 /**
  * struct nilfs_segimp - segment importance
  * @si_segnum: segment number
  * @si_importance: importance of segment
+ * @si_nblocks: number of blocks written in segment
  */
 struct nilfs_segimp {
 	uint64_t si_segnum;
 	long long si_importance;
+	uint32_t si_nblocks;
 };
 
 /* command line option value */
@@ -199,7 +312,8 @@ static char nilfs_cleanerd_msgbuf[NILFS_CLEANER_MSG_MAX_REQSZ];
 
 static const char *nilfs_cleaner_cmd_name[] = {
 	"get-status", "run", "suspend", "resume", "tune", "reload", "wait",
-	"stop", "shutdown"
+	"stop", "shutdown", "get-wastat", "get-progress", "subscribe",
+	"get-stats"
 };
 
 static void nilfs_cleanerd_version(const char *progname)
@@ -221,6 +335,11 @@ static void nilfs_cleanerd_set_log_priority(struct nilfs_cleanerd *cleanerd)
 	setlogmask(LOG_UPTO(cleanerd->config.cf_log_priority));
 }
 
+static inline uint64_t nilfs_cleanerd_nsecs(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
 static void nilfs_cleanerd_dump(struct nilfs_cleanerd *cleanerd)
 {
 	struct timespec ts;
@@ -269,6 +388,32 @@ skip_monotonic_clock:
 	       cleanerd->mm_cleaning_interval.tv_nsec);
 	syslog(LOG_DEBUG, "mm_min_reclaimable_blocks: %lu",
 	       cleanerd->mm_min_reclaimable_blocks);
+	syslog(LOG_DEBUG, "mm_start_segnum: %llu",
+	       (unsigned long long)cleanerd->mm_start_segnum);
+	syslog(LOG_DEBUG, "mm_end_segnum: %llu",
+	       (unsigned long long)cleanerd->mm_end_segnum);
+	syslog(LOG_DEBUG, "mm_usage_rate_threshold: %d",
+	       cleanerd->mm_usage_rate_threshold);
+	syslog(LOG_DEBUG, "mm_deadline: %ld.%09ld",
+	       cleanerd->mm_deadline.tv_sec, cleanerd->mm_deadline.tv_nsec);
+	syslog(LOG_DEBUG, "mm_skipped: %zu",
+	       nilfs_vector_get_size(cleanerd->mm_skipped));
+	syslog(LOG_DEBUG, "------------------- statistics -------------------");
+	syslog(LOG_DEBUG, "cycles: %llu",
+	       (unsigned long long)cleanerd->stats.cs_ncycles);
+	syslog(LOG_DEBUG, "cleaned_segs: %llu",
+	       (unsigned long long)cleanerd->stats.cs_cleaned_segs);
+	syslog(LOG_DEBUG, "deferred_segs: %llu",
+	       (unsigned long long)cleanerd->stats.cs_deferred_segs);
+	syslog(LOG_DEBUG, "protected_segs: %llu",
+	       (unsigned long long)cleanerd->stats.cs_protected_segs);
+	syslog(LOG_DEBUG, "live_blks: %llu",
+	       (unsigned long long)cleanerd->stats.cs_live_blks);
+	syslog(LOG_DEBUG, "defunct_blks: %llu",
+	       (unsigned long long)cleanerd->stats.cs_defunct_blks);
+	syslog(LOG_DEBUG, "lock_wait: %ld.%09ld",
+	       cleanerd->stats.cs_lock_wait.tv_sec,
+	       cleanerd->stats.cs_lock_wait.tv_nsec);
 	syslog(LOG_DEBUG, "=================================================");
 }
 
@@ -301,6 +446,11 @@ static int nilfs_cleanerd_config(struct nilfs_cleanerd *cleanerd,
 
 	nilfs_cleanerd_set_log_priority(cleanerd);
 
+	if (cleanerd->metrics)
+		nilfs_cldmetrics_setup(cleanerd->metrics,
+				       config->cf_metrics_socket,
+				       config->cf_metrics_file);
+
 	if (protection_period != ULONG_MAX) {
 		syslog(LOG_INFO, "override protection period to %lu",
 		       protection_period);
@@ -310,6 +460,215 @@ static int nilfs_cleanerd_config(struct nilfs_cleanerd *cleanerd,
 	return 0;
 }
 
+static const struct nilfs_cldprofile *
+nilfs_cleanerd_profile(const struct nilfs_cleanerd *cleanerd, unsigned long flag)
+{
+	const struct nilfs_cldprofile *prof;
+
+	if (cleanerd->profile < 0 ||
+	    cleanerd->profile >= cleanerd->config.cf_nprofiles)
+		return NULL;
+	prof = &cleanerd->config.cf_profiles[cleanerd->profile];
+	return (prof->pf_flags & flag) ? prof : NULL;
+}
+
+/**
+ * nilfs_cleanerd_base_protection_period - protection period before
+ * emergency adjustment
+ * @cleanerd: cleanerd object
+ *
+ * The protection period given by the command line option takes
+ * precedence over the one of the scheduled profile.
+ */
+static const struct timespec *
+nilfs_cleanerd_base_protection_period(const struct nilfs_cleanerd *cleanerd)
+{
+	const struct nilfs_cldprofile *prof;
+
+	prof = nilfs_cleanerd_profile(cleanerd,
+				      NILFS_CLDPROFILE_PROTECTION_PERIOD);
+	if (prof && protection_period == ULONG_MAX)
+		return &prof->pf_protection_period;
+	return &cleanerd->config.cf_protection_period;
+}
+
+/**
+ * nilfs_cleanerd_set_normal_params - apply parameters of normal cleaning
+ * @cleanerd: cleanerd object
+ *
+ * Parameters overridden by the scheduled profile are taken from it.
+ */
+static void nilfs_cleanerd_set_normal_params(struct nilfs_cleanerd *cleanerd)
+{
+	const struct nilfs_cldconfig *config = &cleanerd->config;
+	const struct nilfs_cldprofile *prof;
+
+	prof = nilfs_cleanerd_profile(cleanerd,
+				      NILFS_CLDPROFILE_NSEGMENTS_PER_CLEAN);
+	cleanerd->ncleansegs = prof ? prof->pf_nsegments_per_clean :
+		config->cf_nsegments_per_clean;
+	prof = nilfs_cleanerd_profile(cleanerd,
+				      NILFS_CLDPROFILE_CLEANING_INTERVAL);
+	cleanerd->cleaning_interval = prof ? prof->pf_cleaning_interval :
+		config->cf_cleaning_interval;
+	prof = nilfs_cleanerd_profile(cleanerd,
+				      NILFS_CLDPROFILE_MIN_RECLAIMABLE_BLOCKS);
+	cleanerd->min_reclaimable_blocks =
+		prof ? prof->pf_min_reclaimable_blocks :
+		config->cf_min_reclaimable_blocks;
+}
+
+static int nilfs_ioprio_get(void)
+{
+#ifdef SYS_ioprio_get
+	return syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static int nilfs_ioprio_set(int ioprio)
+{
+#ifdef SYS_ioprio_set
+	return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/**
+ * nilfs_cleanerd_save_priority - remember priorities at startup
+ * @cleanerd: cleanerd object
+ */
+static void nilfs_cleanerd_save_priority(struct nilfs_cleanerd *cleanerd)
+{
+	cleanerd->orig_ioprio = nilfs_ioprio_get();
+	cleanerd->orig_policy = sched_getscheduler(0);
+	if (cleanerd->orig_policy < 0 ||
+	    sched_getparam(0, &cleanerd->orig_param) < 0) {
+		cleanerd->orig_policy = SCHED_OTHER;
+		memset(&cleanerd->orig_param, 0,
+		       sizeof(cleanerd->orig_param));
+	}
+	errno = 0;
+	cleanerd->orig_nice = getpriority(PRIO_PROCESS, 0);
+	if (cleanerd->orig_nice == -1 && errno)
+		cleanerd->orig_nice = 0;
+}
+
+/**
+ * nilfs_cleanerd_set_priority - switch I/O and CPU priorities
+ * @cleanerd: cleanerd object
+ * @urgent: use the priorities for cleaning under min_clean_segments
+ *
+ * Priorities configured as "none" are restored to those at startup.
+ * Failures are logged and otherwise ignored.
+ */
+static void nilfs_cleanerd_set_priority(struct nilfs_cleanerd *cleanerd,
+					int urgent)
+{
+	const struct nilfs_cldconfig *config = &cleanerd->config;
+	struct sched_param param;
+	int ioprio, cpuprio, policy, nice;
+
+	cleanerd->urgent = urgent;
+	if (cleanerd->prio_state == (urgent ? 2 : 1))
+		return;
+
+	ioprio = urgent ? config->cf_mc_io_priority : config->cf_io_priority;
+	if (ioprio == NILFS_CLDCONFIG_IOPRIO_NONE)
+		ioprio = cleanerd->orig_ioprio;
+	if (ioprio >= 0 && unlikely(nilfs_ioprio_set(ioprio) < 0))
+		syslog(LOG_WARNING, "cannot set I/O priority: %m");
+
+	cpuprio = urgent ? config->cf_mc_cpu_priority : config->cf_cpu_priority;
+	memset(&param, 0, sizeof(param));
+	if (cpuprio == NILFS_CLDCONFIG_CPUPRIO_IDLE) {
+		policy = SCHED_IDLE;
+		nice = cleanerd->orig_nice;
+	} else if (cpuprio == NILFS_CLDCONFIG_CPUPRIO_NONE) {
+		/* real-time policies need their original priority back */
+		policy = cleanerd->orig_policy;
+		param = cleanerd->orig_param;
+		nice = cleanerd->orig_nice;
+	} else {
+		policy = SCHED_OTHER;
+		nice = cpuprio;
+	}
+	if (sched_getscheduler(0) != policy &&
+	    unlikely(sched_setscheduler(0, policy, &param) < 0))
+		syslog(LOG_WARNING, "cannot set scheduling policy: %m");
+	if (unlikely(setpriority(PRIO_PROCESS, 0, nice) < 0))
+		syslog(LOG_WARNING, "cannot set nice value: %m");
+
+	if (cleanerd->prio_state)
+		syslog(LOG_INFO, "%s priority (%s)", urgent ? "raise" : "lower",
+		       urgent ? "clean segments running low" :
+		       "background cleaning");
+	cleanerd->prio_state = urgent ? 2 : 1;
+}
+
+/**
+ * nilfs_cleanerd_set_emergency_period - shorten protection period
+ * @cleanerd: cleanerd object
+ *
+ * The protection period steps down linearly from the base protection
+ * period at level 0 to min_protection_period at the last emergency level.
+ */
+static void nilfs_cleanerd_set_emergency_period(struct nilfs_cleanerd *cleanerd)
+{
+	const struct nilfs_cldconfig *config = &cleanerd->config;
+	struct timespec *pt = &cleanerd->emergency_protection_period;
+	uint64_t period, minperiod;
+
+	period = nilfs_cleanerd_nsecs(
+		nilfs_cleanerd_base_protection_period(cleanerd));
+	minperiod = min_t(uint64_t, period,
+			  nilfs_cleanerd_nsecs(&config->cf_min_protection_period));
+	period -= (period - minperiod) * cleanerd->emergency_level /
+		config->cf_emergency_nlevels;
+	pt->tv_sec = period / 1000000000ULL;
+	pt->tv_nsec = period % 1000000000ULL;
+}
+
+/**
+ * nilfs_cleanerd_update_profile - switch to the profile scheduled now
+ * @cleanerd: cleanerd object
+ *
+ * Parameters of the urgent regime below min_clean_segments are not
+ * affected by profiles.
+ */
+static void nilfs_cleanerd_update_profile(struct nilfs_cleanerd *cleanerd)
+{
+	const struct nilfs_cldconfig *config = &cleanerd->config;
+	struct tm tm;
+	time_t now;
+	int profile = -1;
+
+	if (config->cf_nschedules > 0) {
+		now = time(NULL);
+		if (unlikely(localtime_r(&now, &tm) == NULL))
+			return;
+		profile = nilfs_cldconfig_find_profile(config, &tm);
+	}
+	if (profile == cleanerd->profile)
+		return;
+
+	if (profile >= 0)
+		syslog(LOG_INFO, "switch to profile %s",
+		       config->cf_profiles[profile].pf_name);
+	else
+		syslog(LOG_INFO, "switch to default profile");
+	cleanerd->profile = profile;
+
+	if (!cleanerd->urgent)
+		nilfs_cleanerd_set_normal_params(cleanerd);
+	if (cleanerd->emergency_level > 0)
+		nilfs_cleanerd_set_emergency_period(cleanerd);
+}
+
 /**
  * nilfs_cleanerd_reconfig - reload configuration file
  * @cleanerd: cleanerd object
@@ -324,10 +683,20 @@ static int nilfs_cleanerd_reconfig(struct nilfs_cleanerd *cleanerd,
 	if (unlikely(ret < 0)) {
 		syslog(LOG_ERR, "cannot configure: %m");
 	} else {
-		cleanerd->ncleansegs = config->cf_nsegments_per_clean;
-		cleanerd->cleaning_interval = config->cf_cleaning_interval;
-		cleanerd->min_reclaimable_blocks =
-				config->cf_min_reclaimable_blocks;
+		/* profile indexes may have changed */
+		cleanerd->profile = -1;
+		nilfs_cleanerd_update_profile(cleanerd);
+		nilfs_cleanerd_set_normal_params(cleanerd);
+		if (cleanerd->emergency_level > 0) {
+			/* re-evaluated against the new watermarks later */
+			cleanerd->emergency_level =
+				min_t(int, cleanerd->emergency_level,
+				      config->cf_emergency_nlevels);
+			if (cleanerd->emergency_level > 0)
+				nilfs_cleanerd_set_emergency_period(cleanerd);
+		}
+		cleanerd->prio_state = 0;
+		nilfs_cleanerd_set_priority(cleanerd, cleanerd->urgent);
 		syslog(LOG_INFO, "configuration file reloaded");
 	}
 	return ret;
@@ -337,6 +706,7 @@ static int nilfs_cleanerd_open_queue(struct nilfs_cleanerd *cleanerd,
 				     const char *device)
 {
 	char nambuf[NAME_MAX - 4];
+	char idbuf[48];
 	struct stat stbuf;
 	struct mq_attr attr = {
 		.mq_maxmsg = 6,
@@ -346,7 +716,10 @@ static int nilfs_cleanerd_open_queue(struct nilfs_cleanerd *cleanerd,
 
 	cleanerd->recvq = -1;
 	cleanerd->sendq = -1;
+	cleanerd->ctl = NULL;
+	cleanerd->ctl_client = NULL;
 	cleanerd->jobid = 0;
+	cleanerd->job_active = 0;
 	uuid_clear(cleanerd->client_uuid);
 
 	/* receive queue */
@@ -355,19 +728,19 @@ static int nilfs_cleanerd_open_queue(struct nilfs_cleanerd *cleanerd,
 		goto failed;
 
 	if (S_ISBLK(stbuf.st_mode)) {
-		ret = snprintf(nambuf, sizeof(nambuf),
-			       "/nilfs-cleanerq-%llu",
+		ret = snprintf(idbuf, sizeof(idbuf), "%llu",
 			       (unsigned long long)stbuf.st_rdev);
 	} else if (S_ISREG(stbuf.st_mode) || S_ISDIR(stbuf.st_mode)) {
-		ret = snprintf(nambuf, sizeof(nambuf),
-			       "/nilfs-cleanerq-%llu-%llu",
+		ret = snprintf(idbuf, sizeof(idbuf), "%llu-%llu",
 			       (unsigned long long)stbuf.st_dev,
 			       (unsigned long long)stbuf.st_ino);
 	} else {
 		errno = EINVAL;
 		goto failed;
 	}
+	assert(ret < sizeof(idbuf));
 
+	ret = snprintf(nambuf, sizeof(nambuf), "/nilfs-cleanerq-%s", idbuf);
 	assert(ret < sizeof(nambuf));
 
 	cleanerd->recvq_name = strdup(nambuf);
@@ -381,7 +754,14 @@ static int nilfs_cleanerd_open_queue(struct nilfs_cleanerd *cleanerd,
 		goto failed;
 	}
 
-	assert(ret < sizeof(nambuf));
+	/* control socket; clients fall back to the queue without it */
+	snprintf(nambuf, sizeof(nambuf), NILFS_CLEANER_SOCK_PREFIX "%s",
+		 idbuf);
+	cleanerd->ctl = nilfs_cldctl_create(nambuf);
+	if (unlikely(!cleanerd->ctl))
+		syslog(LOG_ERR,
+		       "cannot create control socket @%s: %m, control socket unavailable",
+		       nambuf);
 
 	return 0;
 
@@ -392,6 +772,10 @@ failed:
 
 static void nilfs_cleanerd_close_queue(struct nilfs_cleanerd *cleanerd)
 {
+	if (cleanerd->ctl) {
+		nilfs_cldctl_destroy(cleanerd->ctl);
+		cleanerd->ctl = NULL;
+	}
 	if (cleanerd->recvq >= 0) {
 		mq_close(cleanerd->recvq);
 		mq_unlink(cleanerd->recvq_name);
@@ -418,6 +802,33 @@ static __attribute__((noinline)) char *get_canonical_path(const char *path)
 	return canonical;
 }
 
+/**
+ * nilfs_cleanerd_state_path - get pathname of a per-volume state file
+ * @cleanerd: cleanerd object
+ * @suffix: suffix of the file name
+ *
+ * The state files are named after the uuid of the volume so that they
+ * are not confused by changes of device names.  Returns NULL if the
+ * state directory is not available.
+ */
+static char *nilfs_cleanerd_state_path(struct nilfs_cleanerd *cleanerd,
+				       const char *suffix)
+{
+	const char *dir = cleanerd->config.cf_state_directory;
+	char uuidbuf[36 + 1];
+	char *path;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		syslog(LOG_WARNING, "cannot create state directory %s: %m",
+		       dir);
+		return NULL;
+	}
+	uuid_unparse_lower(nilfs_get_uuid(cleanerd->nilfs), uuidbuf);
+	if (unlikely(asprintf(&path, "%s/%s.%s", dir, uuidbuf, suffix) < 0))
+		return NULL;
+	return path;
+}
+
 /**
  * nilfs_cleanerd_create - create cleanerd object
  * @dev: name of the device on which the cleanerd operates
@@ -427,6 +838,7 @@ static struct nilfs_cleanerd *
 nilfs_cleanerd_create(const char *dev, const char *dir, const char *conffile)
 {
 	struct nilfs_cleanerd *cleanerd;
+	char *statepath;
 	int ret;
 
 	cleanerd = malloc(sizeof(*cleanerd));
@@ -454,19 +866,74 @@ nilfs_cleanerd_create(const char *dev, const char *dir, const char *conffile)
 	if (unlikely(cleanerd->conffile == NULL))
 		goto out_cnormap;
 
+	cleanerd->mm_skipped = nilfs_vector_create(sizeof(uint64_t));
+	if (unlikely(cleanerd->mm_skipped == NULL))
+		goto out_conffile;
+
+	cleanerd->metrics =
+		nilfs_cldmetrics_create(nilfs_get_dev(cleanerd->nilfs));
+	if (unlikely(cleanerd->metrics == NULL))
+		goto out_skipped;
+
 	ret = nilfs_cleanerd_config(cleanerd, NULL);
 	if (unlikely(ret < 0))
-		goto out_conffile;
+		goto out_metrics;
+
+	nilfs_cleanerd_save_priority(cleanerd);
+
+	statepath = nilfs_cleanerd_state_path(cleanerd, "wastat");
+	cleanerd->wastat = nilfs_cldwastat_create(statepath);
+	free(statepath);
+	if (unlikely(cleanerd->wastat == NULL))
+		goto out_metrics;
+
+	cleanerd->trace = nilfs_cldtrace_create();
+	if (unlikely(cleanerd->trace == NULL))
+		goto out_wastat;
+
+	cleanerd->discard = nilfs_clddiscard_create(cleanerd->nilfs);
+	if (unlikely(cleanerd->discard == NULL))
+		goto out_trace;
+
+	cleanerd->defer = nilfs_clddefer_create();
+	if (unlikely(cleanerd->defer == NULL))
+		goto out_discard;
+
+	cleanerd->select = nilfs_cldselect_create();
+	if (unlikely(cleanerd->select == NULL))
+		goto out_defer;
+
+	statepath = nilfs_cleanerd_state_path(cleanerd, "retain");
+	cleanerd->retain = nilfs_cldretain_create(cleanerd->nilfs, statepath);
+	free(statepath);
+	if (unlikely(cleanerd->retain == NULL))
+		goto out_select;
 
 	ret = nilfs_cleanerd_open_queue(cleanerd,
 					nilfs_get_dev(cleanerd->nilfs));
 	if (unlikely(ret < 0))
-		goto out_conffile;
+		goto out_retain;
 
 	/* success */
 	return cleanerd;
 
 	/* error */
+out_retain:
+	nilfs_cldretain_destroy(cleanerd->retain);
+out_select:
+	nilfs_cldselect_destroy(cleanerd->select);
+out_defer:
+	nilfs_clddefer_destroy(cleanerd->defer);
+out_discard:
+	nilfs_clddiscard_destroy(cleanerd->discard);
+out_trace:
+	nilfs_cldtrace_destroy(cleanerd->trace);
+out_wastat:
+	nilfs_cldwastat_destroy(cleanerd->wastat);
+out_metrics:
+	nilfs_cldmetrics_destroy(cleanerd->metrics);
+out_skipped:
+	nilfs_vector_destroy(cleanerd->mm_skipped);
 out_conffile:
 	free(cleanerd->conffile);
 out_cnormap:
@@ -482,6 +949,14 @@ out_cleanerd:
 static void nilfs_cleanerd_destroy(struct nilfs_cleanerd *cleanerd)
 {
 	nilfs_cleanerd_close_queue(cleanerd);
+	nilfs_cldretain_destroy(cleanerd->retain);
+	nilfs_cldselect_destroy(cleanerd->select);
+	nilfs_clddefer_destroy(cleanerd->defer);
+	nilfs_clddiscard_destroy(cleanerd->discard);
+	nilfs_cldtrace_destroy(cleanerd->trace);
+	nilfs_cldwastat_destroy(cleanerd->wastat);
+	nilfs_cldmetrics_destroy(cleanerd->metrics);
+	nilfs_vector_destroy(cleanerd->mm_skipped);
 	free(cleanerd->conffile);
 	nilfs_cnormap_destroy(cleanerd->cnormap);
 	nilfs_close(cleanerd->nilfs);
@@ -500,6 +975,30 @@ static int nilfs_comp_segimp(const void *elem1, const void *elem2)
 	return (segimp1->si_segnum < segimp2->si_segnum) ? -1 : 1;
 }
 
+static int nilfs_comp_segnum(const void *elem1, const void *elem2)
+{
+	const uint64_t *segnum1 = elem1, *segnum2 = elem2;
+
+	if (*segnum1 == *segnum2)
+		return 0;
+	return (*segnum1 < *segnum2) ? -1 : 1;
+}
+
+/**
+ * nilfs_cleanerd_skipped - check if a segment was skipped in a manual run
+ * @cleanerd: cleanerd object
+ * @segnum: segment number
+ */
+static int nilfs_cleanerd_skipped(struct nilfs_cleanerd *cleanerd,
+				  uint64_t segnum)
+{
+	size_t n = nilfs_vector_get_size(cleanerd->mm_skipped);
+
+	return cleanerd->running == 2 && n > 0 &&
+		bsearch(&segnum, nilfs_vector_get_data(cleanerd->mm_skipped),
+			n, sizeof(segnum), nilfs_comp_segnum) != NULL;
+}
+
 static int nilfs_cleanerd_automatic_suspend(struct nilfs_cleanerd *cleanerd)
 {
 	return cleanerd->config.cf_min_clean_segments > 0;
@@ -519,12 +1018,14 @@ nilfs_cleanerd_cleaning_interval(struct nilfs_cleanerd *cleanerd)
 		&cleanerd->cleaning_interval;
 }
 
-static struct timespec *
+static const struct timespec *
 nilfs_cleanerd_protection_period(struct nilfs_cleanerd *cleanerd)
 {
-	return cleanerd->running == 2 ?
-		&cleanerd->mm_protection_period :
-		&cleanerd->config.cf_protection_period;
+	if (cleanerd->running == 2)
+		return &cleanerd->mm_protection_period;
+	if (cleanerd->emergency_level > 0)
+		return &cleanerd->emergency_protection_period;
+	return nilfs_cleanerd_base_protection_period(cleanerd);
 }
 
 static unsigned long
@@ -535,6 +1036,177 @@ nilfs_cleanerd_min_reclaimable_blocks(struct nilfs_cleanerd *cleanerd)
 		cleanerd->min_reclaimable_blocks;
 }
 
+static uint64_t nilfs_get_reserved_segments(const struct nilfs *nilfs,
+					    uint64_t nsegs)
+{
+	uint32_t ratio = nilfs_get_reserved_segments_ratio(nilfs);
+
+	return max_t(uint64_t, (nsegs * ratio + 99) / 100, NILFS_MIN_NRSVSEGS);
+}
+
+/**
+ * nilfs_cleanerd_grouped - check if victims are grouped by generation
+ * @cleanerd: cleanerd object
+ * @sustat: segment usage statistics
+ *
+ * Grouping can shrink a cleaning step, so it is bypassed in manual runs
+ * and while the number of free segments is below min_clean_segments,
+ * where reclaiming space quickly matters more than data placement.
+ */
+static int nilfs_cleanerd_grouped(struct nilfs_cleanerd *cleanerd,
+				  const struct nilfs_sustat *sustat)
+{
+	struct nilfs_cldconfig *config = &cleanerd->config;
+	uint64_t r_segments;
+
+	if (!config->cf_select_grouped || cleanerd->running == 2)
+		return 0;
+	r_segments = nilfs_get_reserved_segments(cleanerd->nilfs,
+						 sustat->ss_nsegs);
+	return sustat->ss_ncleansegs >=
+		config->cf_min_clean_segments + r_segments;
+}
+
+static int nilfs_cleanerd_ranged(struct nilfs_cleanerd *cleanerd)
+{
+	return cleanerd->running == 2 &&
+		(cleanerd->mm_start_segnum > 0 ||
+		 cleanerd->mm_end_segnum != UINT64_MAX);
+}
+
+/**
+ * nilfs_cleanerd_segment_range - get range of segments to be cleaned
+ * @cleanerd: cleanerd object
+ * @sustat: status information on segments
+ * @startp: place to store the first segment number of the range
+ * @endp: place to store the segment number following the range
+ */
+static void nilfs_cleanerd_segment_range(struct nilfs_cleanerd *cleanerd,
+					 const struct nilfs_sustat *sustat,
+					 uint64_t *startp, uint64_t *endp)
+{
+	if (cleanerd->running == 2) {
+		*endp = min_t(uint64_t, cleanerd->mm_end_segnum,
+			      sustat->ss_nsegs);
+		*startp = min_t(uint64_t, cleanerd->mm_start_segnum, *endp);
+	} else {
+		*startp = 0;
+		*endp = sustat->ss_nsegs;
+	}
+}
+
+/**
+ * nilfs_cleanerd_defer_gen - get checkpoint generation for deferral cache
+ * @cleanerd: cleanerd object
+ * @protcno: start checkpoint number of the protection period
+ * @gen: place to store the generation
+ */
+static int nilfs_cleanerd_defer_gen(struct nilfs_cleanerd *cleanerd,
+				    nilfs_cno_t protcno,
+				    struct nilfs_clddefer_gen *gen)
+{
+	struct nilfs_cpstat cpstat;
+	int ret;
+
+	ret = nilfs_get_cpstat(cleanerd->nilfs, &cpstat);
+	if (unlikely(ret < 0))
+		return ret;
+
+	gen->dg_protcno = protcno;
+	gen->dg_cno = cpstat.cs_cno;
+	gen->dg_ndeleted = cpstat.cs_cno > cpstat.cs_ncps + 1 ?
+		cpstat.cs_cno - cpstat.cs_ncps - 1 : 0;
+	gen->dg_nsss = cpstat.cs_nsss;
+	return 0;
+}
+
+/**
+ * nilfs_cleanerd_defer_prepare - set up deferral cache lookups
+ * @cleanerd: cleanerd object
+ * @gen: place to store the current checkpoint generation
+ *
+ * Manual runs always assess segments on their own.
+ *
+ * Return: 1 if segments in the deferral cache can be passed over, 0
+ * otherwise.
+ */
+static int nilfs_cleanerd_defer_prepare(struct nilfs_cleanerd *cleanerd,
+					struct nilfs_clddefer_gen *gen)
+{
+	const struct timespec *pt;
+	nilfs_cno_t protcno;
+
+	if (cleanerd->running == 2 ||
+	    nilfs_clddefer_count(cleanerd->defer) == 0)
+		return 0;
+
+	pt = nilfs_cleanerd_protection_period(cleanerd);
+	if (unlikely(nilfs_cnormap_track_back(cleanerd->cnormap, pt->tv_sec,
+					      &protcno) < 0 ||
+		     nilfs_cleanerd_defer_gen(cleanerd, protcno, gen) < 0)) {
+		syslog(LOG_WARNING, "cannot check deferred segments: %m");
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * nilfs_cleanerd_defer_record - remember segments deferred by GC
+ * @cleanerd: cleanerd object
+ * @segnums: numbers of the deferred segments
+ * @nsegs: number of deferred segments
+ * @live_blks: number of live blocks found in the deferred segments
+ * @params: reclaim parameters the segments were assessed with
+ *
+ * GC defers a batch of segments as a whole, so a segment of a batch can
+ * have enough reclaimable blocks by itself.  The segments of a batch are
+ * therefore assessed one by one, and only those that fall short of the
+ * threshold on their own are remembered.
+ */
+static void
+nilfs_cleanerd_defer_record(struct nilfs_cleanerd *cleanerd,
+			    const uint64_t *segnums, size_t nsegs,
+			    size_t live_blks,
+			    const struct nilfs_reclaim_params *params)
+{
+	struct nilfs_clddefer_gen gen;
+	struct nilfs_suinfo si;
+	ssize_t *live;
+	size_t i;
+
+	if (cleanerd->running == 2 ||
+	    nilfs_cleanerd_defer_gen(cleanerd, params->protcno, &gen) < 0)
+		return;
+
+	live = malloc(sizeof(*live) * nsegs);
+	if (unlikely(!live))
+		return;
+
+	if (nsegs == 1) {
+		live[0] = live_blks;
+	} else if (nilfs_assess_segments(cleanerd->nilfs, segnums, nsegs,
+					 params, 1, live) < 0) {
+		syslog(LOG_WARNING, "cannot assess deferred segments: %m");
+		goto out;
+	}
+
+	for (i = 0; i < nsegs; i++) {
+		if (live[i] < 0)
+			continue;
+		/* the modification time was just updated by the deferral */
+		if (nilfs_get_suinfo(cleanerd->nilfs, segnums[i], &si,
+				     1) != 1 ||
+		    si.sui_nblocks < live[i] ||
+		    si.sui_nblocks - live[i] >= params->min_reclaimable_blks)
+			continue;
+		if (unlikely(nilfs_clddefer_add(cleanerd->defer, segnums[i],
+						&si, live[i], &gen) < 0))
+			break;
+	}
+out:
+	free(live);
+}
+
 static void
 nilfs_cleanerd_reduce_ncleansegs_for_retry(struct nilfs_cleanerd *cleanerd)
 {
@@ -577,33 +1249,18 @@ static int nilfs_segments_still_reclaimable(struct nilfs *nilfs,
 	return 0;
 }
 
-/**
- * nilfs_shrink_protected_region - shrink region of protected segments
- * @nilfs: nilfs object
- *
- * This tries to update log cursor written in superblocks to make
- * protected segments reclaimable.
- */
-static int nilfs_shrink_protected_region(struct nilfs *nilfs)
-{
-	nilfs_cno_t cno;
-	int ret = -1;
-
-	nilfs_sync(nilfs, &cno);
-
-	if (nilfs_freeze(nilfs) == 0 && nilfs_thaw(nilfs) == 0)
-		ret = 0;
-
-	return ret;
-}
-
 /**
  * nilfs_cleanerd_select_segments - select segments to be reclaimed
  * @cleanerd: cleanerd object
  * @sustat: status information on segments
  * @segnums: array of segment numbers to store selected segments
+ * @nblocks: array to store the number of blocks of selected segments
  * @prottimep: place to store lower limit of protected period
  * @oldestp: place to store the oldest mod-time
+ * @usedp: place to store the number of blocks in dirty segments
+ *
+ * In a ranged manual run, only segments in the range are examined and
+ * @usedp only covers them.
  */
 #define NILFS_CLEANERD_NSUINFO	512
 #define NILFS_CLEANERD_NULLTIME INT64_MAX
@@ -611,18 +1268,25 @@ static int nilfs_shrink_protected_region(struct nilfs *nilfs)
 static ssize_t
 nilfs_cleanerd_select_segments(struct nilfs_cleanerd *cleanerd,
 			       struct nilfs_sustat *sustat, uint64_t *segnums,
-			       int64_t *prottimep, int64_t *oldestp)
+			       uint32_t *nblocks, int64_t *prottimep,
+			       int64_t *oldestp, uint64_t *usedp)
 {
 	struct nilfs *nilfs;
 	struct nilfs_vector *smv;
 	struct nilfs_segimp *sm;
 	struct nilfs_suinfo si[NILFS_CLEANERD_NSUINFO];
+	struct nilfs_clddefer_gen gen;
+	uint64_t lsegnums[NILFS_CLDSELECT_LOOKAHEAD];
+	uint32_t lnblocks[NILFS_CLDSELECT_LOOKAHEAD];
 	struct timespec ts, ts2;
 	int64_t prottime, oldest, lastmod, now;
-	uint64_t segnum;
+	uint64_t segnum, end;
 	size_t count, nsegs;
 	ssize_t nssegs, n;
+	uint64_t nreclaimable = 0, used = 0;
+	unsigned long minblks;
 	long long imp, thr;
+	int use_defer, grouped;
 	int ret;
 	int i;
 
@@ -653,17 +1317,36 @@ nilfs_cleanerd_select_segments(struct nilfs_cleanerd *cleanerd,
 	 */
 	thr = sustat->ss_nongc_ctime;
 
-	for (segnum = 0; segnum < sustat->ss_nsegs; segnum += n) {
-		count = min_t(uint64_t, sustat->ss_nsegs - segnum,
-			      NILFS_CLEANERD_NSUINFO);
+	use_defer = nilfs_cleanerd_defer_prepare(cleanerd, &gen);
+	grouped = nilfs_cleanerd_grouped(cleanerd, sustat);
+	if (!grouped)
+		cleanerd->select_gen = -1;
+	minblks = nilfs_cleanerd_min_reclaimable_blocks(cleanerd);
+
+	nilfs_cleanerd_segment_range(cleanerd, sustat, &segnum, &end);
+	for ( ; segnum < end; segnum += n) {
+		count = min_t(uint64_t, end - segnum, NILFS_CLEANERD_NSUINFO);
 		n = nilfs_get_suinfo(nilfs, segnum, si, count);
 		if (unlikely(n < 0)) {
 			nssegs = n;
 			goto out;
 		}
+		if (n == 0)
+			break;
 		for (i = 0; i < n; i++) {
-			if (!nilfs_suinfo_reclaimable(&si[i]))
+			if (nilfs_suinfo_dirty(&si[i]))
+				used += si[i].sui_nblocks;
+			if (!nilfs_suinfo_reclaimable(&si[i]) ||
+			    nilfs_cleanerd_skipped(cleanerd, segnum + i))
+				continue;
+			nreclaimable++;
+
+			if (use_defer &&
+			    nilfs_clddefer_skip(cleanerd->defer, segnum + i,
+						&si[i], minblks, &gen)) {
+				cleanerd->stats.cs_defer_skipped_segs++;
 				continue;
+			}
 
 			/*
 			 * Use local variable 'lastmod' to treat the
@@ -689,6 +1372,11 @@ nilfs_cleanerd_select_segments(struct nilfs_cleanerd *cleanerd,
 					}
 					sm->si_segnum = segnum + i;
 					sm->si_importance = imp;
+					sm->si_nblocks = si[i].sui_nblocks;
+					if (grouped)
+						nilfs_cldselect_classify(
+							cleanerd->select,
+							segnum + i, lastmod);
 				}
 			}
 		}
@@ -702,14 +1390,35 @@ nilfs_cleanerd_select_segments(struct nilfs_cleanerd *cleanerd,
 	}
 	nilfs_vector_sort(smv, nilfs_comp_segimp);
 
-	nssegs = min_t(size_t, nilfs_vector_get_size(smv), nsegs);
-	for (i = 0; i < nssegs; i++) {
-		sm = nilfs_vector_get_element(smv, i);
-		assert(sm != NULL);
-		segnums[i] = sm->si_segnum;
+	cleanerd->stats.cs_reclaimable_segs = nreclaimable;
+	cleanerd->stats.cs_candidate_segs = nilfs_vector_get_size(smv);
+
+	if (grouped) {
+		/* pick the oldest and the next of the same generation */
+		n = min_t(size_t, nilfs_vector_get_size(smv),
+			  NILFS_CLDSELECT_LOOKAHEAD);
+		for (i = 0; i < n; i++) {
+			sm = nilfs_vector_get_element(smv, i);
+			lsegnums[i] = sm->si_segnum;
+			lnblocks[i] = sm->si_nblocks;
+		}
+		nssegs = nilfs_cldselect_group(cleanerd->select, lsegnums,
+					       lnblocks, n, nsegs,
+					       &cleanerd->select_gen);
+		memcpy(segnums, lsegnums, nssegs * sizeof(*segnums));
+		memcpy(nblocks, lnblocks, nssegs * sizeof(*nblocks));
+	} else {
+		nssegs = min_t(size_t, nilfs_vector_get_size(smv), nsegs);
+		for (i = 0; i < nssegs; i++) {
+			sm = nilfs_vector_get_element(smv, i);
+			assert(sm != NULL);
+			segnums[i] = sm->si_segnum;
+			nblocks[i] = sm->si_nblocks;
+		}
 	}
 	*prottimep = prottime;
 	*oldestp = oldest;
+	*usedp = used;
 
  out:
 	nilfs_vector_destroy(smv);
@@ -873,6 +1582,28 @@ static int nilfs_cleanerd_init_signal_handlers(struct nilfs_cleanerd *cleanerd,
 	return 0;
 }
 
+/**
+ * nilfs_cleanerd_dump_trace - write out the flight recorder
+ * @cleanerd: cleanerd object
+ *
+ * The recorded events are written to <uuid>.trace in the state
+ * directory.  The file can be decoded with nilfs-cldtrace(8).
+ */
+static void nilfs_cleanerd_dump_trace(struct nilfs_cleanerd *cleanerd)
+{
+	char *path;
+
+	path = nilfs_cleanerd_state_path(cleanerd, "trace");
+	if (unlikely(!path))
+		return;
+
+	if (unlikely(nilfs_cldtrace_dump(cleanerd->trace, path) < 0))
+		syslog(LOG_WARNING, "cannot dump trace to %s: %m", path);
+	else
+		syslog(LOG_INFO, "trace dumped to %s", path);
+	free(path);
+}
+
 static void nilfs_cleanerd_handle_signals(struct nilfs_cleanerd *cleanerd)
 {
 	if (nilfs_cleanerd_reload_config) {
@@ -883,42 +1614,282 @@ static void nilfs_cleanerd_handle_signals(struct nilfs_cleanerd *cleanerd)
 	if (nilfs_cleanerd_dump_req) {
 		if (cleanerd->config.cf_log_priority == LOG_DEBUG)
 			nilfs_cleanerd_dump(cleanerd);
+		nilfs_cleanerd_dump_trace(cleanerd);
 		nilfs_cleanerd_dump_req = 0;
 	}
 }
 
-static void nilfs_cleanerd_clean_check_pause(struct nilfs_cleanerd *cleanerd)
+/**
+ * nilfs_cleanerd_update_emergency - adjust emergency level to free space
+ * @cleanerd: cleanerd object
+ * @sustat: status information on segments
+ *
+ * The level goes up as soon as the number of free segments falls below
+ * the next emergency watermark, and goes down once it exceeds the
+ * current watermark by an eighth so that the level does not flap.
+ */
+static void nilfs_cleanerd_update_emergency(struct nilfs_cleanerd *cleanerd,
+					    const struct nilfs_sustat *sustat)
 {
-	cleanerd->running = 0;
-	cleanerd->timeout = cleanerd->config.cf_clean_check_interval;
-	syslog(LOG_INFO, "pause (clean check)");
+	const struct nilfs_cldconfig *config = &cleanerd->config;
+	const uint64_t *thr = config->cf_emergency_clean_segments;
+	uint64_t ncleansegs = sustat->ss_ncleansegs;
+	uint64_t r_segments;
+	int n = config->cf_emergency_nlevels;
+	int prev = cleanerd->emergency_level, level;
+
+	r_segments = nilfs_get_reserved_segments(cleanerd->nilfs,
+						 sustat->ss_nsegs);
+	level = min_t(int, prev, n);
+	while (level < n && ncleansegs < thr[level] + r_segments)
+		level++;
+	if (level <= prev) {
+		while (level > 0 &&
+		       ncleansegs >= thr[level - 1] + thr[level - 1] / 8 + 1 +
+		       r_segments)
+			level--;
+	}
+	if (level == prev)
+		return;
+
+	cleanerd->emergency_level = level;
+	if (level == 0) {
+		syslog(LOG_NOTICE,
+		       "free segments recovered (%llu), protection period restored to %ld seconds",
+		       (unsigned long long)ncleansegs,
+		       (long)nilfs_cleanerd_base_protection_period(
+			       cleanerd)->tv_sec);
+		return;
+	}
+	nilfs_cleanerd_set_emergency_period(cleanerd);
+	syslog(level > prev ? LOG_WARNING : LOG_NOTICE,
+	       "emergency level %d/%d (%llu free segments), protection period %s to %ld seconds",
+	       level, n, (unsigned long long)ncleansegs,
+	       level > prev ? "reduced" : "raised",
+	       (long)cleanerd->emergency_protection_period.tv_sec);
 }
 
-static void nilfs_cleanerd_clean_check_resume(struct nilfs_cleanerd *cleanerd)
+/**
+ * nilfs_cleanerd_watch_start - start watching free segments while paused
+ * @cleanerd: cleanerd object
+ *
+ * While the daemon is paused by the clean check, the number of free
+ * segments is sampled at an adaptive rate between min_clean_check_interval
+ * and clean_check_interval so that a rapid fill is noticed long before
+ * the next regular check.
+ */
+static void nilfs_cleanerd_watch_start(struct nilfs_cleanerd *cleanerd)
 {
-	cleanerd->running = 1;
-	syslog(LOG_INFO, "resume (clean check)");
+	const struct nilfs_cldconfig *config = &cleanerd->config;
+
+	cleanerd->watch =
+		timespecisset(&config->cf_min_clean_check_interval) &&
+		timespeccmp(&config->cf_min_clean_check_interval,
+			    &config->cf_clean_check_interval, <);
+	cleanerd->watch_interval = config->cf_min_clean_check_interval;
+	cleanerd->watch_prev_ncleansegs = 0;
 }
 
-static void nilfs_cleanerd_manual_suspend(struct nilfs_cleanerd *cleanerd)
+/**
+ * nilfs_cleanerd_watch - sample the number of free segments
+ * @cleanerd: cleanerd object
+ *
+ * Return 1 if the number of free segments has fallen below the low
+ * watermark, or 0 otherwise.  The next sampling interval is doubled
+ * while the file system is quiet, reset to the minimum when it is being
+ * written, and bounded by half the time in which the fastest fill seen
+ * so far would reach the watermark.
+ */
+static int nilfs_cleanerd_watch(struct nilfs_cleanerd *cleanerd)
 {
-	cleanerd->mm_prev_state = cleanerd->running;
-	cleanerd->running = -1;
-	cleanerd->timeout = cleanerd->config.cf_clean_check_interval;
-	syslog(LOG_INFO, "suspend (manual)");
-}
+	const struct nilfs_cldconfig *config = &cleanerd->config;
+	struct nilfs_sustat sustat;
+	struct timespec now, dt, interval;
+	uint64_t low, consumed, nsps, eta;
 
-static void nilfs_cleanerd_manual_resume(struct nilfs_cleanerd *cleanerd)
-{
-	/* cleanerd->running == -1 */
+	if (unlikely(nilfs_get_sustat(cleanerd->nilfs, &sustat) < 0 ||
+		     clock_gettime(CLOCK_MONOTONIC, &now) < 0))
+		return 0;
+
+	low = config->cf_min_clean_segments +
+		nilfs_get_reserved_segments(cleanerd->nilfs, sustat.ss_nsegs);
+	if (sustat.ss_ncleansegs < low) {
+		cleanerd->watch = 0;
+		return 1;
+	}
+
+	timespecadd(&cleanerd->watch_interval, &cleanerd->watch_interval,
+		    &interval);
+	if (cleanerd->watch_prev_ncleansegs > sustat.ss_ncleansegs) {
+		consumed = cleanerd->watch_prev_ncleansegs -
+			sustat.ss_ncleansegs;
+		timespecsub(&now, &cleanerd->watch_prev_time, &dt);
+		nsps = nilfs_cleanerd_nsecs(&dt) / consumed;
+		if (cleanerd->watch_nsps == 0 || nsps < cleanerd->watch_nsps)
+			cleanerd->watch_nsps = nsps;
+		interval = config->cf_clean_check_interval;
+	} else if (sustat.ss_nongc_ctime != cleanerd->watch_prev_ctime) {
+		interval = config->cf_min_clean_check_interval;
+	}
+
+	if (cleanerd->watch_nsps > 0) {
+		eta = (sustat.ss_ncleansegs - low) * cleanerd->watch_nsps / 2;
+		if (eta < nilfs_cleanerd_nsecs(&interval)) {
+			interval.tv_sec = eta / 1000000000ULL;
+			interval.tv_nsec = eta % 1000000000ULL;
+		}
+	}
+	if (timespeccmp(&interval, &config->cf_min_clean_check_interval, <))
+		interval = config->cf_min_clean_check_interval;
+	else if (timespeccmp(&interval, &config->cf_clean_check_interval, >))
+		interval = config->cf_clean_check_interval;
+
+	cleanerd->watch_interval = interval;
+	cleanerd->watch_prev_time = now;
+	cleanerd->watch_prev_ncleansegs = sustat.ss_ncleansegs;
+	cleanerd->watch_prev_ctime = sustat.ss_nongc_ctime;
+	return 0;
+}
+
+static void nilfs_cleanerd_clean_check_pause(struct nilfs_cleanerd *cleanerd)
+{
+	cleanerd->running = 0;
+	cleanerd->timeout = cleanerd->config.cf_clean_check_interval;
+	nilfs_cleanerd_set_priority(cleanerd, 0);
+	nilfs_cleanerd_watch_start(cleanerd);
+	syslog(LOG_INFO, "pause (clean check)");
+}
+
+static void nilfs_cleanerd_clean_check_resume(struct nilfs_cleanerd *cleanerd)
+{
+	cleanerd->running = 1;
+	cleanerd->watch = 0;
+	syslog(LOG_INFO, "resume (clean check)");
+}
+
+static int nilfs_cleanerd_status(const struct nilfs_cleanerd *cleanerd)
+{
+	if (cleanerd->running == 0)
+		return NILFS_CLEANER_STATUS_IDLE;
+	else if (cleanerd->running > 0)
+		return NILFS_CLEANER_STATUS_RUNNING;
+	return NILFS_CLEANER_STATUS_SUSPENDED;
+}
+
+/**
+ * nilfs_cleanerd_get_progress - take a snapshot of the progress of GC
+ * @cleanerd: cleanerd object
+ * @progress: place to store the progress
+ *
+ * The time left for a manual job is extrapolated from the pace of its
+ * current pass.
+ */
+static void nilfs_cleanerd_get_progress(const struct nilfs_cleanerd *cleanerd,
+					struct nilfs_cleaner_progress *progress)
+{
+	struct timespec now, elapsed;
+	long done;
+
+	memset(progress, 0, sizeof(*progress));
+	progress->jobid = cleanerd->jobid;
+	progress->status = nilfs_cleanerd_status(cleanerd);
+	progress->cleaned_segs = cleanerd->stats.cs_cleaned_segs;
+	progress->freed_bytes = cleanerd->stats.cs_freed_bytes;
+	progress->free_segs = cleanerd->stats.cs_free_segs;
+	progress->nsegs = cleanerd->stats.cs_nsegs;
+	progress->eta = NILFS_CLEANER_ETA_UNKNOWN;
+
+	if (!cleanerd->job_active)
+		return;
+
+	progress->flags = NILFS_CLEANER_PROGRESS_ACTIVE;
+	progress->remaining_segs = cleanerd->mm_nrestsegs;
+	done = cleanerd->mm_pass_nsegs - cleanerd->mm_nrestsegs;
+	if (cleanerd->running == 2 && done > 0 &&
+	    clock_gettime(CLOCK_MONOTONIC, &now) == 0) {
+		timespecsub(&now, &cleanerd->mm_pass_start, &elapsed);
+		progress->eta = (nilfs_cleanerd_nsecs(&elapsed) / 1e9) *
+			cleanerd->mm_nrestsegs / done + 0.5;
+	}
+}
+
+static void nilfs_cleanerd_make_event(
+	const struct nilfs_cleanerd *cleanerd, unsigned int flags,
+	struct nilfs_cleaner_response_with_progress *res)
+{
+	memset(res, 0, sizeof(*res));
+	nilfs_cleanerd_get_progress(cleanerd, &res->progress);
+	res->progress.flags |= flags;
+	res->hdr.result = NILFS_CLEANER_RSP_EVENT;
+	res->hdr.status = res->progress.status;
+	res->hdr.jobid = res->progress.jobid;
+}
+
+/**
+ * nilfs_cleanerd_notify - send a progress event to subscribed clients
+ * @cleanerd: cleanerd object
+ * @flags: progress flags (NILFS_CLEANER_PROGRESS_*)
+ */
+static void nilfs_cleanerd_notify(struct nilfs_cleanerd *cleanerd,
+				  unsigned int flags)
+{
+	struct nilfs_cleaner_response_with_progress res;
+
+	if (!cleanerd->ctl || !nilfs_cldctl_has_subscribers(cleanerd->ctl))
+		return;
+
+	nilfs_cleanerd_make_event(cleanerd, flags, &res);
+	nilfs_cldctl_broadcast(cleanerd->ctl, &res, sizeof(res),
+			       flags & NILFS_CLEANER_PROGRESS_DONE);
+}
+
+/**
+ * nilfs_cleanerd_end_job - finish the current manual job
+ * @cleanerd: cleanerd object
+ *
+ * Subscribed clients are notified, and the clients waiting for the job
+ * receive their deferred responses.
+ */
+static void nilfs_cleanerd_end_job(struct nilfs_cleanerd *cleanerd)
+{
+	struct nilfs_cleaner_response res = {0};
+
+	if (!cleanerd->job_active)
+		return;
+	cleanerd->job_active = 0;
+	if (!cleanerd->ctl)
+		return;
+
+	nilfs_cleanerd_notify(cleanerd, NILFS_CLEANER_PROGRESS_DONE);
+
+	res.result = NILFS_CLEANER_RSP_ACK;
+	res.status = nilfs_cleanerd_status(cleanerd);
+	res.jobid = cleanerd->jobid;
+	nilfs_cldctl_wake(cleanerd->ctl, cleanerd->jobid, &res, sizeof(res));
+}
+
+static void nilfs_cleanerd_manual_suspend(struct nilfs_cleanerd *cleanerd)
+{
+	cleanerd->mm_prev_state = cleanerd->running;
+	cleanerd->running = -1;
+	cleanerd->timeout = cleanerd->config.cf_clean_check_interval;
+	cleanerd->watch = 0;
+	syslog(LOG_INFO, "suspend (manual)");
+}
+
+static void nilfs_cleanerd_manual_resume(struct nilfs_cleanerd *cleanerd)
+{
+	/* cleanerd->running == -1 */
 	cleanerd->mm_prev_state = 0;
 	cleanerd->running = cleanerd->mm_prev_state;
+	nilfs_cleanerd_end_job(cleanerd);
 	syslog(LOG_INFO, "resume (manual)");
 }
 
 static void nilfs_cleanerd_manual_run(struct nilfs_cleanerd *cleanerd)
 {
 	cleanerd->running = 2;
+	cleanerd->watch = 0;
 	syslog(LOG_INFO, "run (manual)");
 }
 
@@ -926,6 +1897,7 @@ static void nilfs_cleanerd_manual_end(struct nilfs_cleanerd *cleanerd)
 {
 	cleanerd->running = 0;
 	cleanerd->timeout = cleanerd->config.cf_clean_check_interval;
+	nilfs_cleanerd_end_job(cleanerd);
 	syslog(LOG_INFO, "manual run completed");
 }
 
@@ -933,6 +1905,7 @@ static void nilfs_cleanerd_manual_stop(struct nilfs_cleanerd *cleanerd)
 {
 	cleanerd->running = 0;
 	cleanerd->timeout = cleanerd->config.cf_clean_check_interval;
+	nilfs_cleanerd_end_job(cleanerd);
 	syslog(LOG_INFO, "manual run aborted");
 }
 
@@ -1021,12 +1994,20 @@ static int nilfs_cleanerd_recalc_interval(struct nilfs_cleanerd *cleanerd,
 	return 0;
 }
 
-static int nilfs_cleanerd_respond(struct nilfs_cleanerd *cleanerd,
-				  struct nilfs_cleaner_request *req,
-				  const struct nilfs_cleaner_response *res)
+static int nilfs_cleanerd_respond_sized(struct nilfs_cleanerd *cleanerd,
+					struct nilfs_cleaner_request *req,
+					const struct nilfs_cleaner_response *res,
+					size_t size)
 {
 	int ret;
 
+	if (cleanerd->ctl_client) {
+		ret = nilfs_cldctl_send(cleanerd->ctl_client, res, size);
+		if (unlikely(ret < 0))
+			syslog(LOG_ERR, "cannot respond to control client: %m");
+		goto out_log;
+	}
+
 	if (cleanerd->sendq < 0 ||
 	    uuid_compare(cleanerd->client_uuid, req->client_uuid) != 0) {
 		char nambuf[NAME_MAX - 4];
@@ -1048,21 +2029,27 @@ static int nilfs_cleanerd_respond(struct nilfs_cleanerd *cleanerd,
 		}
 		uuid_copy(cleanerd->client_uuid, req->client_uuid);
 	}
-	ret = mq_send(cleanerd->sendq, (char *)res, sizeof(*res),
+	ret = mq_send(cleanerd->sendq, (char *)res, size,
 		      NILFS_CLEANER_PRIO_HIGH);
-	if (unlikely(ret < 0)) {
+	if (unlikely(ret < 0))
 		syslog(LOG_ERR, "cannot respond to client: %m");
-	} else {
-		if (req->cmd >= 0 &&
-		    req->cmd < ARRAY_SIZE(nilfs_cleaner_cmd_name))
-			syslog(LOG_DEBUG, "command %s %s",
-			       nilfs_cleaner_cmd_name[req->cmd],
-			       res->result ? "nacked" : "acked");
-	}
+out_log:
+	if (ret == 0 && req->cmd >= 0 &&
+	    req->cmd < ARRAY_SIZE(nilfs_cleaner_cmd_name))
+		syslog(LOG_DEBUG, "command %s %s",
+		       nilfs_cleaner_cmd_name[req->cmd],
+		       res->result ? "nacked" : "acked");
 out:
 	return ret;
 }
 
+static int nilfs_cleanerd_respond(struct nilfs_cleanerd *cleanerd,
+				  struct nilfs_cleaner_request *req,
+				  const struct nilfs_cleaner_response *res)
+{
+	return nilfs_cleanerd_respond_sized(cleanerd, req, res, sizeof(*res));
+}
+
 static int nilfs_cleanerd_nak(struct nilfs_cleanerd *cleanerd,
 			      struct nilfs_cleaner_request *req,
 			      int errcode)
@@ -1079,13 +2066,7 @@ static int nilfs_cleanerd_cmd_getstat(struct nilfs_cleanerd *cleanerd,
 {
 	struct nilfs_cleaner_response res = {0};
 
-	if (cleanerd->running == 0)
-		res.status = NILFS_CLEANER_STATUS_IDLE;
-	else if (cleanerd->running > 0)
-		res.status = NILFS_CLEANER_STATUS_RUNNING;
-	else
-		res.status = NILFS_CLEANER_STATUS_SUSPENDED;
-
+	res.status = nilfs_cleanerd_status(cleanerd);
 	res.result = NILFS_CLEANER_RSP_ACK;
 	return nilfs_cleanerd_respond(cleanerd, req, &res);
 }
@@ -1161,6 +2142,47 @@ static int nilfs_cleanerd_cmd_run(struct nilfs_cleanerd *cleanerd,
 		cleanerd->mm_min_reclaimable_blocks =
 			cleanerd->min_reclaimable_blocks;
 	}
+	/* range of segments */
+	if (req2->args.valid & NILFS_CLEANER_ARG_START_SEGNUM) {
+		if (req2->args.start_segnum >=
+		    nilfs_get_nsegments(cleanerd->nilfs))
+			goto error_inval;
+		cleanerd->mm_start_segnum = req2->args.start_segnum;
+	} else {
+		cleanerd->mm_start_segnum = 0;
+	}
+	if (req2->args.valid & NILFS_CLEANER_ARG_NSEGS) {
+		if (!req2->args.nsegs)
+			goto error_inval;
+		if (req2->args.nsegs > UINT64_MAX - cleanerd->mm_start_segnum)
+			cleanerd->mm_end_segnum = UINT64_MAX;
+		else
+			cleanerd->mm_end_segnum =
+				cleanerd->mm_start_segnum + req2->args.nsegs;
+	} else {
+		cleanerd->mm_end_segnum = UINT64_MAX;
+	}
+	/* usage rate threshold */
+	if (req2->args.valid & NILFS_CLEANER_ARG_USAGE_RATE_THRESHOLD) {
+		if (!req2->args.usage_rate_threshold ||
+		    req2->args.usage_rate_threshold > 100)
+			goto error_inval;
+		cleanerd->mm_usage_rate_threshold =
+			req2->args.usage_rate_threshold;
+	} else {
+		cleanerd->mm_usage_rate_threshold = 0;
+	}
+	nilfs_vector_clear(cleanerd->mm_skipped);
+	/* runtime */
+	if (req2->args.valid & NILFS_CLEANER_ARG_RUNTIME) {
+		if (!req2->args.runtime ||
+		    clock_gettime(CLOCK_MONOTONIC,
+				  &cleanerd->mm_deadline) < 0)
+			goto error_inval;
+		cleanerd->mm_deadline.tv_sec += req2->args.runtime;
+	} else {
+		timespecclear(&cleanerd->mm_deadline);
+	}
 	/* number of passes */
 	if (req2->args.valid & NILFS_CLEANER_ARG_NPASSES) {
 		if (!req2->args.npasses)
@@ -1171,8 +2193,11 @@ static int nilfs_cleanerd_cmd_run(struct nilfs_cleanerd *cleanerd,
 		cleanerd->mm_nrestpasses = 1;
 		cleanerd->mm_nrestsegs = 0;
 	}
+	nilfs_cleanerd_end_job(cleanerd); /* superseded by the new job */
 	nilfs_cleanerd_manual_run(cleanerd);
 	res.jobid = ++cleanerd->jobid;
+	cleanerd->job_active = 1;
+	cleanerd->mm_pass_nsegs = 0;
 	res.result = NILFS_CLEANER_RSP_ACK;
 out:
 	return nilfs_cleanerd_respond(cleanerd, req, &res);
@@ -1247,8 +2272,27 @@ static int nilfs_cleanerd_cmd_wait(struct nilfs_cleanerd *cleanerd,
 				   struct nilfs_cleaner_request *req,
 				   size_t argsize)
 {
-	/* Not yet implemented */
-	return nilfs_cleanerd_nak(cleanerd, req, EOPNOTSUPP);
+	struct nilfs_cleaner_request_with_jobid *req2;
+	struct nilfs_cleaner_response res = {0};
+
+	/* responses can only be deferred on the control socket */
+	if (!cleanerd->ctl_client)
+		return nilfs_cleanerd_nak(cleanerd, req, EOPNOTSUPP);
+
+	if (argsize < sizeof(req2->jobid))
+		return nilfs_cleanerd_nak(cleanerd, req, EINVAL);
+
+	req2 = (struct nilfs_cleaner_request_with_jobid *)req;
+	if (cleanerd->job_active && req2->jobid == cleanerd->jobid) {
+		nilfs_cldctl_wait(cleanerd->ctl_client, req2->jobid);
+		return 0;
+	}
+
+	/* the job has already ended */
+	res.result = NILFS_CLEANER_RSP_ACK;
+	res.status = nilfs_cleanerd_status(cleanerd);
+	res.jobid = req2->jobid;
+	return nilfs_cleanerd_respond(cleanerd, req, &res);
 }
 
 static int nilfs_cleanerd_cmd_stop(struct nilfs_cleanerd *cleanerd,
@@ -1274,6 +2318,142 @@ static int nilfs_cleanerd_cmd_shutdown(struct nilfs_cleanerd *cleanerd,
 	return nilfs_cleanerd_respond(cleanerd, req, &res);
 }
 
+/**
+ * nilfs_cleanerd_update_stats - refresh gauges of exported statistics
+ * @cleanerd: cleanerd object
+ */
+static void nilfs_cleanerd_update_stats(struct nilfs_cleanerd *cleanerd)
+{
+	struct nilfs_cldstats *stats = &cleanerd->stats;
+
+	stats->cs_state = cleanerd->running;
+	stats->cs_emergency_level = cleanerd->emergency_level;
+	stats->cs_nsegments_per_clean = nilfs_cleanerd_ncleansegs(cleanerd);
+	stats->cs_cleaning_interval =
+		*nilfs_cleanerd_cleaning_interval(cleanerd);
+	stats->cs_protection_period =
+		*nilfs_cleanerd_protection_period(cleanerd);
+	stats->cs_min_reclaimable_blocks =
+		nilfs_cleanerd_min_reclaimable_blocks(cleanerd);
+	stats->cs_defer_segs = nilfs_clddefer_count(cleanerd->defer);
+}
+
+static int nilfs_cleanerd_cmd_get_wastat(struct nilfs_cleanerd *cleanerd,
+					 struct nilfs_cleaner_request *req,
+					 size_t argsize)
+{
+	struct nilfs_cleaner_response_with_wastat res;
+
+	memset(&res, 0, sizeof(res));
+	nilfs_cldwastat_get(cleanerd->wastat, time(NULL), &res.wastat);
+	res.wastat.block_size = nilfs_get_block_size(cleanerd->nilfs);
+
+	res.hdr.result = NILFS_CLEANER_RSP_ACK;
+	return nilfs_cleanerd_respond_sized(cleanerd, req, &res.hdr,
+					    sizeof(res));
+}
+
+static int nilfs_cleanerd_cmd_get_progress(struct nilfs_cleanerd *cleanerd,
+					   struct nilfs_cleaner_request *req,
+					   size_t argsize)
+{
+	struct nilfs_cleaner_response_with_progress res;
+
+	memset(&res, 0, sizeof(res));
+	nilfs_cleanerd_get_progress(cleanerd, &res.progress);
+
+	res.hdr.result = NILFS_CLEANER_RSP_ACK;
+	res.hdr.status = res.progress.status;
+	res.hdr.jobid = res.progress.jobid;
+	return nilfs_cleanerd_respond_sized(cleanerd, req, &res.hdr,
+					    sizeof(res));
+}
+
+static int nilfs_cleanerd_cmd_subscribe(struct nilfs_cleanerd *cleanerd,
+					struct nilfs_cleaner_request *req,
+					size_t argsize)
+{
+	struct nilfs_cleaner_response_with_progress event;
+	struct nilfs_cleaner_response res = {0};
+	int ret;
+
+	/* events can only be sent on the control socket */
+	if (!cleanerd->ctl_client)
+		return nilfs_cleanerd_nak(cleanerd, req, EOPNOTSUPP);
+
+	nilfs_cldctl_subscribe(cleanerd->ctl_client);
+	res.result = NILFS_CLEANER_RSP_ACK;
+	ret = nilfs_cleanerd_respond(cleanerd, req, &res);
+	if (ret == 0) {
+		/* give the subscriber a starting point */
+		nilfs_cleanerd_make_event(cleanerd, 0, &event);
+		nilfs_cldctl_send_event(cleanerd->ctl_client, &event,
+					sizeof(event));
+	}
+	return ret;
+}
+
+/**
+ * nilfs_cleanerd_mode - get cleaning mode reported by get-stats
+ * @cleanerd: cleanerd object
+ */
+static int nilfs_cleanerd_mode(const struct nilfs_cleanerd *cleanerd)
+{
+	switch (cleanerd->running) {
+	case -1:
+		return NILFS_CLEANER_MODE_SUSPENDED;
+	case 1:
+		return cleanerd->urgent ? NILFS_CLEANER_MODE_URGENT :
+			NILFS_CLEANER_MODE_BACKGROUND;
+	case 2:
+		return NILFS_CLEANER_MODE_MANUAL;
+	default:
+		return NILFS_CLEANER_MODE_IDLE;
+	}
+}
+
+static int nilfs_cleanerd_cmd_get_stats(struct nilfs_cleanerd *cleanerd,
+					struct nilfs_cleaner_request *req,
+					size_t argsize)
+{
+	struct nilfs_cleaner_response_with_stats res;
+	struct nilfs_cleaner_stats *st = &res.stats;
+	const struct nilfs_cldstats *stats = &cleanerd->stats;
+
+	nilfs_cleanerd_update_stats(cleanerd);
+
+	memset(&res, 0, sizeof(res));
+	st->version = NILFS_CLEANER_STATS_VERSION;
+	st->size = sizeof(*st);
+	st->status = nilfs_cleanerd_status(cleanerd);
+	st->mode = nilfs_cleanerd_mode(cleanerd);
+	st->nsegments_per_clean = stats->cs_nsegments_per_clean;
+	st->emergency_level = stats->cs_emergency_level;
+	st->cleaning_interval =
+		nilfs_cleanerd_nsecs(&stats->cs_cleaning_interval);
+	st->protection_period = stats->cs_protection_period.tv_sec;
+	st->nsegs = stats->cs_nsegs;
+	st->free_segs = stats->cs_free_segs;
+	st->reserved_segs = stats->cs_reserved_segs;
+	st->reclaimable_segs = stats->cs_reclaimable_segs;
+	st->candidate_segs = stats->cs_candidate_segs;
+	st->ncycles = stats->cs_ncycles;
+	st->cleaned_segs = stats->cs_cleaned_segs;
+	st->deferred_segs = stats->cs_deferred_segs;
+	st->protected_segs = stats->cs_protected_segs;
+	st->live_blks = stats->cs_live_blks;
+	st->defunct_blks = stats->cs_defunct_blks;
+	st->last_cycle = nilfs_cleanerd_nsecs(&stats->cs_last_cycle_time);
+	st->block_size = nilfs_get_block_size(cleanerd->nilfs);
+	nilfs_cleanerd_get_progress(cleanerd, &st->progress);
+
+	res.hdr.result = NILFS_CLEANER_RSP_ACK;
+	res.hdr.status = st->status;
+	res.hdr.jobid = st->progress.jobid;
+	return nilfs_cleanerd_respond_sized(cleanerd, req, &res.hdr,
+					    sizeof(res));
+}
+
 static int nilfs_cleanerd_handle_message(struct nilfs_cleanerd *cleanerd,
 					 void *msgbuf, size_t bytes)
 {
@@ -1319,43 +2499,167 @@ static int nilfs_cleanerd_handle_message(struct nilfs_cleanerd *cleanerd,
 	case NILFS_CLEANER_CMD_SHUTDOWN:
 		ret = nilfs_cleanerd_cmd_shutdown(cleanerd, req, argsize);
 		break;
+	case NILFS_CLEANER_CMD_GET_WASTAT:
+		ret = nilfs_cleanerd_cmd_get_wastat(cleanerd, req, argsize);
+		break;
+	case NILFS_CLEANER_CMD_GET_PROGRESS:
+		ret = nilfs_cleanerd_cmd_get_progress(cleanerd, req, argsize);
+		break;
+	case NILFS_CLEANER_CMD_SUBSCRIBE:
+		ret = nilfs_cleanerd_cmd_subscribe(cleanerd, req, argsize);
+		break;
+	case NILFS_CLEANER_CMD_GET_STATS:
+		ret = nilfs_cleanerd_cmd_get_stats(cleanerd, req, argsize);
+		break;
 	default:
 		syslog(LOG_DEBUG, "received unknown command: %d", req->cmd);
-		return nilfs_cleanerd_nak(cleanerd, req, EINVAL);
+		ret = nilfs_cleanerd_nak(cleanerd, req, EINVAL);
+		break;
 	}
+	nilfs_cldtrace_record(cleanerd->trace, NILFS_CLDTRACE_COMMAND, 0,
+			      req->cmd, ret, 0, 0);
 out:
 	return ret;
 }
 
+/**
+ * nilfs_cleanerd_msg_pending - check if a client has sent a request
+ * @pfd: poll entries (queue, metrics, and control socket entries)
+ * @nfds: number of entries in @pfd
+ *
+ * Hang-ups on control connections count as well, so that closed
+ * connections get released.
+ */
+static int nilfs_cleanerd_msg_pending(const struct pollfd *pfd, nfds_t nfds)
+{
+	nfds_t i;
+
+	if (pfd[0].revents & POLLIN)
+		return 1;
+	for (i = 2; i < nfds; i++) {
+		if (pfd[i].revents)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * nilfs_cleanerd_handle_ctl - handle requests from control clients
+ * @cleanerd: cleanerd object
+ *
+ * Every client gets at most one request handled per wakeup.
+ */
+static void nilfs_cleanerd_handle_ctl(struct nilfs_cleanerd *cleanerd)
+{
+	struct nilfs_cldctl_client *client;
+	ssize_t bytes;
+	int i;
+
+	for (i = 0; i < NILFS_CLDCTL_MAX_CLIENTS; i++) {
+		bytes = nilfs_cldctl_recv(cleanerd->ctl, nilfs_cleanerd_msgbuf,
+					  sizeof(nilfs_cleanerd_msgbuf),
+					  &client);
+		if (bytes <= 0)
+			break;
+		cleanerd->ctl_client = client;
+		nilfs_cleanerd_handle_message(cleanerd, nilfs_cleanerd_msgbuf,
+					      bytes);
+		cleanerd->ctl_client = NULL;
+	}
+}
+
 static int nilfs_cleanerd_wait(struct nilfs_cleanerd *cleanerd)
 {
-	struct pollfd pfd;
+	struct pollfd pfd[3 + NILFS_CLDCTL_MAX_CLIENTS];
+	struct timespec timeout, deadline, now;
 	ssize_t bytes;
-	int ret;
+	nfds_t nfds;
+	int sliced, ret;
 
 	syslog(LOG_DEBUG, "wait %ld.%09ld",
 	       cleanerd->timeout.tv_sec, cleanerd->timeout.tv_nsec);
 
-	memset(&pfd, 0, sizeof(pfd));
-	pfd.fd = cleanerd->recvq;
-	pfd.events = POLLIN;
-
-	ret = ppoll(&pfd, 1, &cleanerd->timeout, NULL);
+	ret = clock_gettime(CLOCK_MONOTONIC, &now);
 	if (unlikely(ret < 0)) {
-		if (errno == EINTR) {
-			syslog(LOG_INFO, "wake up (interrupted)");
+		syslog(LOG_ERR, "cannot get monotonic time: %m");
+		return -1;
+	}
+	timespecadd(&now, &cleanerd->timeout, &deadline);
+	timeout = cleanerd->timeout;
+
+	for (;;) {
+		memset(pfd, 0, sizeof(pfd));
+		pfd[0].fd = cleanerd->recvq;
+		pfd[0].events = POLLIN;
+
+		/* a negative descriptor is ignored by ppoll() */
+		pfd[1].fd = nilfs_cldmetrics_get_fd(cleanerd->metrics);
+		pfd[1].events = POLLIN;
+		nfds = 2;
+
+		if (cleanerd->ctl)
+			nfds += nilfs_cldctl_fill_pollfd(
+				cleanerd->ctl, &pfd[nfds],
+				ARRAY_SIZE(pfd) - nfds);
+
+		/* sleep in shorter slices while watching free segments */
+		sliced = cleanerd->watch && cleanerd->running == 0 &&
+			timespeccmp(&cleanerd->watch_interval, &timeout, <);
+		ret = ppoll(pfd, nfds, sliced ? &cleanerd->watch_interval :
+			    &timeout, NULL);
+		if (unlikely(ret < 0)) {
+			if (errno == EINTR) {
+				syslog(LOG_INFO, "wake up (interrupted)");
+				goto out;
+			}
+			syslog(LOG_ERR, "ppoll failed: %m");
+			return -1;
+		}
+
+		if (ret == 0 && sliced) {
+			if (nilfs_cleanerd_watch(cleanerd)) {
+				syslog(LOG_DEBUG,
+				       "wake up (free segments running low)");
+				goto out;
+			}
+		} else if (!(pfd[1].revents & POLLIN)) {
+			break;
+		} else {
+			/*
+			 * Serving metrics must not shorten the sleep, so go
+			 * back to waiting for the rest of the timeout unless
+			 * a message has also arrived.
+			 */
+			nilfs_cleanerd_update_stats(cleanerd);
+			nilfs_cldmetrics_serve(cleanerd->metrics,
+					       &cleanerd->stats);
+			if (nilfs_cleanerd_msg_pending(pfd, nfds))
+				break;
+		}
+
+		ret = clock_gettime(CLOCK_MONOTONIC, &now);
+		if (unlikely(ret < 0)) {
+			syslog(LOG_ERR, "cannot get monotonic time: %m");
+			return -1;
+		}
+		if (!timespeccmp(&now, &deadline, <)) {
+			syslog(LOG_DEBUG, "wake up (timed out)");
 			goto out;
 		}
-		syslog(LOG_ERR, "ppoll failed: %m");
-		return -1;
+		timespecsub(&deadline, &now, &timeout);
 	}
 
-	if (!(pfd.revents & POLLIN)) {
+	if (!nilfs_cleanerd_msg_pending(pfd, nfds)) {
 		syslog(LOG_DEBUG, "wake up (timed out)");
 		goto out;
 	}
 	syslog(LOG_DEBUG, "wake up to handle message");
 
+	if (cleanerd->ctl)
+		nilfs_cleanerd_handle_ctl(cleanerd);
+	if (!(pfd[0].revents & POLLIN))
+		goto out;
+
 	bytes = mq_receive(cleanerd->recvq, nilfs_cleanerd_msgbuf,
 			   sizeof(nilfs_cleanerd_msgbuf), NULL);
 	if (unlikely(bytes < 0)) {
@@ -1375,14 +2679,6 @@ out:
 	return 0;
 }
 
-static uint64_t nilfs_get_reserved_segments(const struct nilfs *nilfs,
-					    uint64_t nsegs)
-{
-	uint32_t ratio = nilfs_get_reserved_segments_ratio(nilfs);
-
-	return max_t(uint64_t, (nsegs * ratio + 99) / 100, NILFS_MIN_NRSVSEGS);
-}
-
 static int nilfs_cleanerd_handle_clean_check(struct nilfs_cleanerd *cleanerd,
 					     struct nilfs_sustat *sustat)
 {
@@ -1409,16 +2705,15 @@ static int nilfs_cleanerd_handle_clean_check(struct nilfs_cleanerd *cleanerd,
 	if (sustat->ss_ncleansegs <
 	    config->cf_min_clean_segments + r_segments) {
 		/* disk space is close to limit -- accelerate cleaning */
+		nilfs_cleanerd_set_priority(cleanerd, 1);
 		cleanerd->ncleansegs = config->cf_mc_nsegments_per_clean;
 		cleanerd->cleaning_interval = config->cf_mc_cleaning_interval;
 		cleanerd->min_reclaimable_blocks =
 				config->cf_mc_min_reclaimable_blocks;
 	} else {
 		/* continue to run */
-		cleanerd->ncleansegs = config->cf_nsegments_per_clean;
-		cleanerd->cleaning_interval = config->cf_cleaning_interval;
-		cleanerd->min_reclaimable_blocks =
-				config->cf_min_reclaimable_blocks;
+		nilfs_cleanerd_set_priority(cleanerd, 0);
+		nilfs_cleanerd_set_normal_params(cleanerd);
 	}
 
 	return 0; /* do gc */
@@ -1429,35 +2724,104 @@ nilfs_cleanerd_count_inuse_segments(struct nilfs_cleanerd *cleanerd,
 				    struct nilfs_sustat *sustat)
 {
 	struct nilfs_suinfo si[NILFS_CLEANERD_NSUINFO];
-	uint64_t segnum;
-	unsigned long rest, count;
+	uint64_t segnum, end;
+	unsigned long count;
 	ssize_t nsi, i;
 	ssize_t nfound = 0;
 
-	segnum = 0;
-	rest = sustat->ss_nsegs;
-	while (rest > 0 && segnum < sustat->ss_nsegs) {
-		count = min_t(unsigned long, rest, NILFS_CLEANERD_NSUINFO);
+	nilfs_cleanerd_segment_range(cleanerd, sustat, &segnum, &end);
+	while (segnum < end) {
+		count = min_t(uint64_t, end - segnum, NILFS_CLEANERD_NSUINFO);
 		nsi = nilfs_get_suinfo(cleanerd->nilfs, segnum, si, count);
 		if (unlikely(nsi < 0)) {
 			syslog(LOG_ERR, "cannot get segment usage info: %m");
 			return -1;
 		}
+		if (nsi == 0)
+			break;
 		for (i = 0; i < nsi; i++, segnum++) {
-			if (nilfs_suinfo_reclaimable(&si[i])) {
+			if (nilfs_suinfo_reclaimable(&si[i]))
 				nfound++;
-				rest--;
-			}
 		}
 	}
 	return nfound; /* return the number of found segments */
 }
 
+static int nilfs_cleanerd_count_used_blocks(struct nilfs_cleanerd *cleanerd,
+					    struct nilfs_sustat *sustat,
+					    uint64_t *usedp)
+{
+	struct nilfs_suinfo si[NILFS_CLEANERD_NSUINFO];
+	uint64_t segnum, used = 0;
+	unsigned long count;
+	ssize_t nsi, i;
+
+	for (segnum = 0; segnum < sustat->ss_nsegs; segnum += nsi) {
+		count = min_t(uint64_t, sustat->ss_nsegs - segnum,
+			      NILFS_CLEANERD_NSUINFO);
+		nsi = nilfs_get_suinfo(cleanerd->nilfs, segnum, si, count);
+		if (unlikely(nsi < 0)) {
+			syslog(LOG_ERR, "cannot get segment usage info: %m");
+			return -1;
+		}
+		if (nsi == 0)
+			break;
+		for (i = 0; i < nsi; i++) {
+			if (nilfs_suinfo_dirty(&si[i]))
+				used += si[i].sui_nblocks;
+		}
+	}
+	*usedp = used;
+	return 0;
+}
+
+/**
+ * nilfs_cleanerd_sample_writes - sample segment usage for write accounting
+ * @cleanerd: cleanerd object
+ * @sustat: status information on segments
+ * @used: number of blocks in dirty segments
+ */
+static void nilfs_cleanerd_sample_writes(struct nilfs_cleanerd *cleanerd,
+					 const struct nilfs_sustat *sustat,
+					 uint64_t used)
+{
+	cleanerd->wa_nongc_ctime = sustat->ss_nongc_ctime;
+	nilfs_cldwastat_sample(cleanerd->wastat, time(NULL), used);
+}
+
+/**
+ * nilfs_cleanerd_track_writes - sample segment usage by a separate scan
+ * @cleanerd: cleanerd object
+ * @sustat: status information on segments
+ *
+ * Scans the segment usage only if the file system has been updated by
+ * users since the last sample.
+ */
+static void nilfs_cleanerd_track_writes(struct nilfs_cleanerd *cleanerd,
+					struct nilfs_sustat *sustat)
+{
+	uint64_t used;
+
+	if (sustat->ss_nongc_ctime == cleanerd->wa_nongc_ctime)
+		return;
+	if (nilfs_cleanerd_count_used_blocks(cleanerd, sustat, &used) == 0)
+		nilfs_cleanerd_sample_writes(cleanerd, sustat, used);
+}
+
 static int nilfs_cleanerd_handle_manual_mode(struct nilfs_cleanerd *cleanerd,
 					     struct nilfs_sustat *sustat)
 {
+	struct timespec now;
 	ssize_t ret;
 
+	if (timespecisset(&cleanerd->mm_deadline) &&
+	    clock_gettime(CLOCK_MONOTONIC, &now) == 0 &&
+	    !timespeccmp(&now, &cleanerd->mm_deadline, <)) {
+		syslog(LOG_INFO, "runtime of manual run expired");
+		cleanerd->mm_nrestpasses = 0;
+		cleanerd->mm_nrestsegs = 0;
+	}
+
 	if (cleanerd->mm_nrestsegs == 0) {
 		if (cleanerd->mm_nrestpasses > 0) {
 			ret = nilfs_cleanerd_count_inuse_segments(cleanerd,
@@ -1467,6 +2831,9 @@ static int nilfs_cleanerd_handle_manual_mode(struct nilfs_cleanerd *cleanerd,
 			} else {
 				cleanerd->mm_nrestpasses--;
 				cleanerd->mm_nrestsegs = ret;
+				cleanerd->mm_pass_nsegs = ret;
+				clock_gettime(CLOCK_MONOTONIC,
+					      &cleanerd->mm_pass_start);
 			}
 		}
 	}
@@ -1515,13 +2882,218 @@ static void nilfs_cleanerd_progress(struct nilfs_cleanerd *cleanerd, int nsegs)
 	}
 }
 
+/**
+ * nilfs_cleanerd_account - accumulate reclaim statistics
+ * @cleanerd: cleanerd object
+ * @stat: statistics returned by nilfs_xreclaim_segment()
+ * @freed: number of blocks in the cleaned segments
+ */
+static void nilfs_cleanerd_account(struct nilfs_cleanerd *cleanerd,
+				   const struct nilfs_reclaim_stat *stat,
+				   uint64_t freed)
+{
+	struct nilfs_cldstats *stats = &cleanerd->stats;
+
+	stats->cs_protected_segs += stat->protected_segs;
+	stats->cs_deferred_segs += stat->deferred_segs;
+	if (stat->cleaned_segs == 0)
+		return; /* no blocks were moved */
+
+	stats->cs_cleaned_segs += stat->cleaned_segs;
+	stats->cs_live_blks += stat->live_blks;
+	stats->cs_defunct_blks += stat->defunct_blks;
+	stats->cs_copied_bytes += (uint64_t)stat->live_blks *
+		nilfs_get_block_size(cleanerd->nilfs);
+	stats->cs_freed_bytes += freed * nilfs_get_block_size(cleanerd->nilfs);
+
+	nilfs_cldwastat_add_gc(cleanerd->wastat, time(NULL), stat->live_blks,
+			       freed);
+}
+
+/**
+ * nilfs_cleanerd_freed_blocks - count blocks in cleaned segments
+ * @segnums: segment numbers passed to nilfs_xreclaim_segment()
+ * @nblocks: number of blocks of segments in @segnums
+ * @nsegs: number of segments in @segnums
+ * @cleaned: segment numbers reordered by nilfs_xreclaim_segment()
+ * @ncleaned: number of cleaned segments
+ */
+static uint64_t nilfs_cleanerd_freed_blocks(const uint64_t *segnums,
+					    const uint32_t *nblocks,
+					    size_t nsegs,
+					    const uint64_t *cleaned,
+					    size_t ncleaned)
+{
+	uint64_t freed = 0;
+	size_t i, j;
+
+	for (i = 0; i < ncleaned; i++) {
+		for (j = 0; j < nsegs; j++) {
+			if (segnums[j] == cleaned[i]) {
+				freed += nblocks[j];
+				break;
+			}
+		}
+	}
+	return freed;
+}
+
+/**
+ * nilfs_cleanerd_filter_by_usage - drop segments with high live ratio
+ * @cleanerd: cleanerd object
+ * @segnums: array of selected segment numbers
+ * @nblocks: number of blocks of segments in @segnums
+ * @nsegs: number of segments in @segnums
+ * @params: reclaim parameters
+ *
+ * Assesses the latest usage of the selected segments in one pass in the
+ * same way as lssu(1) does, and removes segments whose live ratio is not
+ * below the usage rate threshold of the manual run from @segnums and
+ * @nblocks.
+ * Removed segments are remembered so that they are not selected again
+ * in the run.  Returns the number of remaining segments.
+ */
+static size_t
+nilfs_cleanerd_filter_by_usage(struct nilfs_cleanerd *cleanerd,
+			       uint64_t *segnums, uint32_t *nblocks,
+			       size_t nsegs,
+			       const struct nilfs_reclaim_params *params)
+{
+	unsigned long blocks_per_segment =
+		nilfs_get_blocks_per_segment(cleanerd->nilfs);
+	uint64_t *skipped;
+	ssize_t *live;
+	size_t i, n = 0;
+
+	live = malloc(sizeof(*live) * nsegs);
+	if (unlikely(!live)) {
+		syslog(LOG_WARNING, "cannot assess usage of segments: %m");
+		return nsegs;
+	}
+	if (unlikely(nilfs_assess_segments(cleanerd->nilfs, segnums, nsegs,
+					   params, 1, live) < 0)) {
+		syslog(LOG_WARNING, "cannot assess usage of segments: %m");
+		free(live);
+		return nsegs;
+	}
+
+	for (i = 0; i < nsegs; i++) {
+		if (live[i] < 0 ||
+		    (uint64_t)live[i] * 100 <
+		    (uint64_t)cleanerd->mm_usage_rate_threshold *
+		    blocks_per_segment) {
+			segnums[n] = segnums[i];
+			nblocks[n] = nblocks[i];
+			n++;
+			continue;
+		}
+
+		syslog(LOG_DEBUG, "segment %llu skipped (%zd live blocks)",
+		       (unsigned long long)segnums[i], live[i]);
+		skipped = nilfs_vector_get_new_element(cleanerd->mm_skipped);
+		if (likely(skipped))
+			*skipped = segnums[i];
+	}
+	free(live);
+	if (n < nsegs)
+		nilfs_vector_sort(cleanerd->mm_skipped, nilfs_comp_segnum);
+	return n;
+}
+
+/**
+ * nilfs_cleanerd_freeze - push log cursor by freezing file system
+ * @cleanerd: cleanerd object
+ *
+ * Freezing writes the log cursor to the superblocks, but it blocks all
+ * writers until the file system is thawed.  The duration of the stall
+ * is recorded.
+ */
+static int nilfs_cleanerd_freeze(struct nilfs_cleanerd *cleanerd)
+{
+	struct timespec start, end;
+	int ret = -1, err = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (nilfs_freeze(cleanerd->nilfs) == 0) {
+		if (nilfs_thaw(cleanerd->nilfs) == 0)
+			ret = 0;
+		else
+			err = errno;
+	} else {
+		err = errno;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	cleanerd->freeze_last = end;
+
+	timespecsub(&end, &start, &end);
+	nilfs_cldhist_add(&cleanerd->stats.cs_freeze_stall, &end);
+	nilfs_cldtrace_record(cleanerd->trace, NILFS_CLDTRACE_FREEZE, err,
+			      nilfs_cleanerd_nsecs(&end),
+			      cleanerd->shrink_prot_seq, 0, 0);
+	syslog(LOG_DEBUG, "froze file system for %ld.%09ld seconds",
+	       end.tv_sec, end.tv_nsec);
+	return ret;
+}
+
+/**
+ * nilfs_cleanerd_shrink_protected_region - shrink region of protected segments
+ * @cleanerd: cleanerd object
+ * @protseq: sequence number of the oldest protected segment
+ *
+ * This tries to update log cursor written in superblocks to make
+ * protected segments reclaimable.  Cheaper ways are tried first: a plain
+ * sync, then waiting for the file system to advance the log cursor by
+ * itself.  The file system is frozen only if the cursor has not moved for
+ * freeze_interval and no freeze was done within freeze_interval.  Return
+ * 0 if cleaning should be retried right away, or -1 otherwise.
+ */
+static int
+nilfs_cleanerd_shrink_protected_region(struct nilfs_cleanerd *cleanerd,
+				       uint64_t protseq)
+{
+	const struct timespec *interval = &cleanerd->config.cf_freeze_interval;
+	struct timespec now, t;
+	nilfs_cno_t cno;
+
+	if (unlikely(clock_gettime(CLOCK_MONOTONIC, &now) < 0))
+		return -1;
+
+	if (!cleanerd->shrink_synced || protseq != cleanerd->shrink_prot_seq) {
+		if (protseq != cleanerd->shrink_prot_seq ||
+		    !timespecisset(&cleanerd->shrink_since))
+			cleanerd->shrink_since = now;
+		cleanerd->shrink_prot_seq = protseq;
+		cleanerd->shrink_synced = 1;
+		nilfs_sync(cleanerd->nilfs, &cno);
+		return 0;
+	}
+
+	/* the log cursor has not moved since the sync */
+	timespecadd(&cleanerd->shrink_since, interval, &t);
+	if (timespeccmp(&now, &t, <))
+		return -1; /* wait for the cursor to advance */
+
+	timespecadd(&cleanerd->freeze_last, interval, &t);
+	if (timespecisset(&cleanerd->freeze_last) && timespeccmp(&now, &t, <))
+		return -1; /* rate limited */
+
+	cleanerd->shrink_synced = 0;
+	return nilfs_cleanerd_freeze(cleanerd);
+}
+
 static int nilfs_cleanerd_clean_segments(struct nilfs_cleanerd *cleanerd,
-					 uint64_t *segnums, size_t nsegs,
+					 uint64_t *segnums,
+					 uint32_t *nblocks, size_t nsegs,
 					 uint64_t protseq, size_t *ndone)
 {
+	uint64_t selected[NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX];
 	struct nilfs_reclaim_params params;
 	struct nilfs_reclaim_stat stat;
-	struct timespec *pt;
+	const struct timespec *pt;
+	struct timespec start, end;
+	time_t wstart;
+	uint64_t freed;
+	size_t nskipped = 0;
 	int ret, i, sumsegs;
 
 	params.flags = NILFS_RECLAIM_PARAM_PROTSEQ |
@@ -1539,15 +3111,55 @@ static int nilfs_cleanerd_clean_segments(struct nilfs_cleanerd *cleanerd,
 		syslog(LOG_ERR,
 		       "cannot get checkpoint number from protection period (%llu): %m",
 		       (unsigned long long)pt->tv_sec);
+		nilfs_cldtrace_record(cleanerd->trace, NILFS_CLDTRACE_ERROR,
+				      errno, NILFS_CLDTRACE_OP_CNOMAP, 0, 0, 0);
 		goto out;
 	}
 	syslog(LOG_DEBUG, "got cno %llu from protection period %lu",
 	       (unsigned long long)params.protcno, (unsigned long)pt->tv_sec);
 
+	if (cleanerd->running == 2 && cleanerd->mm_usage_rate_threshold > 0) {
+		nskipped = nsegs;
+		nsegs = nilfs_cleanerd_filter_by_usage(cleanerd, segnums,
+						       nblocks, nsegs,
+						       &params);
+		nskipped -= nsegs;
+		if (nskipped > 0) {
+			/* skipped segments count as processed */
+			nilfs_cleanerd_progress(cleanerd, nskipped);
+			if (nsegs == 0) {
+				*ndone = nskipped;
+				ret = 0;
+				goto out;
+			}
+		}
+	}
+
+	/* segnums is reordered by nilfs_xreclaim_segment() */
+	memcpy(selected, segnums, nsegs * sizeof(*segnums));
+
 	memset(&stat, 0, sizeof(stat));
+	stat.exflags = NILFS_RECLAIM_STAT_LOCK_WAIT;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	wstart = time(NULL);
 	ret = nilfs_xreclaim_segment(cleanerd->nilfs, segnums, nsegs, 0,
 				     &params, &stat);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (cleanerd->select_gen >= 0 && ret == 0 &&
+	    (stat.cleaned_segs > 0 || stat.deferred_segs > 0))
+		/* segments written by GC now carry times in this window */
+		nilfs_cldselect_add_window(cleanerd->select, wstart,
+					   time(NULL), cleanerd->select_gen);
+	timespecsub(&end, &start, &end);
+	if (stat.exflags & NILFS_RECLAIM_STAT_LOCK_WAIT)
+		timespecadd(&cleanerd->stats.cs_lock_wait, &stat.lock_wait,
+			    &cleanerd->stats.cs_lock_wait);
+	else
+		timespecclear(&stat.lock_wait);
 	if (unlikely(ret < 0)) {
+		nilfs_cldtrace_record(cleanerd->trace, NILFS_CLDTRACE_ERROR,
+				      errno, NILFS_CLDTRACE_OP_RECLAIM,
+				      0, 0, 0);
 		if (errno == ENOMEM) {
 			nilfs_cleanerd_reduce_ncleansegs_for_retry(cleanerd);
 			cleanerd->fallback = 1;
@@ -1557,16 +3169,34 @@ static int nilfs_cleanerd_clean_segments(struct nilfs_cleanerd *cleanerd,
 		goto out;
 	}
 
-	*ndone = 0;
+	*ndone = nskipped;
+	freed = nilfs_cleanerd_freed_blocks(selected, nblocks, nsegs, segnums,
+					    stat.cleaned_segs);
+	nilfs_cleanerd_account(cleanerd, &stat, freed);
+	nilfs_cldtrace_record(cleanerd->trace, NILFS_CLDTRACE_RECLAIM, 0,
+			      stat.cleaned_segs, stat.deferred_segs,
+			      stat.protected_segs, stat.live_blks);
+	nilfs_cldtrace_record(cleanerd->trace, NILFS_CLDTRACE_RECLAIM_TIME, 0,
+			      nilfs_cleanerd_nsecs(&end),
+			      nilfs_cleanerd_nsecs(&stat.lock_wait),
+			      stat.defunct_blks, 0);
 
 	if (stat.cleaned_segs > 0) {
 		for (i = 0; i < stat.cleaned_segs; i++)
 			syslog(LOG_DEBUG, "segment %llu cleaned",
 			       (unsigned long long)segnums[i]);
 
+		if (cleanerd->config.cf_use_discard &&
+		    unlikely(nilfs_clddiscard_add(cleanerd->discard, segnums,
+						  stat.cleaned_segs) < 0))
+			syslog(LOG_WARNING,
+			       "cannot queue cleaned segments for discard: %m");
+
 		nilfs_cleanerd_progress(cleanerd, stat.cleaned_segs);
 		cleanerd->fallback = 0;
 		cleanerd->retry_cleaning = 0;
+		cleanerd->shrink_synced = 0;
+		timespecclear(&cleanerd->shrink_since);
 
 		*ndone += stat.cleaned_segs;
 	}
@@ -1577,6 +3207,11 @@ static int nilfs_cleanerd_clean_segments(struct nilfs_cleanerd *cleanerd,
 			syslog(LOG_DEBUG, "segment %llu deferred",
 			       (unsigned long long)segnums[i]);
 
+		nilfs_cleanerd_defer_record(cleanerd,
+					    &segnums[stat.cleaned_segs],
+					    stat.deferred_segs, stat.live_blks,
+					    &params);
+
 		nilfs_cleanerd_progress(cleanerd, stat.deferred_segs);
 		cleanerd->fallback = 0;
 		cleanerd->retry_cleaning = 0;
@@ -1593,7 +3228,8 @@ static int nilfs_cleanerd_clean_segments(struct nilfs_cleanerd *cleanerd,
 		if (!cleanerd->retry_cleaning &&
 		    nilfs_segments_still_reclaimable(
 			    cleanerd->nilfs, segnums, nsegs, protseq) &&
-		    nilfs_shrink_protected_region(cleanerd->nilfs) == 0) {
+		    nilfs_cleanerd_shrink_protected_region(cleanerd,
+							   protseq) == 0) {
 
 			syslog(LOG_DEBUG, "retrying protected region");
 			cleanerd->retry_cleaning = 1;
@@ -1606,6 +3242,152 @@ out:
 	return ret;
 }
 
+/**
+ * nilfs_cleanerd_trace_pacing - record pacing decision of the next cycle
+ * @cleanerd: cleanerd object
+ */
+static void nilfs_cleanerd_trace_pacing(struct nilfs_cleanerd *cleanerd)
+{
+	unsigned long flags = 0;
+
+	if (cleanerd->no_timeout)
+		flags |= NILFS_CLDTRACE_PACING_NO_TIMEOUT;
+	if (cleanerd->fallback)
+		flags |= NILFS_CLDTRACE_PACING_FALLBACK;
+	if (cleanerd->retry_cleaning)
+		flags |= NILFS_CLDTRACE_PACING_RETRY;
+
+	nilfs_cldtrace_record(cleanerd->trace, NILFS_CLDTRACE_PACING, 0,
+			      nilfs_cleanerd_nsecs(&cleanerd->timeout),
+			      nilfs_cleanerd_ncleansegs(cleanerd),
+			      nilfs_cleanerd_nsecs(
+				      nilfs_cleanerd_cleaning_interval(cleanerd)),
+			      flags);
+}
+
+/**
+ * nilfs_cleanerd_discard - discard segments freed by GC
+ * @cleanerd: cleanerd object
+ *
+ * A round is issued at most once per discard interval, and only while
+ * the daemon is idle unless a full batch has piled up.  A suspended
+ * daemon issues nothing.
+ */
+static void nilfs_cleanerd_discard(struct nilfs_cleanerd *cleanerd)
+{
+	struct nilfs_cldconfig *config = &cleanerd->config;
+	struct timespec now, next, elapsed;
+	uint64_t bytes;
+	size_t pending, nranges;
+	ssize_t ndone;
+
+	pending = nilfs_clddiscard_pending(cleanerd->discard);
+	if (pending == 0)
+		return;
+
+	if (!config->cf_use_discard) {
+		nilfs_clddiscard_clear(cleanerd->discard);
+		return;
+	}
+
+	if (cleanerd->running < 0 ||
+	    (cleanerd->running > 0 && pending < config->cf_discard_batch_size))
+		return;
+
+	if (unlikely(clock_gettime(CLOCK_MONOTONIC, &now) < 0))
+		return;
+	timespecadd(&cleanerd->discard_last, &config->cf_discard_interval,
+		    &next);
+	if (timespecisset(&cleanerd->discard_last) &&
+	    timespeccmp(&now, &next, <))
+		return;
+	cleanerd->discard_last = now;
+
+	ndone = nilfs_clddiscard_issue(cleanerd->discard,
+				       config->cf_discard_batch_size, &bytes,
+				       &nranges);
+	clock_gettime(CLOCK_MONOTONIC, &elapsed);
+	timespecsub(&elapsed, &now, &elapsed);
+	cleanerd->stats.cs_discarded_bytes += bytes;
+	nilfs_cldtrace_record(cleanerd->trace, NILFS_CLDTRACE_DISCARD,
+			      ndone < 0 ? errno : 0, ndone < 0 ? 0 : ndone,
+			      nranges, bytes, nilfs_cleanerd_nsecs(&elapsed));
+	if (unlikely(ndone < 0)) {
+		if (errno == EOPNOTSUPP || errno == ENOTTY) {
+			syslog(LOG_WARNING,
+			       "discard is not supported, disabled");
+			config->cf_use_discard = 0;
+			nilfs_clddiscard_clear(cleanerd->discard);
+		} else {
+			syslog(LOG_ERR, "cannot discard segments: %m");
+		}
+		return;
+	}
+	syslog(LOG_DEBUG, "%zd segment%s discarded in %zu range%s",
+	       ndone, ndone == 1 ? "" : "s", nranges, nranges == 1 ? "" : "s");
+}
+
+/**
+ * nilfs_cleanerd_retain - thin out checkpoints by the retention policy
+ * @cleanerd: cleanerd object
+ *
+ * The policy is applied at most once per retention interval.  A
+ * suspended daemon does nothing.  Once retention is disabled, the
+ * snapshots it made are turned back into plain checkpoints.
+ */
+static void nilfs_cleanerd_retain(struct nilfs_cleanerd *cleanerd)
+{
+	struct nilfs_cldconfig *config = &cleanerd->config;
+	struct nilfs_cldretain_policy policy;
+	struct nilfs_cldretain_stat stat;
+	struct timespec now, next;
+
+	if (cleanerd->running < 0 ||
+	    (!config->cf_use_retention &&
+	     nilfs_cldretain_nowned(cleanerd->retain) == 0))
+		return;
+
+	if (unlikely(clock_gettime(CLOCK_MONOTONIC, &now) < 0))
+		return;
+	timespecadd(&cleanerd->retain_last, &config->cf_retention_interval,
+		    &next);
+	if (timespecisset(&cleanerd->retain_last) &&
+	    timespeccmp(&now, &next, <))
+		return;
+	cleanerd->retain_last = now;
+
+	if (!config->cf_use_retention) {
+		nilfs_cldretain_release(cleanerd->retain, &stat);
+		if (stat.rs_demoted)
+			syslog(LOG_INFO,
+			       "retention disabled: %zu snapshot%s released",
+			       stat.rs_demoted,
+			       stat.rs_demoted == 1 ? "" : "s");
+		return;
+	}
+
+	policy.rp_all = (int64_t)config->cf_retention_hours * 3600;
+	policy.rp_hourly = max_t(int64_t, policy.rp_all,
+				 (int64_t)config->cf_retention_days * 86400);
+	policy.rp_daily = max_t(int64_t, policy.rp_hourly,
+				(int64_t)config->cf_retention_weeks * 604800);
+	policy.rp_promote = config->cf_retention_promote;
+
+	if (unlikely(nilfs_cldretain_apply(cleanerd->retain, &policy,
+					   time(NULL), &stat) < 0)) {
+		syslog(LOG_ERR, "cannot apply retention policy: %m");
+		return;
+	}
+	if (stat.rs_deleted || stat.rs_promoted || stat.rs_demoted)
+		syslog(LOG_INFO,
+		       "retention: %zu checkpoint%s deleted, %zu promoted, %zu demoted",
+		       stat.rs_deleted, stat.rs_deleted == 1 ? "" : "s",
+		       stat.rs_promoted, stat.rs_demoted);
+	else
+		syslog(LOG_DEBUG, "retention: %zu checkpoint%s examined",
+		       stat.rs_ncps, stat.rs_ncps == 1 ? "" : "s");
+}
+
 /**
  * nilfs_cleanerd_clean_loop - main loop of the cleaner daemon
  * @cleanerd: cleanerd object
@@ -1615,6 +3397,9 @@ static int nilfs_cleanerd_clean_loop(struct nilfs_cleanerd *cleanerd)
 	struct nilfs_sustat sustat;
 	int64_t prottime = 0, oldest = 0;
 	uint64_t segnums[NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX];
+	uint32_t nblocks[NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX];
+	uint64_t used;
+	struct timespec cycle_start, cycle_end, select_end;
 	sigset_t sigset;
 	size_t ndone;
 	int ns, ret;
@@ -1642,11 +3427,10 @@ static int nilfs_cleanerd_clean_loop(struct nilfs_cleanerd *cleanerd)
 	if (unlikely(ret < 0))
 		return -1;
 
-	cleanerd->ncleansegs = cleanerd->config.cf_nsegments_per_clean;
-	cleanerd->cleaning_interval = cleanerd->config.cf_cleaning_interval;
-	cleanerd->min_reclaimable_blocks =
-			cleanerd->config.cf_min_reclaimable_blocks;
-
+	cleanerd->profile = -1;
+	nilfs_cleanerd_update_profile(cleanerd);
+	nilfs_cleanerd_set_normal_params(cleanerd);
+	nilfs_cleanerd_set_priority(cleanerd, 0);
 
 	if (nilfs_cleanerd_automatic_suspend(cleanerd))
 		nilfs_cleanerd_clean_check_pause(cleanerd);
@@ -1665,42 +3449,110 @@ static int nilfs_cleanerd_clean_loop(struct nilfs_cleanerd *cleanerd)
 		ret = nilfs_get_sustat(cleanerd->nilfs, &sustat);
 		if (unlikely(ret < 0)) {
 			syslog(LOG_ERR, "cannot get segment usage stat: %m");
+			nilfs_cldtrace_record(cleanerd->trace,
+					      NILFS_CLDTRACE_ERROR, errno,
+					      NILFS_CLDTRACE_OP_GET_SUSTAT,
+					      0, 0, 0);
 			return -1;
 		}
-
-		if (nilfs_cleanerd_check_state(cleanerd, &sustat))
+		cleanerd->stats.cs_nsegs = sustat.ss_nsegs;
+		cleanerd->stats.cs_free_segs = sustat.ss_ncleansegs;
+		cleanerd->stats.cs_reserved_segs =
+			nilfs_get_reserved_segments(cleanerd->nilfs,
+						    sustat.ss_nsegs);
+		nilfs_cleanerd_update_profile(cleanerd);
+		nilfs_cleanerd_update_emergency(cleanerd, &sustat);
+
+		if (nilfs_cleanerd_check_state(cleanerd, &sustat)) {
+			nilfs_cleanerd_track_writes(cleanerd, &sustat);
 			goto sleep;
+		}
 
 		/* starts garbage collection */
 		syslog(LOG_DEBUG, "ncleansegs = %llu",
 		       (unsigned long long)sustat.ss_ncleansegs);
 
+		ret = clock_gettime(CLOCK_MONOTONIC, &cycle_start);
+		if (unlikely(ret < 0)) {
+			syslog(LOG_ERR, "cannot get monotonic time: %m");
+			return -1;
+		}
+		nilfs_cldtrace_record(cleanerd->trace,
+				      NILFS_CLDTRACE_CYCLE_START, 0,
+				      sustat.ss_ncleansegs, sustat.ss_nsegs,
+				      cleanerd->running, sustat.ss_nongc_ctime);
+
 		ns = nilfs_cleanerd_select_segments(
-			cleanerd, &sustat, segnums, &prottime, &oldest);
+			cleanerd, &sustat, segnums, nblocks, &prottime,
+			&oldest, &used);
 		if (unlikely(ns < 0)) {
 			syslog(LOG_ERR, "cannot select segments: %m");
+			nilfs_cldtrace_record(cleanerd->trace,
+					      NILFS_CLDTRACE_ERROR, errno,
+					      NILFS_CLDTRACE_OP_SELECT,
+					      0, 0, 0);
 			return -1;
 		}
+		clock_gettime(CLOCK_MONOTONIC, &select_end);
+		timespecsub(&select_end, &cycle_start, &select_end);
+		nilfs_cldtrace_record(cleanerd->trace, NILFS_CLDTRACE_SELECT,
+				      0, ns, cleanerd->stats.cs_reclaimable_segs,
+				      cleanerd->stats.cs_candidate_segs,
+				      nilfs_cleanerd_nsecs(&select_end));
+		if (nilfs_cleanerd_ranged(cleanerd))
+			nilfs_cleanerd_track_writes(cleanerd, &sustat);
+		else
+			nilfs_cleanerd_sample_writes(cleanerd, &sustat, used);
 		syslog(LOG_DEBUG, "%d segment%s selected to be cleaned",
 		       ns, (ns <= 1) ? "" : "s");
 		ndone = 0;
 		if (ns > 0) {
 			ret = nilfs_cleanerd_clean_segments(
-				cleanerd, segnums, ns, sustat.ss_prot_seq,
-				&ndone);
+				cleanerd, segnums, nblocks, ns,
+				sustat.ss_prot_seq, &ndone);
 			if (unlikely(ret < 0))
 				return -1;
+			cleanerd->stats.cs_ncycles++;
 		} else {
 			cleanerd->retry_cleaning = 0;
 		}
 		/* done */
 
+		if (likely(clock_gettime(CLOCK_MONOTONIC, &cycle_end) == 0)) {
+			timespecsub(&cycle_end, &cycle_start, &cycle_end);
+			if (ns > 0) {
+				nilfs_cldhist_add(
+					&cleanerd->stats.cs_cycle_time,
+					&cycle_end);
+				cleanerd->stats.cs_last_cycle_time = cycle_end;
+			}
+			nilfs_cldtrace_record(cleanerd->trace,
+					      NILFS_CLDTRACE_CYCLE_END, 0,
+					      ns, ndone,
+					      nilfs_cleanerd_nsecs(&cycle_end),
+					      0);
+		}
+
 		ret = nilfs_cleanerd_recalc_interval(
 			cleanerd, ns, ndone, prottime, oldest);
-		if (unlikely(ret < 0))
+		if (unlikely(ret < 0)) {
+			nilfs_cldtrace_record(cleanerd->trace,
+					      NILFS_CLDTRACE_ERROR, errno,
+					      NILFS_CLDTRACE_OP_INTERVAL,
+					      0, 0, 0);
 			return -1;
+		}
+		nilfs_cleanerd_trace_pacing(cleanerd);
+		nilfs_cleanerd_notify(cleanerd, 0);
 
 sleep:
+		nilfs_cleanerd_discard(cleanerd);
+		nilfs_cleanerd_retain(cleanerd);
+		nilfs_cleanerd_update_stats(cleanerd);
+		nilfs_cldmetrics_update_file(cleanerd->metrics,
+					     &cleanerd->stats);
+		nilfs_cldwastat_save(cleanerd->wastat, time(NULL));
+
 		ret = sigprocmask(SIG_UNBLOCK, &sigset, NULL);
 		if (unlikely(ret < 0)) {
 			syslog(LOG_ERR, "cannot set signal mask: %m");
@@ -1708,8 +3560,13 @@ sleep:
 		}
 
 		ret = nilfs_cleanerd_wait(cleanerd);
-		if (unlikely(ret < 0))
+		if (unlikely(ret < 0)) {
+			nilfs_cldtrace_record(cleanerd->trace,
+					      NILFS_CLDTRACE_ERROR, errno,
+					      NILFS_CLDTRACE_OP_WAIT,
+					      0, 0, 0);
 			return -1;
+		}
 	}
 	return 0;
 }
@@ -1813,8 +3670,10 @@ int main(int argc, char *argv[])
 
 	if (!sigsetjmp(nilfs_cleanerd_env, 1)) {
 		ret = nilfs_cleanerd_clean_loop(nilfs_cleanerd);
-		if (unlikely(ret < 0))
+		if (unlikely(ret < 0)) {
+			nilfs_cleanerd_dump_trace(nilfs_cleanerd);
 			status = EXIT_FAILURE;
+		}
 	}
 
 	nilfs_cleanerd_destroy(nilfs_cleanerd);
@@ -0,0 +1,252 @@
+/*
+ * nilfs-cldtrace.c - decode trace dumps of nilfs_cleanerd
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif	/* HAVE_UNISTD_H */
+
+#if HAVE_ERR_H
+#include <err.h>
+#endif	/* HAVE_ERR_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_TIME_H
+#include <time.h>
+#endif	/* HAVE_TIME_H */
+
+#include <errno.h>
+#include "util.h"
+#include "cldtrace.h"
+
+#ifdef _GNU_SOURCE
+#include <getopt.h>
+
+static const struct option long_option[] = {
+	{"help", no_argument, NULL, 'h'},
+	{"version", no_argument, NULL, 'V'},
+	{NULL, 0, NULL, 0}
+};
+
+#define CLDTRACE_USAGE	"Usage: %s [OPTION] FILE\n"			\
+			"  -h, --help\t\tdisplay this help and exit\n"	\
+			"  -V, --version\t\tdisplay version and exit\n"
+#else	/* !_GNU_SOURCE */
+#define CLDTRACE_USAGE	"Usage: %s [-hV] file\n"
+#endif	/* _GNU_SOURCE */
+
+static const char *cldtrace_op_name[NILFS_CLDTRACE_OP_NTYPES] = {
+	[NILFS_CLDTRACE_OP_NONE] = "unknown",
+	[NILFS_CLDTRACE_OP_GET_SUSTAT] = "get-sustat",
+	[NILFS_CLDTRACE_OP_SELECT] = "select",
+	[NILFS_CLDTRACE_OP_CNOMAP] = "cnomap",
+	[NILFS_CLDTRACE_OP_RECLAIM] = "reclaim",
+	[NILFS_CLDTRACE_OP_INTERVAL] = "interval",
+	[NILFS_CLDTRACE_OP_WAIT] = "wait",
+};
+
+static const char *cldtrace_cmd_name[] = {
+	"get-status", "run", "suspend", "resume", "tune", "reload", "wait",
+	"stop", "shutdown", "get-wastat", "get-progress", "subscribe",
+	"get-stats"
+};
+
+static void cldtrace_print_nsecs(uint64_t ns)
+{
+	printf("%llu.%06llu", (unsigned long long)(ns / 1000000000ULL),
+	       (unsigned long long)(ns % 1000000000ULL) / 1000);
+}
+
+static void cldtrace_print_event(const struct nilfs_cldtrace_event *ev)
+{
+	const uint64_t *a = ev->te_args;
+
+	switch (ev->te_type) {
+	case NILFS_CLDTRACE_CYCLE_START:
+		printf("cycle-start free=%llu nsegs=%llu state=%lld nongc_ctime=%llu",
+		       (unsigned long long)a[0], (unsigned long long)a[1],
+		       (long long)a[2], (unsigned long long)a[3]);
+		break;
+	case NILFS_CLDTRACE_SELECT:
+		printf("select selected=%llu reclaimable=%llu candidates=%llu time=",
+		       (unsigned long long)a[0], (unsigned long long)a[1],
+		       (unsigned long long)a[2]);
+		cldtrace_print_nsecs(a[3]);
+		break;
+	case NILFS_CLDTRACE_RECLAIM:
+		printf("reclaim cleaned=%llu deferred=%llu protected=%llu live_blks=%llu",
+		       (unsigned long long)a[0], (unsigned long long)a[1],
+		       (unsigned long long)a[2], (unsigned long long)a[3]);
+		break;
+	case NILFS_CLDTRACE_RECLAIM_TIME:
+		printf("reclaim-time time=");
+		cldtrace_print_nsecs(a[0]);
+		printf(" lock_wait=");
+		cldtrace_print_nsecs(a[1]);
+		printf(" defunct_blks=%llu", (unsigned long long)a[2]);
+		break;
+	case NILFS_CLDTRACE_CYCLE_END:
+		printf("cycle-end selected=%llu done=%llu time=",
+		       (unsigned long long)a[0], (unsigned long long)a[1]);
+		cldtrace_print_nsecs(a[2]);
+		break;
+	case NILFS_CLDTRACE_PACING:
+		printf("pacing timeout=");
+		cldtrace_print_nsecs(a[0]);
+		printf(" nsegments_per_clean=%llu interval=",
+		       (unsigned long long)a[1]);
+		cldtrace_print_nsecs(a[2]);
+		if (a[3] & NILFS_CLDTRACE_PACING_NO_TIMEOUT)
+			printf(" no-timeout");
+		if (a[3] & NILFS_CLDTRACE_PACING_FALLBACK)
+			printf(" fallback");
+		if (a[3] & NILFS_CLDTRACE_PACING_RETRY)
+			printf(" retry");
+		break;
+	case NILFS_CLDTRACE_COMMAND:
+		if (a[0] < ARRAY_SIZE(cldtrace_cmd_name))
+			printf("command %s", cldtrace_cmd_name[a[0]]);
+		else
+			printf("command %llu", (unsigned long long)a[0]);
+		printf(" ret=%lld", (long long)a[1]);
+		break;
+	case NILFS_CLDTRACE_ERROR:
+		printf("error op=%s",
+		       a[0] < NILFS_CLDTRACE_OP_NTYPES ?
+		       cldtrace_op_name[a[0]] : "unknown");
+		break;
+	case NILFS_CLDTRACE_DISCARD:
+		printf("discard segments=%llu ranges=%llu bytes=%llu time=",
+		       (unsigned long long)a[0], (unsigned long long)a[1],
+		       (unsigned long long)a[2]);
+		cldtrace_print_nsecs(a[3]);
+		break;
+	case NILFS_CLDTRACE_FREEZE:
+		printf("freeze stall=");
+		cldtrace_print_nsecs(a[0]);
+		printf(" protseq=%llu", (unsigned long long)a[1]);
+		break;
+	default:
+		printf("type %u args=%llu,%llu,%llu,%llu", ev->te_type,
+		       (unsigned long long)a[0], (unsigned long long)a[1],
+		       (unsigned long long)a[2], (unsigned long long)a[3]);
+		break;
+	}
+	if (ev->te_err)
+		printf(" err=%s", strerror(ev->te_err));
+	putchar('\n');
+}
+
+static int cldtrace_decode(FILE *fp, const char *path)
+{
+	struct nilfs_cldtrace_header hdr;
+	struct nilfs_cldtrace_event ev;
+	uint64_t offset, prev = 0;
+	char timebuf[32];
+	time_t t;
+	uint32_t i;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1) {
+		warnx("%s: too short", path);
+		return -1;
+	}
+	if (hdr.th_magic != NILFS_CLDTRACE_MAGIC) {
+		warnx("%s: not a trace dump", path);
+		return -1;
+	}
+	if (hdr.th_version != NILFS_CLDTRACE_VERSION ||
+	    hdr.th_evsize != sizeof(ev)) {
+		warnx("%s: unsupported format version %u", path,
+		      hdr.th_version);
+		return -1;
+	}
+
+	/* offset to convert monotonic time to wall-clock time */
+	offset = hdr.th_realtime - hdr.th_monotonic;
+
+	t = hdr.th_realtime / 1000000000ULL;
+	strftime(timebuf, sizeof(timebuf), "%F %T", localtime(&t));
+	printf("# pid %u, dumped at %s, %u of %llu events\n", hdr.th_pid,
+	       timebuf, hdr.th_nevents, (unsigned long long)hdr.th_seq);
+
+	for (i = 0; i < hdr.th_nevents; i++) {
+		if (fread(&ev, sizeof(ev), 1, fp) != 1) {
+			warnx("%s: truncated at event %u", path, i);
+			return -1;
+		}
+		t = (ev.te_time + offset) / 1000000000ULL;
+		strftime(timebuf, sizeof(timebuf), "%F %T", localtime(&t));
+		printf("%s.%06llu (+", timebuf,
+		       (unsigned long long)((ev.te_time + offset) %
+					    1000000000ULL) / 1000);
+		cldtrace_print_nsecs(prev && ev.te_time >= prev ?
+				     ev.te_time - prev : 0);
+		printf(") ");
+		cldtrace_print_event(&ev);
+		prev = ev.te_time;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char *progname, *last;
+	FILE *fp;
+	int c, status;
+#ifdef _GNU_SOURCE
+	int option_index;
+#endif	/* _GNU_SOURCE */
+
+	last = strrchr(argv[0], '/');
+	progname = last ? last + 1 : argv[0];
+
+#ifdef _GNU_SOURCE
+	while ((c = getopt_long(argc, argv, "hV",
+				long_option, &option_index)) >= 0) {
+#else	/* !_GNU_SOURCE */
+	while ((c = getopt(argc, argv, "hV")) >= 0) {
+#endif	/* _GNU_SOURCE */
+
+		switch (c) {
+		case 'h':
+			fprintf(stderr, CLDTRACE_USAGE, progname);
+			exit(EXIT_SUCCESS);
+		case 'V':
+			printf("%s (%s %s)\n", progname, PACKAGE,
+			       PACKAGE_VERSION);
+			exit(EXIT_SUCCESS);
+		default:
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind != argc - 1) {
+		fprintf(stderr, CLDTRACE_USAGE, progname);
+		exit(EXIT_FAILURE);
+	}
+
+	fp = fopen(argv[optind], "rb");
+	if (fp == NULL)
+		err(EXIT_FAILURE, "cannot open %s", argv[optind]);
+
+	status = cldtrace_decode(fp, argv[optind]) < 0 ?
+		EXIT_FAILURE : EXIT_SUCCESS;
+	fclose(fp);
+	exit(status);
+}
@@ -74,16 +74,22 @@ static const struct option long_option[] = {
 	{"break", no_argument, NULL, 'b'},
 	{"reload", optional_argument, NULL, 'c'},
 	{"help", no_argument, NULL, 'h'},
+	{"stats", no_argument, NULL, 'i'},
 	{"status", no_argument, NULL, 'l'},
 	{"protection-period", required_argument, NULL, 'p'},
 	{"quit", no_argument, NULL, 'q'},
+	{"range", required_argument, NULL, 'R'},
 	{"resume", no_argument, NULL, 'r'},
 	{"stop", no_argument, NULL, 'b'},
 	{"suspend", no_argument, NULL, 's'},
 	{"speed", required_argument, NULL, 'S'},
+	{"time-limit", required_argument, NULL, 'T'},
+	{"usage-threshold", required_argument, NULL, 'u'},
 	{"min-reclaimable-blocks", required_argument, NULL, 'm'},
+	{"progress", no_argument, NULL, 'P'},
 	{"verbose", no_argument, NULL, 'v'},
 	{"version", no_argument, NULL, 'V'},
+	{"wait", no_argument, NULL, 'w'},
 	{NULL, 0, NULL, 0}
 };
 #define NILFS_CLEAN_USAGE						\
@@ -92,24 +98,35 @@ static const struct option long_option[] = {
 	"  -c, --reload[=CONFFILE]\n"					\
 	"            \t\treload config\n"				\
 	"  -h, --help\t\tdisplay this help and exit\n"			\
+	"  -i, --stats\t\tdisplay cleaner statistics\n"		\
 	"  -l, --status\t\tdisplay cleaner status\n"			\
 	"  -p, --protection-period=SECONDS\n"				\
 	"               \t\tspecify protection period\n"		\
 	"  -m, --min-reclaimable-blocks=COUNT[%%]\n"			\
 	"               \t\tset minimum number of reclaimable blocks\n"	\
 	"               \t\tbefore a segment can be cleaned\n"		\
+	"  -P, --progress\t\treport progress until the run completes\n"	\
 	"  -q, --quit\t\tshutdown cleaner\n"				\
 	"  -r, --resume\t\tresume cleaner\n"				\
+	"  -R, --range=START[-END]\n"					\
+	"               \t\tclean only segments in the given range\n"	\
 	"  -s, --suspend\t\tsuspend cleaner\n"				\
 	"  -S, --speed=COUNT[/SECONDS]\n"				\
 	"               \t\tset GC speed\n"				\
+	"  -T, --time-limit=DURATION\n"					\
+	"               \t\tend the cleaner run after DURATION\n"	\
+	"  -u, --usage-threshold=PERCENT\n"				\
+	"               \t\tonly clean segments whose live ratio is\n"	\
+	"               \t\tbelow PERCENT\n"				\
 	"  -v, --verbose\t\tverbose mode\n"				\
-	"  -V, --version\t\tdisplay version and exit\n"
+	"  -V, --version\t\tdisplay version and exit\n"			\
+	"  -w, --wait\t\twait until the run completes\n"
 #else
 #define NILFS_CLEAN_USAGE						  \
-	"Usage: %s [-b] [-c [conffile]] [-h] [-l] [-m blocks]\n"	  \
-	"          [-p protection-period] [-q] [-r] [-s] [-S gc-speed]\n" \
-	"          [-v] [-V] [device]\n"
+	"Usage: %s [-b] [-c [conffile]] [-h] [-i] [-l] [-m blocks] [-P]\n" \
+	"          [-p protection-period] [-q] [-r] [-R start[-end]]\n"	  \
+	"          [-s] [-S gc-speed] [-T time-limit] [-u usage-threshold]\n" \
+	"          [-v] [-V] [-w] [device]\n"
 #endif	/* _GNU_SOURCE */
 
 
@@ -121,6 +138,7 @@ enum {
 	NILFS_CLEAN_CMD_RELOAD,
 	NILFS_CLEAN_CMD_STOP,
 	NILFS_CLEAN_CMD_SHUTDOWN,
+	NILFS_CLEAN_CMD_STATS,
 };
 
 /* options */
@@ -135,6 +153,13 @@ static int nsegments_per_clean = 2;
 static struct timespec cleaning_interval = { 0, 100000000 };   /* 100 msec */
 static unsigned long min_reclaimable_blocks = ULONG_MAX;
 static unsigned char min_reclaimable_blocks_unit = NILFS_CLEANER_ARG_UNIT_NONE;
+static uint64_t start_segnum;
+static uint64_t nsegs_in_range;	/* 0 = up to the last segment */
+static int ranged;
+static unsigned long usage_rate_threshold;	/* 0 = not limited */
+static unsigned long runtime;		/* 0 = not limited */
+static int wait_run;
+static int show_progress;
 
 static sigjmp_buf nilfs_clean_env;
 static struct nilfs_cleaner *nilfs_cleaner;
@@ -167,9 +192,57 @@ static void nilfs_clean_escape(int signum)
 	siglongjmp(nilfs_clean_env, 1);
 }
 
+static void nilfs_clean_print_progress(
+	const struct nilfs_cleaner_progress *progress,
+	const struct nilfs_cleaner_progress *start)
+{
+	printf(_("cleaned=%llu freed=%llu remaining=%llu free=%llu/%llu"),
+	       (unsigned long long)(progress->cleaned_segs -
+				    start->cleaned_segs),
+	       (unsigned long long)(progress->freed_bytes -
+				    start->freed_bytes),
+	       (unsigned long long)progress->remaining_segs,
+	       (unsigned long long)progress->free_segs,
+	       (unsigned long long)progress->nsegs);
+	if (progress->eta != NILFS_CLEANER_ETA_UNKNOWN)
+		printf(_(" eta=%llus"), (unsigned long long)progress->eta);
+	if (progress->flags & NILFS_CLEANER_PROGRESS_DONE)
+		printf(_(" done"));
+	putchar('\n');
+	fflush(stdout);
+}
+
+/**
+ * nilfs_clean_follow - report progress events of a job until it ends
+ * @cleaner: cleaner object
+ * @jobid: job id
+ * @start: progress seen before the job was started
+ */
+static int nilfs_clean_follow(struct nilfs_cleaner *cleaner, uint32_t jobid,
+			      const struct nilfs_cleaner_progress *start)
+{
+	struct nilfs_cleaner_progress progress;
+	int ret;
+
+	do {
+		ret = nilfs_cleaner_recv_progress(cleaner, &progress, NULL);
+		if (unlikely(ret < 0)) {
+			myprintf(_("Error: cannot receive progress: %s\n"),
+				 strerror(errno));
+			return -1;
+		}
+		if (progress.jobid != jobid)
+			continue; /* event sent before the job started */
+		nilfs_clean_print_progress(&progress, start);
+	} while (!(progress.flags & NILFS_CLEANER_PROGRESS_DONE));
+	return 0;
+}
+
 static int nilfs_clean_do_run(struct nilfs_cleaner *cleaner)
 {
 	struct nilfs_cleaner_args args;
+	struct nilfs_cleaner_progress start;
+	uint32_t jobid;
 	int ret;
 
 	args.npasses = 1;
@@ -191,12 +264,102 @@ static int nilfs_clean_do_run(struct nilfs_cleaner *cleaner)
 		args.valid |= NILFS_CLEANER_ARG_MIN_RECLAIMABLE_BLOCKS;
 	}
 
-	ret = nilfs_cleaner_run(cleaner, &args, NULL);
+	if (usage_rate_threshold > 0) {
+		args.usage_rate_threshold = usage_rate_threshold;
+		args.valid |= NILFS_CLEANER_ARG_USAGE_RATE_THRESHOLD;
+	}
+
+	if (runtime > 0) {
+		args.runtime = runtime;
+		args.valid |= NILFS_CLEANER_ARG_RUNTIME;
+	}
+
+	if (ranged) {
+		args.start_segnum = start_segnum;
+		args.valid |= NILFS_CLEANER_ARG_START_SEGNUM;
+		if (nsegs_in_range > 0) {
+			args.nsegs = nsegs_in_range;
+			args.valid |= NILFS_CLEANER_ARG_NSEGS;
+		}
+	}
+
+	if (show_progress) {
+		/* the first event gives the counters before the run */
+		ret = nilfs_cleaner_subscribe(cleaner);
+		if (likely(ret == 0))
+			ret = nilfs_cleaner_recv_progress(cleaner, &start,
+							  NULL);
+		if (unlikely(ret < 0)) {
+			myprintf(_("Error: cannot get progress: %s\n"),
+				 strerror(errno));
+			return -1;
+		}
+	}
+
+	ret = nilfs_cleaner_run(cleaner, &args, &jobid);
 	if (unlikely(ret < 0)) {
 		myprintf(_("Error: cannot run cleaner: %s\n"),
 			 strerror(errno));
 		return -1;
 	}
+
+	if (show_progress)
+		return nilfs_clean_follow(cleaner, jobid, &start);
+
+	if (wait_run) {
+		ret = nilfs_cleaner_wait(cleaner, jobid, NULL);
+		if (unlikely(ret < 0)) {
+			myprintf(_("Error: cannot wait for cleaner: %s\n"),
+				 strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void nilfs_clean_print_wa(const char *label, uint64_t user_blocks,
+				 uint64_t gc_blocks)
+{
+	printf(_("  %-16s user %llu blocks, gc %llu blocks, WA "), label,
+	       (unsigned long long)user_blocks, (unsigned long long)gc_blocks);
+	if (user_blocks > 0)
+		printf("%.2f\n",
+		       (double)(user_blocks + gc_blocks) / user_blocks);
+	else
+		puts("-");
+}
+
+static int nilfs_clean_do_getwastat(struct nilfs_cleaner *cleaner)
+{
+	struct nilfs_cleaner_wastat wastat;
+	char label[32];
+	time_t since;
+	int i, ret;
+
+	ret = nilfs_cleaner_get_wastat(cleaner, &wastat);
+	if (ret < 0) {
+		if (errno == EINVAL)
+			return 0; /* not supported by the cleaner */
+		myprintf(_("Error: cannot get write statistics: %s\n"),
+			 strerror(errno));
+		return -1;
+	}
+
+	printf(_("write statistics (block size %u):\n"), wastat.block_size);
+	for (i = 0; i < wastat.nwindows &&
+		     i < NILFS_CLEANER_WASTAT_NWINDOWS; i++) {
+		if (wastat.windows[i].span % 3600 == 0)
+			snprintf(label, sizeof(label), _("last %uh:"),
+				 wastat.windows[i].span / 3600);
+		else
+			snprintf(label, sizeof(label), _("last %um:"),
+				 wastat.windows[i].span / 60);
+		nilfs_clean_print_wa(label, wastat.windows[i].user_blocks,
+				     wastat.windows[i].gc_blocks);
+	}
+	since = wastat.since;
+	strftime(label, sizeof(label), "%F %T:", localtime(&since));
+	nilfs_clean_print_wa(label, wastat.user_blocks, wastat.gc_blocks);
 	return 0;
 }
 
@@ -224,6 +387,80 @@ static int nilfs_clean_do_getinfo(struct nilfs_cleaner *cleaner)
 	default:
 		printf(_("%d (unknown)\n"), cleaner_status);
 	}
+	if (verbose)
+		return nilfs_clean_do_getwastat(cleaner);
+	return 0;
+}
+
+static const char *nilfs_clean_mode_name[] = {
+	[NILFS_CLEANER_MODE_IDLE] = "idle",
+	[NILFS_CLEANER_MODE_BACKGROUND] = "background",
+	[NILFS_CLEANER_MODE_URGENT] = "urgent",
+	[NILFS_CLEANER_MODE_MANUAL] = "manual",
+	[NILFS_CLEANER_MODE_SUSPENDED] = "suspended",
+};
+
+static int nilfs_clean_do_getstats(struct nilfs_cleaner *cleaner)
+{
+	struct nilfs_cleaner_stats stats;
+	const struct nilfs_cleaner_progress *progress = &stats.progress;
+	int ret;
+
+	ret = nilfs_cleaner_get_stats(cleaner, &stats);
+	if (ret < 0) {
+		if (errno == EINVAL)
+			myprintf(_("Error: statistics not supported by the cleaner\n"));
+		else
+			myprintf(_("Error: cannot get cleaner statistics: %s\n"),
+				 strerror(errno));
+		return -1;
+	}
+
+	if (stats.mode >= 0 && stats.mode < ARRAY_SIZE(nilfs_clean_mode_name))
+		printf(_("mode:                %s\n"),
+		       nilfs_clean_mode_name[stats.mode]);
+	else
+		printf(_("mode:                %d (unknown)\n"), stats.mode);
+	printf(_("emergency level:     %u\n"), stats.emergency_level);
+	printf(_("segments per clean:  %u\n"), stats.nsegments_per_clean);
+	printf(_("cleaning interval:   %llu.%03llu s\n"),
+	       (unsigned long long)(stats.cleaning_interval / 1000000000ULL),
+	       (unsigned long long)(stats.cleaning_interval % 1000000000ULL) /
+	       1000000);
+	printf(_("protection period:   %llu s\n"),
+	       (unsigned long long)stats.protection_period);
+	printf(_("segments:            %llu (free %llu, reserved %llu)\n"),
+	       (unsigned long long)stats.nsegs,
+	       (unsigned long long)stats.free_segs,
+	       (unsigned long long)stats.reserved_segs);
+	printf(_("reclaimable:         %llu (candidates %llu)\n"),
+	       (unsigned long long)stats.reclaimable_segs,
+	       (unsigned long long)stats.candidate_segs);
+	printf(_("cycles:              %llu\n"),
+	       (unsigned long long)stats.ncycles);
+	printf(_("cleaned segments:    %llu\n"),
+	       (unsigned long long)stats.cleaned_segs);
+	printf(_("deferred segments:   %llu\n"),
+	       (unsigned long long)stats.deferred_segs);
+	printf(_("protected segments:  %llu\n"),
+	       (unsigned long long)stats.protected_segs);
+	printf(_("live blocks moved:   %llu (block size %u)\n"),
+	       (unsigned long long)stats.live_blks, stats.block_size);
+	printf(_("defunct blocks:      %llu\n"),
+	       (unsigned long long)stats.defunct_blks);
+	printf(_("last cycle:          %llu.%06llu s\n"),
+	       (unsigned long long)(stats.last_cycle / 1000000000ULL),
+	       (unsigned long long)(stats.last_cycle % 1000000000ULL) / 1000);
+
+	if (progress->flags & NILFS_CLEANER_PROGRESS_ACTIVE) {
+		printf(_("current job:         %u (remaining %llu segments"),
+		       progress->jobid,
+		       (unsigned long long)progress->remaining_segs);
+		if (progress->eta != NILFS_CLEANER_ETA_UNKNOWN)
+			printf(_(", eta %llus"),
+			       (unsigned long long)progress->eta);
+		puts(")");
+	}
 	return 0;
 }
 
@@ -314,6 +551,9 @@ static int nilfs_clean_request(struct nilfs_cleaner *cleaner)
 	case NILFS_CLEAN_CMD_SHUTDOWN:
 		ret = nilfs_clean_do_shutdown(cleaner);
 		break;
+	case NILFS_CLEAN_CMD_STATS:
+		ret = nilfs_clean_do_getstats(cleaner);
+		break;
 	default:
 		goto out;
 	}
@@ -329,6 +569,7 @@ static int nilfs_do_clean(const char *device)
 	int status = EXIT_FAILURE;
 
 	nilfs_cleaner = nilfs_cleaner_open(device, NULL,
+					   NILFS_CLEANER_OPEN_SOCKET |
 					   NILFS_CLEANER_OPEN_QUEUE);
 	if (unlikely(!nilfs_cleaner))
 		goto out;
@@ -443,6 +684,80 @@ static int nilfs_clean_parse_min_reclaimable(const char *arg)
 	return 0;
 }
 
+static int nilfs_clean_parse_range(const char *arg)
+{
+	unsigned long long start, end;
+	const char *p;
+	char *endptr;
+
+	errno = 0;
+	start = strtoull(arg, &endptr, 10);
+	if (endptr == arg || (endptr[0] != '\0' && endptr[0] != '-'))
+		goto failed;
+	if (start == ULLONG_MAX && errno == ERANGE)
+		goto failed_too_large;
+
+	if (endptr[0] == '-') {
+		p = &endptr[1];
+		end = strtoull(p, &endptr, 10);
+		if (endptr == p || endptr[0] != '\0')
+			goto failed;
+		if (end == ULLONG_MAX && errno == ERANGE)
+			goto failed_too_large;
+		if (end < start) {
+			myprintf(_("Error: end of range precedes start: %s\n"),
+				 arg);
+			return -1;
+		}
+		nsegs_in_range = end - start + 1;
+	} else {
+		nsegs_in_range = 0;
+	}
+	start_segnum = start;
+	ranged = 1;
+	return 0;
+
+failed:
+	myprintf(_("Error: invalid segment range: %s\n"), arg);
+	return -1;
+
+failed_too_large:
+	myprintf(_("Error: value too large: %s\n"), arg);
+	return -1;
+}
+
+static int nilfs_clean_parse_usage_threshold(const char *arg)
+{
+	unsigned long percent;
+	char *endptr;
+
+	percent = strtoul(arg, &endptr, 10);
+	if (endptr == arg || (endptr[0] != '\0' && strcmp(endptr, "%") != 0) ||
+	    percent == 0 || percent > 100) {
+		myprintf(_("Error: invalid usage threshold: %s\n"), arg);
+		return -1;
+	}
+	usage_rate_threshold = percent;
+	return 0;
+}
+
+static int nilfs_clean_parse_time_limit(const char *arg)
+{
+	unsigned long period = 0;
+	int ret;
+
+	ret = nilfs_parse_protection_period(arg, &period);
+	if (ret < 0 || period == 0 || period > UINT32_MAX) {
+		if ((ret < 0 && errno == ERANGE) || period > UINT32_MAX)
+			myprintf(_("Error: too large time limit: %s\n"), arg);
+		else
+			myprintf(_("Error: invalid time limit: %s\n"), arg);
+		return -1;
+	}
+	runtime = period;
+	return 0;
+}
+
 static void nilfs_clean_parse_options(int argc, char *argv[])
 {
 #ifdef _GNU_SOURCE
@@ -451,10 +766,10 @@ static void nilfs_clean_parse_options(int argc, char *argv[])
 	int c, ret;
 
 #ifdef _GNU_SOURCE
-	while ((c = getopt_long(argc, argv, "bc::hlm:p:qrsS:vV",
+	while ((c = getopt_long(argc, argv, "bc::hilm:Pp:qrR:sS:T:u:vVw",
 				long_option, &option_index)) >= 0) {
 #else
-	while ((c = getopt(argc, argv, "bc::hlm:p:qrsS:vV")) >= 0) {
+	while ((c = getopt(argc, argv, "bc::hilm:Pp:qrR:sS:T:u:vVw")) >= 0) {
 #endif	/* _GNU_SOURCE */
 		switch (c) {
 		case 'b':
@@ -469,6 +784,9 @@ static void nilfs_clean_parse_options(int argc, char *argv[])
 			nilfs_clean_usage();
 			exit(EXIT_SUCCESS);
 			break;
+		case 'i':
+			clean_cmd = NILFS_CLEAN_CMD_STATS;
+			break;
 		case 'l':
 			clean_cmd = NILFS_CLEAN_CMD_INFO;
 			break;
@@ -476,6 +794,9 @@ static void nilfs_clean_parse_options(int argc, char *argv[])
 			if (nilfs_clean_parse_min_reclaimable(optarg) < 0)
 				exit(EXIT_FAILURE);
 			break;
+		case 'P':
+			show_progress = 1;
+			break;
 		case 'p':
 			ret = nilfs_parse_protection_period(
 				optarg, &protection_period);
@@ -496,6 +817,10 @@ static void nilfs_clean_parse_options(int argc, char *argv[])
 		case 'r':
 			clean_cmd = NILFS_CLEAN_CMD_RESUME;
 			break;
+		case 'R':
+			if (nilfs_clean_parse_range(optarg) < 0)
+				exit(EXIT_FAILURE);
+			break;
 		case 's':
 			clean_cmd = NILFS_CLEAN_CMD_SUSPEND;
 			break;
@@ -503,12 +828,23 @@ static void nilfs_clean_parse_options(int argc, char *argv[])
 			if (nilfs_clean_parse_gcspeed(optarg) < 0)
 				exit(EXIT_FAILURE);
 			break;
+		case 'T':
+			if (nilfs_clean_parse_time_limit(optarg) < 0)
+				exit(EXIT_FAILURE);
+			break;
+		case 'u':
+			if (nilfs_clean_parse_usage_threshold(optarg) < 0)
+				exit(EXIT_FAILURE);
+			break;
 		case 'v':
 			verbose = 1;
 			break;
 		case 'V':
 			show_version_only = 1;
 			break;
+		case 'w':
+			wait_run = 1;
+			break;
 		default:
 			nilfs_clean_usage();
 			exit(EXIT_FAILURE);
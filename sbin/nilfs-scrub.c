@@ -0,0 +1,659 @@
+/*
+ * nilfs-scrub.c - verify data checksums of logs of a mounted NILFS
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif	/* HAVE_UNISTD_H */
+
+#if HAVE_ERR_H
+#include <err.h>
+#endif	/* HAVE_ERR_H */
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>	/* open, posix_fadvise */
+#endif	/* HAVE_FCNTL_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_TIME_H
+#include <time.h>	/* clock_gettime, nanosleep */
+#endif	/* HAVE_TIME_H */
+
+#if HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif	/* HAVE_SYS_SYSCALL_H */
+
+#include <errno.h>
+#include <signal.h>
+#include "nilfs.h"
+#include "segment.h"
+#include "crc32.h"
+#include "compat.h"
+#include "util.h"
+
+#ifdef _GNU_SOURCE
+#include <getopt.h>
+static const struct option long_option[] = {
+	{"rate", required_argument, NULL, 'r'},
+	{"verbose", no_argument, NULL, 'v'},
+	{"help", no_argument, NULL, 'h'},
+	{"version", no_argument, NULL, 'V'},
+	{NULL, 0, NULL, 0}
+};
+
+#define SCRUB_USAGE							\
+	"Usage: %s [OPTION]... [DEVICE]\n"				\
+	"  -r, --rate=MIB\tlimit reads to MIB MiB/s (0: unlimited)\n"	\
+	"  -v, --verbose\t\tlist every block of corrupt logs\n"		\
+	"  -h, --help\t\tdisplay this help and exit\n"			\
+	"  -V, --version\t\tdisplay version and exit\n"
+#else	/* !_GNU_SOURCE */
+#define SCRUB_USAGE	"Usage: %s [-hvV] [-r rate] [device]\n"
+#endif	/* _GNU_SOURCE */
+
+#define SCRUB_NSUINFO		512
+#define SCRUB_DEFAULT_RATE	32	/* MiB/s */
+#define SCRUB_MAX_RATE		(1UL << 20)
+#define SCRUB_EXIT_CORRUPT	2	/* exit status if corruption found */
+#define SCRUB_TIMEBUFSIZE	32
+
+/* I/O priority class for idle-time I/O (see ioprio_set(2)) */
+#define SCRUB_IOPRIO_IDLE	(3 << 13)
+
+/**
+ * struct nilfs_scrub - scrubber state
+ * @nilfs: nilfs object
+ * @devfd: file descriptor of the device, used for reads and hints
+ * @layout: layout of the file system
+ * @buf: buffer holding the segment being verified
+ * @segnums: segments to be verified
+ * @nsegs: number of segments in @segnums
+ * @start: time when reading started
+ * @nbytes: number of bytes read
+ * @nscrubbed: number of segments verified
+ * @nskipped: number of segments skipped because they changed
+ * @nlogs: number of logs verified
+ * @ncorrupt: number of corrupt logs
+ */
+struct nilfs_scrub {
+	struct nilfs *nilfs;
+	int devfd;
+	struct nilfs_layout layout;
+	void *buf;
+	uint64_t *segnums;
+	size_t nsegs;
+	struct timespec start;
+	uint64_t nbytes;
+	uint64_t nscrubbed;
+	uint64_t nskipped;
+	uint64_t nlogs;
+	uint64_t ncorrupt;
+};
+
+static unsigned long param_rate = SCRUB_DEFAULT_RATE;
+static int verbose;
+
+static int nilfs_scrub_ioprio_set(int ioprio)
+{
+#ifdef SYS_ioprio_set
+	return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/**
+ * nilfs_scrub_locate - get the disk location of a segment
+ * @scrub: scrubber state
+ * @segnum: segment number
+ * @blocknrp: place to store the start block number
+ * @nblocksp: place to store the number of blocks
+ */
+static void nilfs_scrub_locate(const struct nilfs_scrub *scrub,
+			       uint64_t segnum, uint64_t *blocknrp,
+			       uint32_t *nblocksp)
+{
+	const struct nilfs_layout *layout = &scrub->layout;
+
+	if (segnum == 0) {
+		*blocknrp = layout->first_segment_blkoff;
+		*nblocksp = layout->blocks_per_segment -
+			(uint32_t)layout->first_segment_blkoff;
+	} else {
+		*blocknrp = segnum * layout->blocks_per_segment;
+		*nblocksp = layout->blocks_per_segment;
+	}
+}
+
+/**
+ * nilfs_scrub_advise - give the kernel an access hint on a segment
+ * @scrub: scrubber state
+ * @segnum: segment number
+ * @advice: POSIX_FADV_WILLNEED to start reading ahead, or
+ * POSIX_FADV_DONTNEED to drop cached pages
+ */
+static void nilfs_scrub_advise(const struct nilfs_scrub *scrub,
+			       uint64_t segnum, int advice)
+{
+	unsigned int blkbits = scrub->layout.blocksize_bits;
+	uint64_t blocknr;
+	uint32_t nblocks;
+
+	nilfs_scrub_locate(scrub, segnum, &blocknr, &nblocks);
+	posix_fadvise(scrub->devfd, blocknr << blkbits,
+		      (off_t)nblocks << blkbits, advice);
+}
+
+static int nilfs_scrub_pread(int fd, void *buf, size_t count, off_t offset)
+{
+	ssize_t ret;
+
+	while (count > 0) {
+		ret = pread(fd, buf, count, offset);
+		if (unlikely(ret < 0)) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (unlikely(ret == 0)) {
+			errno = EIO;
+			return -1;
+		}
+		buf += ret;
+		count -= ret;
+		offset += ret;
+	}
+	return 0;
+}
+
+/**
+ * nilfs_scrub_read_segment - read a segment still in use
+ * @scrub: scrubber state
+ * @segnum: segment number
+ * @segment: segment object to be set up on @scrub->buf
+ * @sip: place to store the segment usage read with the segment
+ *
+ * The segment is read while holding the cleaner lock so that the
+ * garbage collector cannot free and reuse it in the meantime.  Segments
+ * that are no longer dirty, and those in which logs are being written,
+ * are skipped.
+ *
+ * Return: 1 if the segment was read, 0 if it was skipped, or -1 on
+ * failure.
+ */
+static int nilfs_scrub_read_segment(struct nilfs_scrub *scrub,
+				    uint64_t segnum,
+				    struct nilfs_segment *segment,
+				    struct nilfs_suinfo *sip)
+{
+	const struct nilfs_layout *layout = &scrub->layout;
+	struct nilfs_segment_summary *segsum = scrub->buf;
+	sigset_t sigset, oldset;
+	uint64_t blocknr;
+	uint32_t nblocks;
+	ssize_t n;
+	int ret;
+
+	nilfs_scrub_locate(scrub, segnum, &blocknr, &nblocks);
+
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGTERM);
+	if (unlikely(sigprocmask(SIG_BLOCK, &sigset, &oldset) < 0)) {
+		warn("cannot block signals");
+		return -1;
+	}
+
+	ret = nilfs_lock_cleaner(scrub->nilfs);
+	if (unlikely(ret < 0)) {
+		warn("failed to lock cleaner");
+		goto out_sig;
+	}
+
+	n = nilfs_get_suinfo(scrub->nilfs, segnum, sip, 1);
+	if (unlikely(n < 0)) {
+		warn("cannot get segment usage info");
+		ret = -1;
+		goto out_unlock;
+	}
+	if (n == 0 || !nilfs_suinfo_dirty(sip) || nilfs_suinfo_active(sip)) {
+		ret = 0;
+		goto out_unlock;
+	}
+
+	ret = nilfs_scrub_pread(scrub->devfd, scrub->buf,
+				(size_t)nblocks << layout->blocksize_bits,
+				blocknr << layout->blocksize_bits);
+	if (unlikely(ret < 0)) {
+		warn("failed to read segment %llu",
+		     (unsigned long long)segnum);
+		goto out_unlock;
+	}
+	ret = 1;
+
+out_unlock:
+	nilfs_unlock_cleaner(scrub->nilfs);
+out_sig:
+	sigprocmask(SIG_SETMASK, &oldset, NULL);
+
+	if (ret > 0) {
+		scrub->nbytes += (uint64_t)nblocks << layout->blocksize_bits;
+
+		segment->addr = scrub->buf;
+		segment->segsize = (uint64_t)nblocks << layout->blocksize_bits;
+		segment->segnum = segnum;
+		segment->seqnum = le64_to_cpu(segsum->ss_seq);
+		segment->blocknr = blocknr;
+		segment->nblocks = nblocks;
+		segment->blocks_per_segment = layout->blocks_per_segment;
+		segment->blkbits = layout->blocksize_bits;
+		segment->seed = layout->crc_seed;
+		segment->mmapped = 0;
+		segment->adjusted = 0;
+	}
+	return ret;
+}
+
+/**
+ * nilfs_scrub_print_file - print blocks of a file written in a corrupt log
+ * @file: file iterator
+ *
+ * The data checksum covers the whole log, so every block written in it
+ * is suspect.
+ */
+static void nilfs_scrub_print_file(struct nilfs_file *file)
+{
+	const struct nilfs_finfo *finfo = file->finfo;
+	struct nilfs_block blk;
+	uint64_t blkoff, minoff = 0, maxoff = 0;
+	uint32_t ndata = 0, nnode = 0;
+	int real = nilfs_file_use_real_blocknr(file);
+	__le64 *binfo;
+
+	nilfs_block_for_each(&blk, file) {
+		binfo = blk.binfo;
+		if (nilfs_block_is_node(&blk)) {
+			nnode++;
+			continue;
+		}
+		blkoff = le64_to_cpu(real ? binfo[0] : binfo[1]);
+		if (ndata == 0 || blkoff < minoff)
+			minoff = blkoff;
+		if (ndata == 0 || blkoff > maxoff)
+			maxoff = blkoff;
+		ndata++;
+	}
+
+	printf("  ino %llu, cno %llu: %lu data block(s)",
+	       (unsigned long long)le64_to_cpu(finfo->fi_ino),
+	       (unsigned long long)le64_to_cpu(finfo->fi_cno),
+	       (unsigned long)ndata);
+	if (ndata > 0)
+		printf(" at offset %llu-%llu", (unsigned long long)minoff,
+		       (unsigned long long)maxoff);
+	printf(", %lu node block(s)\n", (unsigned long)nnode);
+
+	if (!verbose)
+		return;
+
+	nilfs_block_for_each(&blk, file) {
+		binfo = blk.binfo;
+		printf("    blocknr %llu: ", (unsigned long long)blk.blocknr);
+		if (!real && nilfs_block_is_data(&blk)) {
+			printf("vblocknr %llu, blkoff %llu\n",
+			       (unsigned long long)le64_to_cpu(binfo[0]),
+			       (unsigned long long)le64_to_cpu(binfo[1]));
+		} else if (!real) {
+			printf("vblocknr %llu\n",
+			       (unsigned long long)le64_to_cpu(binfo[0]));
+		} else if (nilfs_block_is_data(&blk)) {
+			printf("blkoff %llu\n",
+			       (unsigned long long)le64_to_cpu(binfo[0]));
+		} else {
+			struct nilfs_binfo_dat *bid = blk.binfo;
+
+			printf("blkoff %llu, level %d\n",
+			       (unsigned long long)le64_to_cpu(bid->bi_blkoff),
+			       bid->bi_level);
+		}
+	}
+}
+
+/**
+ * nilfs_scrub_report - report a log whose data checksum does not match
+ * @pseg: partial segment iterator pointing to the log
+ * @crc: computed data checksum
+ */
+static void nilfs_scrub_report(struct nilfs_psegment *pseg, uint32_t crc)
+{
+	const struct nilfs_segment_summary *segsum = pseg->segsum;
+	char timebuf[SCRUB_TIMEBUFSIZE];
+	struct nilfs_file file;
+	const char *errstr;
+	struct tm tm;
+	time_t t;
+
+	t = (time_t)le64_to_cpu(segsum->ss_create);
+	localtime_r(&t, &tm);
+	strftime(timebuf, sizeof(timebuf), "%F %T", &tm);
+
+	printf("segment %llu: log at block %llu (%lu blocks, cno %llu, %s): "
+	       "data checksum mismatch, stored %08lx, computed %08lx\n",
+	       (unsigned long long)pseg->segment->segnum,
+	       (unsigned long long)pseg->blocknr,
+	       (unsigned long)le32_to_cpu(segsum->ss_nblocks),
+	       (unsigned long long)le64_to_cpu(segsum->ss_cno), timebuf,
+	       (unsigned long)le32_to_cpu(segsum->ss_datasum),
+	       (unsigned long)crc);
+
+	nilfs_file_for_each(&file, pseg) {
+		nilfs_scrub_print_file(&file);
+	}
+	if (nilfs_file_is_error(&file, &errstr))
+		printf("  summary error at offset %lu: %s\n",
+		       (unsigned long)file.offset, errstr);
+}
+
+/**
+ * nilfs_scrub_segment - verify data checksums of logs in a segment
+ * @scrub: scrubber state
+ * @segment: segment read into memory
+ * @si: segment usage of @segment
+ *
+ * Logs are followed from the head of the segment as long as their
+ * summaries are intact and belong to the same segment sequence.  If the
+ * logs end before the number of blocks recorded in the segment usage,
+ * the summary of the next log is reported as damaged.
+ */
+static void nilfs_scrub_segment(struct nilfs_scrub *scrub,
+				const struct nilfs_segment *segment,
+				const struct nilfs_suinfo *si)
+{
+	struct nilfs_psegment pseg;
+	const unsigned char *start;
+	const char *errstr;
+	uint32_t nblocks, crc, covered = 0;
+	size_t len;
+
+	nilfs_psegment_for_each(&pseg, segment, segment->nblocks) {
+		if (le64_to_cpu(pseg.segsum->ss_seq) != segment->seqnum)
+			break;
+
+		nblocks = le32_to_cpu(pseg.segsum->ss_nblocks);
+		start = (const unsigned char *)pseg.segsum +
+			sizeof(pseg.segsum->ss_datasum);
+		len = ((size_t)nblocks << pseg.blkbits) -
+			sizeof(pseg.segsum->ss_datasum);
+		crc = crc32_le(segment->seed, start, len);
+
+		scrub->nlogs++;
+		covered += nblocks;
+		if (crc != le32_to_cpu(pseg.segsum->ss_datasum)) {
+			nilfs_scrub_report(&pseg, crc);
+			scrub->ncorrupt++;
+		}
+	}
+
+	if (nilfs_psegment_is_error(&pseg, &errstr)) {
+		printf("segment %llu: log at block %llu: broken summary: %s\n",
+		       (unsigned long long)segment->segnum,
+		       (unsigned long long)pseg.blocknr, errstr);
+		scrub->ncorrupt++;
+	} else if (covered < si->sui_nblocks) {
+		printf("segment %llu: log at block %llu: unreadable summary "
+		       "(logs cover %lu of %lu blocks)\n",
+		       (unsigned long long)segment->segnum,
+		       (unsigned long long)pseg.blocknr,
+		       (unsigned long)covered,
+		       (unsigned long)si->sui_nblocks);
+		scrub->ncorrupt++;
+	}
+	scrub->nscrubbed++;
+}
+
+/**
+ * nilfs_scrub_throttle - sleep to keep reads within the rate limit
+ * @scrub: scrubber state
+ */
+static void nilfs_scrub_throttle(const struct nilfs_scrub *scrub)
+{
+	struct timespec now, delay;
+	double elapsed, wait;
+
+	if (param_rate == 0)
+		return;
+	if (unlikely(clock_gettime(CLOCK_MONOTONIC, &now) < 0))
+		return;
+
+	elapsed = (now.tv_sec - scrub->start.tv_sec) +
+		(now.tv_nsec - scrub->start.tv_nsec) / 1e9;
+	wait = (double)scrub->nbytes / ((double)param_rate * 1048576) -
+		elapsed;
+	if (wait <= 0)
+		return;
+
+	delay.tv_sec = (time_t)wait;
+	delay.tv_nsec = (long)((wait - delay.tv_sec) * 1e9);
+	while (nanosleep(&delay, &delay) < 0 && errno == EINTR)
+		;
+}
+
+/**
+ * nilfs_scrub_collect - list dirty segments
+ * @scrub: scrubber state
+ *
+ * Return: 0 on success, or -1 on failure.
+ */
+static int nilfs_scrub_collect(struct nilfs_scrub *scrub)
+{
+	struct nilfs_suinfo si[SCRUB_NSUINFO];
+	uint64_t segnum, nsegments = scrub->layout.nsegments;
+	size_t maxsegs = 0;
+	uint64_t *segnums;
+	ssize_t i, n;
+
+	for (segnum = 0; segnum < nsegments; segnum += n) {
+		n = nilfs_get_suinfo(scrub->nilfs, segnum, si,
+				     min_t(uint64_t, nsegments - segnum,
+					   SCRUB_NSUINFO));
+		if (unlikely(n < 0)) {
+			warn("cannot get segment usage info");
+			return -1;
+		}
+		if (n == 0)
+			break;
+
+		for (i = 0; i < n; i++) {
+			if (!nilfs_suinfo_dirty(&si[i]) ||
+			    nilfs_suinfo_active(&si[i]))
+				continue;
+			if (scrub->nsegs == maxsegs) {
+				maxsegs = maxsegs ? maxsegs * 2 : SCRUB_NSUINFO;
+				segnums = realloc(scrub->segnums,
+						  sizeof(*segnums) * maxsegs);
+				if (unlikely(!segnums)) {
+					warn(NULL);
+					return -1;
+				}
+				scrub->segnums = segnums;
+			}
+			scrub->segnums[scrub->nsegs++] = segnum + i;
+		}
+	}
+	return 0;
+}
+
+/**
+ * nilfs_scrub_run - verify all dirty segments
+ * @scrub: scrubber state
+ *
+ * While a segment is verified, the kernel is asked to read ahead the
+ * next one, and pages of verified segments are dropped from the page
+ * cache so that scrubbing does not evict data of foreground work.
+ *
+ * Return: 0 on success, or -1 on failure.
+ */
+static int nilfs_scrub_run(struct nilfs_scrub *scrub)
+{
+	struct nilfs_segment segment;
+	struct nilfs_suinfo si;
+	uint64_t segnum;
+	size_t i;
+	int ret;
+
+	if (unlikely(clock_gettime(CLOCK_MONOTONIC, &scrub->start) < 0)) {
+		warn("cannot get current time");
+		return -1;
+	}
+
+	for (i = 0; i < scrub->nsegs; i++) {
+		segnum = scrub->segnums[i];
+		if (i + 1 < scrub->nsegs)
+			nilfs_scrub_advise(scrub, scrub->segnums[i + 1],
+					   POSIX_FADV_WILLNEED);
+
+		ret = nilfs_scrub_read_segment(scrub, segnum, &segment, &si);
+		if (unlikely(ret < 0))
+			return -1;
+		if (ret == 0)
+			scrub->nskipped++;
+		else
+			nilfs_scrub_segment(scrub, &segment, &si);
+
+		nilfs_scrub_advise(scrub, segnum, POSIX_FADV_DONTNEED);
+		nilfs_scrub_throttle(scrub);
+	}
+	return 0;
+}
+
+static void nilfs_scrub_print_result(const struct nilfs_scrub *scrub)
+{
+	struct timespec now;
+	double elapsed = 0;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == 0)
+		elapsed = (now.tv_sec - scrub->start.tv_sec) +
+			(now.tv_nsec - scrub->start.tv_nsec) / 1e9;
+
+	printf("%llu segment(s), %llu log(s), %llu MiB verified in %.1f s",
+	       (unsigned long long)scrub->nscrubbed,
+	       (unsigned long long)scrub->nlogs,
+	       (unsigned long long)(scrub->nbytes >> 20), elapsed);
+	if (scrub->nskipped > 0)
+		printf(", %llu skipped", (unsigned long long)scrub->nskipped);
+	printf(": %llu corrupt log(s)\n", (unsigned long long)scrub->ncorrupt);
+}
+
+int main(int argc, char *argv[])
+{
+	struct nilfs_scrub scrub;
+	char *dev, *endptr, *progname, *last;
+	int c, status;
+#ifdef _GNU_SOURCE
+	int option_index;
+#endif	/* _GNU_SOURCE */
+
+	last = strrchr(argv[0], '/');
+	progname = last ? last + 1 : argv[0];
+
+#ifdef _GNU_SOURCE
+	while ((c = getopt_long(argc, argv, "r:vhV",
+				long_option, &option_index)) >= 0) {
+#else	/* !_GNU_SOURCE */
+	while ((c = getopt(argc, argv, "r:vhV")) >= 0) {
+#endif	/* _GNU_SOURCE */
+
+		switch (c) {
+		case 'r':
+			param_rate = strtoul(optarg, &endptr, 10);
+			if (endptr == optarg || *endptr != '\0' ||
+			    param_rate > SCRUB_MAX_RATE)
+				errx(EXIT_FAILURE, "invalid rate: %s", optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'h':
+			fprintf(stderr, SCRUB_USAGE, progname);
+			exit(EXIT_SUCCESS);
+		case 'V':
+			printf("%s (%s %s)\n", progname, PACKAGE,
+			       PACKAGE_VERSION);
+			exit(EXIT_SUCCESS);
+		default:
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind > argc - 1)
+		dev = NULL;
+	else if (optind == argc - 1)
+		dev = argv[optind++];
+	else
+		errx(EXIT_FAILURE, "too many arguments");
+
+	memset(&scrub, 0, sizeof(scrub));
+	scrub.nilfs = nilfs_open(dev, NULL, NILFS_OPEN_RAW | NILFS_OPEN_RDONLY |
+				 NILFS_OPEN_GCLK);
+	if (scrub.nilfs == NULL)
+		err(EXIT_FAILURE, "cannot open NILFS on %s", dev ? : "device");
+
+	status = EXIT_FAILURE;
+	if (unlikely(nilfs_get_layout(scrub.nilfs, &scrub.layout,
+				      sizeof(scrub.layout)) < 0)) {
+		warn("cannot get layout information");
+		goto out_close_nilfs;
+	}
+
+	scrub.devfd = open(nilfs_get_dev(scrub.nilfs), O_RDONLY);
+	if (scrub.devfd < 0) {
+		warn("cannot open %s", nilfs_get_dev(scrub.nilfs));
+		goto out_close_nilfs;
+	}
+
+	scrub.buf = malloc((size_t)scrub.layout.blocks_per_segment <<
+			   scrub.layout.blocksize_bits);
+	if (unlikely(!scrub.buf)) {
+		warn(NULL);
+		goto out_close_fd;
+	}
+
+	if (nilfs_scrub_ioprio_set(SCRUB_IOPRIO_IDLE) < 0 && verbose)
+		warn("cannot set I/O priority");
+
+	if (nilfs_scrub_collect(&scrub) < 0 || nilfs_scrub_run(&scrub) < 0)
+		goto out_free;
+
+	nilfs_scrub_print_result(&scrub);
+	status = scrub.ncorrupt > 0 ? SCRUB_EXIT_CORRUPT : EXIT_SUCCESS;
+
+out_free:
+	if (unlikely(fflush(stdout) == EOF)) {
+		warn("failed to write output");
+		status = EXIT_FAILURE;
+	}
+	free(scrub.segnums);
+	free(scrub.buf);
+out_close_fd:
+	close(scrub.devfd);
+out_close_nilfs:
+	nilfs_close(scrub.nilfs);
+	exit(status);
+}